@@ -26,6 +26,18 @@ add_compile_flags(BOTH
 add_compile_flags(C -std=gnu11)
 add_compile_flags(CXX -std=gnu++17)
 
+# Build without C++ exceptions, throws in the framework become fatal errors
+option(NO_EXCEPTIONS "Compile C++ with -fno-exceptions" OFF)
+if (NO_EXCEPTIONS)
+    add_compile_flags(CXX -fno-exceptions)
+endif ()
+
+# Per handle and per driver io statistics, exposed by /dev/iostat
+option(IO_STATISTICS "Collect io statistics" ON)
+if (IO_STATISTICS)
+    add_definitions(-DCONFIG_IO_STATISTICS)
+endif ()
+
 if (BUILDING_SDK)
     add_compile_flags(BOTH
             -Wall
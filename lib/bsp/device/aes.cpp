@@ -63,16 +63,14 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_ECB);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_wait(aes_read);
+            dma_release_channel(aes_read);
         }
     }
 
@@ -89,16 +87,14 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_ECB);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_wait(aes_read);
+            dma_release_channel(aes_read);
         }
     }
 
@@ -115,16 +111,14 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_ECB);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_wait(aes_read);
+            dma_release_channel(aes_read);
         }
     }
 
@@ -141,16 +135,14 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_ECB);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_wait(aes_read);
+            dma_release_channel(aes_read);
         }
     }
 
@@ -167,16 +159,14 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_ECB);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_wait(aes_read);
+            dma_release_channel(aes_read);
         }
     }
 
@@ -193,16 +183,14 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_ECB);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_wait(aes_read);
+            dma_release_channel(aes_read);
         }
     }
 
@@ -219,16 +207,14 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_CBC);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_wait(aes_read);
+            dma_release_channel(aes_read);
         }
     }
 
@@ -245,18 +231,16 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
 
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_CBC);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
+            dma_wait(aes_read);
 
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_release_channel(aes_read);
         }
     }
 
@@ -273,16 +257,14 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_CBC);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_wait(aes_read);
+            dma_release_channel(aes_read);
         }
     }
 
@@ -299,16 +281,14 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_CBC);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_wait(aes_read);
+            dma_release_channel(aes_read);
         }
     }
 
@@ -325,16 +305,14 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_CBC);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_wait(aes_read);
+            dma_release_channel(aes_read);
         }
     }
 
@@ -351,16 +329,14 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), padding_len >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_CBC);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_wait(aes_read);
+            dma_release_channel(aes_read);
         }
     }
 
@@ -377,16 +353,14 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), (input_len + 3) >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), (input_len + 3) >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_GCM);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_wait(aes_read);
+            dma_release_channel(aes_read);
         }
 
         os_gcm_get_tag(gcm_tag.data());
@@ -405,16 +379,14 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), (input_len + 3) >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), (input_len + 3) >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_GCM);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_wait(aes_read);
+            dma_release_channel(aes_read);
         }
 
         os_gcm_get_tag(gcm_tag.data());
@@ -433,16 +405,14 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), (input_len + 3) >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), (input_len + 3) >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_GCM);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_wait(aes_read);
+            dma_release_channel(aes_read);
         }
 
         os_gcm_get_tag(gcm_tag.data());
@@ -461,16 +431,14 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), (input_len + 3) >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), (input_len + 3) >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_GCM);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_wait(aes_read);
+            dma_release_channel(aes_read);
         }
 
         os_gcm_get_tag(gcm_tag.data());
@@ -489,16 +457,14 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), (input_len + 3) >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), (input_len + 3) >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_GCM);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_wait(aes_read);
+            dma_release_channel(aes_read);
         }
 
         os_gcm_get_tag(gcm_tag.data());
@@ -517,16 +483,14 @@ public:
         }
         else
         {
-            handle_t aes_read = dma_open_free();
+            auto &aes_read = dma_acquire_channel();
             dma_set_request_source(aes_read, dma_req_);
 
-            SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
             aes_.dma_sel = 1;
-            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), (input_len + 3) >> 2, 4, event_read);
+            dma_transmit_async(aes_read, &aes_.aes_out_data, output_data.data(), 0, 1, sizeof(uint32_t), (input_len + 3) >> 2, 4);
             aes_input_bytes(input_data.data(), input_len, AES_GCM);
-            configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-            dma_close(aes_read);
-            vSemaphoreDelete(event_read);
+            dma_wait(aes_read);
+            dma_release_channel(aes_read);
         }
 
         os_gcm_get_tag(gcm_tag.data());
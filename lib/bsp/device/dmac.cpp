@@ -14,6 +14,7 @@
  */
 #include <FreeRTOS.h>
 #include <atomic.h>
+#include <clint.h>
 #include <dmac.h>
 #include <hal.h>
 #include <kernel/driver_impl.hpp>
@@ -30,11 +31,14 @@ using namespace sys;
 
 /* DMAC */
 
+#define DMA_CHANNELS 6
+#define DMA_AXI_MASTERS 2
+
 class k_dmac_driver : public dmac_driver, public static_object, public free_object_access
 {
 public:
     k_dmac_driver(uintptr_t base_addr)
-        : dmac_(*reinterpret_cast<volatile dmac_t *>(base_addr)), axi_master1_use_(0), axi_master2_use_(0)
+        : dmac_(*reinterpret_cast<volatile dmac_t *>(base_addr)), lock_(SPINLOCK_INIT), masters_{}, busy_since_{}, stats_start_(0)
     {
     }
 
@@ -77,31 +81,46 @@ public:
         dmac_cfg.cfg.dmac_en = 1;
         dmac_cfg.cfg.int_en = 1;
         writeq(dmac_cfg.data, &dmac_.cfg);
+
+        stats_start_ = clint->mtime;
     }
 
-    uint32_t add_lru_axi_master()
+    virtual int control(uint32_t control_code, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer) override;
+
+    /* Picks the master with fewer bytes in flight, so one large transfer weighs more than
+     * many register sized ones. Called from tasks only. */
+    uint32_t add_lru_axi_master(size_t bytes)
     {
-        uint32_t axi1 = atomic_read(&axi_master1_use_);
-        uint32_t axi2 = atomic_read(&axi_master2_use_);
+        vTaskEnterCritical();
+        spinlock_lock(&lock_);
+        uint32_t axi = masters_[0].outstanding_bytes < masters_[1].outstanding_bytes ? 0 : 1;
+        auto &master = masters_[axi];
+        if (master.outstanding_bytes == 0 && bytes)
+            busy_since_[axi] = clint->mtime;
+        master.outstanding_bytes += bytes;
+        spinlock_unlock(&lock_);
+        vTaskExitCritical();
+        return axi;
+    }
 
-        if (axi1 < axi2)
-        {
-            atomic_add(&axi_master1_use_, 1);
-            return 0;
-        }
-        else
-        {
-            atomic_add(&axi_master2_use_, 1);
-            return 1;
-        }
+    /* Called from the completion isr */
+    void add_transferred(uint32_t axi, size_t bytes)
+    {
+        spinlock_lock(&lock_);
+        masters_[axi].bytes += bytes;
+        spinlock_unlock(&lock_);
     }
 
-    void release_axi_master(uint32_t axi)
+    /* Called from the completion isr */
+    void release_axi_master(uint32_t axi, size_t bytes)
     {
-        if (axi == 0)
-            atomic_add(&axi_master1_use_, -1);
-        else
-            atomic_add(&axi_master2_use_, -1);
+        spinlock_lock(&lock_);
+        auto &master = masters_[axi];
+        master.transfers++;
+        master.outstanding_bytes -= bytes;
+        if (master.outstanding_bytes == 0 && bytes)
+            master.busy_time += clint->mtime - busy_since_[axi];
+        spinlock_unlock(&lock_);
     }
 
     volatile dmac_t &dmac()
@@ -109,10 +128,17 @@ public:
         return dmac_;
     }
 
+private:
+    int get_master_statistics(gsl::span<uint8_t> read_buffer);
+    int get_channel_statistics(gsl::span<uint8_t> read_buffer);
+    void reset_statistics();
+
 private:
     volatile dmac_t &dmac_;
-    int32_t axi_master1_use_;
-    int32_t axi_master2_use_;
+    spinlock_t lock_;
+    dmac_transfer_statistics_t masters_[DMA_AXI_MASTERS];
+    uint64_t busy_since_[DMA_AXI_MASTERS];
+    uint64_t stats_start_;
 };
 
 static k_dmac_driver dev0_driver(DMAC_BASE_ADDR);
@@ -122,20 +148,33 @@ driver &g_dmac_driver_dmac0 = static_cast<driver &>(dev0_driver);
 /* DMA Channel */
 
 #define MAX_PING_PONG_SRCS 4
+#define DMA_MAX_BLOCK_TS 0x3fffff
+#define DMA_SG_INLINE_BLOCKS 8
+#define DMA_MEMCPY_BURST_SIZE 16
+
+/* Elements of the sub-word bounce buffer each channel allocates at install, enough for 8-bit
+ * SPI transfers at the SPI DMA threshold. Longer transfers allocate their own buffer, which
+ * is freed when the channel is released. */
+#ifndef CONFIG_DMA_BOUNCE_WORDS
+#define CONFIG_DMA_BOUNCE_WORDS 0x800
+#endif
 #define C_COMMON_ENTRY         \
     auto &dmac = dmac_.dmac(); \
     auto &dma = dmac.channel[channel_];
 
-class k_dma_driver : public dma_driver, public static_object, public exclusive_object_access
+class k_dma_driver final : public dma_driver, public static_object, public exclusive_object_access
 {
 public:
     k_dma_driver(k_dmac_driver &dmac, uint32_t channel)
-        : dmac_(dmac), channel_(channel)
+        : dmac_(dmac), channel_(channel), bounce_(nullptr), oversized_bounce_(nullptr), oversized_bounce_words_(0)
     {
     }
 
     virtual void install() override
     {
+        completion_ = xSemaphoreCreateBinaryStatic(&completion_buffer_);
+        bounce_ = reinterpret_cast<uint32_t *>(malloc(sizeof(uint32_t) * CONFIG_DMA_BOUNCE_WORDS));
+        configASSERT(bounce_);
         pic_set_irq_handler(IRQN_DMA0_INTERRUPT + channel_, dma_completion_isr, this);
         pic_set_irq_priority(IRQN_DMA0_INTERRUPT + channel_, 1);
         pic_set_irq_enable(IRQN_DMA0_INTERRUPT + channel_, 1);
@@ -193,6 +232,134 @@ public:
     }
 
     virtual void transmit_async(const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size, SemaphoreHandle_t completion_event) override
+    {
+        single_item_ = { src, dest, count };
+        start({ &single_item_, 1 }, count, src_inc, dest_inc, element_size, burst_size, completion_event);
+    }
+
+    virtual void transmit_sg_async(gsl::span<const dma_sg_item_t> items, bool src_inc, bool dest_inc, size_t element_size, size_t burst_size, SemaphoreHandle_t completion_event) override
+    {
+        C_COMMON_ENTRY;
+
+        size_t total = 0, blocks = 0;
+        for (auto &item : items)
+        {
+            total += item.count;
+            blocks += (item.count + DMA_MAX_BLOCK_TS - 1) / DMA_MAX_BLOCK_TS;
+        }
+
+        if (total == 0)
+        {
+            xSemaphoreGive(completion_event);
+            return;
+        }
+
+        int mem_type_src = is_memory((uintptr_t)items[0].src), mem_type_dest = is_memory((uintptr_t)items[0].dest);
+        if ((!mem_type_src || !mem_type_dest) && element_size < 4)
+        {
+            /* The peripheral takes one word per element, the list is packed through the bounce buffer */
+            start(items, total, src_inc, dest_inc, element_size, burst_size, completion_event);
+            return;
+        }
+
+        free(session_.alloc_mem);
+        session_.alloc_mem = NULL;
+
+        src_inc = !src_inc;
+        dest_inc = !dest_inc;
+        configASSERT((dmac.chen & (1 << channel_)) == 0);
+
+        dmac_transfer_flow_t flow_control = get_flow_control(mem_type_src, mem_type_dest);
+        configASSERT(flow_control == DMAC_MEM2MEM_DMA || (element_size >= 4 && element_size <= 8));
+
+        dmac_lli_item_t *lli = lli_;
+        if (blocks > DMA_SG_INLINE_BLOCKS)
+        {
+            void *alloc_mem = malloc(sizeof(dmac_lli_item_t) * (blocks + 1));
+            configASSERT(alloc_mem);
+            session_.alloc_mem = alloc_mem;
+            lli = reinterpret_cast<dmac_lli_item_t *>(((uintptr_t)alloc_mem + sizeof(dmac_lli_item_t) - 1) & ~(sizeof(dmac_lli_item_t) - 1));
+        }
+
+        /* The controller fetches the list from memory, write it through the uncached alias.
+         * Dirty lines left in the cache by earlier use of this memory are written back first,
+         * or evicting them later would overwrite the descriptors */
+        dma_buffer_writeback(lli, sizeof(dmac_lli_item_t) * blocks);
+        lli = reinterpret_cast<dmac_lli_item_t *>(dma_buffer_uncached_view(lli));
+
+        uint32_t axi_master = begin_transfer(total * element_size);
+
+        dmac_ch_ctl_u_t ctl_u;
+        ctl_u.data = readq(&dma.ctl);
+        ctl_u.ch_ctl.sinc = src_inc;
+        ctl_u.ch_ctl.src_tr_width = get_tr_width(element_size);
+        ctl_u.ch_ctl.src_msize = get_msize(burst_size);
+        ctl_u.ch_ctl.dinc = dest_inc;
+        ctl_u.ch_ctl.dst_tr_width = ctl_u.ch_ctl.src_tr_width;
+        ctl_u.ch_ctl.dst_msize = ctl_u.ch_ctl.src_msize;
+        ctl_u.ch_ctl.sms = axi_master;
+        ctl_u.ch_ctl.dms = axi_master;
+        ctl_u.ch_ctl.ioc_blktfr = 0;
+        ctl_u.ch_ctl.shadowreg_or_lli_valid = 1;
+        ctl_u.ch_ctl.shadowreg_or_lli_last = 0;
+
+        size_t block = 0;
+        for (auto &item : items)
+        {
+            uintptr_t src = (uintptr_t)item.src, dest = (uintptr_t)item.dest;
+            for (size_t remain = item.count; remain;)
+            {
+                size_t count = std::min(remain, size_t(DMA_MAX_BLOCK_TS));
+                auto &desc = lli[block];
+                desc.sar = src;
+                desc.dar = dest;
+                desc.ch_block_ts = count - 1;
+                desc.llp = (uint64_t)(uintptr_t)&lli[block + 1] | axi_master;
+                ctl_u.ch_ctl.shadowreg_or_lli_last = ++block == blocks;
+                desc.ctl = ctl_u.data;
+                desc.sstat = 0;
+                desc.dstat = 0;
+
+                if (!src_inc)
+                    src += count * element_size;
+                if (!dest_inc)
+                    dest += count * element_size;
+                remain -= count;
+            }
+        }
+
+        dmac_ch_cfg_u_t cfg_u;
+        cfg_u.data = readq(&dma.cfg);
+        cfg_u.ch_cfg.tt_fc = flow_control;
+        cfg_u.ch_cfg.hs_sel_src = mem_type_src ? DMAC_HS_SOFTWARE : DMAC_HS_HARDWARE;
+        cfg_u.ch_cfg.hs_sel_dst = mem_type_dest ? DMAC_HS_SOFTWARE : DMAC_HS_HARDWARE;
+        cfg_u.ch_cfg.src_per = channel_;
+        cfg_u.ch_cfg.dst_per = channel_;
+        cfg_u.ch_cfg.src_multblk_type = LINKEDLIST;
+        cfg_u.ch_cfg.dst_multblk_type = LINKEDLIST;
+        writeq(cfg_u.data, &dma.cfg);
+
+        session_.is_loop = 0;
+        session_.flow_control = flow_control;
+        session_.element_size = element_size;
+        session_.count = total;
+        session_.bounce = false;
+        session_.dest = items[0].dest;
+
+        dmac_ch_llp_u_t llp_u;
+        llp_u.data = 0;
+        llp_u.llp.lms = axi_master;
+        llp_u.llp.loc = (uintptr_t)lli >> 6;
+        writeq(llp_u.data, &dma.llp);
+
+        dma.intstatus_en = 0xFFFFFFE2;
+        dma.intclear = 0xFFFFFFFF;
+
+        session_.completion_event = completion_event;
+        dmac.chen |= 0x101 << channel_;
+    }
+
+    virtual void loop_async(const volatile void **srcs, size_t src_num, volatile void **dests, size_t dest_num, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size, dma_stage_completion_handler_t stage_completion_handler, void *stage_completion_handler_data, SemaphoreHandle_t completion_event, int *stop_signal) override
     {
         C_COMMON_ENTRY;
         free(session_.alloc_mem);
@@ -207,22 +374,15 @@ public:
         dest_inc = !dest_inc;
         configASSERT(count > 0 && count <= 0x3fffff);
         configASSERT((dmac.chen & (1 << channel_)) == 0);
+        configASSERT(element_size >= 4);
+        configASSERT(src_num > 0 && src_num <= MAX_PING_PONG_SRCS);
+        configASSERT(dest_num > 0 && dest_num <= MAX_PING_PONG_SRCS);
 
-        int mem_type_src = is_memory((uintptr_t)src), mem_type_dest = is_memory((uintptr_t)dest);
+        int mem_type_src = is_memory((uintptr_t)srcs[0]), mem_type_dest = is_memory((uintptr_t)dests[0]);
 
         dmac_ch_cfg_u_t cfg_u;
 
-        dmac_transfer_flow_t flow_control = DMAC_MEM2MEM_DMA;
-        if (mem_type_src == 0 && mem_type_dest == 0)
-        {
-            configASSERT(!"Periph to periph dma is not supported.");
-        }
-        else if (mem_type_src == 1 && mem_type_dest == 0)
-            flow_control = DMAC_MEM2PRF_DMA;
-        else if (mem_type_src == 0 && mem_type_dest == 1)
-            flow_control = DMAC_PRF2MEM_DMA;
-        else if (mem_type_src == 1 && mem_type_dest == 1)
-            flow_control = DMAC_MEM2MEM_DMA;
+        dmac_transfer_flow_t flow_control = get_flow_control(mem_type_src, mem_type_dest);
 
         configASSERT(flow_control == DMAC_MEM2MEM_DMA || element_size <= 8);
 
@@ -237,110 +397,16 @@ public:
 
         writeq(cfg_u.data, &dma.cfg);
 
-        session_.is_loop = 0;
+        session_.is_loop = 1;
         session_.flow_control = flow_control;
 
-        size_t old_elm_size = element_size;
-        session_.element_size = old_elm_size;
-        session_.count = count;
-        session_.dest = dest;
-        session_.alloc_mem = NULL;
-
-        if (flow_control != DMAC_MEM2MEM_DMA && old_elm_size < 4)
-        {
-            void *alloc_mem = malloc(sizeof(uint32_t) * count + 128);
-            session_.alloc_mem = alloc_mem;
-            element_size = sizeof(uint32_t);
-
-            if (!mem_type_src)
-            {
-                dma.sar = (uint64_t)src;
-                dma.dar = (uint64_t)alloc_mem;
-            }
-            else if (!mem_type_dest)
-            {
-                if (old_elm_size == 1)
-                {
-                    size_t i;
-                    const uint8_t *p_src = (const uint8_t *)src;
-                    uint32_t *p_dst = reinterpret_cast<uint32_t *>(alloc_mem);
-                    for (i = 0; i < count; i++)
-                        p_dst[i] = p_src[i];
-                }
-                else if (old_elm_size == 2)
-                {
-                    size_t i;
-                    const uint16_t *p_src = (const uint16_t *)src;
-                    uint32_t *p_dst = reinterpret_cast<uint32_t *>(alloc_mem);
-                    for (i = 0; i < count; i++)
-                        p_dst[i] = p_src[i];
-                }
-                else
-                {
-                    configASSERT(!"invalid element size");
-                }
-
-                dma.sar = (uint64_t)alloc_mem;
-                dma.dar = (uint64_t)dest;
-            }
-            else
-            {
-                configASSERT(!"Impossible");
-            }
-        }
-        else
-        {
-            dma.sar = (uint64_t)src;
-            dma.dar = (uint64_t)dest;
-        }
+        dma.sar = (uint64_t)srcs[0];
+        dma.dar = (uint64_t)dests[0];
 
         dma.block_ts = count - 1;
 
-        uint32_t tr_width = 0;
-        switch (element_size)
-        {
-        case 1:
-            tr_width = 0;
-            break;
-        case 2:
-            tr_width = 1;
-            break;
-        case 4:
-            tr_width = 2;
-            break;
-        case 8:
-            tr_width = 3;
-            break;
-        case 16:
-            tr_width = 4;
-            break;
-        default:
-            configASSERT(!"Invalid element size.");
-            break;
-        }
-
-        uint32_t msize = 0;
-        switch (burst_size)
-        {
-        case 1:
-            msize = 0;
-            break;
-        case 4:
-            msize = 1;
-            break;
-        case 8:
-            msize = 2;
-            break;
-        case 16:
-            msize = 3;
-            break;
-        case 32:
-            msize = 4;
-            break;
-        default:
-            configASSERT(!"Invalid busrt size.");
-            break;
-        }
+        uint32_t tr_width = get_tr_width(element_size);
+        uint32_t msize = get_msize(burst_size);
 
         dma.intstatus_en = 0xFFFFFFE2;
         dma.intclear = 0xFFFFFFFF;
@@ -355,8 +421,7 @@ public:
         ctl_u.ch_ctl.dst_tr_width = tr_width;
         ctl_u.ch_ctl.dst_msize = msize;
 
-        uint32_t axi_master = dmac_.add_lru_axi_master();
-        session_.axi_master = axi_master;
+        uint32_t axi_master = begin_transfer(count * element_size);
 
         ctl_u.ch_ctl.sms = axi_master;
         ctl_u.ch_ctl.dms = axi_master;
@@ -364,10 +429,104 @@ public:
         writeq(ctl_u.data, &dma.ctl);
 
         session_.completion_event = completion_event;
+        session_.stage_completion_handler_data = stage_completion_handler_data;
+        session_.stage_completion_handler = stage_completion_handler;
+        session_.stop_signal = stop_signal;
+        session_.src_num = src_num;
+        session_.dest_num = dest_num;
+        session_.next_src_id = 0;
+        session_.next_dest_id = 0;
+        size_t i = 0;
+        for (i = 0; i < src_num; i++)
+            session_.srcs[i] = srcs[i];
+        for (i = 0; i < dest_num; i++)
+            session_.dests[i] = dests[i];
+
         dmac.chen |= 0x101 << channel_;
     }
 
-    virtual void loop_async(const volatile void **srcs, size_t src_num, volatile void **dests, size_t dest_num, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size, dma_stage_completion_handler_t stage_completion_handler, void *stage_completion_handler_data, SemaphoreHandle_t completion_event, int *stop_signal) override
+    virtual void release_buffers() override
+    {
+        free(oversized_bounce_);
+        oversized_bounce_ = nullptr;
+        oversized_bounce_words_ = 0;
+    }
+
+    void run_async(const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size)
+    {
+        transmit_async(src, dest, src_inc, dest_inc, element_size, count, burst_size, completion_);
+    }
+
+    SemaphoreHandle_t completion_event() const
+    {
+        return completion_;
+    }
+
+    void get_statistics(dmac_transfer_statistics_t &stats, uint64_t now, uint64_t elapsed)
+    {
+        stats = stats_;
+        if (dmac_.dmac().chen & (1 << channel_))
+        {
+            stats.outstanding_bytes = session_.bytes;
+            stats.busy_time += now - session_.started_at;
+        }
+        stats.elapsed_time = elapsed;
+    }
+
+    void reset_statistics()
+    {
+        stats_ = {};
+    }
+
+    void wait()
+    {
+        configASSERT(xSemaphoreTake(completion_, portMAX_DELAY) == pdTRUE);
+    }
+
+    /* Hands the channel back from the isr once the next transfer is done */
+    void release_on_completion()
+    {
+        session_.release = true;
+    }
+
+    /* Runs handler from the isr once the next transfer is done */
+    void set_completion_handler(dma_stage_completion_handler_t handler, void *userdata)
+    {
+        session_.completion_handler = handler;
+        session_.completion_handler_data = userdata;
+    }
+
+    /* A source for memset transfers, one byte repeated up to the widest element */
+    const volatile void *fill_source(int value)
+    {
+        fill_ = uint8_t(value) * UINT64_C(0x0101010101010101);
+        return &fill_;
+    }
+
+    static int is_memory(uintptr_t address)
+    {
+        enum
+        {
+            mem_len = 6 * 1024 * 1024,
+            mem_no_cache_len = 8 * 1024 * 1024,
+        };
+        return ((address >= 0x80000000) && (address < 0x80000000 + mem_len)) || ((address >= 0x40000000) && (address < 0x40000000 + mem_no_cache_len)) || (address == 0x50450040);
+    }
+
+protected:
+    virtual void on_first_open() override
+    {
+        /* Drop a completion left behind by a previous owner that never waited,
+         * this runs in the completion isr of another channel when the arbiter hands this one over */
+        xSemaphoreTakeFromISR(completion_, nullptr);
+    }
+
+private:
+    /* Sub-word peripheral transfers go through a per-channel buffer of one word per element, moved
+     * as a single block: a transfer restarted between chunks would let the RX FIFO overflow or the
+     * TX FIFO run dry, which drops the hardware chip select. The buffer is set aside at install,
+     * see CONFIG_DMA_BOUNCE_WORDS for longer transfers. */
+    void start(gsl::span<const dma_sg_item_t> items, size_t count, bool src_inc, bool dest_inc, size_t element_size, size_t burst_size, SemaphoreHandle_t completion_event)
     {
         C_COMMON_ENTRY;
         free(session_.alloc_mem);
@@ -378,29 +537,15 @@ public:
             return;
         }
 
-        src_inc = !src_inc;
-        dest_inc = !dest_inc;
-        configASSERT(count > 0 && count <= 0x3fffff);
+        auto src = items[0].src;
+        auto dest = items[0].dest;
         configASSERT((dmac.chen & (1 << channel_)) == 0);
-        configASSERT(element_size >= 4);
-        configASSERT(src_num > 0 && src_num <= MAX_PING_PONG_SRCS);
-        configASSERT(dest_num > 0 && dest_num <= MAX_PING_PONG_SRCS);
 
-        int mem_type_src = is_memory((uintptr_t)srcs[0]), mem_type_dest = is_memory((uintptr_t)dests[0]);
+        int mem_type_src = is_memory((uintptr_t)src), mem_type_dest = is_memory((uintptr_t)dest);
 
         dmac_ch_cfg_u_t cfg_u;
 
-        dmac_transfer_flow_t flow_control = DMAC_MEM2MEM_DMA;
-        if (mem_type_src == 0 && mem_type_dest == 0)
-        {
-            configASSERT(!"Periph to periph dma is not supported.");
-        }
-        else if (mem_type_src == 1 && mem_type_dest == 0)
-            flow_control = DMAC_MEM2PRF_DMA;
-        else if (mem_type_src == 0 && mem_type_dest == 1)
-            flow_control = DMAC_PRF2MEM_DMA;
-        else if (mem_type_src == 1 && mem_type_dest == 1)
-            flow_control = DMAC_MEM2MEM_DMA;
+        dmac_transfer_flow_t flow_control = get_flow_control(mem_type_src, mem_type_dest);
 
         configASSERT(flow_control == DMAC_MEM2MEM_DMA || element_size <= 8);
 
@@ -415,75 +560,82 @@ public:
 
         writeq(cfg_u.data, &dma.cfg);
 
-        session_.is_loop = 1;
+        session_.is_loop = 0;
         session_.flow_control = flow_control;
+        session_.element_size = element_size;
+        session_.count = count;
+        session_.dest = dest;
+        session_.bounce = flow_control != DMAC_MEM2MEM_DMA && element_size < 4;
 
-        dma.sar = (uint64_t)srcs[0];
-        dma.dar = (uint64_t)dests[0];
+        if (session_.bounce)
+        {
+            configASSERT(element_size == 1 || element_size == 2);
+            uint32_t *bounce = bounce_;
+            if (count > CONFIG_DMA_BOUNCE_WORDS)
+            {
+                if (oversized_bounce_words_ < count)
+                {
+                    free(oversized_bounce_);
+                    oversized_bounce_ = reinterpret_cast<uint32_t *>(malloc(sizeof(uint32_t) * count));
+                    configASSERT(oversized_bounce_);
+                    oversized_bounce_words_ = count;
+                }
 
-        dma.block_ts = count - 1;
+                bounce = oversized_bounce_;
+            }
 
-        uint32_t tr_width = 0;
-        switch (element_size)
-        {
-        case 1:
-            tr_width = 0;
-            break;
-        case 2:
-            tr_width = 1;
-            break;
-        case 4:
-            tr_width = 2;
-            break;
-        case 8:
-            tr_width = 3;
-            break;
-        case 16:
-            tr_width = 4;
-            break;
-        default:
-            configASSERT(!"Invalid element size.");
-            break;
-        }
+            session_.bounce_buffer = bounce;
 
-        uint32_t msize = 0;
-        switch (burst_size)
+            session_.items = items.data();
+            session_.item_index = 0;
+            session_.item_offset = 0;
+
+            /* The word buffer side always increments */
+            if (flow_control == DMAC_MEM2PRF_DMA)
+            {
+                session_.mem_inc = src_inc;
+                src_inc = true;
+                bounce_copy(bounce, count);
+                dma.sar = (uint64_t)bounce;
+                dma.dar = (uint64_t)dest;
+            }
+            else
+            {
+                session_.mem_inc = dest_inc;
+                dest_inc = true;
+                dma.sar = (uint64_t)src;
+                dma.dar = (uint64_t)bounce;
+            }
+
+            element_size = sizeof(uint32_t);
+        }
+        else
         {
-        case 1:
-            msize = 0;
-            break;
-        case 4:
-            msize = 1;
-            break;
-        case 8:
-            msize = 2;
-            break;
-        case 16:
-            msize = 3;
-            break;
-        case 32:
-            msize = 4;
-            break;
-        default:
-            configASSERT(!"Invalid busrt size.");
-            break;
+            configASSERT(items.size() == 1);
+            dma.sar = (uint64_t)src;
+            dma.dar = (uint64_t)dest;
         }
 
+        configASSERT(count > 0 && count <= DMA_MAX_BLOCK_TS);
+        dma.block_ts = count - 1;
+
+        uint32_t tr_width = get_tr_width(element_size);
+        uint32_t msize = get_msize(burst_size);
+
         dma.intstatus_en = 0xFFFFFFE2;
         dma.intclear = 0xFFFFFFFF;
 
         dmac_ch_ctl_u_t ctl_u;
 
         ctl_u.data = readq(&dma.ctl);
-        ctl_u.ch_ctl.sinc = src_inc;
+        ctl_u.ch_ctl.sinc = !src_inc;
         ctl_u.ch_ctl.src_tr_width = tr_width;
         ctl_u.ch_ctl.src_msize = msize;
-        ctl_u.ch_ctl.dinc = dest_inc;
+        ctl_u.ch_ctl.dinc = !dest_inc;
         ctl_u.ch_ctl.dst_tr_width = tr_width;
         ctl_u.ch_ctl.dst_msize = msize;
 
-        uint32_t axi_master = dmac_.add_lru_axi_master();
-        session_.axi_master = axi_master;
+        uint32_t axi_master = begin_transfer(session_.count * session_.element_size);
 
         ctl_u.ch_ctl.sms = axi_master;
         ctl_u.ch_ctl.dms = axi_master;
@@ -491,23 +643,54 @@ public:
         writeq(ctl_u.data, &dma.ctl);
 
         session_.completion_event = completion_event;
-        session_.stage_completion_handler_data = stage_completion_handler_data;
-        session_.stage_completion_handler = stage_completion_handler;
-        session_.stop_signal = stop_signal;
-        session_.src_num = src_num;
-        session_.dest_num = dest_num;
-        session_.next_src_id = 0;
-        session_.next_dest_id = 0;
-        size_t i = 0;
-        for (i = 0; i < src_num; i++)
-            session_.srcs[i] = srcs[i];
-        for (i = 0; i < dest_num; i++)
-            session_.dests[i] = dests[i];
-
         dmac.chen |= 0x101 << channel_;
     }
 
-private:
+    uint32_t begin_transfer(size_t bytes)
+    {
+        session_.bytes = bytes;
+        session_.started_at = clint->mtime;
+        session_.axi_master = dmac_.add_lru_axi_master(bytes);
+        return session_.axi_master;
+    }
+
+    /* Called from the completion isr */
+    void end_transfer()
+    {
+        stats_.bytes += session_.bytes;
+        stats_.transfers++;
+        stats_.busy_time += clint->mtime - session_.started_at;
+        dmac_.add_transferred(session_.axi_master, session_.bytes);
+        dmac_.release_axi_master(session_.axi_master, session_.bytes);
+    }
+
+    /* Packs the item list into the bounce buffer, or unpacks the buffer into it */
+    void bounce_copy(uint32_t *buffer, size_t words)
+    {
+        auto element_size = session_.element_size;
+        bool pack = session_.flow_control == DMAC_MEM2PRF_DMA;
+
+        while (words)
+        {
+            auto &item = session_.items[session_.item_index];
+            size_t offset = session_.mem_inc ? session_.item_offset * element_size : 0;
+            size_t n = std::min(words, item.count - session_.item_offset);
+            if (pack)
+                dma_widen(buffer, (const uint8_t *)item.src + offset, element_size, n, session_.mem_inc);
+            else
+                dma_narrow((uint8_t *)item.dest + offset, buffer, element_size, n, session_.mem_inc);
+
+            buffer += n;
+            words -= n;
+            session_.item_offset += n;
+            if (session_.item_offset == item.count)
+            {
+                session_.item_index++;
+                session_.item_offset = 0;
+            }
+        }
+    }
+
     static void dma_completion_isr(void *userdata)
     {
         auto &driver = *reinterpret_cast<k_dma_driver *>(userdata);
@@ -523,7 +706,7 @@ private:
         {
             if (atomic_read(driver.session_.stop_signal))
             {
-                driver.dmac_.release_axi_master(driver.session_.axi_master);
+                driver.end_transfer();
                 if (driver.session_.stage_completion_handler)
                     driver.session_.stage_completion_handler(driver.session_.stage_completion_handler_data);
                 xSemaphoreGiveFromISR(driver.session_.completion_event, &xHigherPriorityTaskWoken);
@@ -542,6 +725,8 @@ private:
                 driver.session_.next_dest_id = next_dest_id;
                 dma.dar = (uint64_t)driver.session_.dests[next_dest_id];
 
+                driver.stats_.bytes += driver.session_.bytes;
+                driver.dmac_.add_transferred(driver.session_.axi_master, driver.session_.bytes);
                 if (driver.session_.stage_completion_handler)
                     driver.session_.stage_completion_handler(driver.session_.stage_completion_handler_data);
                 dmac.chen |= 0x101 << driver.channel_;
@@ -549,42 +734,20 @@ private:
         }
         else
         {
-            driver.dmac_.release_axi_master(driver.session_.axi_master);
-
-            if (driver.session_.flow_control != DMAC_MEM2MEM_DMA && driver.session_.element_size < 4)
+            if (driver.session_.bounce && driver.session_.flow_control == DMAC_PRF2MEM_DMA)
+                driver.bounce_copy(driver.session_.bounce_buffer, driver.session_.count);
+            driver.end_transfer();
+            if (driver.session_.completion_handler)
             {
-                if (driver.session_.flow_control == DMAC_PRF2MEM_DMA)
-                {
-                    if (driver.session_.element_size == 1)
-                    {
-                        size_t i;
-                        uint32_t *p_src = reinterpret_cast<uint32_t *>(driver.session_.alloc_mem);
-                        uint8_t *p_dst = (uint8_t *)driver.session_.dest;
-                        for (i = 0; i < driver.session_.count; i++)
-                            p_dst[i] = p_src[i];
-                    }
-                    else if (driver.session_.element_size == 2)
-                    {
-                        size_t i;
-                        uint32_t *p_src = reinterpret_cast<uint32_t *>(driver.session_.alloc_mem);
-                        uint16_t *p_dst = (uint16_t *)driver.session_.dest;
-                        for (i = 0; i < driver.session_.count; i++)
-                            p_dst[i] = p_src[i];
-                    }
-                    else
-                    {
-                        configASSERT(!"invalid element size");
-                    }
-                }
-                else if (driver.session_.flow_control == DMAC_MEM2PRF_DMA)
-                    ;
-                else
-                {
-                    configASSERT(!"Impossible");
-                }
-
+                auto handler = driver.session_.completion_handler;
+                driver.session_.completion_handler = nullptr;
+                handler(driver.session_.completion_handler_data);
+            }
+            if (driver.session_.release)
+            {
+                driver.session_.release = false;
+                dma_release_channel_from_isr(driver, &xHigherPriorityTaskWoken);
             }
-
             xSemaphoreGiveFromISR(driver.session_.completion_event, &xHigherPriorityTaskWoken);
         }
 
@@ -592,25 +755,80 @@ private:
             portYIELD_FROM_ISR();
     }
 
-    static int is_memory(uintptr_t address)
+    static dmac_transfer_flow_t get_flow_control(int mem_type_src, int mem_type_dest)
     {
-        enum
+        if (mem_type_src == 1 && mem_type_dest == 0)
+            return DMAC_MEM2PRF_DMA;
+        else if (mem_type_src == 0 && mem_type_dest == 1)
+            return DMAC_PRF2MEM_DMA;
+        else if (mem_type_src == 0 && mem_type_dest == 0)
+            configASSERT(!"Periph to periph dma is not supported.");
+        return DMAC_MEM2MEM_DMA;
+    }
+
+    static uint32_t get_tr_width(size_t element_size)
+    {
+        switch (element_size)
         {
-            mem_len = 6 * 1024 * 1024,
-            mem_no_cache_len = 8 * 1024 * 1024,
-        };
-        return ((address >= 0x80000000) && (address < 0x80000000 + mem_len)) || ((address >= 0x40000000) && (address < 0x40000000 + mem_no_cache_len)) || (address == 0x50450040);
+        case 1:
+            return 0;
+        case 2:
+            return 1;
+        case 4:
+            return 2;
+        case 8:
+            return 3;
+        case 16:
+            return 4;
+        default:
+            configASSERT(!"Invalid element size.");
+            return 0;
+        }
+    }
+
+    static uint32_t get_msize(size_t burst_size)
+    {
+        switch (burst_size)
+        {
+        case 1:
+            return 0;
+        case 4:
+            return 1;
+        case 8:
+            return 2;
+        case 16:
+            return 3;
+        case 32:
+            return 4;
+        default:
+            configASSERT(!"Invalid busrt size.");
+            return 0;
+        }
     }
 
 private:
     k_dmac_driver &dmac_;
     uint32_t channel_;
+    StaticSemaphore_t completion_buffer_;
+    SemaphoreHandle_t completion_;
+    dmac_lli_item_t lli_[DMA_SG_INLINE_BLOCKS];
+    dma_sg_item_t single_item_;
+    uint32_t *bounce_;
+    uint32_t *oversized_bounce_;
+    size_t oversized_bounce_words_;
+    uint64_t fill_;
+    dmac_transfer_statistics_t stats_;
 
     struct
     {
         SemaphoreHandle_t completion_event;
         uint32_t axi_master;
+        size_t bytes;
+        uint64_t started_at;
         int is_loop;
+        bool release;
+        dma_stage_completion_handler_t completion_handler;
+        void *completion_handler_data;
         union {
             struct
             {
@@ -619,6 +837,12 @@ private:
                 size_t count;
                 void *alloc_mem;
                 volatile void *dest;
+                bool bounce;
+                bool mem_inc;
+                uint32_t *bounce_buffer;
+                const dma_sg_item_t *items;
+                size_t item_index;
+                size_t item_offset;
             };
 
             struct
@@ -644,9 +868,289 @@ static k_dma_driver dev0_c3_driver(dev0_driver, 3);
 static k_dma_driver dev0_c4_driver(dev0_driver, 4);
 static k_dma_driver dev0_c5_driver(dev0_driver, 5);
 
+static k_dma_driver *const dev0_channels[DMA_CHANNELS] = { &dev0_c0_driver, &dev0_c1_driver, &dev0_c2_driver, &dev0_c3_driver, &dev0_c4_driver, &dev0_c5_driver };
+
+int k_dmac_driver::control(uint32_t control_code, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer)
+{
+    switch (control_code)
+    {
+    case DMAC_CONTROL_GET_CHANNEL_STATISTICS:
+        return get_channel_statistics(read_buffer);
+    case DMAC_CONTROL_GET_MASTER_STATISTICS:
+        return get_master_statistics(read_buffer);
+    case DMAC_CONTROL_RESET_STATISTICS:
+        reset_statistics();
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+int k_dmac_driver::get_channel_statistics(gsl::span<uint8_t> read_buffer)
+{
+    auto stats = reinterpret_cast<dmac_transfer_statistics_t *>(read_buffer.data());
+    size_t count = std::min(read_buffer.size() / sizeof(dmac_transfer_statistics_t), size_t(DMA_CHANNELS));
+    uint64_t now = clint->mtime;
+    for (size_t i = 0; i < count; i++)
+        dev0_channels[i]->get_statistics(stats[i], now, now - stats_start_);
+    return count;
+}
+
+int k_dmac_driver::get_master_statistics(gsl::span<uint8_t> read_buffer)
+{
+    auto stats = reinterpret_cast<dmac_transfer_statistics_t *>(read_buffer.data());
+    size_t count = std::min(read_buffer.size() / sizeof(dmac_transfer_statistics_t), size_t(DMA_AXI_MASTERS));
+    vTaskEnterCritical();
+    spinlock_lock(&lock_);
+    uint64_t now = clint->mtime;
+    for (size_t i = 0; i < count; i++)
+    {
+        stats[i] = masters_[i];
+        if (masters_[i].outstanding_bytes)
+            stats[i].busy_time += now - busy_since_[i];
+        stats[i].elapsed_time = now - stats_start_;
+    }
+    spinlock_unlock(&lock_);
+    vTaskExitCritical();
+    return count;
+}
+
+void k_dmac_driver::reset_statistics()
+{
+    vTaskEnterCritical();
+    spinlock_lock(&lock_);
+    uint64_t now = clint->mtime;
+    for (size_t i = 0; i < DMA_AXI_MASTERS; i++)
+    {
+        masters_[i].bytes = 0;
+        masters_[i].transfers = 0;
+        masters_[i].busy_time = 0;
+        busy_since_[i] = now;
+    }
+    stats_start_ = now;
+    spinlock_unlock(&lock_);
+    vTaskExitCritical();
+
+    for (auto channel : dev0_channels)
+        channel->reset_statistics();
+}
+
 driver &g_dma_driver_dma0 = dev0_c0_driver;
 driver &g_dma_driver_dma1 = dev0_c1_driver;
 driver &g_dma_driver_dma2 = dev0_c2_driver;
 driver &g_dma_driver_dma3 = dev0_c3_driver;
 driver &g_dma_driver_dma4 = dev0_c4_driver;
 driver &g_dma_driver_dma5 = dev0_c5_driver;
+
+void sys::dma_widen(uint32_t *dest, const volatile void *src, size_t element_size, size_t count, bool src_inc)
+{
+    if (!src_inc)
+    {
+        uint32_t value = element_size == 1 ? *(const volatile uint8_t *)src : *(const volatile uint16_t *)src;
+        while (count--)
+            *dest++ = value;
+    }
+    else if (element_size == 1)
+    {
+        auto p_src = (const uint8_t *)src;
+        for (; count >= 4; count -= 4, p_src += 4, dest += 4)
+        {
+            uint32_t value;
+            memcpy(&value, p_src, sizeof(value));
+            dest[0] = value & 0xFF;
+            dest[1] = (value >> 8) & 0xFF;
+            dest[2] = (value >> 16) & 0xFF;
+            dest[3] = value >> 24;
+        }
+        while (count--)
+            *dest++ = *p_src++;
+    }
+    else
+    {
+        auto p_src = (const uint16_t *)src;
+        for (; count >= 2; count -= 2, p_src += 2, dest += 2)
+        {
+            uint32_t value;
+            memcpy(&value, p_src, sizeof(value));
+            dest[0] = value & 0xFFFF;
+            dest[1] = value >> 16;
+        }
+        if (count)
+            *dest = *p_src;
+    }
+}
+
+void sys::dma_narrow(volatile void *dest, const uint32_t *src, size_t element_size, size_t count, bool dest_inc)
+{
+    if (!dest_inc)
+    {
+        if (count && element_size == 1)
+            *(volatile uint8_t *)dest = src[count - 1];
+        else if (count)
+            *(volatile uint16_t *)dest = src[count - 1];
+    }
+    else if (element_size == 1)
+    {
+        auto p_dst = (uint8_t *)dest;
+        for (; count >= 4; count -= 4, src += 4, p_dst += 4)
+        {
+            uint32_t value = (src[0] & 0xFF) | (src[1] & 0xFF) << 8 | (src[2] & 0xFF) << 16 | src[3] << 24;
+            memcpy(p_dst, &value, sizeof(value));
+        }
+        while (count--)
+            *p_dst++ = *src++;
+    }
+    else
+    {
+        auto p_dst = (uint16_t *)dest;
+        for (; count >= 2; count -= 2, src += 2, p_dst += 2)
+        {
+            uint32_t value = (src[0] & 0xFFFF) | src[1] << 16;
+            memcpy(p_dst, &value, sizeof(value));
+        }
+        if (count)
+            *p_dst = *src;
+    }
+}
+
+/* k_dma_driver is final, so these calls bind statically */
+
+void sys::dma_set_request_source(dma_driver &channel, uint32_t request)
+{
+    static_cast<k_dma_driver &>(channel).set_select_request(request);
+}
+
+void sys::dma_transmit_async(dma_driver &channel, const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size, SemaphoreHandle_t completion_event)
+{
+    static_cast<k_dma_driver &>(channel).transmit_async(src, dest, src_inc, dest_inc, element_size, count, burst_size, completion_event);
+}
+
+void sys::dma_transmit_async(dma_driver &channel, const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size)
+{
+    static_cast<k_dma_driver &>(channel).run_async(src, dest, src_inc, dest_inc, element_size, count, burst_size);
+}
+
+void sys::dma_transmit_sg_async(dma_driver &channel, gsl::span<const dma_sg_item_t> items, bool src_inc, bool dest_inc, size_t element_size, size_t burst_size)
+{
+    auto &dma = static_cast<k_dma_driver &>(channel);
+    dma.transmit_sg_async(items, src_inc, dest_inc, element_size, burst_size, dma.completion_event());
+}
+
+void sys::dma_set_completion_handler(dma_driver &channel, dma_stage_completion_handler_t handler, void *userdata, bool release)
+{
+    auto &dma = static_cast<k_dma_driver &>(channel);
+    dma.set_completion_handler(handler, userdata);
+    if (release)
+        dma.release_on_completion();
+}
+
+void sys::dma_wait(dma_driver &channel)
+{
+    static_cast<k_dma_driver &>(channel).wait();
+}
+
+void sys::dma_transmit(dma_driver &channel, const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size)
+{
+    auto &dma = static_cast<k_dma_driver &>(channel);
+    dma.run_async(src, dest, src_inc, dest_inc, element_size, count, burst_size);
+    dma.wait();
+}
+
+/* DMA memcpy */
+
+/* Below this size the channel setup and interrupt cost more than the CPU copy,
+ * see the dma_memcpy rows of src/throughput. */
+#ifndef CONFIG_DMA_MEMCPY_THRESHOLD
+#define CONFIG_DMA_MEMCPY_THRESHOLD 4096
+#endif
+
+/* Copies with the CPU, or starts a DMA for the widest aligned middle part and copies the
+ * unaligned head and tail with the CPU. Returns the channel if a DMA was started.
+ * A copy never waits for a channel, the CPU is used when none is free. */
+static k_dma_driver *dma_copy_start(uint8_t *dest, const uint8_t *src, int value, size_t size, SemaphoreHandle_t completion_event, bool release)
+{
+    uintptr_t src_addr = src ? (uintptr_t)src : (uintptr_t)dest;
+    dma_driver *channel = nullptr;
+    if (size >= CONFIG_DMA_MEMCPY_THRESHOLD && k_dma_driver::is_memory((uintptr_t)dest) && k_dma_driver::is_memory(src_addr))
+        channel = dma_try_acquire_channel(DMA_PRIORITY_NORMAL, DMA_SUBSYSTEM_NONE, 0);
+
+    if (!channel)
+    {
+        if (src)
+            memcpy(dest, src, size);
+        else
+            memset(dest, value, size);
+        if (completion_event)
+            xSemaphoreGive(completion_event);
+        return nullptr;
+    }
+
+    size_t element_size = 8;
+    while (((uintptr_t)dest - src_addr) % element_size)
+        element_size /= 2;
+    size_t head = (element_size - (uintptr_t)dest % element_size) % element_size;
+    size_t count = (size - head) / element_size;
+    size_t tail = size - head - count * element_size;
+
+    if (src)
+    {
+        memcpy(dest, src, head);
+        memcpy(dest + size - tail, src + size - tail, tail);
+    }
+    else
+    {
+        memset(dest, value, head);
+        memset(dest + size - tail, value, tail);
+    }
+
+    auto &dma = static_cast<k_dma_driver &>(*channel);
+    if (!completion_event)
+        completion_event = dma.completion_event();
+    if (release)
+        dma.release_on_completion();
+    const volatile void *dma_src = src ? src + head : dma.fill_source(value);
+    if (count <= DMA_MAX_BLOCK_TS)
+    {
+        dma.transmit_async(dma_src, dest + head, src != nullptr, true, element_size, count, DMA_MEMCPY_BURST_SIZE, completion_event);
+    }
+    else
+    {
+        /* Longer than one block, e.g. a large copy between oddly spaced buffers moving bytes:
+         * the linked list splits it, and the descriptors are built before this returns */
+        dma_sg_item_t item = { dma_src, dest + head, count };
+        dma.transmit_sg_async({ &item, 1 }, src != nullptr, true, element_size, DMA_MEMCPY_BURST_SIZE, completion_event);
+    }
+    return &dma;
+}
+
+static void dma_copy(uint8_t *dest, const uint8_t *src, int value, size_t size)
+{
+    auto dma = dma_copy_start(dest, src, value, size, nullptr, false);
+    if (dma)
+    {
+        dma->wait();
+        dma_release_channel(*dma);
+    }
+}
+
+void dma_memcpy_async(void *dest, const void *src, size_t size, SemaphoreHandle_t completion_event)
+{
+    configASSERT(completion_event);
+    dma_copy_start((uint8_t *)dest, (const uint8_t *)src, 0, size, completion_event, true);
+}
+
+void dma_memset_async(void *dest, int value, size_t size, SemaphoreHandle_t completion_event)
+{
+    configASSERT(completion_event);
+    dma_copy_start((uint8_t *)dest, nullptr, value, size, completion_event, true);
+}
+
+void dma_memcpy(void *dest, const void *src, size_t size)
+{
+    dma_copy((uint8_t *)dest, (const uint8_t *)src, 0, size);
+}
+
+void dma_memset(void *dest, int value, size_t size)
+{
+    dma_copy((uint8_t *)dest, nullptr, value, size);
+}
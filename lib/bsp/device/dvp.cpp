@@ -136,6 +136,8 @@ public:
     virtual void set_output_attributes(uint32_t index, video_format_t format, void *output_buffer) override
     {
         configASSERT(index < 2);
+        /* The DVP writes memory, so the CPU reads the frames back through the uncached alias */
+        output_buffers_[index] = dma_buffer_uncached_view(output_buffer);
 
         if (index == 0)
         {
@@ -153,6 +155,12 @@ public:
         }
     }
 
+    virtual void *get_output_buffer(uint32_t index) override
+    {
+        configASSERT(index < 2);
+        return output_buffers_[index];
+    }
+
     virtual void set_frame_event_enable(dvp_frame_event_t event, bool enable) override
     {
         switch (event)
@@ -230,6 +238,7 @@ private:
     void *frame_event_callback_data_;
     size_t width_;
     size_t height_;
+    void *output_buffers_[2] = {};
     uint32_t xclk_devide_;
 };
 
@@ -84,19 +84,17 @@ public:
         ctl.fft_enable = 1;
         fft_.fft_ctrl.data = ctl.data;
 
-        uintptr_t dma_write = dma_open_free();
-        uintptr_t dma_read = dma_open_free();
+        auto &dma_write = dma_acquire_channel();
+        auto &dma_read = dma_acquire_channel();
         dma_set_request_source(dma_write, SYSCTL_DMA_SELECT_FFT_TX_REQ);
         dma_set_request_source(dma_read, SYSCTL_DMA_SELECT_FFT_RX_REQ);
-        SemaphoreHandle_t event_read = xSemaphoreCreateBinary(), event_write = xSemaphoreCreateBinary();
-        dma_transmit_async(dma_read, &fft_.fft_output_fifo, output, 0, 1, sizeof(uint64_t), point_num >> 1, 4, event_read);
-        dma_transmit_async(dma_write, input, &fft_.fft_input_fifo, 1, 0, sizeof(uint64_t), point_num >> 1, 4, event_write);
-        configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE && xSemaphoreTake(event_write, portMAX_DELAY) == pdTRUE);
+        dma_transmit_async(dma_read, &fft_.fft_output_fifo, output, 0, 1, sizeof(uint64_t), point_num >> 1, 4);
+        dma_transmit_async(dma_write, input, &fft_.fft_input_fifo, 1, 0, sizeof(uint64_t), point_num >> 1, 4);
+        dma_wait(dma_read);
+        dma_wait(dma_write);
 
-        dma_close(dma_write);
-        dma_close(dma_read);
-        vSemaphoreDelete(event_read);
-        vSemaphoreDelete(event_write);
+        dma_release_channel(dma_write);
+        dma_release_channel(dma_read);
     }
 
 private:
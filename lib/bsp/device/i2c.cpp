@@ -17,6 +17,7 @@
 #include <hal.h>
 #include <i2c.h>
 #include <kernel/driver_impl.hpp>
+#include <kernel/slab.hpp>
 #include <plic.h>
 #include <semphr.h>
 #include <stdio.h>
@@ -32,8 +33,18 @@ using namespace sys;
 #define COMMON_ENTRY \
     semaphore_lock locker(free_mutex_);
 
+#define I2C_COMMAND_BLOCK_LENGTH 32
+
 class k_i2c_device_driver;
 
+/* DMA command words of a short sequential transfer, longer transfers use the heap */
+struct i2c_command_block : public slab_object<i2c_command_block>
+{
+    uint32_t data[I2C_COMMAND_BLOCK_LENGTH];
+};
+
+DEFINE_SLAB_OBJECT(i2c_command_block, 4);
+
 class k_i2c_driver : public i2c_driver, public static_object, public free_object_access
 {
 public:
@@ -135,11 +146,11 @@ public:
         COMMON_ENTRY;
         setup_device(device);
 
-        uintptr_t dma_write = dma_open_free();
+        auto &dma_write = dma_acquire_channel();
 
         dma_set_request_source(dma_write, dma_req_ + 1);
         dma_transmit(dma_write, buffer.data(), &i2c_.data_cmd, 1, 0, 1, buffer.size(), 4);
-        dma_close(dma_write);
+        dma_release_channel(dma_write);
 
         while (i2c_.status & I2C_STATUS_ACTIVITY)
         {
@@ -154,29 +165,41 @@ public:
         COMMON_ENTRY;
         setup_device(device);
 
-        auto write_cmd = std::make_unique<uint32_t[]>(write_buffer.size() + read_buffer.size());
+        size_t cmd_len = write_buffer.size() + read_buffer.size();
+        std::unique_ptr<i2c_command_block> cmd_block;
+        std::unique_ptr<uint32_t[]> cmd_heap;
+        uint32_t *write_cmd;
+        if (cmd_len <= I2C_COMMAND_BLOCK_LENGTH)
+        {
+            cmd_block = std::make_unique<i2c_command_block>();
+            write_cmd = cmd_block->data;
+        }
+        else
+        {
+            cmd_heap = std::make_unique<uint32_t[]>(cmd_len);
+            write_cmd = cmd_heap.get();
+        }
+
         size_t i;
         for (i = 0; i < write_buffer.size(); i++)
             write_cmd[i] = write_buffer[i];
         for (i = 0; i < read_buffer.size(); i++)
             write_cmd[i + write_buffer.size()] = I2C_DATA_CMD_CMD;
 
-        uintptr_t dma_write = dma_open_free();
-        uintptr_t dma_read = dma_open_free();
-        SemaphoreHandle_t event_read = xSemaphoreCreateBinary(), event_write = xSemaphoreCreateBinary();
+        auto &dma_write = dma_acquire_channel();
+        auto &dma_read = dma_acquire_channel();
 
         dma_set_request_source(dma_write, dma_req_ + 1);
         dma_set_request_source(dma_read, dma_req_);
 
-        dma_transmit_async(dma_read, &i2c_.data_cmd, read_buffer.data(), 0, 1, 1, read_buffer.size(), 1, event_read);
-        dma_transmit_async(dma_write, write_cmd.get(), &i2c_.data_cmd, 1, 0, sizeof(uint32_t), write_buffer.size() + read_buffer.size(), 4, event_write);
+        dma_transmit_async(dma_read, &i2c_.data_cmd, read_buffer.data(), 0, 1, 1, read_buffer.size(), 1);
+        dma_transmit_async(dma_write, write_cmd, &i2c_.data_cmd, 1, 0, sizeof(uint32_t), cmd_len, 4);
 
-        configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE && xSemaphoreTake(event_write, portMAX_DELAY) == pdTRUE);
+        dma_wait(dma_read);
+        dma_wait(dma_write);
 
-        dma_close(dma_write);
-        dma_close(dma_read);
-        vSemaphoreDelete(event_read);
-        vSemaphoreDelete(event_write);
+        dma_release_channel(dma_write);
+        dma_release_channel(dma_read);
         return read_buffer.size();
     }
 
@@ -13,6 +13,7 @@
  * limitations under the License.
  */
 #include <FreeRTOS.h>
+#include <devices.h>
 #include <fpioa.h>
 #include <hal.h>
 #include <i2s.h>
@@ -162,10 +163,10 @@ public:
         session_.block_align = block_align;
         session_.buffer_frames = format.sample_rate * delay_ms / 1000;
         configASSERT(session_.buffer_frames >= 100);
-        free(session_.buffer);
+        dma_buffer_free(session_.buffer);
         session_.buffer_size = session_.block_align * session_.buffer_frames;
-        session_.buffer = (uint8_t *)malloc(session_.buffer_size * BUFFER_COUNT);
-        memset(session_.buffer, 0, session_.buffer_size * BUFFER_COUNT);
+        session_.buffer = (uint8_t *)dma_buffer_alloc(session_.buffer_size * BUFFER_COUNT, DMA_BUFFER_UNCACHED);
+        dma_memset(session_.buffer, 0, session_.buffer_size * BUFFER_COUNT);
         session_.buffer_ptr = 0;
         session_.next_free_buffer = 0;
         session_.stop_signal = 0;
@@ -269,19 +270,19 @@ public:
         session_.block_align = block_align;
         session_.buffer_frames = format.sample_rate * delay_ms / 1000;
         configASSERT(session_.buffer_frames >= 100);
-        free(session_.buffer);
+        dma_buffer_free(session_.buffer);
         session_.buffer_size = session_.block_align * session_.buffer_frames;
-        session_.buffer = (uint8_t *)malloc(session_.buffer_size * BUFFER_COUNT);
-        memset(session_.buffer, 0, session_.buffer_size * BUFFER_COUNT);
+        session_.buffer = (uint8_t *)dma_buffer_alloc(session_.buffer_size * BUFFER_COUNT, DMA_BUFFER_UNCACHED);
+        dma_memset(session_.buffer, 0, session_.buffer_size * BUFFER_COUNT);
         session_.buffer_ptr = 0;
         session_.next_free_buffer = 0;
         session_.stop_signal = 0;
         session_.transmit_dma = NULL_HANDLE;
         session_.dma_in_use_buffer = 0;
         session_.use_low_16bits = format.bits_per_sample == 16;
-        free(session_.buffer_16to32);
+        dma_buffer_free(session_.buffer_16to32);
         if (session_.use_low_16bits)
-            session_.buffer_16to32 = (uint8_t *)malloc(session_.buffer_size * 2 * BUFFER_COUNT);
+            session_.buffer_16to32 = (uint8_t *)dma_buffer_alloc(session_.buffer_size * 2 * BUFFER_COUNT, DMA_BUFFER_UNCACHED);
     }
 
     virtual void get_buffer(gsl::span<uint8_t> &buffer, size_t &frames) override
@@ -317,7 +318,7 @@ public:
             configASSERT(!session_.transmit_dma);
 
             session_.stop_signal = 0;
-            session_.transmit_dma = dma_open_free();
+            session_.transmit_dma = dma_open_free_priority(DMA_PRIORITY_REALTIME, DMA_SUBSYSTEM_AUDIO, portMAX_DELAY);
             dma_set_request_source(session_.transmit_dma, dma_req_ - 1);
             session_.dma_in_use_buffer = 0;
             session_.stage_completion_event = xSemaphoreCreateCounting(100, 0);
@@ -338,7 +339,7 @@ public:
             configASSERT(!session_.transmit_dma);
 
             session_.stop_signal = 0;
-            session_.transmit_dma = dma_open_free();
+            session_.transmit_dma = dma_open_free_priority(DMA_PRIORITY_REALTIME, DMA_SUBSYSTEM_AUDIO, portMAX_DELAY);
             dma_set_request_source(session_.transmit_dma, dma_req_);
             session_.dma_in_use_buffer = 0;
             session_.stage_completion_event = xSemaphoreCreateCounting(100, 0);
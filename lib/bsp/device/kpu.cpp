@@ -58,7 +58,7 @@ public:
         }
         else
         {
-            throw std::runtime_error("Cannot load kmodel.");
+            SYS_THROW(std::runtime_error("Cannot load kmodel."));
         }
     }
 
@@ -119,7 +119,6 @@ public:
 
         auto model_context = system_handle_to_object(context).as<k_model_context>();
         model_context->get(&ctx_);
-        dma_ch_ = dma_open_free();
         ctx_.current_layer = 0;
         ctx_.current_body = ctx_.body_start;
         
@@ -147,6 +146,7 @@ public:
             return -1;
         const kpu_model_conv_layer_argument_t *first_layer = (const kpu_model_conv_layer_argument_t *)ctx_.body_start;
         kpu_layer_argument_t layer_arg = *(kpu_layer_argument_t *)(ctx_.model_buffer + first_layer->layer_offset);
+        dma_ch_ = &dma_acquire_channel(DMA_PRIORITY_HIGH, DMA_SUBSYSTEM_KPU);
 
 #if KPU_DEBUG
         gettimeofday(&last_time_, NULL);
@@ -176,6 +176,8 @@ public:
             }
         }
         done_flag_ = 0;
+        dma_release_channel(*dma_ch_);
+        dma_ch_ = nullptr;
         return 0;
     }
 
@@ -218,15 +220,7 @@ private:
 
     void kpu_flush_cache(uint32_t addr, size_t lines)
     {
-        size_t line;
-        for (line = 0; line < lines; line++)
-        {
-            const uint64_t *src = (const uint64_t *)(AI_RAM_BASE_ADDR + (addr + line) * 64);
-            uint64_t *dest = (uint64_t *)(AI_IO_BASE_ADDR + (addr + line) * 64);
-            size_t i;
-            for (i = 0; i < 8; i++)
-                dest[i] = src[i];
-        }
+        dma_buffer_writeback((const void *)((uintptr_t)AI_RAM_BASE_ADDR + (uintptr_t)addr * 64), lines * 64);
     }
 
     void kpu_send_layer(const kpu_layer_argument_t *layer)
@@ -271,7 +265,12 @@ private:
         	row_length = (width + 63) / 64;
         }
 
-        if ((uintptr_t)src % 8 == 0 && width % 8 == 0)
+        if (width % 64 == 0)
+        {
+            /* Rows fill whole lines without padding, so the layout matches the source */
+            dma_memcpy(dest, src, width * height * channels);
+        }
+        else if ((uintptr_t)src % 8 == 0 && width % 8 == 0)
         {
             width /= 8;
             const uint64_t *u64_src = (const uint64_t *)src;
@@ -310,8 +309,8 @@ private:
     {
         uint64_t input_size = layer->kernel_calc_type_cfg.data.channel_switch_addr * 64 * (layer->image_channel_num.data.i_ch_num + 1);
 
-        dma_set_request_source(dma_ch_, dma_req_);
-        dma_transmit_async(dma_ch_, src, (void *)(uintptr_t)((uint8_t *)AI_IO_BASE_ADDR + layer->image_addr.data.image_src_addr * 64), 1, 1, sizeof(uint64_t), input_size / 8, 16, completion_event_);
+        dma_set_request_source(*dma_ch_, dma_req_);
+        dma_transmit_async(*dma_ch_, src, (void *)(uintptr_t)((uint8_t *)AI_IO_BASE_ADDR + layer->image_addr.data.image_src_addr * 64), 1, 1, sizeof(uint64_t), input_size / 8, 16, completion_event_);
     }
 
     void kpu_input_with_padding(const kpu_layer_argument_t *layer, const uint8_t *src)
@@ -533,7 +532,7 @@ private:
         {
             kpu_model_memory_range_t input = arg->inputs_mem[i];
             const uint8_t *src = (const uint8_t *)(ctx_.main_buffer + input.start);
-            memcpy(dest, src, input.size);
+            dma_memcpy(dest, src, input.size);
             dest += input.size;
         }
     }
@@ -551,8 +550,8 @@ private:
 
             layer.dma_parameter.data.send_data_out = 1;
 
-            dma_set_request_source(dma_ch_, dma_req_);
-            dma_transmit_async(dma_ch_, (void *)(&kpu_.fifo_data_out), dest, 0, 1, sizeof(uint64_t), (layer.dma_parameter.data.dma_total_byte + 8) / 8, 8, completion_event_);
+            dma_set_request_source(*dma_ch_, dma_req_);
+            dma_transmit_async(*dma_ch_, (void *)(&kpu_.fifo_data_out), dest, 0, 1, sizeof(uint64_t), (layer.dma_parameter.data.dma_total_byte + 8) / 8, 8, completion_event_);
         }
         else
         {
@@ -784,7 +783,7 @@ private:
     sysctl_clock_t clock_;
     sysctl_dma_select_t dma_req_;
     SemaphoreHandle_t free_mutex_;
-    uintptr_t dma_ch_;
+    dma_driver *dma_ch_ = nullptr;
     SemaphoreHandle_t completion_event_;
     uint8_t done_flag_ = 0;
     kpu_model_context_t ctx_;
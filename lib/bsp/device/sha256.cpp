@@ -81,32 +81,52 @@ public:
         sha256_.sha_function_reg_0.sha_endian = SHA256_BIG_ENDIAN;
         sha256_.sha_function_reg_0.sha_en = ENABLE_SHA;
         sha256_.sha_num_reg.sha_data_cnt = (input_data.size() + SHA256_BLOCK_LEN + 8) / SHA256_BLOCK_LEN;
-        context.dma_buf = (uint32_t *)malloc((input_data.size() + SHA256_BLOCK_LEN + 8) / SHA256_BLOCK_LEN * 16 * sizeof(uint32_t));
         context.buffer_len = 0L;
         context.dma_buf_len = 0L;
         context.total_len = 0L;
-        for (i = 0; i < (sizeof(context.dma_buf) / 4); i++)
-            context.dma_buf[i] = 0;
-        sha256_update_buf(&context, input_data.data(), input_data.size());
+
+        /* Whole blocks of a registered buffer are fed to the engine in place, only the padded tail is copied */
+        size_t direct_len = 0;
+        if (((uintptr_t)input_data.data() & 3) == 0 && dma_buffer_is_registered(input_data.data(), input_data.size()))
+            direct_len = input_data.size() / SHA256_BLOCK_LEN * SHA256_BLOCK_LEN;
+
+        if (direct_len)
+        {
+            context.dma_buf = tail_buf_;
+            context.total_len = direct_len * 8L;
+        }
+        else
+        {
+            context.dma_buf = (uint32_t *)malloc((input_data.size() + SHA256_BLOCK_LEN + 8) / SHA256_BLOCK_LEN * 16 * sizeof(uint32_t));
+            for (i = 0; i < (sizeof(context.dma_buf) / 4); i++)
+                context.dma_buf[i] = 0;
+        }
+
+        sha256_update_buf(&context, input_data.data() + direct_len, input_data.size() - direct_len);
         sha256_final_buf(&context);
 
-        uintptr_t dma_write = dma_open_free();
+        auto &dma_write = dma_acquire_channel();
 
         dma_set_request_source(dma_write, SYSCTL_DMA_SELECT_SHA_RX_REQ);
 
-        SemaphoreHandle_t event_write = xSemaphoreCreateBinary();
+        if (direct_len)
+        {
+            dma_transmit_async(dma_write, input_data.data(), &sha256_.sha_data_in1, 1, 0, sizeof(uint32_t), direct_len / sizeof(uint32_t), 16);
+            sha256_.sha_function_reg_1.dma_en = 0x1;
+            dma_wait(dma_write);
+        }
 
-        dma_transmit_async(dma_write, context.dma_buf, &sha256_.sha_data_in1, 1, 0, sizeof(uint32_t), context.dma_buf_len, 16, event_write);
+        dma_transmit_async(dma_write, context.dma_buf, &sha256_.sha_data_in1, 1, 0, sizeof(uint32_t), context.dma_buf_len, 16);
         sha256_.sha_function_reg_1.dma_en = 0x1;
-        configASSERT(xSemaphoreTake(event_write, portMAX_DELAY) == pdTRUE);
+        dma_wait(dma_write);
 
         while (!(sha256_.sha_function_reg_0.sha_en))
             ;
         for (i = 0; i < SHA256_HASH_WORDS; i++)
             *((uint32_t *)&output_data[i * 4]) = sha256_.sha_result[SHA256_HASH_WORDS - i - 1];
-        free(context.dma_buf);
-        dma_close(dma_write);
-        vSemaphoreDelete(event_write);
+        if (!direct_len)
+            free(context.dma_buf);
+        dma_release_channel(dma_write);
     }
 
 private:
@@ -156,6 +176,8 @@ private:
     volatile sha256_t &sha256_;
     sysctl_clock_t clock_;
     SemaphoreHandle_t free_mutex_;
+    /* The last partial block, padding and length of a registered input */
+    uint32_t tail_buf_[SHA256_BLOCK_LEN * 2 / sizeof(uint32_t)];
 };
 
 static k_sha256_driver dev0_driver(SHA256_BASE_ADDR, SYSCTL_CLOCK_SHA);
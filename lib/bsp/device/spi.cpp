@@ -13,11 +13,15 @@
  * limitations under the License.
  */
 #include <FreeRTOS.h>
+#include <atomic>
+#include <devices.h>
 #include <fpioa.h>
 #include <hal.h>
 #include <kernel/driver_impl.hpp>
+#include <kernel/slab.hpp>
 #include <math.h>
 #include <semphr.h>
+#include <sleep.h>
 #include <spi.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,37 +31,61 @@
 
 using namespace sys;
 
-#define SPI_TRANSMISSION_THRESHOLD 0x800UL
+/* Frames from which transfers go through DMA rather than the FIFO, tune with src/throughput */
+#ifndef CONFIG_SPI_DMA_THRESHOLD
+#define CONFIG_SPI_DMA_THRESHOLD 0x800UL
+#endif
+
+#define SPI_TRANSMISSION_THRESHOLD CONFIG_SPI_DMA_THRESHOLD
+#define SPI_SG_INLINE_ITEMS 8
+#define SPI_FIFO_DEPTH 32
+#define SPI_INT_TXE 0x01
+#define SPI_INT_RXO 0x08
+#define SPI_INT_RXF 0x10
+/* The DMA loops over a slave ring in this many stages */
+#define SPI_SLAVE_RING_STAGES 4
 /* SPI Controller */
 
 #define TMOD_MASK (3 << tmod_off_)
 #define TMOD_VALUE(value) (value << tmod_off_)
-#define COMMON_ENTRY \
-    semaphore_lock locker(free_mutex_);
+#define COMMON_ENTRY                    \
+    semaphore_lock locker(free_mutex_); \
+    wait_async_idle();
 
 class k_spi_device_driver;
 
 class k_spi_driver : public spi_driver, public static_object, public free_object_access
 {
 public:
-    k_spi_driver(uintptr_t base_addr, sysctl_clock_t clock, sysctl_dma_select_t dma_req, uint8_t mod_off, uint8_t dfs_off, uint8_t tmod_off, uint8_t frf_off)
-        : spi_(*reinterpret_cast<volatile spi_t *>(base_addr)), clock_(clock), dma_req_(dma_req), mod_off_(mod_off), dfs_off_(dfs_off), tmod_off_(tmod_off), frf_off_(frf_off)
+    k_spi_driver(uintptr_t base_addr, sysctl_clock_t clock, sysctl_dma_select_t dma_req, plic_irq_t irq, uint8_t mod_off, uint8_t dfs_off, uint8_t tmod_off, uint8_t frf_off)
+        : spi_(*reinterpret_cast<volatile spi_t *>(base_addr)), clock_(clock), dma_req_(dma_req), irq_(irq), mod_off_(mod_off), dfs_off_(dfs_off), tmod_off_(tmod_off), frf_off_(frf_off)
     {
     }
 
     virtual void install() override
     {
         free_mutex_ = xSemaphoreCreateMutex();
+        async_idle_ = xSemaphoreCreateBinary();
+        xSemaphoreGive(async_idle_);
+        fifo_event_ = xSemaphoreCreateBinary();
         sysctl_clock_disable(clock_);
+
+        pic_set_irq_handler(irq_, on_fifo_irq, this);
+        pic_set_irq_priority(irq_, 1);
     }
 
     virtual void on_first_open() override
     {
         sysctl_clock_enable(clock_);
+        /* The controller comes out of reset with its interrupts unmasked */
+        spi_.imr = 0x00;
+        regs_.valid = false;
+        pic_set_irq_enable(irq_, 1);
     }
 
     virtual void on_last_close() override
     {
+        pic_set_irq_enable(irq_, 0);
         sysctl_clock_disable(clock_);
     }
 
@@ -66,15 +94,23 @@ public:
     double set_clock_rate(k_spi_device_driver &device, double clock_rate);
     int read(k_spi_device_driver &device, gsl::span<uint8_t> buffer);
     int write(k_spi_device_driver &device, gsl::span<const uint8_t> buffer);
+    int readv(k_spi_device_driver &device, gsl::span<const io_vec_t> buffers);
+    int writev(k_spi_device_driver &device, gsl::span<const io_vec_t> buffers);
+    bool begin_read(k_spi_device_driver &device, gsl::span<uint8_t> buffer, async_io_state &state);
+    bool begin_write(k_spi_device_driver &device, gsl::span<const uint8_t> buffer, async_io_state &state);
+    int end_io(k_spi_device_driver &device, async_io_state &state);
     int transfer_full_duplex(k_spi_device_driver &device, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer);
     int transfer_sequential(k_spi_device_driver &device, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer);
     int read_write(k_spi_device_driver &device, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer);
+    int transfer_list(k_spi_device_driver &device, gsl::span<const spi_segment_t> segments);
     void fill(k_spi_device_driver &device, uint32_t instruction, uint32_t address, uint32_t value, size_t count);
     virtual void slave_config(uint32_t data_bit_length, const spi_slave_handler_t &handler) override
     {
         slave_context_.data_bit_length = data_bit_length;
         slave_context_.handler = &handler;
         uint8_t slv_oe = 10;
+        /* The slave interrupt owns ctrlr0 from now on */
+        regs_.valid = false;
         spi_.ssienr = 0x00;
         spi_.ctrlr0 = (0x0 << mod_off_) | (0x1 << slv_oe) | ((data_bit_length - 1) << dfs_off_);
         spi_.txftlr = 0x00000000;
@@ -87,6 +123,11 @@ public:
         pic_set_irq_enable(IRQN_SPI_SLAVE_INTERRUPT, 1);
     }
 
+    virtual void slave_config_dma(const spi_slave_dma_config_t &config) override;
+    virtual size_t slave_read(gsl::span<uint8_t> buffer) override;
+    virtual size_t slave_write(gsl::span<const uint8_t> buffer) override;
+    virtual void slave_get_statistics(spi_slave_statistics_t &stats) override;
+
     static void on_spi_irq(void *userdata)
     {
         auto &driver = *reinterpret_cast<k_spi_driver *>(userdata);
@@ -124,8 +165,169 @@ public:
         }
     }
 
+    static void on_slave_dma_irq(void *userdata)
+    {
+        auto &driver = *reinterpret_cast<k_spi_driver *>(userdata);
+        if (driver.spi_.isr & SPI_INT_RXO)
+        {
+            (void)driver.spi_.rxoicr;
+            driver.slave_dma_.stats.fifo_overruns++;
+        }
+    }
+
+    static void on_slave_rx_stage(void *userdata)
+    {
+        auto &driver = *reinterpret_cast<k_spi_driver *>(userdata);
+        auto &ring = driver.slave_dma_.rx;
+        size_t head = ring.head.load(std::memory_order_relaxed) + ring.stage_frames;
+        ring.head.store(head, std::memory_order_release);
+
+        size_t unread = head - ring.tail.load(std::memory_order_acquire);
+        if (unread > ring.frames - ring.stage_frames)
+            driver.slave_dma_.stats.rx_overruns++;
+        if (driver.slave_dma_.on_threshold && unread >= driver.slave_dma_.threshold)
+            driver.slave_dma_.on_threshold(driver.slave_dma_.userdata);
+    }
+
+    static void on_slave_tx_stage(void *userdata)
+    {
+        auto &driver = *reinterpret_cast<k_spi_driver *>(userdata);
+        auto &ring = driver.slave_dma_.tx;
+        size_t tail = ring.tail.load(std::memory_order_relaxed) + ring.stage_frames;
+        ring.tail.store(tail, std::memory_order_release);
+
+        /* The stage the DMA goes on to is short of fresh frames, its old ones go out again */
+        if (ring.head.load(std::memory_order_acquire) < tail + ring.stage_frames)
+            driver.slave_dma_.stats.tx_underruns++;
+    }
+
+    static void on_fifo_irq(void *userdata)
+    {
+        auto &driver = *reinterpret_cast<k_spi_driver *>(userdata);
+        if (driver.service_fifo())
+        {
+            driver.spi_.imr = 0x00;
+            BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+            xSemaphoreGiveFromISR(driver.fifo_event_, &xHigherPriorityTaskWoken);
+            if (xHigherPriorityTaskWoken)
+            {
+                portYIELD_FROM_ISR();
+            }
+        }
+    }
+
+    /* Ends an async transfer from the DMA completion isr, so the bus is free before it is reaped */
+    static void on_async_complete(void *userdata)
+    {
+        auto &driver = *reinterpret_cast<k_spi_driver *>(userdata);
+        if (driver.async_tx_)
+        {
+            while ((driver.spi_.sr & 0x05) != 0x04)
+                ;
+        }
+
+        driver.spi_.ser = 0x00;
+        driver.spi_.ssienr = 0x00;
+        driver.spi_.dmacr = 0x00;
+        BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+        xSemaphoreGiveFromISR(driver.async_idle_, &xHigherPriorityTaskWoken);
+        if (xHigherPriorityTaskWoken)
+        {
+            portYIELD_FROM_ISR();
+        }
+    }
+
 private:
+    /* Lets a transfer started by begin_read or begin_write finish before the caller takes the bus */
+    void wait_async_idle()
+    {
+        xSemaphoreTake(async_idle_, portMAX_DELAY);
+        xSemaphoreGive(async_idle_);
+    }
+
+    bool try_begin_async()
+    {
+        if (xSemaphoreTake(free_mutex_, 0) != pdTRUE)
+            return false;
+        if (xSemaphoreTake(async_idle_, 0) != pdTRUE)
+        {
+            xSemaphoreGive(free_mutex_);
+            return false;
+        }
+
+        return true;
+    }
+
     void setup_device(k_spi_device_driver &device);
+    void set_tmod(uint32_t tmod);
+    bool use_fifo_irq(k_spi_device_driver &device, size_t frames);
+    void transfer_fifo_irq(k_spi_device_driver &device, const uint8_t *tx_buffer, uint8_t *rx_buffer, size_t frames);
+    bool service_fifo();
+    void read_fifo(k_spi_device_driver &device, uint8_t *buffer, size_t rx_frames);
+    void write_fifo(k_spi_device_driver &device, const uint8_t *buffer, size_t tx_buffer_len);
+    size_t send_segments(k_spi_device_driver &device, gsl::span<const spi_segment_t> segments, dma_driver *&dma);
+    size_t receive_segments(k_spi_device_driver &device, gsl::span<const spi_segment_t> tx_segments, gsl::span<const spi_segment_t> rx_segments, dma_driver *&dma);
+    dma_driver &list_channel(k_spi_device_driver &device, dma_driver *&dma);
+
+    /* Frames count up without wrapping, the ISR advances one side and the slave_read or
+     * slave_write caller the other */
+    struct slave_ring
+    {
+        uint32_t *buffer;
+        size_t frames;
+        size_t stage_frames;
+        std::atomic<size_t> head;
+        std::atomic<size_t> tail;
+    };
+
+    void start_slave_ring(slave_ring &ring, size_t frames, bool receive);
+
+    /* DMA scatter list, on the stack for the common few-buffer case */
+    class sg_items
+    {
+    public:
+        sg_items(size_t count)
+            : count_(count), items_(count <= SPI_SG_INLINE_ITEMS ? inline_items_ : new dma_sg_item_t[count])
+        {
+        }
+
+        ~sg_items()
+        {
+            if (items_ != inline_items_)
+                delete[] items_;
+        }
+
+        dma_sg_item_t &operator[](size_t index)
+        {
+            return items_[index];
+        }
+
+        gsl::span<const dma_sg_item_t> span() const
+        {
+            return { items_, std::ptrdiff_t(count_) };
+        }
+
+    private:
+        size_t count_;
+        dma_sg_item_t inline_items_[SPI_SG_INLINE_ITEMS];
+        dma_sg_item_t *items_;
+    };
+
+    static size_t get_vectored_length(gsl::span<const io_vec_t> buffers)
+    {
+        size_t length = 0;
+        for (auto &vec : buffers)
+            length += vec.len;
+        return length;
+    }
+
+    static size_t get_segments_length(gsl::span<const spi_segment_t> segments)
+    {
+        size_t length = 0;
+        for (auto &segment : segments)
+            length += segment.length;
+        return length;
+    }
 
     static void write_inst_addr(volatile uint32_t *dr, const uint8_t **buffer, size_t width)
     {
@@ -149,18 +351,55 @@ private:
     volatile spi_t &spi_;
     sysctl_clock_t clock_;
     sysctl_dma_select_t dma_req_;
+    plic_irq_t irq_;
     uint8_t mod_off_;
     uint8_t dfs_off_;
     uint8_t tmod_off_;
     uint8_t frf_off_;
 
     SemaphoreHandle_t free_mutex_;
+    /* Taken while an async DMA transfer owns the bus, given back by its completion isr */
+    SemaphoreHandle_t async_idle_;
+    bool async_tx_;
+    SemaphoreHandle_t fifo_event_;
     spi_slave_context_t slave_context_;
+
+    /* Registers as setup_device and set_tmod last wrote them, so a transfer only rewrites
+     * the ones its device configures differently */
+    struct
+    {
+        bool valid;
+        uint32_t baudr;
+        uint32_t ctrlr0;
+        uint32_t spi_ctrlr0;
+    } regs_ = {};
+
+    /* The interrupt driven transfer in progress, shared with the ISR */
+    struct
+    {
+        const uint8_t *tx_buffer;
+        uint8_t *rx_buffer;
+        size_t tx_frames;
+        size_t rx_frames;
+        uint32_t width;
+    } fifo_;
+
+    struct
+    {
+        slave_ring rx;
+        slave_ring tx;
+        uint32_t width;
+        size_t threshold;
+        spi_slave_threshold_handler_t on_threshold;
+        void *userdata;
+        int stop_signal;
+        spi_slave_statistics_t stats;
+    } slave_dma_;
 };
 
 /* SPI Device */
 
-class k_spi_device_driver : public spi_device_driver, public heap_object, public exclusive_object_access
+class k_spi_device_driver : public spi_device_driver, public async_io_driver, public heap_object, public exclusive_object_access, public slab_object<k_spi_device_driver>
 {
 public:
     k_spi_device_driver(object_accessor<k_spi_driver> spi, spi_mode_t mode, spi_frame_format_t frame_format, uint32_t chip_select_mask, uint32_t data_bit_length)
@@ -216,6 +455,31 @@ public:
         return spi_->write(*this, buffer);
     }
 
+    virtual int readv(gsl::span<const io_vec_t> buffers) override
+    {
+        return spi_->readv(*this, buffers);
+    }
+
+    virtual int writev(gsl::span<const io_vec_t> buffers) override
+    {
+        return spi_->writev(*this, buffers);
+    }
+
+    virtual bool begin_read(gsl::span<uint8_t> buffer, async_io_state &state) override
+    {
+        return spi_->begin_read(*this, buffer, state);
+    }
+
+    virtual bool begin_write(gsl::span<const uint8_t> buffer, async_io_state &state) override
+    {
+        return spi_->begin_write(*this, buffer, state);
+    }
+
+    virtual int end_io(async_io_state &state) override
+    {
+        return spi_->end_io(*this, state);
+    }
+
     virtual int transfer_full_duplex(gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer) override
     {
         return spi_->transfer_full_duplex(*this, write_buffer, read_buffer);
@@ -226,11 +490,27 @@ public:
         return spi_->transfer_sequential(*this, write_buffer, read_buffer);
     }
 
+    virtual int transfer_list(gsl::span<const spi_segment_t> segments) override
+    {
+        return spi_->transfer_list(*this, segments);
+    }
+
     virtual void fill(uint32_t instruction, uint32_t address, uint32_t value, size_t count) override
     {
         spi_->fill(*this, instruction, address, value, count);
     }
 
+    virtual void set_dma_priority(dma_priority_t priority, dma_subsystem_t subsystem) override
+    {
+        dma_priority_ = priority;
+        dma_subsystem_ = subsystem;
+    }
+
+    virtual void set_fifo_mode(spi_fifo_mode_t mode) override
+    {
+        fifo_mode_ = mode;
+    }
+
 private:
     static int get_buffer_width(size_t data_bit_length)
     {
@@ -269,9 +549,17 @@ private:
     uint32_t wait_cycles_ = 0;
     spi_inst_addr_trans_mode_t trans_mode_;
     uint32_t baud_rate_ = 0x2;
+    double clock_rate_ = 0;
+    uint32_t source_clock_ = 0;
+    double actual_clock_rate_ = 0;
     uint32_t buffer_width_ = 0;
+    dma_priority_t dma_priority_ = DMA_PRIORITY_NORMAL;
+    dma_subsystem_t dma_subsystem_ = DMA_SUBSYSTEM_NONE;
+    spi_fifo_mode_t fifo_mode_ = SPI_FIFO_POLLED;
 };
 
+DEFINE_SLAB_OBJECT(k_spi_device_driver, 4);
+
 object_ptr<spi_device_driver> k_spi_driver::get_device(spi_mode_t mode, spi_frame_format_t frame_format, uint32_t chip_select_mask, uint32_t data_bit_length)
 {
     auto driver = make_object<k_spi_device_driver>(make_accessor<k_spi_driver>(this), mode, frame_format, chip_select_mask, data_bit_length);
@@ -281,12 +569,20 @@ object_ptr<spi_device_driver> k_spi_driver::get_device(spi_mode_t mode, spi_fram
 
 double k_spi_driver::set_clock_rate(k_spi_device_driver &device, double clock_rate)
 {
-    double clk = (double)sysctl_clock_get_freq(clock_);
+    /* Callers set the rate before every transfer, only work out the divider when it changes */
+    uint32_t source_clock = sysctl_clock_get_freq(clock_);
+    if (clock_rate == device.clock_rate_ && source_clock == device.source_clock_)
+        return device.actual_clock_rate_;
+
+    double clk = (double)source_clock;
     uint32_t div = std::min(65534U, std::max((uint32_t)ceil(clk / clock_rate), 2U));
     if (div & 1)
         div++;
     device.baud_rate_ = div;
-    return clk / div;
+    device.clock_rate_ = clock_rate;
+    device.source_clock_ = source_clock;
+    device.actual_clock_rate_ = clk / div;
+    return device.actual_clock_rate_;
 }
 
 int k_spi_driver::read(k_spi_device_driver &device, gsl::span<uint8_t> buffer)
@@ -299,7 +595,13 @@ int k_spi_driver::read(k_spi_device_driver &device, gsl::span<uint8_t> buffer)
     size_t rx_buffer_len = buffer.size();
     size_t rx_frames = rx_buffer_len / device.buffer_width_;
     auto buffer_read = buffer.data();
-    set_bit_mask(&spi_.ctrlr0, TMOD_MASK, TMOD_VALUE(2));
+    if (use_fifo_irq(device, rx_frames))
+    {
+        transfer_fifo_irq(device, nullptr, buffer_read, rx_frames);
+        return buffer.size();
+    }
+
+    set_tmod(2);
     spi_.ctrlr1 = rx_frames - 1;
     spi_.ssienr = 0x01;
     if (device.frame_format_ == SPI_FF_STANDARD)
@@ -311,13 +613,13 @@ int k_spi_driver::read(k_spi_device_driver &device, gsl::span<uint8_t> buffer)
     {
         vTaskEnterCritical();
         size_t index, fifo_len;
+        /* Once only: the received frames overwrite the instruction and address at the head of the buffer */
+        const uint8_t *buffer_it = buffer.data();
+        write_inst_addr(spi_.dr, &buffer_it, device.inst_width_);
+        write_inst_addr(spi_.dr, &buffer_it, device.addr_width_);
+        spi_.ser = device.chip_select_mask_;
         while (rx_frames)
         {
-            const uint8_t *buffer_it = buffer.data();
-            write_inst_addr(spi_.dr, &buffer_it, device.inst_width_);
-            write_inst_addr(spi_.dr, &buffer_it, device.addr_width_);
-            spi_.ser = device.chip_select_mask_;
-
             fifo_len = spi_.rxflr;
             fifo_len = fifo_len < rx_frames ? fifo_len : rx_frames;
             switch (device.buffer_width_)
@@ -341,18 +643,16 @@ int k_spi_driver::read(k_spi_device_driver &device, gsl::span<uint8_t> buffer)
     }
     else
     {
-        uintptr_t dma_read = dma_open_free();
+        auto &dma_read = dma_acquire_channel(device.dma_priority_, device.dma_subsystem_);
         dma_set_request_source(dma_read, dma_req_);
         spi_.dmacr = 0x1;
-        SemaphoreHandle_t event_read = xSemaphoreCreateBinary();
-        dma_transmit_async(dma_read, &spi_.dr[0], buffer_read, 0, 1, device.buffer_width_, rx_frames, 1, event_read);
+        dma_transmit_async(dma_read, &spi_.dr[0], buffer_read, 0, 1, device.buffer_width_, rx_frames, 1);
         const uint8_t *buffer_it = buffer.data();
         write_inst_addr(spi_.dr, &buffer_it, device.inst_width_);
         write_inst_addr(spi_.dr, &buffer_it, device.addr_width_);
         spi_.ser = device.chip_select_mask_;
-        configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE);
-        dma_close(dma_read);
-        vSemaphoreDelete(event_read);
+        dma_wait(dma_read);
+        dma_release_channel(dma_read);
     }
 
     spi_.ser = 0x00;
@@ -368,74 +668,303 @@ int k_spi_driver::write(k_spi_device_driver &device, gsl::span<const uint8_t> bu
 
     setup_device(device);
 
-    uint32_t i = 0;
     size_t tx_buffer_len = buffer.size() - (device.inst_width_ + device.addr_width_);
     size_t tx_frames = tx_buffer_len / device.buffer_width_;
     auto buffer_write = buffer.data();
-    set_bit_mask(&spi_.ctrlr0, TMOD_MASK, TMOD_VALUE(1));
+    if (use_fifo_irq(device, tx_frames))
+    {
+        transfer_fifo_irq(device, buffer_write, nullptr, tx_frames);
+        return buffer.size();
+    }
+
+    set_tmod(1);
 
     if (tx_frames < SPI_TRANSMISSION_THRESHOLD)
     {
         vTaskEnterCritical();
-        size_t index, fifo_len;
         spi_.ssienr = 0x01;
         write_inst_addr(spi_.dr, &buffer_write, device.inst_width_);
         write_inst_addr(spi_.dr, &buffer_write, device.addr_width_);
         spi_.ser = device.chip_select_mask_;
-        while (tx_buffer_len)
+        write_fifo(device, buffer_write, tx_buffer_len);
+        vTaskExitCritical();
+    }
+    else
+    {
+        auto &dma_write = dma_acquire_channel(device.dma_priority_, device.dma_subsystem_);
+        dma_set_request_source(dma_write, dma_req_ + 1);
+        spi_.dmacr = 0x2;
+        spi_.ssienr = 0x01;
+        write_inst_addr(spi_.dr, &buffer_write, device.inst_width_);
+        write_inst_addr(spi_.dr, &buffer_write, device.addr_width_);
+        dma_transmit_async(dma_write, buffer_write, &spi_.dr[0], 1, 0, device.buffer_width_, tx_frames, 4);
+        spi_.ser = device.chip_select_mask_;
+        dma_wait(dma_write);
+        dma_release_channel(dma_write);
+    }
+    while ((spi_.sr & 0x05) != 0x04)
+        ;
+    spi_.ser = 0x00;
+    spi_.ssienr = 0x00;
+    spi_.dmacr = 0x00;
+
+    return buffer.size();
+}
+
+int k_spi_driver::readv(k_spi_device_driver &device, gsl::span<const io_vec_t> buffers)
+{
+    if (buffers.empty())
+        return 0;
+    if (buffers.size() == 1)
+        return read(device, { reinterpret_cast<uint8_t *>(buffers[0].base), std::ptrdiff_t(buffers[0].len) });
+
+    size_t rx_buffer_len = get_vectored_length(buffers);
+    size_t rx_frames = rx_buffer_len / device.buffer_width_;
+
+    COMMON_ENTRY;
+
+    setup_device(device);
+
+    set_tmod(2);
+    spi_.ctrlr1 = rx_frames - 1;
+    spi_.ssienr = 0x01;
+    if (device.frame_format_ == SPI_FF_STANDARD)
+    {
+        spi_.dr[0] = 0xFFFFFFFF;
+    }
+
+    const uint8_t *buffer_it = reinterpret_cast<const uint8_t *>(buffers[0].base);
+    if (rx_frames < SPI_TRANSMISSION_THRESHOLD)
+    {
+        vTaskEnterCritical();
+        write_inst_addr(spi_.dr, &buffer_it, device.inst_width_);
+        write_inst_addr(spi_.dr, &buffer_it, device.addr_width_);
+        spi_.ser = device.chip_select_mask_;
+        for (auto &vec : buffers)
         {
-            fifo_len = 32 - spi_.txflr;
-            fifo_len = fifo_len < tx_buffer_len ? fifo_len : tx_buffer_len;
-            switch (device.buffer_width_)
-            {
-            case 4:
-                fifo_len = fifo_len / 4 * 4;
-                for (index = 0; index < fifo_len / 4; index++)
-                    spi_.dr[0] = ((uint32_t *)buffer_write)[i++];
-                break;
-            case 2:
-                fifo_len = fifo_len / 2 * 2;
-                for (index = 0; index < fifo_len / 2; index++)
-                    spi_.dr[0] = ((uint16_t *)buffer_write)[i++];
-                break;
-            default:
-                for (index = 0; index < fifo_len; index++)
-                    spi_.dr[0] = buffer_write[i++];
-                break;
-            }
-            tx_buffer_len -= fifo_len;
+            configASSERT(vec.len % device.buffer_width_ == 0);
+            read_fifo(device, reinterpret_cast<uint8_t *>(vec.base), vec.len / device.buffer_width_);
         }
         vTaskExitCritical();
     }
     else
     {
-        uintptr_t dma_write = dma_open_free();
+        sg_items items(buffers.size());
+        for (size_t i = 0; i < buffers.size(); i++)
+        {
+            configASSERT(buffers[i].len % device.buffer_width_ == 0);
+            items[i] = { &spi_.dr[0], buffers[i].base, buffers[i].len / device.buffer_width_ };
+        }
+
+        auto &dma_read = dma_acquire_channel(device.dma_priority_, device.dma_subsystem_);
+        dma_set_request_source(dma_read, dma_req_);
+        spi_.dmacr = 0x1;
+        dma_transmit_sg_async(dma_read, items.span(), 0, 1, device.buffer_width_, 1);
+        write_inst_addr(spi_.dr, &buffer_it, device.inst_width_);
+        write_inst_addr(spi_.dr, &buffer_it, device.addr_width_);
+        spi_.ser = device.chip_select_mask_;
+        dma_wait(dma_read);
+        dma_release_channel(dma_read);
+    }
+
+    spi_.ser = 0x00;
+    spi_.ssienr = 0x00;
+    spi_.dmacr = 0x00;
+
+    return rx_buffer_len;
+}
+
+int k_spi_driver::writev(k_spi_device_driver &device, gsl::span<const io_vec_t> buffers)
+{
+    if (buffers.empty())
+        return 0;
+    if (buffers.size() == 1)
+        return write(device, { reinterpret_cast<const uint8_t *>(buffers[0].base), std::ptrdiff_t(buffers[0].len) });
+
+    size_t buffer_len = get_vectored_length(buffers);
+    size_t inst_addr_len = device.inst_width_ + device.addr_width_;
+    configASSERT(buffers[0].len >= inst_addr_len);
+    size_t tx_frames = (buffer_len - inst_addr_len) / device.buffer_width_;
+
+    COMMON_ENTRY;
+
+    setup_device(device);
+
+    auto buffer_write = reinterpret_cast<const uint8_t *>(buffers[0].base);
+    set_tmod(1);
+
+    if (tx_frames < SPI_TRANSMISSION_THRESHOLD)
+    {
+        vTaskEnterCritical();
+        spi_.ssienr = 0x01;
+        write_inst_addr(spi_.dr, &buffer_write, device.inst_width_);
+        write_inst_addr(spi_.dr, &buffer_write, device.addr_width_);
+        spi_.ser = device.chip_select_mask_;
+        write_fifo(device, buffer_write, buffers[0].len - inst_addr_len);
+        for (auto &vec : buffers.subspan(1))
+            write_fifo(device, reinterpret_cast<const uint8_t *>(vec.base), vec.len);
+        vTaskExitCritical();
+    }
+    else
+    {
+        /* One descriptor chain keeps the chip select asserted across all buffers. */
+        sg_items items(buffers.size());
+        items[0] = { buffer_write + inst_addr_len, &spi_.dr[0], (buffers[0].len - inst_addr_len) / device.buffer_width_ };
+        for (size_t i = 1; i < buffers.size(); i++)
+        {
+            configASSERT(buffers[i].len % device.buffer_width_ == 0);
+            items[i] = { buffers[i].base, &spi_.dr[0], buffers[i].len / device.buffer_width_ };
+        }
+
+        auto &dma_write = dma_acquire_channel(device.dma_priority_, device.dma_subsystem_);
         dma_set_request_source(dma_write, dma_req_ + 1);
         spi_.dmacr = 0x2;
         spi_.ssienr = 0x01;
         write_inst_addr(spi_.dr, &buffer_write, device.inst_width_);
         write_inst_addr(spi_.dr, &buffer_write, device.addr_width_);
-        SemaphoreHandle_t event_write = xSemaphoreCreateBinary();
-        dma_transmit_async(dma_write, buffer_write, &spi_.dr[0], 1, 0, device.buffer_width_, tx_frames, 4, event_write);
+        dma_transmit_sg_async(dma_write, items.span(), 1, 0, device.buffer_width_, 4);
         spi_.ser = device.chip_select_mask_;
-        configASSERT(xSemaphoreTake(event_write, portMAX_DELAY) == pdTRUE);
-        dma_close(dma_write);
-        vSemaphoreDelete(event_write);
+        dma_wait(dma_write);
+        dma_release_channel(dma_write);
     }
+
     while ((spi_.sr & 0x05) != 0x04)
         ;
     spi_.ser = 0x00;
     spi_.ssienr = 0x00;
     spi_.dmacr = 0x00;
 
-    return buffer.size();
+    return buffer_len;
+}
+
+bool k_spi_driver::begin_read(k_spi_device_driver &device, gsl::span<uint8_t> buffer, async_io_state &state)
+{
+    size_t rx_frames = buffer.size() / device.buffer_width_;
+    /* FIFO transfers are left to the io worker, and so is a bus held by another transfer */
+    if (rx_frames < SPI_TRANSMISSION_THRESHOLD || !try_begin_async())
+        return false;
+
+    setup_device(device);
+
+    set_tmod(2);
+    spi_.ctrlr1 = rx_frames - 1;
+    spi_.ssienr = 0x01;
+    if (device.frame_format_ == SPI_FF_STANDARD)
+    {
+        spi_.dr[0] = 0xFFFFFFFF;
+    }
+
+    auto &dma_read = dma_acquire_channel(device.dma_priority_, device.dma_subsystem_);
+    dma_set_request_source(dma_read, dma_req_);
+    async_tx_ = false;
+    dma_set_completion_handler(dma_read, on_async_complete, this, true);
+    spi_.dmacr = 0x1;
+    dma_transmit_async(dma_read, &spi_.dr[0], buffer.data(), 0, 1, device.buffer_width_, rx_frames, 1, state.completion_event);
+    const uint8_t *buffer_it = buffer.data();
+    write_inst_addr(spi_.dr, &buffer_it, device.inst_width_);
+    write_inst_addr(spi_.dr, &buffer_it, device.addr_width_);
+    spi_.ser = device.chip_select_mask_;
+
+    /* Sync calls now wait on async_idle_ rather than on the submitter reaping */
+    xSemaphoreGive(free_mutex_);
+    state.context[0] = buffer.size();
+    return true;
+}
+
+bool k_spi_driver::begin_write(k_spi_device_driver &device, gsl::span<const uint8_t> buffer, async_io_state &state)
+{
+    size_t tx_frames = (buffer.size() - (device.inst_width_ + device.addr_width_)) / device.buffer_width_;
+    if (tx_frames < SPI_TRANSMISSION_THRESHOLD || !try_begin_async())
+        return false;
+
+    setup_device(device);
+
+    auto buffer_write = buffer.data();
+    set_tmod(1);
+
+    auto &dma_write = dma_acquire_channel(device.dma_priority_, device.dma_subsystem_);
+    dma_set_request_source(dma_write, dma_req_ + 1);
+    async_tx_ = true;
+    dma_set_completion_handler(dma_write, on_async_complete, this, true);
+    spi_.dmacr = 0x2;
+    spi_.ssienr = 0x01;
+    write_inst_addr(spi_.dr, &buffer_write, device.inst_width_);
+    write_inst_addr(spi_.dr, &buffer_write, device.addr_width_);
+    dma_transmit_async(dma_write, buffer_write, &spi_.dr[0], 1, 0, device.buffer_width_, tx_frames, 4, state.completion_event);
+    spi_.ser = device.chip_select_mask_;
+
+    xSemaphoreGive(free_mutex_);
+    state.context[0] = buffer.size();
+    return true;
+}
+
+/* The completion isr has already released the bus and the channel */
+int k_spi_driver::end_io(k_spi_device_driver &device, async_io_state &state)
+{
+    return state.context[0];
+}
+
+void k_spi_driver::read_fifo(k_spi_device_driver &device, uint8_t *buffer, size_t rx_frames)
+{
+    uint32_t i = 0;
+    size_t index, fifo_len;
+    while (rx_frames)
+    {
+        fifo_len = spi_.rxflr;
+        fifo_len = fifo_len < rx_frames ? fifo_len : rx_frames;
+        switch (device.buffer_width_)
+        {
+        case 4:
+            for (index = 0; index < fifo_len; index++)
+                ((uint32_t *)buffer)[i++] = spi_.dr[0];
+            break;
+        case 2:
+            for (index = 0; index < fifo_len; index++)
+                ((uint16_t *)buffer)[i++] = (uint16_t)spi_.dr[0];
+            break;
+        default:
+            for (index = 0; index < fifo_len; index++)
+                buffer[i++] = (uint8_t)spi_.dr[0];
+            break;
+        }
+        rx_frames -= fifo_len;
+    }
+}
+
+void k_spi_driver::write_fifo(k_spi_device_driver &device, const uint8_t *buffer, size_t tx_buffer_len)
+{
+    uint32_t i = 0;
+    size_t index, fifo_len;
+    while (tx_buffer_len)
+    {
+        fifo_len = 32 - spi_.txflr;
+        fifo_len = fifo_len < tx_buffer_len ? fifo_len : tx_buffer_len;
+        switch (device.buffer_width_)
+        {
+        case 4:
+            fifo_len = fifo_len / 4 * 4;
+            for (index = 0; index < fifo_len / 4; index++)
+                spi_.dr[0] = ((uint32_t *)buffer)[i++];
+            break;
+        case 2:
+            fifo_len = fifo_len / 2 * 2;
+            for (index = 0; index < fifo_len / 2; index++)
+                spi_.dr[0] = ((uint16_t *)buffer)[i++];
+            break;
+        default:
+            for (index = 0; index < fifo_len; index++)
+                spi_.dr[0] = buffer[i++];
+            break;
+        }
+        tx_buffer_len -= fifo_len;
+    }
 }
 
 int k_spi_driver::transfer_full_duplex(k_spi_device_driver &device, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer)
 {
     COMMON_ENTRY;
     setup_device(device);
-    set_bit_mask(&spi_.ctrlr0, TMOD_MASK, TMOD_VALUE(0));
+    set_tmod(0);
     return read_write(device, write_buffer, read_buffer);
 }
 
@@ -443,7 +972,7 @@ int k_spi_driver::transfer_sequential(k_spi_device_driver &device, gsl::span<con
 {
     COMMON_ENTRY;
     setup_device(device);
-    set_bit_mask(&spi_.ctrlr0, TMOD_MASK, TMOD_VALUE(3));
+    set_tmod(3);
     return read_write(device, write_buffer, read_buffer);
 }
 
@@ -458,6 +987,24 @@ int k_spi_driver::read_write(k_spi_device_driver &device, gsl::span<const uint8_
     auto buffer_write = write_buffer.data();
     uint32_t i = 0;
 
+    if (use_fifo_irq(device, std::max(tx_frames, rx_frames)))
+    {
+        /* Chip select is not the controller's in this mode, so a sequential transfer may be split */
+        if ((regs_.ctrlr0 & TMOD_MASK) == TMOD_VALUE(0) && tx_frames == rx_frames)
+        {
+            transfer_fifo_irq(device, buffer_write, buffer_read, rx_frames);
+        }
+        else
+        {
+            if (tx_frames)
+                transfer_fifo_irq(device, buffer_write, nullptr, tx_frames);
+            if (rx_frames)
+                transfer_fifo_irq(device, nullptr, buffer_read, rx_frames);
+        }
+
+        return read_buffer.size();
+    }
+
     if (rx_frames < SPI_TRANSMISSION_THRESHOLD)
     {
         vTaskEnterCritical();
@@ -517,8 +1064,8 @@ int k_spi_driver::read_write(k_spi_device_driver &device, gsl::span<const uint8_
     }
     else
     {
-        uintptr_t dma_write = dma_open_free();
-        uintptr_t dma_read = dma_open_free();
+        auto &dma_write = dma_acquire_channel(device.dma_priority_, device.dma_subsystem_);
+        auto &dma_read = dma_acquire_channel(device.dma_priority_, device.dma_subsystem_);
 
         dma_set_request_source(dma_write, dma_req_ + 1);
         dma_set_request_source(dma_read, dma_req_);
@@ -526,16 +1073,14 @@ int k_spi_driver::read_write(k_spi_device_driver &device, gsl::span<const uint8_
         spi_.dmacr = 0x3;
         spi_.ssienr = 0x01;
         spi_.ser = device.chip_select_mask_;
-        SemaphoreHandle_t event_read = xSemaphoreCreateBinary(), event_write = xSemaphoreCreateBinary();
-        dma_transmit_async(dma_read, &spi_.dr[0], buffer_read, 0, 1, device.buffer_width_, rx_frames, 1, event_read);
-        dma_transmit_async(dma_write, buffer_write, &spi_.dr[0], 1, 0, device.buffer_width_, tx_frames, 4, event_write);
+        dma_transmit_async(dma_read, &spi_.dr[0], buffer_read, 0, 1, device.buffer_width_, rx_frames, 1);
+        dma_transmit_async(dma_write, buffer_write, &spi_.dr[0], 1, 0, device.buffer_width_, tx_frames, 4);
 
-        configASSERT(xSemaphoreTake(event_read, portMAX_DELAY) == pdTRUE && xSemaphoreTake(event_write, portMAX_DELAY) == pdTRUE);
+        dma_wait(dma_read);
+        dma_wait(dma_write);
 
-        dma_close(dma_write);
-        dma_close(dma_read);
-        vSemaphoreDelete(event_read);
-        vSemaphoreDelete(event_write);
+        dma_release_channel(dma_write);
+        dma_release_channel(dma_read);
     }
     spi_.ser = 0x00;
     spi_.ssienr = 0x00;
@@ -544,15 +1089,179 @@ int k_spi_driver::read_write(k_spi_device_driver &device, gsl::span<const uint8_
     return read_buffer.size();
 }
 
+int k_spi_driver::transfer_list(k_spi_device_driver &device, gsl::span<const spi_segment_t> segments)
+{
+    configASSERT(device.frame_format_ == SPI_FF_STANDARD);
+
+    COMMON_ENTRY;
+
+    setup_device(device);
+
+    /* Taken by the first segment long enough for DMA and kept for the rest of the list */
+    dma_driver *dma = nullptr;
+    size_t transferred = 0;
+    while (!segments.empty())
+    {
+        if (segments[0].type == SPI_SEGMENT_DELAY)
+        {
+            usleep(segments[0].length);
+            segments = segments.subspan(1);
+            continue;
+        }
+
+        /* One chip select frame: writes, then reads, up to a release */
+        size_t writes = 0, count = 0;
+        while (count < (size_t)segments.size())
+        {
+            auto &segment = segments[count];
+            if (segment.type == SPI_SEGMENT_DELAY || (segment.type == SPI_SEGMENT_WRITE && writes != count))
+                break;
+            configASSERT(segment.length && segment.length % device.buffer_width_ == 0);
+            if (segment.type == SPI_SEGMENT_WRITE)
+                writes++;
+            count++;
+            if (segment.cs_release)
+                break;
+        }
+
+        auto tx_segments = segments.first(writes);
+        auto rx_segments = segments.subspan(writes, count - writes);
+        /* EEPROM mode only takes the writes ahead of a read through the FIFO */
+        if (!rx_segments.empty() && get_segments_length(tx_segments) / device.buffer_width_ <= SPI_FIFO_DEPTH)
+        {
+            transferred += receive_segments(device, tx_segments, rx_segments, dma);
+        }
+        else
+        {
+            if (!tx_segments.empty())
+                transferred += send_segments(device, tx_segments, dma);
+            if (!rx_segments.empty())
+                transferred += receive_segments(device, {}, rx_segments, dma);
+        }
+
+        segments = segments.subspan(count);
+    }
+
+    if (dma)
+        dma_release_channel(*dma);
+    return transferred;
+}
+
+size_t k_spi_driver::send_segments(k_spi_device_driver &device, gsl::span<const spi_segment_t> segments, dma_driver *&dma)
+{
+    size_t tx_buffer_len = get_segments_length(segments);
+    size_t tx_frames = tx_buffer_len / device.buffer_width_;
+    if (use_fifo_irq(device, tx_frames))
+    {
+        for (auto &segment : segments)
+            transfer_fifo_irq(device, segment.write_buffer, nullptr, segment.length / device.buffer_width_);
+        return tx_buffer_len;
+    }
+
+    set_tmod(1);
+
+    if (tx_frames < SPI_TRANSMISSION_THRESHOLD)
+    {
+        vTaskEnterCritical();
+        spi_.ssienr = 0x01;
+        spi_.ser = device.chip_select_mask_;
+        for (auto &segment : segments)
+            write_fifo(device, segment.write_buffer, segment.length);
+        vTaskExitCritical();
+    }
+    else
+    {
+        sg_items items(segments.size());
+        for (size_t i = 0; i < (size_t)segments.size(); i++)
+            items[i] = { segments[i].write_buffer, &spi_.dr[0], segments[i].length / device.buffer_width_ };
+
+        auto &dma_write = list_channel(device, dma);
+        dma_set_request_source(dma_write, dma_req_ + 1);
+        spi_.dmacr = 0x2;
+        spi_.ssienr = 0x01;
+        dma_transmit_sg_async(dma_write, items.span(), 1, 0, device.buffer_width_, 4);
+        spi_.ser = device.chip_select_mask_;
+        dma_wait(dma_write);
+    }
+
+    while ((spi_.sr & 0x05) != 0x04)
+        ;
+    spi_.ser = 0x00;
+    spi_.ssienr = 0x00;
+    spi_.dmacr = 0x00;
+
+    return tx_buffer_len;
+}
+
+size_t k_spi_driver::receive_segments(k_spi_device_driver &device, gsl::span<const spi_segment_t> tx_segments, gsl::span<const spi_segment_t> rx_segments, dma_driver *&dma)
+{
+    size_t rx_buffer_len = get_segments_length(rx_segments);
+    size_t rx_frames = rx_buffer_len / device.buffer_width_;
+    if (tx_segments.empty() && use_fifo_irq(device, rx_frames))
+    {
+        for (auto &segment : rx_segments)
+            transfer_fifo_irq(device, nullptr, segment.read_buffer, segment.length / device.buffer_width_);
+        return rx_buffer_len;
+    }
+
+    set_tmod(tx_segments.empty() ? 2 : 3);
+    spi_.ctrlr1 = rx_frames - 1;
+
+    if (rx_frames < SPI_TRANSMISSION_THRESHOLD)
+    {
+        vTaskEnterCritical();
+        spi_.ssienr = 0x01;
+        if (tx_segments.empty())
+            spi_.dr[0] = 0xFFFFFFFF;
+        for (auto &segment : tx_segments)
+            write_fifo(device, segment.write_buffer, segment.length);
+        spi_.ser = device.chip_select_mask_;
+        for (auto &segment : rx_segments)
+            read_fifo(device, segment.read_buffer, segment.length / device.buffer_width_);
+        vTaskExitCritical();
+    }
+    else
+    {
+        sg_items items(rx_segments.size());
+        for (size_t i = 0; i < (size_t)rx_segments.size(); i++)
+            items[i] = { &spi_.dr[0], rx_segments[i].read_buffer, rx_segments[i].length / device.buffer_width_ };
+
+        auto &dma_read = list_channel(device, dma);
+        dma_set_request_source(dma_read, dma_req_);
+        spi_.dmacr = 0x1;
+        spi_.ssienr = 0x01;
+        dma_transmit_sg_async(dma_read, items.span(), 0, 1, device.buffer_width_, 1);
+        if (tx_segments.empty())
+            spi_.dr[0] = 0xFFFFFFFF;
+        for (auto &segment : tx_segments)
+            write_fifo(device, segment.write_buffer, segment.length);
+        spi_.ser = device.chip_select_mask_;
+        dma_wait(dma_read);
+    }
+
+    spi_.ser = 0x00;
+    spi_.ssienr = 0x00;
+    spi_.dmacr = 0x00;
+
+    return get_segments_length(tx_segments) + rx_buffer_len;
+}
+
+dma_driver &k_spi_driver::list_channel(k_spi_device_driver &device, dma_driver *&dma)
+{
+    if (!dma)
+        dma = &dma_acquire_channel(device.dma_priority_, device.dma_subsystem_);
+    return *dma;
+}
+
 void k_spi_driver::fill(k_spi_device_driver &device, uint32_t instruction, uint32_t address, uint32_t value, size_t count)
 {
     COMMON_ENTRY;
     setup_device(device);
 
-    uintptr_t dma_write = dma_open_free();
+    auto &dma_write = dma_acquire_channel(device.dma_priority_, device.dma_subsystem_);
     dma_set_request_source(dma_write, dma_req_ + 1);
 
-    set_bit_mask(&spi_.ctrlr0, TMOD_MASK, TMOD_VALUE(1));
+    set_tmod(1);
     spi_.dmacr = 0x2;
     spi_.ssienr = 0x01;
 
@@ -561,13 +1270,11 @@ void k_spi_driver::fill(k_spi_device_driver &device, uint32_t instruction, uint3
     buffer = (const uint8_t *)&address;
     write_inst_addr(spi_.dr, &buffer, device.addr_width_);
 
-    SemaphoreHandle_t event_write = xSemaphoreCreateBinary();
-    dma_transmit_async(dma_write, &value, &spi_.dr[0], 0, 0, sizeof(uint32_t), count, 4, event_write);
+    dma_transmit_async(dma_write, &value, &spi_.dr[0], 0, 0, sizeof(uint32_t), count, 4);
 
     spi_.ser = device.chip_select_mask_;
-    configASSERT(xSemaphoreTake(event_write, portMAX_DELAY) == pdTRUE);
-    dma_close(dma_write);
-    vSemaphoreDelete(event_write);
+    dma_wait(dma_write);
+    dma_release_channel(dma_write);
 
     while ((spi_.sr & 0x05) != 0x04)
         ;
@@ -576,18 +1283,144 @@ void k_spi_driver::fill(k_spi_device_driver &device, uint32_t instruction, uint3
     spi_.dmacr = 0x00;
 }
 
-void k_spi_driver::setup_device(k_spi_device_driver &device)
+/* Transfers that fit the FIFO are over before an interrupt could be taken, so they are polled */
+bool k_spi_driver::use_fifo_irq(k_spi_device_driver &device, size_t frames)
 {
-    spi_.baudr = device.baud_rate_;
-    spi_.imr = 0x00;
-    spi_.dmacr = 0x00;
-    spi_.dmatdlr = 0x10;
-    spi_.dmardlr = 0x0;
+    return device.fifo_mode_ == SPI_FIFO_INTERRUPT && device.frame_format_ == SPI_FF_STANDARD
+        && device.inst_width_ + device.addr_width_ == 0 && frames > SPI_FIFO_DEPTH && frames < SPI_TRANSMISSION_THRESHOLD;
+}
+
+/* Receiving runs in full duplex, sending 0xFF frames when there is no data to write. Frames
+ * are only sent while the receive FIFO has room for their replies, so it never overflows
+ * however late the interrupt is taken. */
+void k_spi_driver::transfer_fifo_irq(k_spi_device_driver &device, const uint8_t *tx_buffer, uint8_t *rx_buffer, size_t frames)
+{
+    set_tmod(rx_buffer ? 0 : 1);
+    fifo_.tx_buffer = tx_buffer;
+    fifo_.rx_buffer = rx_buffer;
+    fifo_.tx_frames = frames;
+    fifo_.rx_frames = rx_buffer ? frames : 0;
+    fifo_.width = device.buffer_width_;
+    spi_.txftlr = SPI_FIFO_DEPTH / 2;
+    spi_.ssienr = 0x01;
+
+    service_fifo();
+    spi_.ser = device.chip_select_mask_;
+    spi_.imr = rx_buffer ? SPI_INT_RXF : SPI_INT_TXE;
+    xSemaphoreTake(fifo_event_, portMAX_DELAY);
+
+    while ((spi_.sr & 0x05) != 0x04)
+        ;
     spi_.ser = 0x00;
     spi_.ssienr = 0x00;
-    spi_.ctrlr0 = (device.mode_ << mod_off_) | (device.frame_format_ << frf_off_) | ((device.data_bit_length_ - 1) << dfs_off_);
-    spi_.spi_ctrlr0 = 0;
+    spi_.txftlr = 0x00;
+    spi_.rxftlr = 0x00;
+}
 
+/* Drains and refills the FIFOs, returns true once the transfer is complete */
+bool k_spi_driver::service_fifo()
+{
+    size_t index;
+    if (fifo_.rx_buffer)
+    {
+        size_t fifo_len = std::min(size_t(spi_.rxflr), fifo_.rx_frames);
+        switch (fifo_.width)
+        {
+        case 4:
+            for (index = 0; index < fifo_len; index++)
+                ((uint32_t *)fifo_.rx_buffer)[index] = spi_.dr[0];
+            break;
+        case 2:
+            for (index = 0; index < fifo_len; index++)
+                ((uint16_t *)fifo_.rx_buffer)[index] = (uint16_t)spi_.dr[0];
+            break;
+        default:
+            for (index = 0; index < fifo_len; index++)
+                fifo_.rx_buffer[index] = (uint8_t)spi_.dr[0];
+            break;
+        }
+        fifo_.rx_buffer += fifo_len * fifo_.width;
+        fifo_.rx_frames -= fifo_len;
+        if (!fifo_.rx_frames)
+            return true;
+    }
+
+    size_t in_flight = fifo_.rx_buffer ? fifo_.rx_frames - fifo_.tx_frames : size_t(spi_.txflr);
+    size_t fifo_len = std::min(SPI_FIFO_DEPTH - in_flight, fifo_.tx_frames);
+    if (!fifo_.tx_buffer)
+    {
+        for (index = 0; index < fifo_len; index++)
+            spi_.dr[0] = 0xFFFFFFFF;
+    }
+    else
+    {
+        switch (fifo_.width)
+        {
+        case 4:
+            for (index = 0; index < fifo_len; index++)
+                spi_.dr[0] = ((const uint32_t *)fifo_.tx_buffer)[index];
+            break;
+        case 2:
+            for (index = 0; index < fifo_len; index++)
+                spi_.dr[0] = ((const uint16_t *)fifo_.tx_buffer)[index];
+            break;
+        default:
+            for (index = 0; index < fifo_len; index++)
+                spi_.dr[0] = fifo_.tx_buffer[index];
+            break;
+        }
+        fifo_.tx_buffer += fifo_len * fifo_.width;
+    }
+    fifo_.tx_frames -= fifo_len;
+
+    if (fifo_.rx_buffer)
+    {
+        /* Wake once half the frames in flight have come back, or all of them near the end */
+        in_flight = fifo_.rx_frames - fifo_.tx_frames;
+        spi_.rxftlr = std::min(in_flight, size_t(SPI_FIFO_DEPTH / 2)) - 1;
+        return false;
+    }
+
+    /* With everything queued, wait for the transmit FIFO to empty */
+    if (!fifo_.tx_frames)
+    {
+        if (!spi_.txflr)
+            return true;
+        spi_.txftlr = 0x00;
+    }
+
+    return false;
+}
+
+void k_spi_driver::setup_device(k_spi_device_driver &device)
+{
+    /* Every transfer leaves the controller disabled with its interrupts, DMA requests and
+     * chip selects off, so these only need writing once */
+    if (!regs_.valid)
+    {
+        spi_.imr = 0x00;
+        spi_.dmacr = 0x00;
+        spi_.dmatdlr = 0x10;
+        spi_.dmardlr = 0x0;
+        spi_.ser = 0x00;
+        spi_.ssienr = 0x00;
+    }
+
+    if (!regs_.valid || regs_.baudr != device.baud_rate_)
+    {
+        spi_.baudr = device.baud_rate_;
+        regs_.baudr = device.baud_rate_;
+    }
+
+    /* Transfers set their own TMOD after this */
+    uint32_t ctrlr0 = (device.mode_ << mod_off_) | (device.frame_format_ << frf_off_) | ((device.data_bit_length_ - 1) << dfs_off_);
+    if (!regs_.valid || (regs_.ctrlr0 & ~TMOD_MASK) != ctrlr0)
+    {
+        spi_.ctrlr0 = ctrlr0;
+        regs_.ctrlr0 = ctrlr0;
+    }
+
+    uint32_t spi_ctrlr0 = 0;
     if (device.frame_format_ != SPI_FF_STANDARD)
     {
         configASSERT(device.wait_cycles_ < (1 << 5));
@@ -632,14 +1465,205 @@ void k_spi_driver::setup_device(k_spi_device_driver &device)
         configASSERT(device.address_length_ % 4 == 0 && device.address_length_ <= 60);
         uint32_t addr_l = device.address_length_ / 4;
 
-        spi_.spi_ctrlr0 = (device.wait_cycles_ << 11) | (inst_l << 8) | (addr_l << 2) | trans;
+        spi_ctrlr0 = (device.wait_cycles_ << 11) | (inst_l << 8) | (addr_l << 2) | trans;
+    }
+
+    if (!regs_.valid || regs_.spi_ctrlr0 != spi_ctrlr0)
+    {
+        spi_.spi_ctrlr0 = spi_ctrlr0;
+        regs_.spi_ctrlr0 = spi_ctrlr0;
+    }
+
+    regs_.valid = true;
+}
+
+void k_spi_driver::set_tmod(uint32_t tmod)
+{
+    uint32_t ctrlr0 = (regs_.ctrlr0 & ~TMOD_MASK) | TMOD_VALUE(tmod);
+    if (ctrlr0 != regs_.ctrlr0)
+    {
+        spi_.ctrlr0 = ctrlr0;
+        regs_.ctrlr0 = ctrlr0;
+    }
+}
+
+/* Receive only keeps the slave output disabled. Otherwise the controller transmits and
+ * receives at once and the frames the master clocks out come from the tx ring. */
+void k_spi_driver::slave_config_dma(const spi_slave_dma_config_t &config)
+{
+    COMMON_ENTRY;
+    configASSERT(!slave_dma_.rx.buffer);
+    configASSERT(config.data_bit_length >= 4 && config.data_bit_length <= 32);
+    configASSERT(config.rx_frames && config.rx_frames % SPI_SLAVE_RING_STAGES == 0);
+    configASSERT(config.tx_frames % SPI_SLAVE_RING_STAGES == 0);
+
+    bool transmit = config.tx_frames != 0;
+    slave_dma_.width = k_spi_device_driver::get_buffer_width(config.data_bit_length);
+    slave_dma_.threshold = config.threshold;
+    slave_dma_.on_threshold = config.on_threshold;
+    slave_dma_.userdata = config.userdata;
+    slave_dma_.stop_signal = 0;
+    slave_dma_.stats = {};
+
+    uint8_t slv_oe = 10;
+    regs_.valid = false;
+    spi_.ssienr = 0x00;
+    spi_.ctrlr0 = (0x0 << mod_off_) | ((transmit ? 0 : 1) << slv_oe) | ((config.data_bit_length - 1) << dfs_off_) | TMOD_VALUE(transmit ? 0 : 2);
+    spi_.dmardlr = 0x00;
+    spi_.dmatdlr = 0x10;
+    spi_.imr = SPI_INT_RXO;
+    pic_set_irq_handler(irq_, on_slave_dma_irq, this);
+    pic_set_irq_enable(irq_, 1);
+
+    start_slave_ring(slave_dma_.rx, config.rx_frames, true);
+    if (transmit)
+        start_slave_ring(slave_dma_.tx, config.tx_frames, false);
+
+    spi_.dmacr = transmit ? 0x3 : 0x1;
+    spi_.ssienr = 0x01;
+}
+
+void k_spi_driver::start_slave_ring(slave_ring &ring, size_t frames, bool receive)
+{
+    ring.buffer = (uint32_t *)dma_buffer_alloc(frames * sizeof(uint32_t), DMA_BUFFER_UNCACHED);
+    configASSERT(ring.buffer);
+    /* Until slave_write gets ahead, the master reads idle frames */
+    std::fill(ring.buffer, ring.buffer + frames, 0xFFFFFFFF);
+    ring.frames = frames;
+    ring.stage_frames = frames / SPI_SLAVE_RING_STAGES;
+    ring.head.store(0, std::memory_order_relaxed);
+    ring.tail.store(0, std::memory_order_relaxed);
+
+    volatile void *stages[SPI_SLAVE_RING_STAGES];
+    for (size_t i = 0; i < SPI_SLAVE_RING_STAGES; i++)
+        stages[i] = ring.buffer + i * ring.stage_frames;
+
+    auto &dma = dma_acquire_channel(DMA_PRIORITY_REALTIME, DMA_SUBSYSTEM_NONE);
+    if (receive)
+    {
+        const volatile void *srcs[1] = { &spi_.dr[0] };
+        dma_set_request_source(dma, dma_req_);
+        dma.loop_async(srcs, 1, stages, SPI_SLAVE_RING_STAGES, false, true, sizeof(uint32_t), ring.stage_frames, 1, on_slave_rx_stage, this, xSemaphoreCreateBinary(), &slave_dma_.stop_signal);
     }
+    else
+    {
+        const volatile void *srcs[SPI_SLAVE_RING_STAGES];
+        volatile void *dests[1] = { &spi_.dr[0] };
+        std::copy(stages, stages + SPI_SLAVE_RING_STAGES, srcs);
+        dma_set_request_source(dma, dma_req_ + 1);
+        dma.loop_async(srcs, SPI_SLAVE_RING_STAGES, dests, 1, true, false, sizeof(uint32_t), ring.stage_frames, 4, on_slave_tx_stage, this, xSemaphoreCreateBinary(), &slave_dma_.stop_signal);
+    }
+}
+
+size_t k_spi_driver::slave_read(gsl::span<uint8_t> buffer)
+{
+    auto &ring = slave_dma_.rx;
+    configASSERT(ring.buffer);
+    size_t width = slave_dma_.width;
+    size_t wanted = buffer.size() / width;
+    /* Frames the DMA has not started writing over again */
+    size_t window = ring.frames - ring.stage_frames;
+
+    while (true)
+    {
+        size_t head = ring.head.load(std::memory_order_acquire);
+        size_t tail = ring.tail.load(std::memory_order_relaxed);
+        if (head - tail > window)
+        {
+            slave_dma_.stats.dropped_frames += head - window - tail;
+            tail = head - window;
+        }
+
+        size_t count = std::min(wanted, head - tail);
+        uint8_t *dest = buffer.data();
+        size_t pos = tail % ring.frames;
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t frame = ring.buffer[pos];
+            if (++pos == ring.frames)
+                pos = 0;
+            switch (width)
+            {
+            case 4:
+                memcpy(dest, &frame, 4);
+                break;
+            case 2:
+            {
+                uint16_t half = (uint16_t)frame;
+                memcpy(dest, &half, 2);
+                break;
+            }
+            default:
+                *dest = (uint8_t)frame;
+                break;
+            }
+            dest += width;
+        }
+
+        /* Start over if the DMA lapped the copy */
+        if (ring.head.load(std::memory_order_acquire) - tail > window)
+        {
+            ring.tail.store(tail, std::memory_order_release);
+            continue;
+        }
+
+        ring.tail.store(tail + count, std::memory_order_release);
+        return count * width;
+    }
+}
+
+size_t k_spi_driver::slave_write(gsl::span<const uint8_t> buffer)
+{
+    auto &ring = slave_dma_.tx;
+    configASSERT(ring.buffer);
+    size_t width = slave_dma_.width;
+    size_t tail = ring.tail.load(std::memory_order_acquire);
+    /* The stage at tail is on the wire, after an underrun writing resumes past it */
+    size_t head = std::max(ring.head.load(std::memory_order_relaxed), tail + ring.stage_frames);
+    size_t count = std::min(buffer.size() / width, tail + ring.frames - head);
+
+    const uint8_t *src = buffer.data();
+    size_t pos = head % ring.frames;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t frame;
+        switch (width)
+        {
+        case 4:
+            memcpy(&frame, src, 4);
+            break;
+        case 2:
+        {
+            uint16_t half;
+            memcpy(&half, src, 2);
+            frame = half;
+            break;
+        }
+        default:
+            frame = *src;
+            break;
+        }
+        ring.buffer[pos] = frame;
+        if (++pos == ring.frames)
+            pos = 0;
+        src += width;
+    }
+
+    ring.head.store(head + count, std::memory_order_release);
+    return count * width;
+}
+
+void k_spi_driver::slave_get_statistics(spi_slave_statistics_t &stats)
+{
+    stats = slave_dma_.stats;
+    stats.received_frames = slave_dma_.rx.head.load(std::memory_order_acquire);
+    stats.sent_frames = slave_dma_.tx.tail.load(std::memory_order_acquire);
 }
 
-static k_spi_driver dev0_driver(SPI0_BASE_ADDR, SYSCTL_CLOCK_SPI0, SYSCTL_DMA_SELECT_SSI0_RX_REQ, 6, 16, 8, 21);
-static k_spi_driver dev1_driver(SPI1_BASE_ADDR, SYSCTL_CLOCK_SPI1, SYSCTL_DMA_SELECT_SSI1_RX_REQ, 6, 16, 8, 21);
-static k_spi_driver dev_slave_driver(SPI_SLAVE_BASE_ADDR, SYSCTL_CLOCK_SPI2, SYSCTL_DMA_SELECT_SSI2_RX_REQ, 6, 16, 8, 21);
-static k_spi_driver dev3_driver(SPI3_BASE_ADDR, SYSCTL_CLOCK_SPI3, SYSCTL_DMA_SELECT_SSI3_RX_REQ, 8, 0, 10, 22);
+static k_spi_driver dev0_driver(SPI0_BASE_ADDR, SYSCTL_CLOCK_SPI0, SYSCTL_DMA_SELECT_SSI0_RX_REQ, IRQN_SPI0_INTERRUPT, 6, 16, 8, 21);
+static k_spi_driver dev1_driver(SPI1_BASE_ADDR, SYSCTL_CLOCK_SPI1, SYSCTL_DMA_SELECT_SSI1_RX_REQ, IRQN_SPI1_INTERRUPT, 6, 16, 8, 21);
+static k_spi_driver dev_slave_driver(SPI_SLAVE_BASE_ADDR, SYSCTL_CLOCK_SPI2, SYSCTL_DMA_SELECT_SSI2_RX_REQ, IRQN_SPI_SLAVE_INTERRUPT, 6, 16, 8, 21);
+static k_spi_driver dev3_driver(SPI3_BASE_ADDR, SYSCTL_CLOCK_SPI3, SYSCTL_DMA_SELECT_SSI3_RX_REQ, IRQN_SPI3_INTERRUPT, 8, 0, 10, 22);
 
 driver &g_spi_driver_spi0 = dev0_driver;
 driver &g_spi_driver_spi1 = dev1_driver;
@@ -59,7 +59,7 @@ off_t sys_lseek(int fd, off_t offset, int whence)
     if (STDOUT_FILENO == fd || STDERR_FILENO == fd)
         return -1;
 
-    try
+    SYS_TRY
     {
         auto &obj = system_handle_to_object(fd);
         if (auto f = obj.as<filesystem_file>())
@@ -84,7 +84,7 @@ off_t sys_lseek(int fd, off_t offset, int whence)
 
         return -1;
     }
-    catch (...)
+    SYS_CATCH_ALL
     {
         return -1;
     }
@@ -95,7 +95,7 @@ int sys_fstat(int fd, struct kernel_stat *buf)
     if (STDOUT_FILENO == fd || STDERR_FILENO == fd)
         return 0;
 
-    try
+    SYS_TRY
     {
         memset(buf, 0, sizeof(struct kernel_stat));
         auto &obj = system_handle_to_object(fd);
@@ -107,7 +107,7 @@ int sys_fstat(int fd, struct kernel_stat *buf)
 
         return -1;
     }
-    catch (...)
+    SYS_CATCH_ALL
     {
         return -1;
     }
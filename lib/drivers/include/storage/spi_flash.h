@@ -0,0 +1,49 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _DRIVERS_SPI_FLASH_H
+#define _DRIVERS_SPI_FLASH_H
+
+#include <stdint.h>
+#include <osdefs.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief       Install a SPI NOR flash driver
+ *
+ * The flash is exposed as 512 bytes blocks. Reads use the quad I/O fast read, writes go
+ * through a buffer of one 4KB erase sector which is programmed when another sector is
+ * written, on sync and on the last close. The flash must be W25Q compatible
+ * (JEDEC ID 0x9F, QE in status register 2) and at most 16MB.
+ *
+ * @param[in]   spi_handle          The SPI controller handle
+ * @param[in]   spi_cs_mask         The chip select mask of the flash
+ * @param[in]   base_address        Byte offset of the first block in the flash, must be 4KB aligned
+ * @param[in]   size                Bytes exposed from base_address, 0 to use the rest of the flash
+ *
+ * @return      result
+ *     - 0      Fail
+ *     - other  The driver handle
+ */
+handle_t spi_flash_driver_install(handle_t spi_handle, uint32_t spi_cs_mask, uint32_t base_address, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DRIVERS_SPI_FLASH_H */
@@ -172,13 +172,13 @@ private:
 
 handle_t spi_ws2812b_driver_install(handle_t spi_handle, uint32_t total_number)
 {
-    try
+    SYS_TRY
     {
         auto driver = make_object<k_spi_ws2812b_driver>(spi_handle, total_number);
         driver->install();
         return system_alloc_handle(make_accessor(driver));
     }
-    catch (...)
+    SYS_CATCH_ALL
     {
         return NULL_HANDLE;
     }
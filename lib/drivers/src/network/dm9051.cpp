@@ -19,6 +19,7 @@
 #include <kernel/driver_impl.hpp>
 #include <stdlib.h>
 #include <string.h>
+#include <initializer_list>
 #include <printf.h>
 #include <sys/unistd.h>
 #include "network/dm9051.h"
@@ -211,6 +212,8 @@ enum DM9051_TYPE
 #define GPCR_GEP_CNTL   (1 << 0)
 
 #define SPI_WR_BURST    (0xF8)
+#define DM9051_SEND_VECS 8
+#define DM9051_WRITE_BATCH 16
 #define SPI_RD_BURST    (0x72)
 
 #define SPI_READ        (0x03)
@@ -239,6 +242,7 @@ public:
         auto spi = make_accessor(spi_driver_);
         spi_dev_ = make_accessor(spi->get_device(SPI_MODE_0, SPI_FF_STANDARD, spi_cs_mask_, 8));
         spi_dev_->set_clock_rate(20000000);
+        spi_dev_->set_dma_priority(DMA_PRIORITY_HIGH, DMA_SUBSYSTEM_NETWORK);
 
         int_gpio_ = make_accessor(int_gpio_driver_);
         int_gpio_->set_drive_mode(int_gpio_pin_, GPIO_DM_INPUT);
@@ -304,24 +308,22 @@ public:
         set_phy_mode(DM9051_AUTO);
         set_mac_address(mac_address_);
 
-        /* set multicast address */
-        for (size_t i = 0; i < 8; i++)
-        { /* Clear Multicast set */
-            /* Set Broadcast */
-            write(DM9051_MAR + i, (7 == i) ? 0x80 : 0x00);
-        }
+        /* set multicast address: clear the multicast set, then set broadcast */
+        write({ { DM9051_MAR + 0, 0x00 }, { DM9051_MAR + 1, 0x00 }, { DM9051_MAR + 2, 0x00 }, { DM9051_MAR + 3, 0x00 },
+            { DM9051_MAR + 4, 0x00 }, { DM9051_MAR + 5, 0x00 }, { DM9051_MAR + 6, 0x00 }, { DM9051_MAR + 7, 0x80 } });
 
         /************************************************
         *** Activate DM9051 and Setup DM9051 Registers **
         *************************************************/
-        /* Clear DM9051 Set and Disable Wakeup function */
-        write(DM9051_NCR, NCR_DEFAULT);
-        /* Clear TCR Register set */
-        write(DM9051_TCR, TCR_DEFAULT);
-        /* Discard long Packet and CRC error Packet */
-        write(DM9051_RCR, RCR_DEFAULT);
-        /*  Set 1.15 ms Jam Pattern Timer */
-        write(DM9051_BPTR, BPTR_DEFAULT);
+        write({
+            /* Clear DM9051 Set and Disable Wakeup function */
+            { DM9051_NCR, NCR_DEFAULT },
+            /* Clear TCR Register set */
+            { DM9051_TCR, TCR_DEFAULT },
+            /* Discard long Packet and CRC error Packet */
+            { DM9051_RCR, RCR_DEFAULT },
+            /*  Set 1.15 ms Jam Pattern Timer */
+            { DM9051_BPTR, BPTR_DEFAULT } });
 
         /* Open / Close Flow Control */
         //DM9051_Write_Reg(DM9051_FCTR, FCTR_DEAFULT);
@@ -351,8 +353,7 @@ public:
         {
             usleep(5000);
         }
-        write(DM9051_TXPLL, length & 0xff);
-        write(DM9051_TXPLH, (length >> 8) & 0xff);
+        write({ { DM9051_TXPLL, uint8_t(length & 0xff) }, { DM9051_TXPLH, uint8_t((length >> 8) & 0xff) } });
     }
 
     virtual void send(gsl::span<const uint8_t> buffer) override
@@ -360,6 +361,22 @@ public:
         write_memory(buffer);
     }
 
+    virtual void sendv(gsl::span<const io_vec_t> buffers) override
+    {
+        static const uint8_t to_write[1] = { SPI_WR_BURST };
+        io_vec_t vecs[DM9051_SEND_VECS + 1];
+        vecs[0] = { const_cast<uint8_t *>(to_write), sizeof(to_write) };
+
+        /* Each burst write continues at the tx memory pointer, so a long chain can be split */
+        while (!buffers.empty())
+        {
+            auto count = std::min(buffers.size(), std::ptrdiff_t(DM9051_SEND_VECS));
+            std::copy(buffers.begin(), buffers.begin() + count, vecs + 1);
+            spi_dev_->writev({ vecs, count + 1 });
+            buffers = buffers.subspan(count);
+        }
+    }
+
     virtual void end_send() override
     {
         /* Issue TX polling command */
@@ -371,10 +388,17 @@ public:
         uint16_t len = 0;
         uint16_t status;
 
-        read(DM9051_MRCMDX); // dummy read
-
+        /* The dummy read and the header burst go out under one bus lock */
+        static const uint8_t to_write[] = { DM9051_MRCMDX, SPI_RD_BURST };
+        uint8_t dummy;
         uint8_t header[4];
-        read_memory({ header });
+        const spi_segment_t segments[] = {
+            { SPI_SEGMENT_WRITE, &to_write[0], nullptr, 1, false },
+            { SPI_SEGMENT_READ, nullptr, &dummy, 1, true },
+            { SPI_SEGMENT_WRITE, &to_write[1], nullptr, 1, false },
+            { SPI_SEGMENT_READ, nullptr, header, sizeof(header), true }
+        };
+        spi_dev_->transfer_list(segments);
         status = header[0] | (header[1] << 8);
         len = header[2] | (header[3] << 8);
         if (len > DM9051_PKT_MAX)
@@ -474,16 +498,40 @@ private:
         spi_dev_->write({ to_write });
     }
 
-    void write_phy(uint8_t addr, uint16_t data)
+    struct register_write
     {
-        /* Fill the phyxcer register into REG_0C */
-        write(DM9051_EPAR, DM9051_PHY | addr);
+        uint8_t addr;
+        uint8_t data;
+    };
 
-        /* Fill the written data into REG_0D & REG_0E */
-        write(DM9051_EPDRL, (data & 0xff));
-        write(DM9051_EPDRH, ((data >> 8) & 0xff));
-        /* Issue phyxcer write command */
-        write(DM9051_EPCR, 0xa);
+    /* Writes several registers under one bus lock, each in its own chip select frame */
+    void write(std::initializer_list<register_write> writes)
+    {
+        configASSERT(writes.size() <= DM9051_WRITE_BATCH);
+        uint8_t to_write[DM9051_WRITE_BATCH][2];
+        spi_segment_t segments[DM9051_WRITE_BATCH];
+        size_t count = 0;
+        for (auto &reg : writes)
+        {
+            to_write[count][0] = reg.addr | 0x80;
+            to_write[count][1] = reg.data;
+            segments[count] = { SPI_SEGMENT_WRITE, to_write[count], nullptr, 2, true };
+            count++;
+        }
+
+        spi_dev_->transfer_list({ segments, std::ptrdiff_t(count) });
+    }
+
+    void write_phy(uint8_t addr, uint16_t data)
+    {
+        write({
+            /* Fill the phyxcer register into REG_0C */
+            { DM9051_EPAR, uint8_t(DM9051_PHY | addr) },
+            /* Fill the written data into REG_0D & REG_0E */
+            { DM9051_EPDRL, uint8_t(data & 0xff) },
+            { DM9051_EPDRH, uint8_t((data >> 8) & 0xff) },
+            /* Issue phyxcer write command */
+            { DM9051_EPCR, 0xa } });
 
         /* Wait write complete */
         //_DM9051_Delay_ms(500);
@@ -498,10 +546,11 @@ private:
 
     uint16_t read_phy(uint8_t addr)
     {
-        /* Fill the phyxcer register into REG_0C */
-        write(DM9051_EPAR, DM9051_PHY | addr);
-        /* Issue phyxcer read command */
-        write(DM9051_EPCR, 0xc);
+        write({
+            /* Fill the phyxcer register into REG_0C */
+            { DM9051_EPAR, uint8_t(DM9051_PHY | addr) },
+            /* Issue phyxcer read command */
+            { DM9051_EPCR, 0xc } });
 
         /* Wait read complete */
         //_DM9051_Delay_ms(100);
@@ -524,20 +573,14 @@ private:
 
     void write_memory(gsl::span<const uint8_t> buffer)
     {
-        auto new_buffer = std::make_unique<uint8_t[]>(buffer.size_bytes() + 1);
-        std::copy(buffer.begin(), buffer.end(), new_buffer.get() + 1);
-        new_buffer[0] = SPI_WR_BURST;
-        spi_dev_->write({ new_buffer.get(), buffer.size_bytes() + 1 });
+        const io_vec_t vecs[] = { { const_cast<uint8_t *>(buffer.data()), size_t(buffer.size()) } };
+        sendv(vecs);
     }
 
     void set_mac_address(const mac_address_t &mac_addr)
     {
-        write(DM9051_PAR + 0, mac_addr.data[0]);
-        write(DM9051_PAR + 1, mac_addr.data[1]);
-        write(DM9051_PAR + 2, mac_addr.data[2]);
-        write(DM9051_PAR + 3, mac_addr.data[3]);
-        write(DM9051_PAR + 4, mac_addr.data[4]);
-        write(DM9051_PAR + 5, mac_addr.data[5]);
+        write({ { DM9051_PAR + 0, mac_addr.data[0] }, { DM9051_PAR + 1, mac_addr.data[1] }, { DM9051_PAR + 2, mac_addr.data[2] },
+            { DM9051_PAR + 3, mac_addr.data[3] }, { DM9051_PAR + 4, mac_addr.data[4] }, { DM9051_PAR + 5, mac_addr.data[5] } });
 
         configASSERT(read(DM9051_PAR) == mac_addr.data[0]);
     }
@@ -597,14 +640,14 @@ private:
 
 handle_t dm9051_driver_install(handle_t spi_handle, uint32_t spi_cs_mask, handle_t int_gpio_handle, uint32_t int_gpio_pin, const mac_address_t *mac_address)
 {
-    try
+    SYS_TRY
     {
         configASSERT(mac_address);
         auto driver = make_object<dm9051_driver>(spi_handle, spi_cs_mask, int_gpio_handle, int_gpio_pin, * mac_address);
         driver->install();
         return system_alloc_handle(make_accessor(driver));
     }
-    catch (...)
+    SYS_CATCH_ALL
     {
         return NULL_HANDLE;
     }
@@ -13,6 +13,7 @@
  * limitations under the License.
  */
 #include "storage/sdcard.h"
+#include <algorithm>
 #include <hal.h>
 #include <kernel/driver_impl.hpp>
 #include <stdlib.h>
@@ -29,6 +30,7 @@ using namespace sys;
 #define SD_START_DATA_MULTIPLE_BLOCK_READ 0xFE /*!< Data token start byte, Start Multiple Block Read */
 #define SD_START_DATA_SINGLE_BLOCK_WRITE 0xFE /*!< Data token start byte, Start Single Block Write */
 #define SD_START_DATA_MULTIPLE_BLOCK_WRITE 0xFC /*!< Data token start byte, Start Multiple Block Write */
+#define SD_STOP_DATA_MULTIPLE_BLOCK_WRITE 0xFD /*!< Data token stop byte, Stop Multiple Block Write */
 
 /*
  * @brief  Commands: CMDxx = CMD-number | 0x40
@@ -52,6 +54,9 @@ using namespace sys;
 #define SD_SPI_LOW_CLOCK_RATE 200000U
 #define SD_SPI_HIGH_CLOCK_RATE 40000000U
 #define SPI_SLAVE_SELECT 3
+/* Bytes read after a block: the data response and the start of busy when writing, the gap
+ * before the next data token when reading */
+#define SD_BLOCK_TAIL_PROBE 16
 
 /** 
   * @brief  Card Specific Data: CSD Register   
@@ -143,6 +148,10 @@ public:
     {
         auto spi = make_accessor(spi_driver_);
         spi8_dev_ = make_accessor(spi->get_device(SPI_MODE_0, SPI_FF_STANDARD, 1, 8));
+        /* Bulk block transfers should not hold up latency critical DMA users */
+        spi8_dev_->set_dma_priority(DMA_PRIORITY_LOW, DMA_SUBSYSTEM_NONE);
+        /* Chip select is a GPIO, so the FIFO may run dry between interrupts */
+        spi8_dev_->set_fifo_mode(SPI_FIFO_INTERRUPT);
 
         cs_gpio_ = make_accessor(cs_gpio_driver_);
         cs_gpio_->set_drive_mode(cs_gpio_pin_, GPIO_DM_OUTPUT);
@@ -201,16 +210,6 @@ private:
         spi8_dev_->read({ data_buff, std::ptrdiff_t(length) });
     }
 
-    void sd_write_data_dma(const uint8_t *data_buff)
-    {
-        spi8_dev_->write({ data_buff, 512L });
-    }
-
-    void sd_read_data_dma(uint8_t *data_buff)
-    {
-        spi8_dev_->read({ data_buff, 512L });
-    }
-
     /*
      * @brief  Send 5 bytes command to the SD card.
      * @param  Cmd: The user expected command to send to SD card.
@@ -662,9 +661,36 @@ private:
         return 0;
     }
 
+    /*
+     * @brief  Wait for the card to release DO, which it holds low while busy.
+     * @retval The SD Response:
+     *         - 0xFF: Sequence failed
+     *         - 0: Sequence succeed
+     */
+    uint8_t sd_wait_ready()
+    {
+        uint8_t probe[SD_BLOCK_TAIL_PROBE];
+        uint32_t timeout = 0x3FFFF;
+        while (timeout--)
+        {
+            sd_read_data(probe, sizeof(probe));
+            if (probe[sizeof(probe) - 1] == 0xFF)
+                return 0;
+        }
+        return 0xFF;
+    }
+
+    /*
+     * @brief  Reads blocks, each block with its CRC and the bytes up to the next data token
+     *         in one transfer. Data bytes already read past the token start the next block.
+     * @retval The SD Response:
+     *         - 0xFF: Sequence failed
+     *         - 0: Sequence succeed
+     */
     uint8_t sd_read_sector_dma(uint8_t *data_buff, uint32_t sector, uint32_t count)
     {
-        uint8_t frame[2], flag;
+        uint8_t tail[2 + SD_BLOCK_TAIL_PROBE], flag;
+        size_t ahead = 0;
 
         /*!< Send CMD17 (SD_CMD17) to read one block */
         if (count == 1)
@@ -683,16 +709,40 @@ private:
             sd_end_cmd();
             return 0xFF;
         }
-        while (count)
+        /*!< Wait for the first data token */
+        if (sd_get_response() == SD_START_DATA_SINGLE_BLOCK_READ)
         {
-            if (sd_get_response() != SD_START_DATA_SINGLE_BLOCK_READ)
-                break;
-            /*!< Read the SD block data : read NumByteToRead data */
-            sd_read_data_dma(data_buff);
-            /*!< Get CRC bytes (not really needed by us, but required by SD) */
-            sd_read_data(frame, 2);
-            data_buff += 512;
-            count--;
+            while (count)
+            {
+                size_t probe = count > 1 ? SD_BLOCK_TAIL_PROBE : 0;
+                /*!< Read the SD block data and the CRC bytes (not really needed by us, but required by SD) */
+                const spi_segment_t segments[] = {
+                    { SPI_SEGMENT_READ, nullptr, data_buff + ahead, 512 - ahead, false },
+                    { SPI_SEGMENT_READ, nullptr, tail, 2 + probe, false }
+                };
+                spi8_dev_->transfer_list(segments);
+                data_buff += 512;
+                if (!--count)
+                    break;
+
+                auto probe_end = tail + 2 + probe;
+                auto token = std::find_if(tail + 2, probe_end, [](uint8_t value) { return value != 0xFF; });
+                if (token == probe_end)
+                {
+                    if (sd_get_response() != SD_START_DATA_MULTIPLE_BLOCK_READ)
+                        break;
+                    ahead = 0;
+                }
+                else if (*token == SD_START_DATA_MULTIPLE_BLOCK_READ)
+                {
+                    ahead = probe_end - (token + 1);
+                    memcpy(data_buff, token + 1, ahead);
+                }
+                else
+                {
+                    break;
+                }
+            }
         }
         sd_end_cmd();
         if (flag)
@@ -706,18 +756,35 @@ private:
         return count > 0 ? 0xFF : 0;
     }
 
+    /*
+     * @brief  Writes blocks, each block with its token, CRC, data response and the first
+     *         busy bytes in one transfer. The card only takes the next block once it has
+     *         released busy, so busy is only polled further when the probe ends busy.
+     * @retval The SD Response:
+     *         - 0xFF: Sequence failed
+     *         - 0: Sequence succeed
+     */
     uint8_t sd_write_sector_dma(const uint8_t *data_buff, uint32_t sector, uint32_t count)
     {
-        uint8_t frame[2] = { 0xFF };
+        uint8_t token[2] = { 0xFF };
+        uint8_t crc[2] = { 0xFF, 0xFF };
+        uint8_t status[SD_BLOCK_TAIL_PROBE];
+        uint8_t flag;
 
         if (count == 1)
         {
-            frame[1] = SD_START_DATA_SINGLE_BLOCK_WRITE;
+            flag = 0;
+            token[1] = SD_START_DATA_SINGLE_BLOCK_WRITE;
             sd_send_cmd(SD_CMD24, sector, 0);
         }
         else
         {
-            frame[1] = SD_START_DATA_MULTIPLE_BLOCK_WRITE;
+            flag = 1;
+            token[1] = SD_START_DATA_MULTIPLE_BLOCK_WRITE;
+            /*!< Pre-erase the blocks about to be written, ACMD23 is an application command */
+            sd_send_cmd(SD_CMD55, 0, 0);
+            sd_get_response();
+            sd_end_cmd();
             sd_send_cmd(SD_ACMD23, count, 0);
             sd_get_response();
             sd_end_cmd();
@@ -731,15 +798,28 @@ private:
         }
         while (count--)
         {
-            /*!< Send the data token to signify the start of the data */
-            sd_write_data(frame, 2);
-            /*!< Write the block data to SD : write count data by block */
-            sd_write_data_dma(data_buff);
-            /*!< Put CRC bytes (not really needed by us, but required by SD) */
-            sd_write_data(frame, 2);
+            /*!< Send the data token, the block data and the CRC bytes (not really needed by us, but required by SD) */
+            const spi_segment_t segments[] = {
+                { SPI_SEGMENT_WRITE, token, nullptr, 2, false },
+                { SPI_SEGMENT_WRITE, data_buff, nullptr, 512, false },
+                { SPI_SEGMENT_WRITE, crc, nullptr, 2, false },
+                { SPI_SEGMENT_READ, nullptr, status, sizeof(status), false }
+            };
+            spi8_dev_->transfer_list(segments);
             data_buff += 512;
-            /*!< Read data response */
-            if (sd_get_dataresponse() != 0x00)
+            /*!< Check the data response: xxx0<status>1, 010 for data accepted */
+            if ((status[0] & 0x1F) != 0x05 || (status[sizeof(status) - 1] != 0xFF && sd_wait_ready() != 0))
+            {
+                sd_end_cmd();
+                return 0xFF;
+            }
+        }
+        if (flag)
+        {
+            /*!< Stop the transmission, the card is busy again while it commits the last block */
+            const uint8_t stop[2] = { SD_STOP_DATA_MULTIPLE_BLOCK_WRITE, 0xFF };
+            sd_write_data(stop, sizeof(stop));
+            if (sd_wait_ready() != 0)
             {
                 sd_end_cmd();
                 return 0xFF;
@@ -763,13 +843,13 @@ private:
 
 handle_t spi_sdcard_driver_install(handle_t spi_handle, handle_t cs_gpio_handle, uint32_t cs_gpio_pin)
 {
-    try
+    SYS_TRY
     {
         auto driver = make_object<k_spi_sdcard_driver>(spi_handle, cs_gpio_handle, cs_gpio_pin);
         driver->install();
         return system_alloc_handle(make_accessor(driver));
     }
-    catch (...)
+    SYS_CATCH_ALL
     {
         return NULL_HANDLE;
     }
@@ -0,0 +1,413 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "storage/spi_flash.h"
+#include <algorithm>
+#include <hal.h>
+#include <kernel/driver_impl.hpp>
+#include <string.h>
+#include <task.h>
+
+using namespace sys;
+
+#define FLASH_CMD_WRITE_ENABLE 0x06
+#define FLASH_CMD_READ_STATUS1 0x05
+#define FLASH_CMD_READ_STATUS2 0x35
+#define FLASH_CMD_WRITE_STATUS2 0x31
+#define FLASH_CMD_PAGE_PROGRAM 0x02
+#define FLASH_CMD_SECTOR_ERASE 0x20
+#define FLASH_CMD_READ_JEDEC_ID 0x9F
+#define FLASH_CMD_FAST_READ_QUAD_IO 0xEB
+
+#define FLASH_STATUS1_BUSY 0x01
+#define FLASH_STATUS2_QE 0x02
+
+#define SPI_FLASH_CLOCK_RATE 50000000U
+#define SPI_FLASH_PAGE_SIZE 256
+#define SPI_FLASH_SECTOR_SIZE 4096
+#define SPI_FLASH_BLOCK_SIZE 512
+#define SPI_FLASH_BLOCKS_PER_SECTOR (SPI_FLASH_SECTOR_SIZE / SPI_FLASH_BLOCK_SIZE)
+#define SPI_FLASH_PAGES_PER_SECTOR (SPI_FLASH_SECTOR_SIZE / SPI_FLASH_PAGE_SIZE)
+/* 24 bits addressing */
+#define SPI_FLASH_MAX_SIZE (16 * 1024 * 1024)
+/* Single block reads (FAT, directories) go through the cache, longer runs are read directly */
+#define SPI_FLASH_CACHE_BLOCKS 8
+/* Frames of one quad read, ctrlr1 counts at most 64K */
+#define SPI_FLASH_READ_CHUNK (32 * 1024)
+#define SPI_FLASH_INVALID_SECTOR UINT32_MAX
+
+class k_spi_flash_driver : public block_storage_driver, public heap_object, public free_object_access
+{
+public:
+    k_spi_flash_driver(handle_t spi_handle, uint32_t spi_cs_mask, uint32_t base_address, uint32_t size)
+        : spi_driver_(system_handle_to_object(spi_handle).get_object().as<spi_driver>())
+        , spi_cs_mask_(spi_cs_mask)
+        , base_address_(base_address)
+        , size_(size)
+    {
+        configASSERT(base_address % SPI_FLASH_SECTOR_SIZE == 0);
+    }
+
+    virtual void install() override
+    {
+        free_mutex_ = xSemaphoreCreateMutex();
+    }
+
+    virtual void on_first_open() override
+    {
+        auto spi = make_accessor(spi_driver_);
+        spi8_dev_ = make_accessor(spi->get_device(SPI_MODE_0, SPI_FF_STANDARD, spi_cs_mask_, 8));
+        spi8_dev_->set_clock_rate(SPI_FLASH_CLOCK_RATE);
+
+        /* 0xEB: instruction on one line, then 24 bits address and 8 mode bits, 4 dummy clocks
+         * and data on four lines. 32 bits frames keep the FIFO and the DMA at a quarter of the
+         * transfers, the words arrive most significant byte first. */
+        spi32_quad_dev_ = make_accessor(spi->get_device(SPI_MODE_0, SPI_FF_QUAD, spi_cs_mask_, 32));
+        spi32_quad_dev_->config_non_standard(8, 32, 4, SPI_AITM_ADDR_STANDARD);
+        spi32_quad_dev_->set_clock_rate(SPI_FLASH_CLOCK_RATE);
+
+        uint8_t cmd = FLASH_CMD_READ_JEDEC_ID;
+        uint8_t id[3];
+        spi8_dev_->transfer_sequential({ &cmd, 1 }, id);
+        configASSERT(id[2] >= 16 && id[2] <= 24);
+        uint32_t flash_size = 1U << id[2];
+        configASSERT(flash_size <= SPI_FLASH_MAX_SIZE && base_address_ < flash_size);
+        if (!size_)
+            size_ = flash_size - base_address_;
+        configASSERT(base_address_ + size_ <= flash_size);
+
+        enable_quad();
+
+        for (auto &line : cache_)
+        {
+            line.block = UINT32_MAX;
+            line.last_use = 0;
+        }
+        buffered_sector_ = SPI_FLASH_INVALID_SECTOR;
+        dirty_pages_ = 0;
+        needs_erase_ = false;
+    }
+
+    virtual void on_last_close() override
+    {
+        flush();
+        spi32_quad_dev_.reset();
+        spi8_dev_.reset();
+    }
+
+    virtual uint32_t get_rw_block_size() override
+    {
+        return SPI_FLASH_BLOCK_SIZE;
+    }
+
+    virtual uint32_t get_blocks_count() override
+    {
+        return size_ / SPI_FLASH_BLOCK_SIZE;
+    }
+
+    virtual void read_blocks(uint32_t start_block, uint32_t blocks_count, gsl::span<uint8_t> buffer) override
+    {
+        semaphore_lock locker(free_mutex_);
+        configASSERT(start_block + blocks_count <= get_blocks_count());
+        configASSERT(buffer.size() >= blocks_count * SPI_FLASH_BLOCK_SIZE);
+
+        auto dest = buffer.data();
+        if (blocks_count == 1 || ((uintptr_t)dest & 3))
+        {
+            for (uint32_t i = 0; i < blocks_count; i++)
+                read_block_cached(start_block + i, dest + i * SPI_FLASH_BLOCK_SIZE);
+        }
+        else
+        {
+            read_flash(block_address(start_block), dest, blocks_count * SPI_FLASH_BLOCK_SIZE);
+            /* Writes still in the sector buffer are newer than the flash */
+            if (dirty_pages_)
+            {
+                for (uint32_t i = 0; i < blocks_count; i++)
+                {
+                    if ((start_block + i) / SPI_FLASH_BLOCKS_PER_SECTOR == buffered_sector_)
+                        memcpy(dest + i * SPI_FLASH_BLOCK_SIZE, buffered_block(start_block + i), SPI_FLASH_BLOCK_SIZE);
+                }
+            }
+        }
+    }
+
+    virtual void write_blocks(uint32_t start_block, uint32_t blocks_count, gsl::span<const uint8_t> buffer) override
+    {
+        semaphore_lock locker(free_mutex_);
+        configASSERT(start_block + blocks_count <= get_blocks_count());
+        configASSERT(buffer.size() >= blocks_count * SPI_FLASH_BLOCK_SIZE);
+
+        auto src = buffer.data();
+        while (blocks_count)
+        {
+            uint32_t sector = start_block / SPI_FLASH_BLOCKS_PER_SECTOR;
+            uint32_t first = start_block % SPI_FLASH_BLOCKS_PER_SECTOR;
+            uint32_t count = std::min(blocks_count, SPI_FLASH_BLOCKS_PER_SECTOR - first);
+            if (sector != buffered_sector_)
+            {
+                flush_sector();
+                buffered_sector_ = sector;
+                /* A whole sector rewrite does not need the old contents */
+                if (count == SPI_FLASH_BLOCKS_PER_SECTOR)
+                    needs_erase_ = true;
+                else
+                    read_flash(base_address_ + sector * SPI_FLASH_SECTOR_SIZE, sector_buffer_, SPI_FLASH_SECTOR_SIZE);
+            }
+
+            merge(first * SPI_FLASH_BLOCK_SIZE, src, count * SPI_FLASH_BLOCK_SIZE);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                auto line = find_cache_line(start_block + i);
+                if (line)
+                    memcpy(line->data, src + i * SPI_FLASH_BLOCK_SIZE, SPI_FLASH_BLOCK_SIZE);
+            }
+
+            src += count * SPI_FLASH_BLOCK_SIZE;
+            start_block += count;
+            blocks_count -= count;
+        }
+    }
+
+    virtual void flush() override
+    {
+        semaphore_lock locker(free_mutex_);
+        flush_sector();
+    }
+
+private:
+    struct cache_line
+    {
+        uint32_t block;
+        uint32_t last_use;
+        uint32_t data[SPI_FLASH_BLOCK_SIZE / sizeof(uint32_t)];
+    };
+
+    uint32_t block_address(uint32_t block) const noexcept
+    {
+        return base_address_ + block * SPI_FLASH_BLOCK_SIZE;
+    }
+
+    uint8_t *buffered_block(uint32_t block) noexcept
+    {
+        return reinterpret_cast<uint8_t *>(sector_buffer_) + (block % SPI_FLASH_BLOCKS_PER_SECTOR) * SPI_FLASH_BLOCK_SIZE;
+    }
+
+    cache_line *find_cache_line(uint32_t block) noexcept
+    {
+        for (auto &line : cache_)
+        {
+            if (line.block == block)
+                return &line;
+        }
+
+        return nullptr;
+    }
+
+    void read_block_cached(uint32_t block, uint8_t *dest)
+    {
+        if (block / SPI_FLASH_BLOCKS_PER_SECTOR == buffered_sector_)
+        {
+            memcpy(dest, buffered_block(block), SPI_FLASH_BLOCK_SIZE);
+            return;
+        }
+
+        auto line = find_cache_line(block);
+        if (!line)
+        {
+            line = &cache_[0];
+            for (auto &candidate : cache_)
+            {
+                if (candidate.last_use < line->last_use)
+                    line = &candidate;
+            }
+
+            line->block = UINT32_MAX;
+            read_flash(block_address(block), line->data, SPI_FLASH_BLOCK_SIZE);
+            line->block = block;
+        }
+
+        line->last_use = ++cache_clock_;
+        memcpy(dest, line->data, SPI_FLASH_BLOCK_SIZE);
+    }
+
+    /* dest must be 4 bytes aligned and length a multiple of 4 */
+    void read_flash(uint32_t address, void *dest, size_t length)
+    {
+        auto buffer = reinterpret_cast<uint8_t *>(dest);
+        while (length)
+        {
+            size_t chunk = std::min(length, (size_t)SPI_FLASH_READ_CHUNK);
+            /* The driver takes the instruction and the address from the head of the buffer
+             * before the data overwrites it */
+            uint32_t addr_mode = address << 8;
+            buffer[0] = FLASH_CMD_FAST_READ_QUAD_IO;
+            memcpy(buffer + 1, &addr_mode, sizeof(addr_mode));
+            spi32_quad_dev_->read({ buffer, (std::ptrdiff_t)chunk });
+
+            auto words = reinterpret_cast<uint32_t *>(buffer);
+            for (size_t i = 0; i < chunk / sizeof(uint32_t); i++)
+                words[i] = __builtin_bswap32(words[i]);
+
+            address += chunk;
+            buffer += chunk;
+            length -= chunk;
+        }
+    }
+
+    /* Programming can only clear bits, anything else needs the sector erased first */
+    void merge(size_t offset, const uint8_t *src, size_t length)
+    {
+        auto dest = reinterpret_cast<uint8_t *>(sector_buffer_) + offset;
+        if (!needs_erase_)
+        {
+            for (size_t i = 0; i < length; i++)
+            {
+                if ((dest[i] & src[i]) != src[i])
+                {
+                    needs_erase_ = true;
+                    break;
+                }
+            }
+        }
+
+        memcpy(dest, src, length);
+        for (size_t page = offset / SPI_FLASH_PAGE_SIZE; page <= (offset + length - 1) / SPI_FLASH_PAGE_SIZE; page++)
+            dirty_pages_ |= 1U << page;
+    }
+
+    void flush_sector()
+    {
+        if (!dirty_pages_)
+            return;
+
+        uint32_t address = base_address_ + buffered_sector_ * SPI_FLASH_SECTOR_SIZE;
+        auto data = reinterpret_cast<const uint8_t *>(sector_buffer_);
+        uint32_t pages = dirty_pages_;
+        if (needs_erase_)
+        {
+            erase_sector(address);
+            pages = 0;
+            for (size_t page = 0; page < SPI_FLASH_PAGES_PER_SECTOR; page++)
+            {
+                auto page_data = data + page * SPI_FLASH_PAGE_SIZE;
+                if (std::any_of(page_data, page_data + SPI_FLASH_PAGE_SIZE, [](uint8_t value) { return value != 0xFF; }))
+                    pages |= 1U << page;
+            }
+        }
+
+        for (size_t page = 0; page < SPI_FLASH_PAGES_PER_SECTOR; page++)
+        {
+            if (pages & (1U << page))
+                program_page(address + page * SPI_FLASH_PAGE_SIZE, data + page * SPI_FLASH_PAGE_SIZE);
+        }
+
+        dirty_pages_ = 0;
+        needs_erase_ = false;
+    }
+
+    void erase_sector(uint32_t address)
+    {
+        static const uint8_t write_enable = FLASH_CMD_WRITE_ENABLE;
+        const uint8_t cmd[] = { FLASH_CMD_SECTOR_ERASE, (uint8_t)(address >> 16), (uint8_t)(address >> 8), (uint8_t)address };
+        const spi_segment_t segments[] = {
+            { SPI_SEGMENT_WRITE, &write_enable, nullptr, 1, true },
+            { SPI_SEGMENT_WRITE, cmd, nullptr, sizeof(cmd), true }
+        };
+
+        spi8_dev_->transfer_list(segments);
+        /* Tens of milliseconds, let other tasks run */
+        wait_ready(true);
+    }
+
+    void program_page(uint32_t address, const uint8_t *data)
+    {
+        static const uint8_t write_enable = FLASH_CMD_WRITE_ENABLE;
+        const uint8_t cmd[] = { FLASH_CMD_PAGE_PROGRAM, (uint8_t)(address >> 16), (uint8_t)(address >> 8), (uint8_t)address };
+        const spi_segment_t segments[] = {
+            { SPI_SEGMENT_WRITE, &write_enable, nullptr, 1, true },
+            { SPI_SEGMENT_WRITE, cmd, nullptr, sizeof(cmd), false },
+            { SPI_SEGMENT_WRITE, data, nullptr, SPI_FLASH_PAGE_SIZE, true }
+        };
+
+        spi8_dev_->transfer_list(segments);
+        wait_ready(false);
+    }
+
+    void enable_quad()
+    {
+        uint8_t cmd = FLASH_CMD_READ_STATUS2;
+        uint8_t status2;
+        spi8_dev_->transfer_sequential({ &cmd, 1 }, { &status2, 1 });
+        if (status2 & FLASH_STATUS2_QE)
+            return;
+
+        static const uint8_t write_enable = FLASH_CMD_WRITE_ENABLE;
+        const uint8_t write_status[] = { FLASH_CMD_WRITE_STATUS2, (uint8_t)(status2 | FLASH_STATUS2_QE) };
+        const spi_segment_t segments[] = {
+            { SPI_SEGMENT_WRITE, &write_enable, nullptr, 1, true },
+            { SPI_SEGMENT_WRITE, write_status, nullptr, sizeof(write_status), true }
+        };
+
+        spi8_dev_->transfer_list(segments);
+        wait_ready(true);
+    }
+
+    void wait_ready(bool yield)
+    {
+        uint8_t cmd = FLASH_CMD_READ_STATUS1;
+        uint8_t status1;
+        while (true)
+        {
+            spi8_dev_->transfer_sequential({ &cmd, 1 }, { &status1, 1 });
+            if (!(status1 & FLASH_STATUS1_BUSY))
+                break;
+            if (yield)
+                vTaskDelay(1);
+        }
+    }
+
+private:
+    object_ptr<spi_driver> spi_driver_;
+    uint32_t spi_cs_mask_;
+    uint32_t base_address_;
+    uint32_t size_;
+    SemaphoreHandle_t free_mutex_;
+
+    object_accessor<spi_device_driver> spi8_dev_;
+    object_accessor<spi_device_driver> spi32_quad_dev_;
+
+    cache_line cache_[SPI_FLASH_CACHE_BLOCKS];
+    uint32_t cache_clock_ = 0;
+
+    /* One erase sector of pending writes, valid from buffered_sector_ on */
+    uint32_t sector_buffer_[SPI_FLASH_SECTOR_SIZE / sizeof(uint32_t)];
+    uint32_t buffered_sector_;
+    uint32_t dirty_pages_;
+    bool needs_erase_;
+};
+
+handle_t spi_flash_driver_install(handle_t spi_handle, uint32_t spi_cs_mask, uint32_t base_address, uint32_t size)
+{
+    SYS_TRY
+    {
+        auto driver = make_object<k_spi_flash_driver>(spi_handle, spi_cs_mask, base_address, size);
+        driver->install();
+        return system_alloc_handle(make_accessor(driver));
+    }
+    SYS_CATCH_ALL
+    {
+        return NULL_HANDLE;
+    }
+}
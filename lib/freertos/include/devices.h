@@ -70,6 +70,30 @@ int io_read(handle_t file, uint8_t *buffer, size_t len);
  */
 int io_write(handle_t file, const uint8_t *buffer, size_t len);
 
+/**
+ * @brief       Read from a device into multiple buffers
+ *
+ * @param[in]   file        The device handle
+ * @param[in]   vecs        The destination buffers, filled in order
+ * @param[in]   count       The number of buffers
+ *
+ * @return      Actual bytes read
+ */
+int io_readv(handle_t file, const io_vec_t *vecs, size_t count);
+
+/**
+ * @brief       Write multiple buffers to a device as a single transfer
+ *
+ * @param[in]   file        The device handle
+ * @param[in]   vecs        The source buffers, written in order
+ * @param[in]   count       The number of buffers
+ *
+ * @return      result
+ *     - total  Success
+ *     - other  Fail
+ */
+int io_writev(handle_t file, const io_vec_t *vecs, size_t count);
+
 /**
  * @brief       Send control info to a device
  *
@@ -84,6 +108,92 @@ int io_write(handle_t file, const uint8_t *buffer, size_t len);
  */
 int io_control(handle_t file, uint32_t control_code, const uint8_t *write_buffer, size_t write_len, uint8_t *read_buffer, size_t read_len);
 
+/**
+ * @brief       Create an asynchronous io queue owned by the calling task
+ *
+ * @param[in]   depth       Maximum operations in flight
+ *
+ * @return      The queue handle, close it with io_close
+ */
+handle_t io_queue_create(size_t depth);
+
+/**
+ * @brief       Submit operations to an io queue
+ *
+ * @param[in]   queue           The queue handle
+ * @param[in]   submissions     The operations. IO_OP_READ uses read_buffer/read_len,
+ *                              IO_OP_WRITE uses write_buffer/write_len, IO_OP_CONTROL uses all of them
+ * @param[in]   count           The number of operations
+ *
+ * @return      The number of operations accepted, less than count if the queue is full
+ */
+int io_submit(handle_t queue, const io_submission_t *submissions, size_t count);
+
+/**
+ * @brief       Retire completed operations of an io queue
+ *
+ * @param[in]   queue           The queue handle
+ * @param[out]  completions     The completions, the handler of each operation (if any) is called first
+ * @param[in]   count           Maximum completions to retire
+ * @param[in]   min_complete    Block until at least this many completions are retired
+ * @param[in]   timeout         Maximum ticks to block
+ *
+ * @return      The number of completions retired
+ */
+int io_reap(handle_t queue, io_completion_t *completions, size_t count, size_t min_complete, TickType_t timeout);
+
+/**
+ * @brief       Allocate a registered DMA buffer
+ *
+ * @param[in]   size            The buffer size in bytes
+ * @param[in]   flags           DMA_BUFFER_UNCACHED to return the uncached alias
+ *
+ * @return      The buffer, aligned to a cache line, or NULL if out of memory
+ */
+void *dma_buffer_alloc(size_t size, uint32_t flags);
+
+/**
+ * @brief       Free a buffer allocated by dma_buffer_alloc
+ *
+ * @param[in]   buffer          The buffer, either alias
+ */
+void dma_buffer_free(void *buffer);
+
+/**
+ * @brief       Register memory as a DMA buffer, drivers then transfer from/to it without copies.
+ *              It must stay valid until unregistered.
+ *
+ * @param[in]   buffer          The buffer, 8 bytes aligned in the main SRAM (either alias)
+ * @param[in]   size            The buffer size in bytes
+ * @param[in]   flags           The dma_buffer_flags_t the buffer is accessed with
+ *
+ * @return      result
+ *     - 0      Success
+ *     - -1     Fail, errno is EINVAL for unsuitable memory or ENOMEM if too many buffers are registered
+ */
+int dma_buffer_register(void *buffer, size_t size, uint32_t flags);
+
+/**
+ * @brief       Unregister a buffer registered by dma_buffer_register
+ *
+ * @param[in]   buffer          The buffer
+ *
+ * @return      result
+ *     - 0      Success
+ *     - -1     Fail, the buffer is not registered
+ */
+int dma_buffer_unregister(void *buffer);
+
+/**
+ * @brief       Get statistics of the kernel object slab allocators
+ *
+ * @param[out]  stats           The statistics, one entry per object type
+ * @param[in]   count           Maximum entries to write
+ *
+ * @return      The number of slab allocators, may be greater than count
+ */
+size_t system_get_slab_statistics(slab_statistics_t *stats, size_t count);
+
 /**
  * @brief       Configure a UART device
  *
@@ -277,6 +387,53 @@ void i2s_stop(handle_t file);
  */
 void spi_slave_config(handle_t file, uint32_t data_bit_length, spi_slave_handler_t *handler);
 
+/**
+ * @brief       Configure SPI slave mode with DMA ring buffers
+ *
+ * The DMA receives into the rx ring and sends from the tx ring without an interrupt per
+ * frame, each frame taking 32 bits of the rings. When the reader falls a quarter of the
+ * ring behind, the oldest frames are overwritten. As with spi_slave_config, slave mode
+ * stays on once configured.
+ *
+ * @param[in]   file                The SPI controller handle
+ * @param[in]   config              The frame length, ring sizes and threshold callback
+ */
+void spi_slave_config_dma(handle_t file, const spi_slave_dma_config_t *config);
+
+/**
+ * @brief       Take received frames from the SPI slave rx ring, without waiting
+ *
+ * Lock-free against the DMA, calls must come from one task at a time.
+ *
+ * @param[in]   file                The SPI controller handle
+ * @param[out]  buffer              The buffer, 1, 2 or 4 bytes per frame after the frame length
+ * @param[in]   len                 The buffer length in bytes
+ *
+ * @return      Bytes read, 0 if no frames were pending
+ */
+int spi_slave_read(handle_t file, uint8_t *buffer, size_t len);
+
+/**
+ * @brief       Queue frames in the SPI slave tx ring, without waiting
+ *
+ * Lock-free against the DMA, calls must come from one task at a time.
+ *
+ * @param[in]   file                The SPI controller handle
+ * @param[in]   buffer              The frames, 1, 2 or 4 bytes each after the frame length
+ * @param[in]   len                 The buffer length in bytes
+ *
+ * @return      Bytes queued, less than len when the ring is full
+ */
+int spi_slave_write(handle_t file, const uint8_t *buffer, size_t len);
+
+/**
+ * @brief       Get the traffic and overrun counters of SPI slave DMA mode
+ *
+ * @param[in]   file                The SPI controller handle
+ * @param[out]  stats               The statistics
+ */
+void spi_slave_get_statistics(handle_t file, spi_slave_statistics_t *stats);
+
 /**
  * @brief       Register and open a SPI device
  *
@@ -312,6 +469,28 @@ void spi_dev_config_non_standard(handle_t file, uint32_t instruction_length, uin
  */
 double spi_dev_set_clock_rate(handle_t file, double clock_rate);
 
+/**
+ * @brief       Set the priority of the DMA channels a SPI device transfers with
+ *
+ * @param[in]   file            The SPI device handle
+ * @param[in]   priority        The DMA priority, DMA_PRIORITY_NORMAL by default
+ * @param[in]   subsystem       The subsystem whose reserved channels are used, DMA_SUBSYSTEM_NONE by default
+ */
+void spi_dev_set_dma_priority(handle_t file, dma_priority_t priority, dma_subsystem_t subsystem);
+
+/**
+ * @brief       Set how a SPI device moves transfers too short for DMA
+ *
+ * In SPI_FIFO_INTERRUPT mode, transfers longer than the FIFO are fed from the SPI interrupt,
+ * so the caller blocks instead of spinning with interrupts masked. The FIFO may run dry
+ * between refills, which ends the frame of the controller's own chip select, so use it for
+ * devices whose chip select is driven from a GPIO.
+ *
+ * @param[in]   file            The SPI device handle
+ * @param[in]   mode            The FIFO mode, SPI_FIFO_POLLED by default
+ */
+void spi_dev_set_fifo_mode(handle_t file, spi_fifo_mode_t mode);
+
 /**
  * @brief       Transfer data between a SPI device using full duplex
  *
@@ -338,6 +517,23 @@ int spi_dev_transfer_full_duplex(handle_t file, const uint8_t *write_buffer, siz
  */
 int spi_dev_transfer_sequential(handle_t file, const uint8_t *write_buffer, size_t write_len, uint8_t *read_buffer, size_t read_len);
 
+/**
+ * @brief       Run a list of write, read and delay segments on a SPI device
+ *
+ * The list holds the bus and the device setup for its whole length, and any DMA channel it
+ * needs is taken once. Consecutive writes, optionally followed by reads, share one chip select
+ * frame up to a segment with cs_release set. Hardware chip select still ends a frame where
+ * a read is followed by a write, at a delay, and where more than a FIFO of writes precedes
+ * a read; drive chip select from a GPIO to hold it over the whole list.
+ *
+ * @param[in]   file            The SPI device handle
+ * @param[in]   segments        The segments, in bus order
+ * @param[in]   count           The count of segments
+ *
+ * @return      Bytes written and read
+ */
+int spi_dev_transfer_list(handle_t file, const spi_segment_t *segments, size_t count);
+
 /**
  * @brief       Fill a sequence of idential frame to a SPI device
  *
@@ -404,6 +600,17 @@ void dvp_set_output_enable(handle_t file, uint32_t index, bool enable);
  */
 void dvp_set_output_attributes(handle_t file, uint32_t index, video_format_t format, void *output_buffer);
 
+/**
+ * @brief       Get the output buffer of a DVP device through the uncached alias,
+ *              so frames can be read, or passed to the KPU, without copies or stale cache lines
+ *
+ * @param[in]   file                The DVP device handle
+ * @param[in]   index               The output index
+ *
+ * @return      The output buffer, NULL if none is set
+ */
+void *dvp_get_output_buffer(handle_t file, uint32_t index);
+
 /**
  * @brief       Enable or disable a frame event of a DVP device
  *
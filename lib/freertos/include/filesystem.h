@@ -160,6 +160,18 @@ bool filesystem_find_next(handle_t handle, find_find_data_t *find_data);
  */
 int filesystem_find_close(handle_t handle);
 
+/**
+ * @brief       Get the block cache statistics of a mounted filesystem
+ *
+ * @param[in]   name                The filesystem path
+ * @param[out]  stats               The statistics
+ *
+ * @return      result
+ *     - 0      Success
+ *     - other  Fail, or the cache is disabled with CONFIG_FS_BLOCK_CACHE_BLOCKS 0
+ */
+int filesystem_get_cache_statistics(const char *name, block_cache_statistics_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -61,6 +61,38 @@ void pic_set_irq_priority(uint32_t irq, uint32_t priority);
  */
 handle_t dma_open_free();
 
+/**
+ * @brief       Wait for a free DMA channel by priority and open it
+ *
+ * @param[in]   priority        Waiters of higher priority are served first
+ * @param[in]   subsystem       Channels reserved for this subsystem are tried first,
+ *                              DMA_SUBSYSTEM_NONE for shared channels only
+ * @param[in]   timeout         The ticks to wait, portMAX_DELAY to wait forever
+ *
+ * @return      The DMA handle, NULL_HANDLE on timeout
+ */
+handle_t dma_open_free_priority(dma_priority_t priority, dma_subsystem_t subsystem, TickType_t timeout);
+
+/**
+ * @brief       Reserve DMA channels for a subsystem, replacing its previous reservation
+ *
+ * @param[in]   subsystem       The subsystem
+ * @param[in]   count           The channel count, at least one channel stays shared
+ *
+ * @return      0 on success, -1 if not enough shared channels are left
+ */
+int dma_reserve_channels(dma_subsystem_t subsystem, size_t count);
+
+/**
+ * @brief       Get the utilisation of the DMA channels
+ *
+ * @param[out]  stats       The statistics of each channel
+ * @param[in]   count       The capacity of stats
+ *
+ * @return      The channel count, which may be larger than count
+ */
+size_t dma_get_channel_statistics(dma_channel_statistics_t *stats, size_t count);
+
 /**
  * @brief       Close DMA
  * @param[in]   file        The DMA handle
@@ -101,6 +133,20 @@ void dma_transmit_async(handle_t file, const volatile void *src, volatile void *
  */
 void dma_transmit(handle_t file, const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size);
 
+/**
+ * @brief       DMA a scatter list asynchronously, signalling once when the whole list is done
+ * @param[in]   file                    The DMA handle
+ * @param[in]   items                   The source, destination and element count of each segment,
+ *                                      kept valid until completion for sub-word peripheral transfers
+ * @param[in]   item_count              The segment count
+ * @param[in]   src_inc                 Enable increment of source address
+ * @param[in]   dest_inc                Enable increment of destination address
+ * @param[in]   element_size            Element size in bytes
+ * @param[in]   burst_size              Element count to transmit per request
+ * @param[in]   completion_event        Event to signal when this transmition is completed
+ */
+void dma_transmit_sg_async(handle_t file, const dma_sg_item_t *items, size_t item_count, bool src_inc, bool dest_inc, size_t element_size, size_t burst_size, SemaphoreHandle_t completion_event);
+
 /**
  * @brief       DMA loop asynchronously
  * @param[in]   file                                The DMA handle
@@ -120,6 +166,80 @@ void dma_transmit(handle_t file, const volatile void *src, volatile void *dest,
  */
 void dma_loop_async(handle_t file, const volatile void **srcs, size_t src_num, volatile void **dests, size_t dest_num, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size, dma_stage_completion_handler_t stage_completion_handler, void *stage_completion_handler_data, SemaphoreHandle_t completion_event, int *stop_signal);
 
+/**
+ * @brief       Copy memory asynchronously, with the CPU below CONFIG_DMA_MEMCPY_THRESHOLD bytes
+ *              or when either side is not DMA reachable, otherwise on a free DMA channel
+ *              that is given back when the copy completes
+ * @param[out]  dest                    The destination
+ * @param[in]   src                     The source, must not overlap the destination
+ * @param[in]   size                    The length in bytes
+ * @param[in]   completion_event        Event to signal when the copy is completed
+ */
+void dma_memcpy_async(void *dest, const void *src, size_t size, SemaphoreHandle_t completion_event);
+
+/**
+ * @brief       Fill memory asynchronously, with the same CPU fallback as dma_memcpy_async
+ * @param[out]  dest                    The destination
+ * @param[in]   value                   The byte value to fill
+ * @param[in]   size                    The length in bytes
+ * @param[in]   completion_event        Event to signal when the fill is completed
+ */
+void dma_memset_async(void *dest, int value, size_t size, SemaphoreHandle_t completion_event);
+
+/**
+ * @brief       Copy memory synchronously, see dma_memcpy_async
+ * @param[out]  dest        The destination
+ * @param[in]   src         The source, must not overlap the destination
+ * @param[in]   size        The length in bytes
+ */
+void dma_memcpy(void *dest, const void *src, size_t size);
+
+/**
+ * @brief       Fill memory synchronously, see dma_memset_async
+ * @param[out]  dest        The destination
+ * @param[in]   value       The byte value to fill
+ * @param[in]   size        The length in bytes
+ */
+void dma_memset(void *dest, int value, size_t size);
+
+/**
+ * @brief       Check whether a range lies in a registered DMA buffer
+ *
+ * @param[in]   buffer      The start of the range, either alias
+ * @param[in]   size        The range length in bytes
+ *
+ * @return      True if registered, the range is then DMA reachable and 8 bytes aligned at the buffer start
+ */
+bool dma_buffer_is_registered(const volatile void *buffer, size_t size);
+
+/**
+ * @brief       Get the cached alias of a main or AI SRAM address
+ *
+ * @param[in]   buffer          The address, either alias, others are returned unchanged
+ *
+ * @return      The address at 0x80000000
+ */
+void *dma_buffer_cached_view(const volatile void *buffer);
+
+/**
+ * @brief       Get the uncached alias of a main or AI SRAM address, through which the CPU
+ *              sees what DMA or the KPU wrote without reading stale cache lines
+ *
+ * @param[in]   buffer          The address, either alias, others are returned unchanged
+ *
+ * @return      The address at 0x40000000
+ */
+void *dma_buffer_uncached_view(const volatile void *buffer);
+
+/**
+ * @brief       Write the cache lines covering a range back to memory, so DMA and the KPU
+ *              see what the CPU wrote through the cached alias
+ *
+ * @param[in]   buffer          The start of the range, either alias
+ * @param[in]   size            The range length in bytes
+ */
+void dma_buffer_writeback(const volatile void *buffer, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
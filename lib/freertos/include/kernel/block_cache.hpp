@@ -0,0 +1,69 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _FREERTOS_BLOCK_CACHE_H
+#define _FREERTOS_BLOCK_CACHE_H
+
+#include "driver.hpp"
+#include <memory>
+
+namespace sys
+{
+/* Write-back LRU cache in front of any block storage device. Requests of bypass_blocks or
+ * more go straight to the device, shorter ones (FAT and directory sectors) are cached.
+ * Dirty blocks stay in the cache until evicted or flushed, then adjacent ones go out
+ * together in writes of up to write_run_blocks. The caller serialises access. */
+class block_cache
+{
+public:
+    block_cache(block_storage_driver &storage, size_t blocks, size_t bypass_blocks, size_t write_run_blocks);
+    block_cache(block_cache &) = delete;
+    block_cache &operator=(block_cache &) = delete;
+
+    void read_blocks(uint32_t start_block, uint32_t blocks_count, gsl::span<uint8_t> buffer);
+    void write_blocks(uint32_t start_block, uint32_t blocks_count, gsl::span<const uint8_t> buffer);
+    void flush();
+    void get_statistics(block_cache_statistics_t &stats) const noexcept;
+
+private:
+    struct line
+    {
+        uint32_t block;
+        uint32_t last_use;
+        bool valid;
+        bool dirty;
+        uint8_t *data;
+    };
+
+    line *find(uint32_t block) noexcept;
+    line *find_dirty(uint32_t block) noexcept;
+    line &allocate(uint32_t block);
+    void touch(line &l) noexcept;
+    void write_back(uint32_t block);
+
+private:
+    block_storage_driver &storage_;
+    size_t block_size_;
+    size_t blocks_;
+    size_t bypass_blocks_;
+    size_t write_run_blocks_;
+    uint32_t clock_;
+    std::unique_ptr<line[]> lines_;
+    std::unique_ptr<uint8_t[]> data_;
+    std::unique_ptr<uint8_t[]> write_run_;
+    block_cache_statistics_t stats_;
+};
+}
+
+#endif /* _FREERTOS_BLOCK_CACHE_H */
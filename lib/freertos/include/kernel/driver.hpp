@@ -18,6 +18,9 @@
 #include "object.hpp"
 #include <gsl/span>
 #include <memory>
+#include <errno.h>
+#include <stdexcept>
+#include <string.h>
 
 #define MAKE_ENUM_CLASS_BITMASK_TYPE(enumName)                                                           \
     static_assert(std::is_enum<enumName>::value, "enumName is not a enum.");                             \
@@ -77,11 +80,132 @@ private:
     int code_;
 };
 
+struct error_code
+{
+    int code;
+};
+
+inline error_code make_error(int code) noexcept
+{
+    return { code };
+}
+
+/* A value or an errno, for failures that are expected on the hot path (EAGAIN, EOF, ...) */
+template <class T>
+class result
+{
+public:
+    result(T value) noexcept
+        : value_(std::move(value)), code_(0)
+    {
+    }
+
+    result(error_code error) noexcept
+        : value_(), code_(error.code)
+    {
+    }
+
+    bool is_ok() const noexcept
+    {
+        return !code_;
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return is_ok();
+    }
+
+    int error() const noexcept
+    {
+        return code_;
+    }
+
+    T &value()
+    {
+        if (code_)
+            SYS_THROW(errno_exception(strerror(code_), code_));
+        return value_;
+    }
+
+    T value_or(T other) const
+    {
+        return code_ ? other : value_;
+    }
+
+private:
+    T value_;
+    int code_;
+};
+
+/* The C API convention: the value, or -1 with errno set */
+template <class T>
+int result_to_errno(const result<T> &r) noexcept
+{
+    if (r)
+        return (int)r.value_or(T());
+    errno = r.error();
+    return -1;
+}
+
+template <>
+class result<void>
+{
+public:
+    result() noexcept
+        : code_(0)
+    {
+    }
+
+    result(error_code error) noexcept
+        : code_(error.code)
+    {
+    }
+
+    bool is_ok() const noexcept
+    {
+        return !code_;
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return is_ok();
+    }
+
+    int error() const noexcept
+    {
+        return code_;
+    }
+
+    void value() const
+    {
+        if (code_)
+            SYS_THROW(errno_exception(strerror(code_), code_));
+    }
+
+private:
+    int code_;
+};
+
+inline int result_to_errno(const result<void> &r) noexcept
+{
+    if (r)
+        return 0;
+    errno = r.error();
+    return -1;
+}
+
 class object_access : public virtual object
 {
 public:
     virtual void open() = 0;
     virtual void close() = 0;
+
+    /* Like open, but returns false instead of throwing when access is denied */
+    virtual bool try_open()
+    {
+        open();
+        return true;
+    }
 };
 
 template <class T>
@@ -139,7 +263,7 @@ public:
     {
         auto obj = obj_.template as<U>();
         if (obj_ && !obj)
-            throw std::bad_cast();
+            SYS_THROW(std::bad_cast());
         obj_.reset();
         return object_accessor<U>(std::move(obj));
     }
@@ -178,6 +302,14 @@ object_accessor<T> make_accessor(object_ptr<T> obj)
     return object_accessor<T>(std::move(obj));
 }
 
+template <typename T>
+object_accessor<T> try_make_accessor(object_ptr<T> obj)
+{
+    if (!obj->try_open())
+        return {};
+    return object_accessor<T>(std::move(obj));
+}
+
 class driver : public virtual object, public virtual object_access
 {
 public:
@@ -190,12 +322,30 @@ typedef struct tag_driver_registry
     object_ptr<driver> driver_ptr;
 } driver_registry_t;
 
+struct async_io_state
+{
+    SemaphoreHandle_t completion_event;
+    uintptr_t context[3];
+};
+
+class async_io_driver : public virtual object_access
+{
+public:
+    /* Return false to let the io worker run the transfer synchronously instead */
+    virtual bool begin_read(gsl::span<uint8_t> buffer, async_io_state &state) = 0;
+    virtual bool begin_write(gsl::span<const uint8_t> buffer, async_io_state &state) = 0;
+    /* Called by the submitting task once completion_event has been taken */
+    virtual int end_io(async_io_state &state) = 0;
+};
+
 class uart_driver : public driver
 {
 public:
     virtual void config(uint32_t baud_rate, uint32_t databits, uart_stopbits_t stopbits, uart_parity_t parity) = 0;
     virtual int read(gsl::span<uint8_t> buffer) = 0;
     virtual int write(gsl::span<const uint8_t> buffer) = 0;
+    virtual int readv(gsl::span<const io_vec_t> buffers);
+    virtual int writev(gsl::span<const io_vec_t> buffers);
     virtual void set_read_timeout(size_t millisecond) = 0;
 };
 
@@ -216,6 +366,8 @@ public:
     virtual double set_clock_rate(double clock_rate) = 0;
     virtual int read(gsl::span<uint8_t> buffer) = 0;
     virtual int write(gsl::span<const uint8_t> buffer) = 0;
+    virtual int readv(gsl::span<const io_vec_t> buffers);
+    virtual int writev(gsl::span<const io_vec_t> buffers);
     virtual int transfer_sequential(gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer) = 0;
 };
 
@@ -245,9 +397,14 @@ public:
     virtual double set_clock_rate(double clock_rate) = 0;
     virtual int read(gsl::span<uint8_t> buffer) = 0;
     virtual int write(gsl::span<const uint8_t> buffer) = 0;
+    virtual int readv(gsl::span<const io_vec_t> buffers);
+    virtual int writev(gsl::span<const io_vec_t> buffers);
     virtual int transfer_full_duplex(gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer) = 0;
     virtual int transfer_sequential(gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer) = 0;
+    virtual int transfer_list(gsl::span<const spi_segment_t> segments) = 0;
     virtual void fill(uint32_t instruction, uint32_t address, uint32_t value, size_t count) = 0;
+    virtual void set_dma_priority(dma_priority_t priority, dma_subsystem_t subsystem) = 0;
+    virtual void set_fifo_mode(spi_fifo_mode_t mode) = 0;
 };
 
 class spi_driver : public driver
@@ -255,6 +412,10 @@ class spi_driver : public driver
 public:
     virtual object_ptr<spi_device_driver> get_device(spi_mode_t mode, spi_frame_format_t frame_format, uint32_t chip_select_mask, uint32_t data_bit_length) = 0;
     virtual void slave_config(uint32_t data_bit_length, const spi_slave_handler_t &handler) = 0;
+    virtual void slave_config_dma(const spi_slave_dma_config_t &config) = 0;
+    virtual size_t slave_read(gsl::span<uint8_t> buffer) = 0;
+    virtual size_t slave_write(gsl::span<const uint8_t> buffer) = 0;
+    virtual void slave_get_statistics(spi_slave_statistics_t &stats) = 0;
 };
 
 class dvp_driver : public driver
@@ -266,6 +427,7 @@ public:
     virtual void set_signal(dvp_signal_type_t type, bool value) = 0;
     virtual void set_output_enable(uint32_t index, bool enable) = 0;
     virtual void set_output_attributes(uint32_t index, video_format_t format, void *output_buffer) = 0;
+    virtual void *get_output_buffer(uint32_t index) = 0;
     virtual void set_frame_event_enable(dvp_frame_event_t event, bool enable) = 0;
     virtual void set_on_frame_event(dvp_on_frame_event_t callback, void *userdata) = 0;
     virtual double xclk_set_clock_rate(double clock_rate) = 0;
@@ -384,10 +546,14 @@ public:
     virtual void set_select_request(uint32_t request) = 0;
     virtual void config(uint32_t priority) = 0;
     virtual void transmit_async(const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size, SemaphoreHandle_t completion_event) = 0;
+    virtual void transmit_sg_async(gsl::span<const dma_sg_item_t> items, bool src_inc, bool dest_inc, size_t element_size, size_t burst_size, SemaphoreHandle_t completion_event) = 0;
     virtual void loop_async(const volatile void **srcs, size_t src_num, volatile void **dests, size_t dest_num, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size, dma_stage_completion_handler_t stage_completion_handler, void *stage_completion_handler_data, SemaphoreHandle_t completion_event, int *stop_signal) = 0;
+    /* Free memory a transfer allocated beyond what install set aside, called in task context on release */
+    virtual void release_buffers();
 };
 
-class dmac_driver : public driver
+/* Answers the dmac_control_t codes */
+class dmac_driver : public custom_driver
 {
 public:
 };
@@ -399,13 +565,17 @@ public:
     virtual uint32_t get_blocks_count() = 0;
     virtual void read_blocks(uint32_t start_block, uint32_t blocks_count, gsl::span<uint8_t> buffer) = 0;
     virtual void write_blocks(uint32_t start_block, uint32_t blocks_count, gsl::span<const uint8_t> buffer) = 0;
+    /* Commit buffered writes to the medium, drivers writing through need not override it */
+    virtual void flush();
 };
 
 class filesystem_file : public virtual object_access
 {
 public:
-    virtual size_t read(gsl::span<uint8_t> buffer) = 0;
-    virtual size_t write(gsl::span<const uint8_t> buffer) = 0;
+    virtual result<size_t> read(gsl::span<uint8_t> buffer) = 0;
+    virtual result<size_t> write(gsl::span<const uint8_t> buffer) = 0;
+    virtual result<size_t> readv(gsl::span<const io_vec_t> buffers);
+    virtual result<size_t> writev(gsl::span<const io_vec_t> buffers);
     virtual fpos_t get_position() = 0;
     virtual void set_position(fpos_t position) = 0;
     virtual uint64_t get_size() = 0;
@@ -430,6 +600,7 @@ public:
     virtual void reset(SemaphoreHandle_t interrupt_event) = 0;
     virtual void begin_send(size_t length) = 0;
     virtual void send(gsl::span<const uint8_t> buffer) = 0;
+    virtual void sendv(gsl::span<const io_vec_t> buffers);
     virtual void end_send() = 0;
     virtual size_t begin_receive() = 0;
     virtual void receive(gsl::span<uint8_t> buffer) = 0;
@@ -439,17 +610,19 @@ public:
 class network_socket : public virtual custom_driver, public virtual object_access
 {
 public:
-    virtual object_accessor<network_socket> accept(socket_address_t *remote_address) = 0;
+    virtual result<object_accessor<network_socket>> accept(socket_address_t *remote_address) = 0;
     virtual void bind(const socket_address_t &address) = 0;
-    virtual void connect(const socket_address_t &address) = 0;
+    virtual result<void> connect(const socket_address_t &address) = 0;
     virtual void listen(uint32_t backlog) = 0;
     virtual void shutdown(socket_shutdown_t how) = 0;
-    virtual size_t send(gsl::span<const uint8_t> buffer, socket_message_flag_t flags) = 0;
-    virtual size_t receive(gsl::span<uint8_t> buffer, socket_message_flag_t flags) = 0;
-    virtual size_t send_to(gsl::span<const uint8_t> buffer, socket_message_flag_t flags, const socket_address_t &to) = 0;
-    virtual size_t receive_from(gsl::span<uint8_t> buffer, socket_message_flag_t flags, socket_address_t *from) = 0;
-    virtual size_t read(gsl::span<uint8_t> buffer) = 0;
-    virtual size_t write(gsl::span<const uint8_t> buffer) = 0;
+    virtual result<size_t> send(gsl::span<const uint8_t> buffer, socket_message_flag_t flags) = 0;
+    virtual result<size_t> receive(gsl::span<uint8_t> buffer, socket_message_flag_t flags) = 0;
+    virtual result<size_t> send_to(gsl::span<const uint8_t> buffer, socket_message_flag_t flags, const socket_address_t &to) = 0;
+    virtual result<size_t> receive_from(gsl::span<uint8_t> buffer, socket_message_flag_t flags, socket_address_t *from) = 0;
+    virtual result<size_t> read(gsl::span<uint8_t> buffer) = 0;
+    virtual result<size_t> write(gsl::span<const uint8_t> buffer) = 0;
+    virtual result<size_t> readv(gsl::span<const io_vec_t> buffers) = 0;
+    virtual result<size_t> writev(gsl::span<const io_vec_t> buffers) = 0;
     virtual int fcntl(int cmd, int val) = 0;
     virtual void select(fd_set *readset, fd_set *writeset, fd_set *exceptset, struct timeval *timeout) = 0;
 };
@@ -474,6 +647,27 @@ object_accessor<driver> system_open_driver(const char *name);
 handle_t system_alloc_handle(object_accessor<object_access> object);
 
 object_accessor<object_access> &system_handle_to_object(handle_t file);
+
+/* Typed DMA access for the built-in drivers, without handles, RTTI or virtual dispatch */
+dma_driver &dma_acquire_channel(dma_priority_t priority = DMA_PRIORITY_NORMAL, dma_subsystem_t subsystem = DMA_SUBSYSTEM_NONE);
+/* Returns nullptr if no channel is granted within timeout ticks */
+dma_driver *dma_try_acquire_channel(dma_priority_t priority, dma_subsystem_t subsystem, TickType_t timeout);
+void dma_release_channel(dma_driver &channel);
+void dma_release_channel_from_isr(dma_driver &channel, BaseType_t *higher_priority_task_woken);
+void dma_set_request_source(dma_driver &channel, uint32_t request);
+void dma_transmit_async(dma_driver &channel, const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size, SemaphoreHandle_t completion_event);
+/* Signals the channel's own completion object, which dma_wait takes */
+void dma_transmit_async(dma_driver &channel, const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size);
+void dma_transmit_sg_async(dma_driver &channel, gsl::span<const dma_sg_item_t> items, bool src_inc, bool dest_inc, size_t element_size, size_t burst_size);
+/* Runs handler from the completion isr of the next transfer, before its completion event is given.
+ * With release set the channel is handed back in the isr as well, right after handler. */
+void dma_set_completion_handler(dma_driver &channel, dma_stage_completion_handler_t handler, void *userdata, bool release);
+void dma_wait(dma_driver &channel);
+void dma_transmit(dma_driver &channel, const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size);
+
+/* Sub-word elements to and from the one word per element layout of peripheral data registers */
+void dma_widen(uint32_t *dest, const volatile void *src, size_t element_size, size_t count, bool src_inc);
+void dma_narrow(volatile void *dest, const uint32_t *src, size_t element_size, size_t count, bool dest_inc);
 }
 
 #endif /* _FREERTOS_DRIVER_H */
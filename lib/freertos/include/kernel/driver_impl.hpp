@@ -63,6 +63,7 @@ public:
 
     virtual void open() override;
     virtual void close() override;
+    virtual bool try_open() override;
 
 protected:
     virtual void on_first_open();
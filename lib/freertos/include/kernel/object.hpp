@@ -16,11 +16,39 @@
 #define _FREERTOS_OBJECT_H
 
 #include "osdefs.h"
+#include <exception>
 #include <typeinfo>
 #include <utility>
 
+/* With -fno-exceptions a throw becomes a fatal error and catch clauses are never entered */
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+#define SYS_TRY try
+#define SYS_CATCH(x) catch (x)
+#define SYS_CATCH_ALL catch (...)
+#define SYS_THROW(x) throw x
+#else
+#define SYS_NO_EXCEPTIONS 1
+#define SYS_TRY if (true)
+#define SYS_CATCH(x) else if (false) for (x = ::sys::no_exception(); false;)
+#define SYS_CATCH_ALL else if (false)
+#define SYS_THROW(x) ::sys::throw_fatal(x)
+#endif
+
 namespace sys
 {
+#ifdef SYS_NO_EXCEPTIONS
+struct no_exception
+{
+    template <class T>
+    operator T &() const noexcept
+    {
+        __builtin_unreachable();
+    }
+};
+
+[[noreturn]] void throw_fatal(const std::exception &e) noexcept;
+#endif
+
 class access_denied_exception : public std::exception
 {
 public:
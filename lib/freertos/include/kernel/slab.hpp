@@ -0,0 +1,118 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _FREERTOS_SLAB_H
+#define _FREERTOS_SLAB_H
+
+#include "object.hpp"
+#include <atomic.h>
+#include <cstddef>
+#include <new>
+
+namespace sys
+{
+/* Fixed size block allocator. Slabs are taken from the heap on demand and never given back,
+ * so a long running system only sees a few slab sized heap allocations per object type. */
+class slab_allocator
+{
+public:
+    constexpr slab_allocator(const char *name, size_t object_size, size_t objects_per_slab) noexcept
+        : name_(name), object_size_(object_size), block_size_(align_block(object_size)), objects_per_slab_(objects_per_slab), lock_(SPINLOCK_INIT), free_list_(nullptr), slabs_(0), in_use_(0), peak_(0), allocations_(0), fallbacks_(0), next_(nullptr)
+    {
+    }
+
+    slab_allocator(slab_allocator &) = delete;
+    slab_allocator &operator=(slab_allocator &) = delete;
+
+    size_t object_size() const noexcept
+    {
+        return object_size_;
+    }
+
+    void *allocate() noexcept;
+    void deallocate(void *ptr) noexcept;
+    void *allocate_fallback(size_t size) noexcept;
+    void get_statistics(slab_statistics_t &stats) noexcept;
+
+    static size_t get_all_statistics(slab_statistics_t *stats, size_t count) noexcept;
+
+private:
+    struct free_block
+    {
+        free_block *next;
+    };
+
+    static constexpr size_t align_block(size_t size) noexcept
+    {
+        return (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    }
+
+    bool grow() noexcept;
+    void lock() noexcept;
+    void unlock() noexcept;
+
+private:
+    const char *name_;
+    size_t object_size_;
+    size_t block_size_;
+    size_t objects_per_slab_;
+    spinlock_t lock_;
+    free_block *free_list_;
+    size_t slabs_;
+    size_t in_use_;
+    size_t peak_;
+    size_t allocations_;
+    size_t fallbacks_;
+    slab_allocator *next_;
+};
+
+/* Routes new/delete of T through its slab_allocator, which is defined with DEFINE_SLAB_OBJECT
+ * in the translation unit that implements T. Derived classes of another size use the heap. */
+template <class T>
+class slab_object
+{
+public:
+    static void *operator new(size_t size)
+    {
+        auto ptr = operator new(size, std::nothrow);
+        if (!ptr)
+            SYS_THROW(std::bad_alloc());
+        return ptr;
+    }
+
+    static void *operator new(size_t size, const std::nothrow_t &) noexcept
+    {
+        if (size == allocator_.object_size())
+            return allocator_.allocate();
+        return allocator_.allocate_fallback(size);
+    }
+
+    static void operator delete(void *ptr, size_t size) noexcept
+    {
+        if (size == allocator_.object_size())
+            allocator_.deallocate(ptr);
+        else
+            ::operator delete(ptr);
+    }
+
+private:
+    static slab_allocator allocator_;
+};
+
+#define DEFINE_SLAB_OBJECT(type, objects_per_slab) \
+    template <>                                    \
+    sys::slab_allocator sys::slab_object<type>::allocator_(#type, sizeof(type), objects_per_slab)
+}
+
+#endif /* _FREERTOS_SLAB_H */
@@ -34,6 +34,146 @@ extern "C"
 
 typedef uintptr_t handle_t;
 
+typedef struct _io_vec
+{
+    void *base;
+    size_t len;
+} io_vec_t;
+
+typedef struct _dma_sg_item
+{
+    const volatile void *src;
+    volatile void *dest;
+    size_t count;
+} dma_sg_item_t;
+
+typedef enum _io_opcode
+{
+    IO_OP_READ,
+    IO_OP_WRITE,
+    IO_OP_CONTROL
+} io_opcode_t;
+
+typedef struct _io_completion
+{
+    void *userdata;
+    int result;
+    int error;
+} io_completion_t;
+
+typedef void (*io_completion_handler_t)(const io_completion_t *completion);
+
+typedef struct _io_submission
+{
+    handle_t file;
+    io_opcode_t opcode;
+    uint32_t control_code;
+    const uint8_t *write_buffer;
+    size_t write_len;
+    uint8_t *read_buffer;
+    size_t read_len;
+    void *userdata;
+    io_completion_handler_t handler;
+} io_submission_t;
+
+typedef enum _dma_buffer_flags
+{
+    DMA_BUFFER_CACHED = 0,
+    /* Accessed through the uncached alias at 0x40000000 */
+    DMA_BUFFER_UNCACHED = 1
+} dma_buffer_flags_t;
+
+/* Orders waiters for a DMA channel, and is written to the channel's ch_prior for the AXI arbitration */
+typedef enum _dma_priority
+{
+    DMA_PRIORITY_LOW = 0,
+    DMA_PRIORITY_NORMAL = 2,
+    DMA_PRIORITY_HIGH = 5,
+    DMA_PRIORITY_REALTIME = 7
+} dma_priority_t;
+
+typedef enum _dma_subsystem
+{
+    DMA_SUBSYSTEM_NONE,
+    DMA_SUBSYSTEM_AUDIO,
+    DMA_SUBSYSTEM_KPU,
+    DMA_SUBSYSTEM_NETWORK,
+    DMA_SUBSYSTEM_MAX
+} dma_subsystem_t;
+
+typedef struct _dma_channel_statistics
+{
+    const char *name;
+    /* DMA_SUBSYSTEM_NONE if the channel is shared */
+    dma_subsystem_t reserved_for;
+    size_t grants;
+    /* Grants to a waiter when the previous owner released the channel */
+    size_t handoffs;
+    /* Time the channel was owned and the time since the statistics started, in mtime ticks */
+    uint64_t busy_time;
+    uint64_t elapsed_time;
+} dma_channel_statistics_t;
+
+/* io_control codes of /dev/dmac0, the statistics are returned in read_buffer
+ * and the control returns the number of entries filled */
+typedef enum _dmac_control
+{
+    /* One dmac_transfer_statistics_t per channel */
+    DMAC_CONTROL_GET_CHANNEL_STATISTICS,
+    /* One dmac_transfer_statistics_t per AXI master */
+    DMAC_CONTROL_GET_MASTER_STATISTICS,
+    DMAC_CONTROL_RESET_STATISTICS
+} dmac_control_t;
+
+typedef struct _dmac_transfer_statistics
+{
+    uint64_t bytes;
+    uint64_t transfers;
+    /* Bytes of the transfers in flight */
+    uint64_t outstanding_bytes;
+    /* Time with a transfer in flight and the time since the statistics were reset, in mtime ticks */
+    uint64_t busy_time;
+    uint64_t elapsed_time;
+} dmac_transfer_statistics_t;
+
+typedef struct _slab_statistics
+{
+    const char *name;
+    size_t object_size;
+    size_t objects_per_slab;
+    size_t slabs;
+    size_t in_use;
+    size_t peak;
+    size_t allocations;
+    size_t fallbacks;
+} slab_statistics_t;
+
+#define IO_STATISTICS_BUCKETS 16
+/* Bucket i of the latency histogram counts calls of [2^(i + 8), 2^(i + 9)) cycles, the first and last are open ended */
+#define IO_STATISTICS_BUCKET_SHIFT 8
+
+typedef struct _io_statistics
+{
+    /* Driver name, NULL if unknown */
+    const char *name;
+    uint64_t calls;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t cycles;
+    uint32_t histogram[IO_STATISTICS_BUCKETS];
+} io_statistics_t;
+
+/* Control codes of /dev/iostat */
+typedef enum _iostat_control
+{
+    /* write_buffer: handle_t, read_buffer: io_statistics_t */
+    IOSTAT_GET_HANDLE,
+    /* write_buffer: uint32_t driver index, read_buffer: io_statistics_t. Fails past the last driver */
+    IOSTAT_GET_DRIVER,
+    /* write_buffer: handle_t to reset one handle, empty to reset all drivers */
+    IOSTAT_RESET
+} iostat_control_t;
+
 typedef enum _uart_stopbits
 {
     UART_STOP_1,
@@ -135,6 +275,32 @@ typedef enum _spi_slave_event
     SPI_EV_RECV,
 } spi_slave_event_t;
 
+typedef enum _spi_fifo_mode
+{
+    /* The CPU feeds the FIFO with interrupts masked, so hardware chip select stays asserted */
+    SPI_FIFO_POLLED,
+    /* The FIFO is refilled from the SPI interrupt and may run dry between refills */
+    SPI_FIFO_INTERRUPT
+} spi_fifo_mode_t;
+
+typedef enum _spi_segment_type
+{
+    SPI_SEGMENT_WRITE,
+    SPI_SEGMENT_READ,
+    SPI_SEGMENT_DELAY
+} spi_segment_type_t;
+
+typedef struct _spi_segment
+{
+    spi_segment_type_t type;
+    const uint8_t *write_buffer;
+    uint8_t *read_buffer;
+    /* Bytes to transfer, or microseconds to wait for SPI_SEGMENT_DELAY */
+    size_t length;
+    /* End the chip select frame after this segment, so the next one starts a new command */
+    bool cs_release;
+} spi_segment_t;
+
 typedef struct _spi_slave_handler
 {
     void (*on_receive)(uint32_t data);
@@ -142,6 +308,36 @@ typedef struct _spi_slave_handler
     spi_slave_event_t (*on_event)(uint32_t data);
 } spi_slave_handler_t;
 
+typedef void (*spi_slave_threshold_handler_t)(void *userdata);
+
+typedef struct _spi_slave_dma_config
+{
+    uint32_t data_bit_length;
+    /* Frames of the receive ring, a multiple of 4: the DMA fills it a quarter at a time */
+    size_t rx_frames;
+    /* Frames of the transmit ring, a multiple of 4, or 0 to only receive */
+    size_t tx_frames;
+    /* Unread frames from which on_threshold is called after each quarter received */
+    size_t threshold;
+    /* Called from the DMA interrupt, may be NULL */
+    spi_slave_threshold_handler_t on_threshold;
+    void *userdata;
+} spi_slave_dma_config_t;
+
+typedef struct _spi_slave_statistics
+{
+    uint64_t received_frames;
+    uint64_t sent_frames;
+    /* Receive quarters started over frames not read yet */
+    uint32_t rx_overruns;
+    /* Frames overwritten before spi_slave_read got to them */
+    uint64_t dropped_frames;
+    /* Transmit quarters sent before spi_slave_write had filled them */
+    uint32_t tx_underruns;
+    /* Receive FIFO overflows, frames lost while the DMA moved to the next quarter */
+    uint32_t fifo_overruns;
+} spi_slave_statistics_t;
+
 typedef enum _video_format
 {
     VIDEO_FMT_RGB565,
@@ -259,6 +455,19 @@ typedef struct _find_file_data
     char filename[MAX_PATH];
 } find_find_data_t;
 
+typedef struct _block_cache_statistics
+{
+    uint64_t read_hits;
+    uint64_t read_misses;
+    uint64_t write_hits;
+    uint64_t write_misses;
+    /* Blocks of requests long enough to go straight to the device */
+    uint64_t bypassed_blocks;
+    /* Dirty blocks written back, and the multi-block writes that carried them */
+    uint64_t written_back_blocks;
+    uint64_t write_back_runs;
+} block_cache_statistics_t;
+
 typedef enum _address_family
 {
     AF_UNSPECIFIED,
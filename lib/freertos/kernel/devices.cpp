@@ -17,11 +17,17 @@
 #include "device_priv.h"
 #include "filesystem.h"
 #include "hal.h"
-#include "kernel/driver.hpp"
+#include "kernel/driver_impl.hpp"
+#include "kernel/slab.hpp"
 #include <atomic.h>
+#include <atomic>
+#include <encoding.h>
+#include <errno.h>
 #include <plic.h>
 #include <semphr.h>
 #include <stdio.h>
+#include <task.h>
+#include <clint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sysctl.h>
@@ -29,9 +35,29 @@
 
 using namespace sys;
 
-#define MAX_HANDLES 256
 #define HANDLE_OFFSET 256
+#define HANDLE_SEGMENT_SIZE 256
+#define MAX_HANDLE_SEGMENTS 256
+#define HANDLE_INDEX_BITS 16
+#define HANDLE_INDEX_MASK ((1U << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_GENERATION_MASK 0x3FFFU
 #define MAX_CUSTOM_DRIVERS 32
+#define MAX_DMA_BUFFERS 32
+#define DMA_BUFFER_ALIGNMENT 64
+#define SRAM_CACHED_BASE 0x80000000
+#define SRAM_UNCACHED_BASE 0x40000000
+#define SRAM_DMA_SIZE (6 * 1024 * 1024)
+/* The main SRAM and the AI SRAM behind it */
+#define SRAM_ALIAS_SIZE (8 * 1024 * 1024)
+#define IO_WORKER_COUNT 2
+#define IO_WORKER_PRIORITY 3
+#define IO_WORKER_STACK_SIZE (configMINIMAL_STACK_SIZE * 4)
+/* Power of 2, larger than all the driver registries together */
+#define DRIVER_INDEX_SIZE 256
+
+#ifdef CONFIG_IO_STATISTICS
+#define MAX_IO_STAT_DRIVERS 64
+#endif
 
 #define DEFINE_INSTALL_DRIVER(type)          \
     static void install_##type##_drivers()   \
@@ -45,21 +71,85 @@ using namespace sys;
         }                                    \
     }
 
-#define CATCH_ALL           \
-    catch (errno_exception & e) \
+#define CATCH_ALL                  \
+    SYS_CATCH(errno_exception & e) \
     {                       \
         errno = e.code();    \
         return -1;          \
     }
 
+typedef enum
+{
+    FILE_KIND_OTHER,
+    FILE_KIND_UART,
+    FILE_KIND_I2C_DEVICE,
+    FILE_KIND_SPI_DEVICE,
+    FILE_KIND_FILESYSTEM_FILE,
+    FILE_KIND_NETWORK_SOCKET
+} file_kind_t;
+
+#ifdef CONFIG_IO_STATISTICS
+typedef struct
+{
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> cycles;
+    std::atomic<uint32_t> histogram[IO_STATISTICS_BUCKETS];
+} io_stat_t;
+
 typedef struct
+{
+    const char *name;
+    io_stat_t stat;
+} io_driver_stat_t;
+#endif
+
+struct _file : public slab_object<_file>
 {
     object_accessor<object_access> object;
-} _file;
+    /* Resolved once in io_alloc_file, so io_read/io_write/io_control don't need RTTI */
+    file_kind_t kind;
+    union {
+        uart_driver *uart;
+        i2c_device_driver *i2c_device;
+        spi_device_driver *spi_device;
+        filesystem_file *file;
+        network_socket *socket;
+    };
+    custom_driver *custom;
+    async_io_driver *async;
+#ifdef CONFIG_IO_STATISTICS
+    io_stat_t stat;
+    /* Shared by all the handles of a driver, null if untracked */
+    io_driver_stat_t *driver_stat;
+#endif
+};
+
+DEFINE_SLAB_OBJECT(_file, 16);
+
+/* Handle = HANDLE_OFFSET + (generation << HANDLE_INDEX_BITS | index), it must fit in a posix fd */
+static_assert(HANDLE_SEGMENT_SIZE * MAX_HANDLE_SEGMENTS == HANDLE_INDEX_MASK + 1, "Handle index bits mismatch.");
+static_assert(HANDLE_OFFSET + ((uint64_t)HANDLE_GENERATION_MASK << HANDLE_INDEX_BITS | HANDLE_INDEX_MASK) <= INT32_MAX, "Handle exceeds int range.");
 
-static _file *handles_[MAX_HANDLES];
+typedef struct
+{
+    std::atomic<_file *> file;
+    std::atomic<uint32_t> generation;
+    std::atomic<uint32_t> next_free;
+} handle_slot_t;
+
+static handle_slot_t handle_segment0_[HANDLE_SEGMENT_SIZE];
+static std::atomic<handle_slot_t *> handle_segments_[MAX_HANDLE_SEGMENTS] = { handle_segment0_ };
+/* Count of slot indices ever handed out */
+static std::atomic<uint32_t> handle_count_(0);
+/* Free slot stack: (tag << 32) | (index + 1), the tag guards against ABA */
+static std::atomic<uint64_t> handle_free_head_(0);
 static driver_registry_t g_custom_drivers[MAX_CUSTOM_DRIVERS];
+static std::atomic<size_t> custom_drivers_count_(0);
 static const char dummy_driver_name[] = "";
+/* Open addressing hash index by name over the system, hal and custom drivers */
+static std::atomic<driver_registry_t *> driver_index_[DRIVER_INDEX_SIZE];
 
 uintptr_t fft_file_;
 uintptr_t aes_file_;
@@ -72,56 +162,74 @@ DEFINE_INSTALL_DRIVER(hal);
 DEFINE_INSTALL_DRIVER(dma);
 DEFINE_INSTALL_DRIVER(system);
 
-object_accessor<driver> find_free_driver(driver_registry_t *registry, const char *name)
+static uint32_t hash_driver_name(const char *name)
+{
+    uint32_t hash = 2166136261U;
+    while (*name)
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static void index_driver(driver_registry_t *registry)
+{
+    uint32_t i = hash_driver_name(registry->name);
+    for (size_t probes = 0; probes < DRIVER_INDEX_SIZE; probes++, i++)
+    {
+        auto &slot = driver_index_[i & (DRIVER_INDEX_SIZE - 1)];
+        driver_registry_t *head = nullptr;
+        if (slot.compare_exchange_strong(head, registry, std::memory_order_acq_rel))
+            return;
+        /* The first registered driver wins, as it did with the linear search */
+        if (strcmp(head->name, registry->name) == 0)
+            return;
+    }
+
+    configASSERT(!"Driver index is full.");
+}
+
+static void index_drivers(driver_registry_t *registry)
 {
     auto head = registry;
     while (head->name)
     {
-        if (strcmp(name, head->name) == 0)
-        {
-            auto &driver = head->driver_ptr;
-            try
-            {
-                return make_accessor(driver);
-            }
-            catch (...)
-            {
-                return {};
-            }
-        }
-
+        index_driver(head);
         head++;
     }
-
-    return {};
 }
 
-object_accessor<driver> find_free_dynamic_driver(const char *name)
+static driver_registry_t *find_driver_registry(const char *name)
 {
-    size_t i = 0;
-    driver_registry_t *head = g_custom_drivers;
-    for (i = 0; i < MAX_CUSTOM_DRIVERS; i++, head++)
+    uint32_t i = hash_driver_name(name);
+    for (size_t probes = 0; probes < DRIVER_INDEX_SIZE; probes++, i++)
     {
-        if (head->name && strcmp(name, head->name) == 0)
-        {
-            auto &driver = head->driver_ptr;
-            try
-            {
-                return make_accessor(driver);
-            }
-            catch (...)
-            {
-                return {};
-            }
-        }
+        auto head = driver_index_[i & (DRIVER_INDEX_SIZE - 1)].load(std::memory_order_acquire);
+        if (!head)
+            break;
+        if (strcmp(head->name, name) == 0)
+            return head;
     }
 
+    return nullptr;
+}
+
+static object_accessor<driver> find_free_driver(const char *name)
+{
+    if (auto registry = find_driver_registry(name))
+        return try_make_accessor(registry->driver_ptr);
+
     return {};
 }
 
+static void install_iostat_driver();
+
 void install_drivers()
 {
     install_system_drivers();
+    install_iostat_driver();
 
     fft_file_ = io_open("/dev/fft0");
     aes_file_ = io_open("/dev/aes0");
@@ -129,14 +237,41 @@ void install_drivers()
     kpu_file_ = io_open("/dev/kpu0");
 }
 
+#define RESOLVE_FILE_KIND(t, m, k)      \
+    if (auto f = file->object.as<t>()) \
+    {                                  \
+        file->kind = k;                \
+        file->m = f;                   \
+    }
+
+static void io_resolve_file_kind(_file *file)
+{
+    /* clang-format off */
+    RESOLVE_FILE_KIND(uart_driver, uart, FILE_KIND_UART)
+    else RESOLVE_FILE_KIND(i2c_device_driver, i2c_device, FILE_KIND_I2C_DEVICE)
+    else RESOLVE_FILE_KIND(spi_device_driver, spi_device, FILE_KIND_SPI_DEVICE)
+    else RESOLVE_FILE_KIND(filesystem_file, file, FILE_KIND_FILESYSTEM_FILE)
+    else RESOLVE_FILE_KIND(network_socket, socket, FILE_KIND_NETWORK_SOCKET)
+    else
+    {
+        file->kind = FILE_KIND_OTHER;
+        file->uart = nullptr;
+    }
+    /* clang-format on */
+
+    file->custom = file->object.as<custom_driver>();
+    file->async = file->object.as<async_io_driver>();
+}
+
 static _file *io_alloc_file(object_accessor<object_access> object)
 {
     if (object)
     {
-        _file *file = new (std::nothrow) _file;
+        _file *file = new (std::nothrow) _file();
         if (!file)
             return nullptr;
         file->object = std::move(object);
+        io_resolve_file_kind(file);
         return file;
     }
 
@@ -151,100 +286,322 @@ static _file *io_alloc_file(object_ptr<object_access> object)
     return nullptr;
 }
 
-static _file *io_open_reg(driver_registry_t *registry, const char *name, _file **file)
+/* IO Statistics */
+
+#ifdef CONFIG_IO_STATISTICS
+static io_driver_stat_t io_driver_stats_[MAX_IO_STAT_DRIVERS];
+static std::atomic<size_t> io_driver_stats_count_(0);
+static spinlock_t io_driver_stats_lock_ = SPINLOCK_INIT;
+
+static io_driver_stat_t *io_stat_find_driver(const char *name)
 {
-    auto driver = find_free_driver(registry, name);
-    if (driver)
+    /* Names are compared by address, they come from the driver registries */
+    size_t count = io_driver_stats_count_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; i++)
     {
-        _file *ret = io_alloc_file(std::move(driver));
-        *file = ret;
-        return ret;
+        if (io_driver_stats_[i].name == name)
+            return io_driver_stats_ + i;
     }
 
-    return nullptr;
+    io_driver_stat_t *stat = nullptr;
+    vTaskEnterCritical();
+    spinlock_lock(&io_driver_stats_lock_);
+    count = io_driver_stats_count_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (io_driver_stats_[i].name == name)
+            stat = io_driver_stats_ + i;
+    }
+
+    if (!stat && count < MAX_IO_STAT_DRIVERS)
+    {
+        stat = io_driver_stats_ + count;
+        stat->name = name;
+        io_driver_stats_count_.store(count + 1, std::memory_order_release);
+    }
+
+    spinlock_unlock(&io_driver_stats_lock_);
+    vTaskExitCritical();
+    return stat;
 }
 
-static _file *io_open_dynamic(const char *name, _file **file)
+static void io_stat_attach(_file *file, const char *name)
 {
-    auto driver = find_free_dynamic_driver(name);
-    if (driver)
+    if (file)
     {
-        _file *ret = io_alloc_file(std::move(driver));
-        *file = ret;
-        return ret;
+        if (!name)
+        {
+            if (file->kind == FILE_KIND_FILESYSTEM_FILE)
+                name = "filesystem";
+            else if (file->kind == FILE_KIND_NETWORK_SOCKET)
+                name = "network";
+            else
+                return;
+        }
+
+        file->driver_stat = io_stat_find_driver(name);
     }
+}
 
-    return nullptr;
+static void io_stat_inherit(_file *file, _file *parent)
+{
+    if (file)
+        file->driver_stat = parent->driver_stat;
 }
 
-/* Generic IO Implementation Helper Macros */
+static void io_stat_record(io_stat_t &stat, uint64_t cycles, size_t bytes, bool error)
+{
+    int bucket = 63 - __builtin_clzll(cycles | 1) - IO_STATISTICS_BUCKET_SHIFT;
+    if (bucket < 0)
+        bucket = 0;
+    else if (bucket >= IO_STATISTICS_BUCKETS)
+        bucket = IO_STATISTICS_BUCKETS - 1;
+
+    stat.calls.fetch_add(1, std::memory_order_relaxed);
+    stat.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    if (error)
+        stat.errors.fetch_add(1, std::memory_order_relaxed);
+    stat.cycles.fetch_add(cycles, std::memory_order_relaxed);
+    stat.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+static void io_stat_reset(io_stat_t &stat)
+{
+    stat.calls.store(0, std::memory_order_relaxed);
+    stat.bytes.store(0, std::memory_order_relaxed);
+    stat.errors.store(0, std::memory_order_relaxed);
+    stat.cycles.store(0, std::memory_order_relaxed);
+    for (auto &bucket : stat.histogram)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+static void io_stat_get(const io_stat_t &stat, const char *name, io_statistics_t &statistics)
+{
+    statistics.name = name;
+    statistics.calls = stat.calls.load(std::memory_order_relaxed);
+    statistics.bytes = stat.bytes.load(std::memory_order_relaxed);
+    statistics.errors = stat.errors.load(std::memory_order_relaxed);
+    statistics.cycles = stat.cycles.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < IO_STATISTICS_BUCKETS; i++)
+        statistics.histogram[i] = stat.histogram[i].load(std::memory_order_relaxed);
+}
 
-#define DEFINE_READ_PROXY(t)                                  \
-    if (auto f = rfile->object.as<t>())                       \
-    {                                                         \
-        return (int)f->read({ buffer, std::ptrdiff_t(len) }); \
+/* Times one call with mcycle. A task that migrates to the other core mid call may land in the last bucket. */
+class io_stat_scope
+{
+public:
+    io_stat_scope(_file *file) noexcept
+        : file_(file), start_(read_csr(mcycle)), completed_(false)
+    {
     }
 
-#define DEFINE_WRITE_PROXY(t)                                  \
-    if (auto f = rfile->object.as<t>())                        \
-    {                                                          \
-        return (int)f->write({ buffer, std::ptrdiff_t(len) }); \
+    ~io_stat_scope()
+    {
+        /* Calls without a result fail only by unwinding */
+        if (!completed_)
+            record(0, std::uncaught_exceptions() != 0);
     }
 
-#define DEFINE_CONTROL_PROXY(t)                                                                                                       \
-    if (auto t = rfile->object.as<t##_driver>())                                                                                      \
-    {                                                                                                                                 \
-        return (int)t->control(control_code, { write_buffer, std::ptrdiff_t(write_len) }, { read_buffer, std::ptrdiff_t(read_len) }); \
+    int transfer(int result) noexcept
+    {
+        return complete(result, result > 0 ? result : 0);
     }
 
-static void dma_add_free();
+    int complete(int result, size_t bytes) noexcept
+    {
+        record(result < 0 ? 0 : bytes, result < 0);
+        completed_ = true;
+        return result;
+    }
 
-int io_read(handle_t file, uint8_t *buffer, size_t len)
+private:
+    void record(size_t bytes, bool error) noexcept
+    {
+        uint64_t cycles = read_csr(mcycle) - start_;
+        io_stat_record(file_->stat, cycles, bytes, error);
+        if (auto driver_stat = file_->driver_stat)
+            io_stat_record(driver_stat->stat, cycles, bytes, error);
+    }
+
+private:
+    _file *file_;
+    uint64_t start_;
+    bool completed_;
+};
+
+#define IO_STAT_SCOPE(file) io_stat_scope io_stat(file)
+#define IO_STAT_TRANSFER(x) io_stat.transfer(x)
+#define IO_STAT_COMPLETE(x, bytes) io_stat.complete(x, bytes)
+#else
+#define IO_STAT_SCOPE(file)
+#define IO_STAT_TRANSFER(x) (x)
+#define IO_STAT_COMPLETE(x, bytes) (x)
+
+static void io_stat_attach(_file *file, const char *name)
+{
+}
+
+static void io_stat_inherit(_file *file, _file *parent)
+{
+}
+#endif
+
+/* Generic IO Implementation Helper Macros */
+
+static int io_return(int value)
+{
+    return value;
+}
+
+template <class T>
+static int io_return(const result<T> &value)
+{
+    return result_to_errno(value);
+}
+
+#define DEFINE_READ_PROXY(k, t) \
+    case k:                     \
+        return IO_STAT_TRANSFER(io_return(rfile->t->read({ buffer, std::ptrdiff_t(len) })));
+
+#define DEFINE_WRITE_PROXY(k, t) \
+    case k:                      \
+        return IO_STAT_TRANSFER(io_return(rfile->t->write({ buffer, std::ptrdiff_t(len) })));
+
+#define DEFINE_READV_PROXY(k, t) \
+    case k:                      \
+        return IO_STAT_TRANSFER(io_return(rfile->t->readv({ vecs, std::ptrdiff_t(count) })));
+
+#define DEFINE_WRITEV_PROXY(k, t) \
+    case k:                       \
+        return IO_STAT_TRANSFER(io_return(rfile->t->writev({ vecs, std::ptrdiff_t(count) })));
+
+#define IO_ENTRY                            \
+    _file *rfile = io_handle_to_file(file); \
+    if (!rfile)                             \
+    {                                       \
+        errno = EBADF;                      \
+        return -1;                          \
+    }                                       \
+    IO_STAT_SCOPE(rfile)
+
+static void dma_channel_released(dma_driver &channel, BaseType_t *higher_priority_task_woken);
+
+static void io_free(_file *file)
 {
-    try
+    if (file)
     {
-        configASSERT(file >= HANDLE_OFFSET);
-        _file *rfile = (_file *)handles_[file - HANDLE_OFFSET];
-        /* clang-format off */
-        DEFINE_READ_PROXY(uart_driver)
-        else DEFINE_READ_PROXY(i2c_device_driver)
-        else DEFINE_READ_PROXY(spi_device_driver)
-        else DEFINE_READ_PROXY(filesystem_file)
-        else DEFINE_READ_PROXY(network_socket)
-        else
+        auto dma = file->object.as<dma_driver>();
+        delete file;
+        if (dma)
         {
-            return -1;
+            dma->release_buffers();
+            dma_channel_released(*dma, nullptr);
         }
-        /* clang-format on */
     }
-    CATCH_ALL;
 }
 
-static void io_free(_file *file)
+static handle_slot_t *io_get_handle_slot(uint32_t index)
 {
-    if (file)
+    auto slots = handle_segments_[index / HANDLE_SEGMENT_SIZE].load(std::memory_order_acquire);
+    return slots ? slots + index % HANDLE_SEGMENT_SIZE : nullptr;
+}
+
+static handle_slot_t *io_grow_handle_slot(uint32_t index)
+{
+    auto &segment = handle_segments_[index / HANDLE_SEGMENT_SIZE];
+    auto slots = segment.load(std::memory_order_acquire);
+    if (!slots)
     {
-        if (file->object.is<dma_driver>())
-            dma_add_free();
+        auto new_slots = new (std::nothrow) handle_slot_t[HANDLE_SEGMENT_SIZE]();
+        if (!new_slots)
+            return nullptr;
+        if (segment.compare_exchange_strong(slots, new_slots, std::memory_order_acq_rel))
+            slots = new_slots;
+        else
+            delete[] new_slots;
+    }
 
-        delete file;
+    return slots + index % HANDLE_SEGMENT_SIZE;
+}
+
+static bool io_pop_free_handle(uint32_t &index)
+{
+    uint64_t head = handle_free_head_.load(std::memory_order_acquire);
+    while (head & 0xFFFFFFFF)
+    {
+        uint32_t top = (uint32_t)head - 1;
+        uint64_t next = ((head & ~0xFFFFFFFFULL) + (1ULL << 32)) | io_get_handle_slot(top)->next_free.load(std::memory_order_relaxed);
+        if (handle_free_head_.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            index = top;
+            return true;
+        }
     }
+
+    return false;
+}
+
+static void io_push_free_handle(uint32_t index)
+{
+    auto slot = io_get_handle_slot(index);
+    uint64_t head = handle_free_head_.load(std::memory_order_relaxed);
+    uint64_t next;
+    do
+    {
+        slot->next_free.store((uint32_t)head, std::memory_order_relaxed);
+        next = ((head & ~0xFFFFFFFFULL) + (1ULL << 32)) | (index + 1);
+    } while (!handle_free_head_.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+}
+
+static handle_slot_t *io_decode_handle(handle_t file, uint32_t &index, uint32_t &generation)
+{
+    if (file < HANDLE_OFFSET)
+        return nullptr;
+
+    uintptr_t value = file - HANDLE_OFFSET;
+    index = value & HANDLE_INDEX_MASK;
+    generation = value >> HANDLE_INDEX_BITS;
+    return io_get_handle_slot(index);
+}
+
+static _file *io_handle_to_file(handle_t file)
+{
+    uint32_t index, generation;
+    auto slot = io_decode_handle(file, index, generation);
+    if (!slot || slot->generation.load(std::memory_order_acquire) != generation)
+        return nullptr;
+    return slot->file.load(std::memory_order_acquire);
 }
 
 static handle_t io_alloc_handle(_file *file)
 {
     if (file)
     {
-        size_t i, j;
-        for (i = 0; i < 2; i++)
+        uint32_t index;
+        handle_slot_t *slot = nullptr;
+        if (io_pop_free_handle(index))
+        {
+            slot = io_get_handle_slot(index);
+        }
+        else
         {
-            for (j = 0; j < MAX_HANDLES; j++)
+            /* Claim the next index only once its segment exists, so a failed allocation loses nothing */
+            index = handle_count_.load(std::memory_order_relaxed);
+            while (index <= HANDLE_INDEX_MASK && (slot = io_grow_handle_slot(index)))
             {
-                if (atomic_cas(handles_ + j, 0, file) == 0)
-                    return j + HANDLE_OFFSET;
+                if (handle_count_.compare_exchange_weak(index, index + 1, std::memory_order_relaxed))
+                    break;
+                slot = nullptr;
             }
         }
 
+        if (slot)
+        {
+            slot->file.store(file, std::memory_order_release);
+            uint32_t generation = slot->generation.load(std::memory_order_relaxed);
+            return HANDLE_OFFSET + ((generation << HANDLE_INDEX_BITS) | index);
+        }
+
         io_free(file);
         return 0;
     }
@@ -254,19 +611,13 @@ static handle_t io_alloc_handle(_file *file)
 
 handle_t io_open(const char *name)
 {
-    _file *file = 0;
-    if (io_open_reg(g_system_drivers, name, &file))
-    {
-    }
-    else if (io_open_reg(g_hal_drivers, name, &file))
-    {
-    }
-    else if (io_open_dynamic(name, &file))
-    {
-    }
-
+    auto registry = find_driver_registry(name);
+    _file *file = registry ? io_alloc_file(try_make_accessor(registry->driver_ptr)) : nullptr;
     if (file)
+    {
+        io_stat_attach(file, registry->name);
         return io_alloc_handle(file);
+    }
     configASSERT(file);
     return 0;
 }
@@ -275,65 +626,430 @@ int io_close(handle_t file)
 {
     if (file)
     {
-        configASSERT(file >= HANDLE_OFFSET);
-        _file *rfile = (_file *)handles_[file - HANDLE_OFFSET];
-        io_free(rfile);
-        atomic_set(handles_ + file - HANDLE_OFFSET, 0);
+        uint32_t index, generation;
+        auto slot = io_decode_handle(file, index, generation);
+        /* Only the closer that advances the generation owns the slot */
+        if (!slot || !slot->generation.compare_exchange_strong(generation, (generation + 1) & HANDLE_GENERATION_MASK, std::memory_order_acq_rel))
+        {
+            errno = EBADF;
+            return -1;
+        }
+
+        io_free(slot->file.exchange(nullptr, std::memory_order_acq_rel));
+        io_push_free_handle(index);
     }
 
     return 0;
 }
 
+int io_read(handle_t file, uint8_t *buffer, size_t len)
+{
+    SYS_TRY
+    {
+        IO_ENTRY;
+        switch (rfile->kind)
+        {
+            DEFINE_READ_PROXY(FILE_KIND_UART, uart)
+            DEFINE_READ_PROXY(FILE_KIND_I2C_DEVICE, i2c_device)
+            DEFINE_READ_PROXY(FILE_KIND_SPI_DEVICE, spi_device)
+            DEFINE_READ_PROXY(FILE_KIND_FILESYSTEM_FILE, file)
+            DEFINE_READ_PROXY(FILE_KIND_NETWORK_SOCKET, socket)
+        default:
+            return IO_STAT_TRANSFER(-1);
+        }
+    }
+    CATCH_ALL;
+}
+
 int io_write(handle_t file, const uint8_t *buffer, size_t len)
 {
-    try
+    SYS_TRY
     {
-        configASSERT(file >= HANDLE_OFFSET);
-        _file *rfile = (_file *)handles_[file - HANDLE_OFFSET];
-        /* clang-format off */
-        DEFINE_WRITE_PROXY(uart_driver)
-        else DEFINE_WRITE_PROXY(i2c_device_driver)
-        else DEFINE_WRITE_PROXY(spi_device_driver)
-        else DEFINE_WRITE_PROXY(filesystem_file)
-        else DEFINE_WRITE_PROXY(network_socket)
-        else
+        IO_ENTRY;
+        switch (rfile->kind)
         {
-            return -1;
+            DEFINE_WRITE_PROXY(FILE_KIND_UART, uart)
+            DEFINE_WRITE_PROXY(FILE_KIND_I2C_DEVICE, i2c_device)
+            DEFINE_WRITE_PROXY(FILE_KIND_SPI_DEVICE, spi_device)
+            DEFINE_WRITE_PROXY(FILE_KIND_FILESYSTEM_FILE, file)
+            DEFINE_WRITE_PROXY(FILE_KIND_NETWORK_SOCKET, socket)
+        default:
+            return IO_STAT_TRANSFER(-1);
+        }
+    }
+    CATCH_ALL;
+}
+
+int io_readv(handle_t file, const io_vec_t *vecs, size_t count)
+{
+    SYS_TRY
+    {
+        IO_ENTRY;
+        switch (rfile->kind)
+        {
+            DEFINE_READV_PROXY(FILE_KIND_UART, uart)
+            DEFINE_READV_PROXY(FILE_KIND_I2C_DEVICE, i2c_device)
+            DEFINE_READV_PROXY(FILE_KIND_SPI_DEVICE, spi_device)
+            DEFINE_READV_PROXY(FILE_KIND_FILESYSTEM_FILE, file)
+            DEFINE_READV_PROXY(FILE_KIND_NETWORK_SOCKET, socket)
+        default:
+            return IO_STAT_TRANSFER(-1);
+        }
+    }
+    CATCH_ALL;
+}
+
+int io_writev(handle_t file, const io_vec_t *vecs, size_t count)
+{
+    SYS_TRY
+    {
+        IO_ENTRY;
+        switch (rfile->kind)
+        {
+            DEFINE_WRITEV_PROXY(FILE_KIND_UART, uart)
+            DEFINE_WRITEV_PROXY(FILE_KIND_I2C_DEVICE, i2c_device)
+            DEFINE_WRITEV_PROXY(FILE_KIND_SPI_DEVICE, spi_device)
+            DEFINE_WRITEV_PROXY(FILE_KIND_FILESYSTEM_FILE, file)
+            DEFINE_WRITEV_PROXY(FILE_KIND_NETWORK_SOCKET, socket)
+        default:
+            return IO_STAT_TRANSFER(-1);
         }
-        /* clang-format on */
     }
     CATCH_ALL;
 }
 
-int io_control(handle_t file, uint32_t control_code, const uint8_t *write_buffer, size_t write_len, uint8_t *read_buffer, size_t read_len)
+int io_control(handle_t file, uint32_t control_code, const uint8_t *write_buffer, size_t write_len, uint8_t *read_buffer, size_t read_len)
+{
+    SYS_TRY
+    {
+        IO_ENTRY;
+        if (auto custom = rfile->custom)
+            return IO_STAT_COMPLETE((int)custom->control(control_code, { write_buffer, std::ptrdiff_t(write_len) }, { read_buffer, std::ptrdiff_t(read_len) }), 0);
+        return IO_STAT_COMPLETE(-1, 0);
+    }
+    CATCH_ALL;
+}
+
+/* Async IO */
+
+typedef struct
+{
+    io_submission_t submission;
+    /* Null when the operation runs on an io worker */
+    async_io_driver *async;
+    async_io_state state;
+    uint32_t sequence;
+    int result;
+    int error;
+    bool busy;
+} io_operation_t;
+
+static QueueHandle_t io_worker_queue_;
+
+static void io_worker_thread(void *arg)
+{
+    io_operation_t *op;
+    while (1)
+    {
+        if (xQueueReceive(io_worker_queue_, &op, portMAX_DELAY) == pdTRUE)
+        {
+            auto &sub = op->submission;
+            errno = 0;
+            SYS_TRY
+            {
+                switch (sub.opcode)
+                {
+                case IO_OP_READ:
+                    op->result = io_read(sub.file, sub.read_buffer, sub.read_len);
+                    break;
+                case IO_OP_WRITE:
+                    op->result = io_write(sub.file, sub.write_buffer, sub.write_len);
+                    break;
+                case IO_OP_CONTROL:
+                    op->result = io_control(sub.file, sub.control_code, sub.write_buffer, sub.write_len, sub.read_buffer, sub.read_len);
+                    break;
+                default:
+                    op->result = -1;
+                    errno = EINVAL;
+                    break;
+                }
+            }
+            SYS_CATCH_ALL
+            {
+                op->result = -1;
+                errno = EIO;
+            }
+
+            op->error = op->result < 0 ? errno : 0;
+            xSemaphoreGive(op->state.completion_event);
+        }
+    }
+}
+
+static void io_start_workers()
+{
+    vTaskEnterCritical();
+    bool created = io_worker_queue_ != nullptr;
+    if (!created)
+        io_worker_queue_ = xQueueCreate(IO_WORKER_COUNT * 8, sizeof(io_operation_t *));
+    vTaskExitCritical();
+
+    if (!created)
+    {
+        configASSERT(io_worker_queue_);
+        for (size_t i = 0; i < IO_WORKER_COUNT; i++)
+            configASSERT(xTaskCreate(io_worker_thread, "io worker", IO_WORKER_STACK_SIZE, nullptr, IO_WORKER_PRIORITY, nullptr) == pdPASS);
+    }
+}
+
+class k_io_queue : public heap_object, public exclusive_object_access
+{
+public:
+    k_io_queue(size_t depth)
+        : operations_(new io_operation_t[depth]()), depth_(depth), sequence_(0), owner_(xTaskGetCurrentTaskHandle())
+    {
+        for (size_t i = 0; i < depth_; i++)
+        {
+            auto event = xSemaphoreCreateBinary();
+            configASSERT(event);
+            operations_[i].state.completion_event = event;
+        }
+    }
+
+    ~k_io_queue()
+    {
+        for (size_t i = 0; i < depth_; i++)
+            vSemaphoreDelete(operations_[i].state.completion_event);
+    }
+
+    size_t submit(gsl::span<const io_submission_t> submissions)
+    {
+        configASSERT(owner_ == xTaskGetCurrentTaskHandle());
+        size_t submitted = 0;
+        for (auto &sub : submissions)
+        {
+            auto op = alloc_operation();
+            if (!op)
+                break;
+
+            op->submission = sub;
+            op->async = nullptr;
+            op->sequence = sequence_++;
+            op->busy = true;
+            submitted++;
+
+            _file *rfile = io_handle_to_file(sub.file);
+            if (!rfile)
+            {
+                complete_failed(*op, EBADF);
+                continue;
+            }
+
+            if (rfile->async && sub.opcode != IO_OP_CONTROL)
+            {
+                /* Without exceptions SYS_CATCH wraps its handler in a for, keep the continue outside */
+                int error = 0;
+                SYS_TRY
+                {
+                    bool started = sub.opcode == IO_OP_READ
+                        ? rfile->async->begin_read({ sub.read_buffer, std::ptrdiff_t(sub.read_len) }, op->state)
+                        : rfile->async->begin_write({ sub.write_buffer, std::ptrdiff_t(sub.write_len) }, op->state);
+                    if (started)
+                    {
+                        op->async = rfile->async;
+                        continue;
+                    }
+                }
+                SYS_CATCH(errno_exception & e)
+                {
+                    error = e.code();
+                }
+                SYS_CATCH_ALL
+                {
+                    error = EIO;
+                }
+
+                if (error)
+                {
+                    complete_failed(*op, error);
+                    continue;
+                }
+            }
+
+            io_start_workers();
+            configASSERT(xQueueSend(io_worker_queue_, &op, portMAX_DELAY) == pdTRUE);
+        }
+
+        return submitted;
+    }
+
+    size_t reap(gsl::span<io_completion_t> completions, size_t min_complete, TickType_t timeout)
+    {
+        configASSERT(owner_ == xTaskGetCurrentTaskHandle());
+        size_t reaped = 0;
+        size_t count = completions.size();
+        min_complete = std::min(min_complete, count);
+        TimeOut_t time_out;
+        vTaskSetTimeOutState(&time_out);
+
+        while (reaped < count)
+        {
+            for (size_t i = 0; i < depth_ && reaped < count; i++)
+            {
+                auto &op = operations_[i];
+                if (op.busy && xSemaphoreTake(op.state.completion_event, 0) == pdTRUE)
+                    retire(op, completions[reaped++]);
+            }
+
+            if (reaped >= min_complete || reaped == count)
+                break;
+
+            /* Block on the oldest operation, the others are picked up by the next sweep */
+            auto oldest = find_oldest_operation();
+            if (!oldest || xTaskCheckForTimeOut(&time_out, &timeout) != pdFALSE)
+                break;
+            if (xSemaphoreTake(oldest->state.completion_event, timeout) != pdTRUE)
+                break;
+            retire(*oldest, completions[reaped++]);
+        }
+
+        return reaped;
+    }
+
+protected:
+    virtual void on_last_close() override
+    {
+        io_completion_t completion;
+        for (size_t i = 0; i < depth_; i++)
+        {
+            auto &op = operations_[i];
+            if (op.busy)
+            {
+                configASSERT(xSemaphoreTake(op.state.completion_event, portMAX_DELAY) == pdTRUE);
+                op.submission.handler = nullptr;
+                retire(op, completion);
+            }
+        }
+    }
+
+private:
+    io_operation_t *alloc_operation()
+    {
+        for (size_t i = 0; i < depth_; i++)
+        {
+            if (!operations_[i].busy)
+                return &operations_[i];
+        }
+
+        return nullptr;
+    }
+
+    io_operation_t *find_oldest_operation()
+    {
+        io_operation_t *oldest = nullptr;
+        for (size_t i = 0; i < depth_; i++)
+        {
+            auto &op = operations_[i];
+            if (op.busy && (!oldest || int32_t(op.sequence - oldest->sequence) < 0))
+                oldest = &op;
+        }
+
+        return oldest;
+    }
+
+    /* Completes an operation that never started, the next reap picks it up */
+    void complete_failed(io_operation_t &op, int error)
+    {
+        op.result = -1;
+        op.error = error;
+        xSemaphoreGive(op.state.completion_event);
+    }
+
+    void retire(io_operation_t &op, io_completion_t &completion)
+    {
+        if (op.async)
+        {
+            SYS_TRY
+            {
+                op.result = op.async->end_io(op.state);
+                op.error = 0;
+            }
+            SYS_CATCH(errno_exception & e)
+            {
+                op.result = -1;
+                op.error = e.code();
+            }
+            SYS_CATCH_ALL
+            {
+                op.result = -1;
+                op.error = EIO;
+            }
+        }
+
+        completion.userdata = op.submission.userdata;
+        completion.result = op.result;
+        completion.error = op.error;
+        op.busy = false;
+        if (op.submission.handler)
+            op.submission.handler(&completion);
+    }
+
+private:
+    std::unique_ptr<io_operation_t[]> operations_;
+    size_t depth_;
+    uint32_t sequence_;
+    TaskHandle_t owner_;
+};
+
+#define IO_QUEUE_ENTRY                                                  \
+    _file *rqueue = io_handle_to_file(queue);                           \
+    auto io_queue = rqueue ? rqueue->object.as<k_io_queue>() : nullptr; \
+    if (!io_queue)                                                      \
+    {                                                                   \
+        errno = EBADF;                                                  \
+        return -1;                                                      \
+    }
+
+handle_t io_queue_create(size_t depth)
+{
+    configASSERT(depth);
+    auto queue = make_object<k_io_queue>(depth);
+    return system_alloc_handle(make_accessor(queue));
+}
+
+int io_submit(handle_t queue, const io_submission_t *submissions, size_t count)
+{
+    SYS_TRY
+    {
+        IO_QUEUE_ENTRY;
+        return (int)io_queue->submit({ submissions, std::ptrdiff_t(count) });
+    }
+    CATCH_ALL;
+}
+
+int io_reap(handle_t queue, io_completion_t *completions, size_t count, size_t min_complete, TickType_t timeout)
 {
-    try
+    SYS_TRY
     {
-        configASSERT(file >= HANDLE_OFFSET);
-        _file *rfile = (_file *)handles_[file - HANDLE_OFFSET];
-        DEFINE_CONTROL_PROXY(custom)
-        else
-        {
-            return -1;
-        }
+        IO_QUEUE_ENTRY;
+        return (int)io_queue->reap({ completions, std::ptrdiff_t(count) }, min_complete, timeout);
     }
     CATCH_ALL;
-    
 }
 
 /* Device IO Implementation Helper Macros */
 
-#define COMMON_ENTRY(t)                                     \
-    configASSERT(file >= HANDLE_OFFSET);                    \
-    _file *rfile = (_file *)handles_[file - HANDLE_OFFSET]; \
-    configASSERT(rfile && rfile->object.is<t##_driver>());  \
-    auto t = rfile->object.as<t##_driver>();
+#define COMMON_ENTRY(t)                                    \
+    _file *rfile = io_handle_to_file(file);                \
+    configASSERT(rfile && rfile->object.is<t##_driver>()); \
+    auto t = rfile->object.as<t##_driver>();               \
+    IO_STAT_SCOPE(rfile)
 
-#define COMMON_ENTRY_FILE(file, t)                          \
-    configASSERT(file >= HANDLE_OFFSET);                    \
-    _file *rfile = (_file *)handles_[file - HANDLE_OFFSET]; \
-    configASSERT(rfile && rfile->object.is<t##_driver>());  \
-    auto t = rfile->object.as<t##_driver>();
+#define COMMON_ENTRY_FILE(file, t)                         \
+    _file *rfile = io_handle_to_file(file);                \
+    configASSERT(rfile && rfile->object.is<t##_driver>()); \
+    auto t = rfile->object.as<t##_driver>();               \
+    IO_STAT_SCOPE(rfile)
 
 /* UART */
 
@@ -393,7 +1109,9 @@ handle_t i2c_get_device(handle_t file, uint32_t slave_address, uint32_t address_
 {
     COMMON_ENTRY(i2c);
     auto driver = i2c->get_device(slave_address, address_width);
-    return io_alloc_handle(io_alloc_file(driver));
+    _file *device_file = io_alloc_file(driver);
+    io_stat_inherit(device_file, rfile);
+    return io_alloc_handle(device_file);
 }
 
 double i2c_dev_set_clock_rate(handle_t file, double clock_rate)
@@ -405,7 +1123,8 @@ double i2c_dev_set_clock_rate(handle_t file, double clock_rate)
 int i2c_dev_transfer_sequential(handle_t file, const uint8_t *write_buffer, size_t write_len, uint8_t *read_buffer, size_t read_len)
 {
     COMMON_ENTRY(i2c_device);
-    return i2c_device->transfer_sequential({ write_buffer, std::ptrdiff_t(write_len) }, { read_buffer, std::ptrdiff_t(read_len) });
+    int read = i2c_device->transfer_sequential({ write_buffer, std::ptrdiff_t(write_len) }, { read_buffer, std::ptrdiff_t(read_len) });
+    return IO_STAT_COMPLETE(read, write_len + read);
 }
 
 void i2c_config_as_slave(handle_t file, uint32_t slave_address, uint32_t address_width, i2c_slave_handler_t *handler)
@@ -467,11 +1186,39 @@ void spi_slave_config(handle_t file, uint32_t data_bit_length, spi_slave_handler
     spi->slave_config(data_bit_length, *handler);
 }
 
+void spi_slave_config_dma(handle_t file, const spi_slave_dma_config_t *config)
+{
+    COMMON_ENTRY(spi);
+    spi->slave_config_dma(*config);
+}
+
+int spi_slave_read(handle_t file, uint8_t *buffer, size_t len)
+{
+    COMMON_ENTRY(spi);
+    size_t read = spi->slave_read({ buffer, std::ptrdiff_t(len) });
+    return IO_STAT_COMPLETE((int)read, read);
+}
+
+int spi_slave_write(handle_t file, const uint8_t *buffer, size_t len)
+{
+    COMMON_ENTRY(spi);
+    size_t written = spi->slave_write({ buffer, std::ptrdiff_t(len) });
+    return IO_STAT_COMPLETE((int)written, written);
+}
+
+void spi_slave_get_statistics(handle_t file, spi_slave_statistics_t *stats)
+{
+    COMMON_ENTRY(spi);
+    spi->slave_get_statistics(*stats);
+}
+
 handle_t spi_get_device(handle_t file, spi_mode_t mode, spi_frame_format_t frame_format, uint32_t chip_select_mask, uint32_t data_bit_length)
 {
     COMMON_ENTRY(spi);
     auto driver = spi->get_device(mode, frame_format, chip_select_mask, data_bit_length);
-    return io_alloc_handle(io_alloc_file(driver));
+    _file *device_file = io_alloc_file(driver);
+    io_stat_inherit(device_file, rfile);
+    return io_alloc_handle(device_file);
 }
 
 void spi_dev_config_non_standard(handle_t file, uint32_t instruction_length, uint32_t address_length, uint32_t wait_cycles, spi_inst_addr_trans_mode_t trans_mode)
@@ -486,16 +1233,37 @@ double spi_dev_set_clock_rate(handle_t file, double clock_rate)
     return spi_device->set_clock_rate(clock_rate);
 }
 
+void spi_dev_set_dma_priority(handle_t file, dma_priority_t priority, dma_subsystem_t subsystem)
+{
+    COMMON_ENTRY(spi_device);
+    spi_device->set_dma_priority(priority, subsystem);
+}
+
+void spi_dev_set_fifo_mode(handle_t file, spi_fifo_mode_t mode)
+{
+    COMMON_ENTRY(spi_device);
+    spi_device->set_fifo_mode(mode);
+}
+
 int spi_dev_transfer_full_duplex(handle_t file, const uint8_t *write_buffer, size_t write_len, uint8_t *read_buffer, size_t read_len)
 {
     COMMON_ENTRY(spi_device);
-    return spi_device->transfer_full_duplex({ write_buffer, std::ptrdiff_t(write_len) }, { read_buffer, std::ptrdiff_t(read_len) });
+    int read = spi_device->transfer_full_duplex({ write_buffer, std::ptrdiff_t(write_len) }, { read_buffer, std::ptrdiff_t(read_len) });
+    return IO_STAT_COMPLETE(read, write_len + read);
 }
 
 int spi_dev_transfer_sequential(handle_t file, const uint8_t *write_buffer, size_t write_len, uint8_t *read_buffer, size_t read_len)
 {
     COMMON_ENTRY(spi_device);
-    return spi_device->transfer_sequential({ write_buffer, std::ptrdiff_t(write_len) }, { read_buffer, std::ptrdiff_t(read_len) });
+    int read = spi_device->transfer_sequential({ write_buffer, std::ptrdiff_t(write_len) }, { read_buffer, std::ptrdiff_t(read_len) });
+    return IO_STAT_COMPLETE(read, write_len + read);
+}
+
+int spi_dev_transfer_list(handle_t file, const spi_segment_t *segments, size_t count)
+{
+    COMMON_ENTRY(spi_device);
+    int transferred = spi_device->transfer_list({ segments, std::ptrdiff_t(count) });
+    return IO_STAT_COMPLETE(transferred, transferred);
 }
 
 void spi_dev_fill(handle_t file, uint32_t instruction, uint32_t address, uint32_t value, size_t count)
@@ -542,6 +1310,12 @@ void dvp_set_output_attributes(handle_t file, uint32_t index, video_format_t for
     dvp->set_output_attributes(index, format, output_buffer);
 }
 
+void *dvp_get_output_buffer(handle_t file, uint32_t index)
+{
+    COMMON_ENTRY(dvp);
+    return dvp->get_output_buffer(index);
+}
+
 void dvp_set_frame_event_enable(handle_t file, dvp_frame_event_t event, bool enable)
 {
     COMMON_ENTRY(dvp);
@@ -566,7 +1340,9 @@ handle_t sccb_get_device(handle_t file, uint32_t slave_address, uint32_t reg_add
 {
     COMMON_ENTRY(sccb);
     auto driver = sccb->get_device(slave_address, reg_address_width);
-    return io_alloc_handle(io_alloc_file(driver));
+    _file *device_file = io_alloc_file(driver);
+    io_stat_inherit(device_file, rfile);
+    return io_alloc_handle(device_file);
 }
 
 uint8_t sccb_dev_read_byte(handle_t file, uint16_t reg_address)
@@ -828,24 +1604,57 @@ typedef struct
 } pic_context_t;
 
 static pic_context_t pic_context_;
-static SemaphoreHandle_t dma_free_;
+
+#define MAX_DMA_CHANNELS 6
+
+typedef struct
+{
+    driver_registry_t *registry;
+    dma_subsystem_t reserved_for;
+    bool owned;
+    uint64_t acquired_at;
+    uint64_t busy_time;
+    size_t grants;
+    size_t handoffs;
+} dma_channel_state_t;
+
+/* A task waiting for a channel, on its own stack and queued by priority */
+typedef struct _dma_waiter
+{
+    dma_priority_t priority;
+    dma_subsystem_t subsystem;
+    size_t channel;
+    StaticSemaphore_t granted_buffer;
+    SemaphoreHandle_t granted;
+    struct _dma_waiter *next;
+} dma_waiter_t;
+
+#define DMA_NO_CHANNEL SIZE_MAX
+
+static dma_channel_state_t dma_channels_[MAX_DMA_CHANNELS];
+static size_t dma_channel_count_;
+static dma_waiter_t *dma_waiters_;
+static uint64_t dma_stats_start_;
+static spinlock_t dma_arbiter_lock_ = SPINLOCK_INIT;
 
 static void init_dma_system()
 {
-    size_t count = 0;
     driver_registry_t *head = g_dma_drivers;
     while (head->name)
     {
-        count++;
+        configASSERT(dma_channel_count_ < MAX_DMA_CHANNELS);
+        dma_channels_[dma_channel_count_++].registry = head;
         head++;
     }
 
-    dma_free_ = xSemaphoreCreateCounting(count, count);
+    dma_stats_start_ = clint->mtime;
 }
 
 void install_hal()
 {
     uxCPUClockRate = sysctl_clock_get_freq(SYSCTL_CLOCK_CPU);
+    index_drivers(g_system_drivers);
+    index_drivers(g_hal_drivers);
     install_hal_drivers();
     pic_file_ = io_open("/dev/pic0");
     configASSERT(pic_file_);
@@ -883,39 +1692,275 @@ void sys::kernel_iface_pic_on_irq(uint32_t irq)
 
 /* DMA */
 
-handle_t dma_open_free()
+/* Channels are only opened and closed under this lock, except for the close on release,
+ * which is followed by dma_channel_released. The isr side runs with interrupts masked. */
+static void dma_arbiter_lock()
 {
-    configASSERT(xSemaphoreTake(dma_free_, portMAX_DELAY) == pdTRUE);
+    vTaskEnterCritical();
+    spinlock_lock(&dma_arbiter_lock_);
+}
 
-    driver_registry_t *head = g_dma_drivers;
-    object_accessor<driver> dma;
-    while (head->name)
+static void dma_arbiter_unlock()
+{
+    spinlock_unlock(&dma_arbiter_lock_);
+    vTaskExitCritical();
+}
+
+static size_t dma_channel_index(dma_driver &channel)
+{
+    for (size_t i = 0; i < dma_channel_count_; i++)
+    {
+        if (dma_channels_[i].registry->driver_ptr.get() == &channel)
+            return i;
+    }
+
+    configASSERT(!"Not a dma channel.");
+    return DMA_NO_CHANNEL;
+}
+
+static bool dma_channel_eligible(size_t index, dma_subsystem_t subsystem)
+{
+    auto reserved_for = dma_channels_[index].reserved_for;
+    return reserved_for == DMA_SUBSYSTEM_NONE || reserved_for == subsystem;
+}
+
+static void dma_channel_granted(size_t index)
+{
+    auto &state = dma_channels_[index];
+    state.owned = true;
+    state.acquired_at = clint->mtime;
+    state.grants++;
+}
+
+/* Takes a free channel, the subsystem's reserved ones first, unless a queued waiter of
+ * at least the same priority could use it. Called with the lock held. */
+static size_t dma_try_take_channel(dma_priority_t priority, dma_subsystem_t subsystem)
+{
+    for (int pass = 0; pass < 2; pass++)
     {
-        auto &driver = head->driver_ptr;
-        try
+        for (size_t i = 0; i < dma_channel_count_; i++)
         {
-            dma = make_accessor(driver);
-            break;
+            bool reserved = dma_channels_[i].reserved_for != DMA_SUBSYSTEM_NONE;
+            if (!dma_channel_eligible(i, subsystem) || reserved != (pass == 0))
+                continue;
+
+            bool queued = false;
+            for (auto waiter = dma_waiters_; waiter && waiter->priority >= priority; waiter = waiter->next)
+            {
+                if (dma_channel_eligible(i, waiter->subsystem))
+                {
+                    queued = true;
+                    break;
+                }
+            }
+
+            if (!queued && dma_channels_[i].registry->driver_ptr->try_open())
+            {
+                dma_channel_granted(i);
+                return i;
+            }
         }
-        catch (...)
+    }
+
+    return DMA_NO_CHANNEL;
+}
+
+static size_t dma_acquire(dma_priority_t priority, dma_subsystem_t subsystem, TickType_t timeout)
+{
+    configASSERT(subsystem < DMA_SUBSYSTEM_MAX);
+
+    dma_arbiter_lock();
+    size_t index = dma_try_take_channel(priority, subsystem);
+    if (index != DMA_NO_CHANNEL || timeout == 0)
+    {
+        dma_arbiter_unlock();
+        return index;
+    }
+
+    dma_waiter_t waiter;
+    waiter.priority = priority;
+    waiter.subsystem = subsystem;
+    waiter.channel = DMA_NO_CHANNEL;
+    waiter.granted = xSemaphoreCreateBinaryStatic(&waiter.granted_buffer);
+
+    /* Behind the waiters of the same priority */
+    auto link = &dma_waiters_;
+    while (*link && (*link)->priority >= priority)
+        link = &(*link)->next;
+    waiter.next = *link;
+    *link = &waiter;
+    dma_arbiter_unlock();
+
+    xSemaphoreTake(waiter.granted, timeout);
+
+    dma_arbiter_lock();
+    if (waiter.channel == DMA_NO_CHANNEL)
+    {
+        link = &dma_waiters_;
+        while (*link != &waiter)
+            link = &(*link)->next;
+        *link = waiter.next;
+    }
+    dma_arbiter_unlock();
+    return waiter.channel;
+}
+
+/* Hands a closed channel to the first queued waiter that may use it.
+ * Called from an isr when higher_priority_task_woken is given. */
+static void dma_channel_released(dma_driver &channel, BaseType_t *higher_priority_task_woken)
+{
+    size_t index = dma_channel_index(channel);
+    auto &state = dma_channels_[index];
+
+    if (higher_priority_task_woken)
+        spinlock_lock(&dma_arbiter_lock_);
+    else
+        dma_arbiter_lock();
+
+    state.owned = false;
+    state.busy_time += clint->mtime - state.acquired_at;
+    for (auto link = &dma_waiters_; *link; link = &(*link)->next)
+    {
+        auto waiter = *link;
+        if (dma_channel_eligible(index, waiter->subsystem))
         {
-            head++;
+            /* Someone who did not have to wait may have taken it in the meantime */
+            if (state.registry->driver_ptr->try_open())
+            {
+                *link = waiter->next;
+                waiter->channel = index;
+                dma_channel_granted(index);
+                state.handoffs++;
+                if (higher_priority_task_woken)
+                    xSemaphoreGiveFromISR(waiter->granted, higher_priority_task_woken);
+                else
+                    xSemaphoreGive(waiter->granted);
+            }
+            break;
         }
     }
 
-    configASSERT(dma);
-    uintptr_t handle = io_alloc_handle(io_alloc_file(std::move(dma)));
+    if (higher_priority_task_woken)
+        spinlock_unlock(&dma_arbiter_lock_);
+    else
+        dma_arbiter_unlock();
+}
+
+static dma_driver &dma_channel_driver(size_t index, dma_priority_t priority)
+{
+    auto &channel = static_cast<dma_driver &>(*dma_channels_[index].registry->driver_ptr);
+    channel.config(priority);
+    return channel;
+}
+
+handle_t dma_open_free_priority(dma_priority_t priority, dma_subsystem_t subsystem, TickType_t timeout)
+{
+    size_t index = dma_acquire(priority, subsystem, timeout);
+    if (index == DMA_NO_CHANNEL)
+        return NULL_HANDLE;
+
+    auto head = dma_channels_[index].registry;
+    dma_channel_driver(index, priority);
+    _file *file = io_alloc_file(object_accessor<driver>(object_ptr<driver>(head->driver_ptr)));
+    io_stat_attach(file, head->name);
+    uintptr_t handle = io_alloc_handle(file);
     return handle;
 }
 
+handle_t dma_open_free()
+{
+    return dma_open_free_priority(DMA_PRIORITY_NORMAL, DMA_SUBSYSTEM_NONE, portMAX_DELAY);
+}
+
 void dma_close(handle_t file)
 {
     io_close(file);
 }
 
-static void dma_add_free()
+int dma_reserve_channels(dma_subsystem_t subsystem, size_t count)
+{
+    configASSERT(subsystem != DMA_SUBSYSTEM_NONE && subsystem < DMA_SUBSYSTEM_MAX);
+
+    int ret = 0;
+    dma_arbiter_lock();
+    size_t shared = 0;
+    for (size_t i = 0; i < dma_channel_count_; i++)
+    {
+        if (dma_channels_[i].reserved_for == subsystem)
+            dma_channels_[i].reserved_for = DMA_SUBSYSTEM_NONE;
+        if (dma_channels_[i].reserved_for == DMA_SUBSYSTEM_NONE)
+            shared++;
+    }
+
+    if (count >= shared)
+    {
+        ret = -1;
+    }
+    else
+    {
+        /* From the last channel, so the first ones stay shared */
+        for (size_t i = dma_channel_count_; count && i-- > 0;)
+        {
+            if (dma_channels_[i].reserved_for == DMA_SUBSYSTEM_NONE)
+            {
+                dma_channels_[i].reserved_for = subsystem;
+                count--;
+            }
+        }
+    }
+
+    dma_arbiter_unlock();
+    return ret;
+}
+
+size_t dma_get_channel_statistics(dma_channel_statistics_t *stats, size_t count)
+{
+    dma_arbiter_lock();
+    uint64_t now = clint->mtime;
+    for (size_t i = 0; i < std::min(count, dma_channel_count_); i++)
+    {
+        auto &state = dma_channels_[i];
+        auto &stat = stats[i];
+        stat.name = state.registry->name;
+        stat.reserved_for = state.reserved_for;
+        stat.grants = state.grants;
+        stat.handoffs = state.handoffs;
+        stat.busy_time = state.busy_time;
+        if (state.owned)
+            stat.busy_time += now - state.acquired_at;
+        stat.elapsed_time = now - dma_stats_start_;
+    }
+
+    dma_arbiter_unlock();
+    return dma_channel_count_;
+}
+
+dma_driver &sys::dma_acquire_channel(dma_priority_t priority, dma_subsystem_t subsystem)
+{
+    size_t index = dma_acquire(priority, subsystem, portMAX_DELAY);
+    configASSERT(index != DMA_NO_CHANNEL);
+    return dma_channel_driver(index, priority);
+}
+
+dma_driver *sys::dma_try_acquire_channel(dma_priority_t priority, dma_subsystem_t subsystem, TickType_t timeout)
+{
+    size_t index = dma_acquire(priority, subsystem, timeout);
+    if (index == DMA_NO_CHANNEL)
+        return nullptr;
+    return &dma_channel_driver(index, priority);
+}
+
+void sys::dma_release_channel(dma_driver &channel)
 {
-    xSemaphoreGive(dma_free_);
+    channel.close();
+    channel.release_buffers();
+    dma_channel_released(channel, nullptr);
+}
+
+void sys::dma_release_channel_from_isr(dma_driver &channel, BaseType_t *higher_priority_task_woken)
+{
+    channel.close();
+    dma_channel_released(channel, higher_priority_task_woken);
 }
 
 void dma_set_request_source(handle_t file, uint32_t request)
@@ -932,10 +1977,14 @@ void dma_transmit_async(handle_t file, const volatile void *src, volatile void *
 
 void dma_transmit(handle_t file, const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size)
 {
-    SemaphoreHandle_t event = xSemaphoreCreateBinary();
-    dma_transmit_async(file, src, dest, src_inc, dest_inc, element_size, count, burst_size, event);
-    configASSERT(xSemaphoreTake(event, portMAX_DELAY) == pdTRUE);
-    vSemaphoreDelete(event);
+    COMMON_ENTRY(dma);
+    sys::dma_transmit(*dma, src, dest, src_inc, dest_inc, element_size, count, burst_size);
+}
+
+void dma_transmit_sg_async(handle_t file, const dma_sg_item_t *items, size_t item_count, bool src_inc, bool dest_inc, size_t element_size, size_t burst_size, SemaphoreHandle_t completion_event)
+{
+    COMMON_ENTRY(dma);
+    dma->transmit_sg_async({ items, std::ptrdiff_t(item_count) }, src_inc, dest_inc, element_size, burst_size, completion_event);
 }
 
 void dma_loop_async(handle_t file, const volatile void **srcs, size_t src_num, volatile void **dests, size_t dest_num, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size, dma_stage_completion_handler_t stage_completion_handler, void *stage_completion_handler_data, SemaphoreHandle_t completion_event, int *stop_signal)
@@ -944,55 +1993,307 @@ void dma_loop_async(handle_t file, const volatile void **srcs, size_t src_num, v
     dma->loop_async(srcs, src_num, dests, dest_num, src_inc, dest_inc, element_size, count, burst_size, stage_completion_handler, stage_completion_handler_data, completion_event, stop_signal);
 }
 
-/* System */
+/* DMA Buffers */
 
-driver_registry_t *sys::system_install_driver(const char *name, object_ptr<driver> driver)
+typedef struct
+{
+    /* Cached alias, 0 if the entry is free */
+    uintptr_t base;
+    size_t size;
+    uint32_t flags;
+    /* Heap block of dma_buffer_alloc */
+    void *alloc_mem;
+} dma_buffer_entry_t;
+
+static dma_buffer_entry_t dma_buffers_[MAX_DMA_BUFFERS];
+static spinlock_t dma_buffers_lock_ = SPINLOCK_INIT;
+
+static uintptr_t dma_buffer_cached_address(const volatile void *buffer)
+{
+    return (uintptr_t)dma_buffer_cached_view(buffer);
+}
+
+static void dma_buffers_lock()
+{
+    vTaskEnterCritical();
+    spinlock_lock(&dma_buffers_lock_);
+}
+
+static void dma_buffers_unlock()
 {
-    size_t i = 0;
-    driver_registry_t *head = g_custom_drivers;
-    for (i = 0; i < MAX_CUSTOM_DRIVERS; i++, head++)
+    spinlock_unlock(&dma_buffers_lock_);
+    vTaskExitCritical();
+}
+
+static bool dma_buffer_add(uintptr_t base, size_t size, uint32_t flags, void *alloc_mem)
+{
+    bool added = false;
+    dma_buffers_lock();
+    for (auto &entry : dma_buffers_)
     {
-        if (!head->name)
+        if (!entry.base)
         {
-            head->name = name ? strdup(name) : dummy_driver_name;
-            head->driver_ptr = driver;
+            entry.base = base;
+            entry.size = size;
+            entry.flags = flags;
+            entry.alloc_mem = alloc_mem;
+            added = true;
+            break;
+        }
+    }
 
-            driver->install();
-            return head;
+    dma_buffers_unlock();
+    return added;
+}
+
+/* Only removes buffers of dma_buffer_alloc if allocated is set, or registered ones otherwise */
+static bool dma_buffer_remove(uintptr_t base, bool allocated, void *&alloc_mem)
+{
+    bool removed = false;
+    dma_buffers_lock();
+    for (auto &entry : dma_buffers_)
+    {
+        if (entry.base == base && (entry.alloc_mem != nullptr) == allocated)
+        {
+            alloc_mem = entry.alloc_mem;
+            entry.base = 0;
+            removed = true;
+            break;
+        }
+    }
+
+    dma_buffers_unlock();
+    return removed;
+}
+
+void *dma_buffer_alloc(size_t size, uint32_t flags)
+{
+    /* Whole cache lines, so no line of the buffer is shared with other heap data */
+    size = (size + DMA_BUFFER_ALIGNMENT - 1) & ~(size_t)(DMA_BUFFER_ALIGNMENT - 1);
+    void *alloc_mem = malloc(size + DMA_BUFFER_ALIGNMENT - 1);
+    if (!alloc_mem)
+        return nullptr;
+
+    uintptr_t base = ((uintptr_t)alloc_mem + DMA_BUFFER_ALIGNMENT - 1) & ~(uintptr_t)(DMA_BUFFER_ALIGNMENT - 1);
+    if (!dma_buffer_add(base, size, flags, alloc_mem))
+    {
+        free(alloc_mem);
+        return nullptr;
+    }
+
+    if (flags & DMA_BUFFER_UNCACHED)
+    {
+        /* Lines left dirty by earlier users of the range must not land on top of what the DMA writes */
+        dma_buffer_writeback((void *)base, size);
+        base = base - SRAM_CACHED_BASE + SRAM_UNCACHED_BASE;
+    }
+    return (void *)base;
+}
+
+void dma_buffer_free(void *buffer)
+{
+    void *alloc_mem = nullptr;
+    if (buffer && dma_buffer_remove(dma_buffer_cached_address(buffer), true, alloc_mem))
+        free(alloc_mem);
+}
+
+int dma_buffer_register(void *buffer, size_t size, uint32_t flags)
+{
+    uintptr_t base = dma_buffer_cached_address(buffer);
+    if (!size || (base & 7) || base < SRAM_CACHED_BASE || base + size > SRAM_CACHED_BASE + SRAM_DMA_SIZE)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!dma_buffer_add(base, size, flags, nullptr))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+int dma_buffer_unregister(void *buffer)
+{
+    void *alloc_mem = nullptr;
+    if (!buffer || !dma_buffer_remove(dma_buffer_cached_address(buffer), false, alloc_mem))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+bool dma_buffer_is_registered(const volatile void *buffer, size_t size)
+{
+    uintptr_t address = dma_buffer_cached_address(buffer);
+    bool registered = false;
+    dma_buffers_lock();
+    for (auto &entry : dma_buffers_)
+    {
+        if (entry.base && address >= entry.base && address + size <= entry.base + entry.size)
+        {
+            registered = true;
+            break;
         }
     }
 
+    dma_buffers_unlock();
+    return registered;
+}
+
+void *dma_buffer_cached_view(const volatile void *buffer)
+{
+    uintptr_t address = (uintptr_t)buffer;
+    if (address >= SRAM_UNCACHED_BASE && address < SRAM_UNCACHED_BASE + SRAM_ALIAS_SIZE)
+        address = address - SRAM_UNCACHED_BASE + SRAM_CACHED_BASE;
+    return (void *)address;
+}
+
+void *dma_buffer_uncached_view(const volatile void *buffer)
+{
+    uintptr_t address = (uintptr_t)buffer;
+    if (address >= SRAM_CACHED_BASE && address < SRAM_CACHED_BASE + SRAM_ALIAS_SIZE)
+        address = address - SRAM_CACHED_BASE + SRAM_UNCACHED_BASE;
+    return (void *)address;
+}
+
+void dma_buffer_writeback(const volatile void *buffer, size_t size)
+{
+    /* There is no cache maintenance instruction, a line reaches memory when it is stored again through the uncached alias */
+    uintptr_t begin = dma_buffer_cached_address(buffer) & ~(uintptr_t)(DMA_BUFFER_ALIGNMENT - 1);
+    uintptr_t end = (dma_buffer_cached_address(buffer) + size + DMA_BUFFER_ALIGNMENT - 1) & ~(uintptr_t)(DMA_BUFFER_ALIGNMENT - 1);
+    if (!size || begin < SRAM_CACHED_BASE || end > SRAM_CACHED_BASE + SRAM_ALIAS_SIZE)
+        return;
+
+    auto src = reinterpret_cast<const volatile uint64_t *>(begin);
+    auto dest = reinterpret_cast<volatile uint64_t *>(begin - SRAM_CACHED_BASE + SRAM_UNCACHED_BASE);
+    for (size_t i = 0; i < (end - begin) / sizeof(uint64_t); i++)
+        dest[i] = src[i];
+}
+
+/* System */
+
+driver_registry_t *sys::system_install_driver(const char *name, object_ptr<driver> driver)
+{
+    size_t i = custom_drivers_count_.fetch_add(1, std::memory_order_relaxed);
+    if (i < MAX_CUSTOM_DRIVERS)
+    {
+        driver_registry_t *head = g_custom_drivers + i;
+        head->name = name ? strdup(name) : dummy_driver_name;
+        head->driver_ptr = driver;
+
+        driver->install();
+        index_driver(head);
+        return head;
+    }
+
     configASSERT(!"Max custom drivers exceeded.");
     return nullptr;
 }
 
 object_accessor<driver> sys::system_open_driver(const char *name)
 {
-    auto driver = find_free_driver(g_system_drivers, name);
-    if (!driver)
-        driver = find_free_driver(g_hal_drivers, name);
+    auto driver = find_free_driver(name);
     if (!driver)
-        driver = find_free_dynamic_driver(name);
-    if (!driver)
-        throw std::runtime_error("driver is not found.");
+        SYS_THROW(std::runtime_error("driver is not found."));
     return driver;
 }
 
 handle_t sys::system_alloc_handle(object_accessor<object_access> object)
 {
-    return io_alloc_handle(io_alloc_file(std::move(object)));
+    _file *file = io_alloc_file(std::move(object));
+    io_stat_attach(file, nullptr);
+    return io_alloc_handle(file);
 }
 
 object_accessor<object_access> &sys::system_handle_to_object(handle_t file)
 {
-    if (file < HANDLE_OFFSET)
-        throw std::invalid_argument("Invalid handle.");
-
-    _file *rfile = (_file *)handles_[file - HANDLE_OFFSET];
-    configASSERT(rfile);
+    _file *rfile = io_handle_to_file(file);
+    if (!rfile)
+        SYS_THROW(std::invalid_argument("Invalid handle."));
     return rfile->object;
 }
 
+#ifdef CONFIG_IO_STATISTICS
+class k_iostat_driver : public custom_driver, public static_object, public free_object_access
+{
+public:
+    virtual void install() override
+    {
+    }
+
+    virtual int control(uint32_t control_code, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer) override
+    {
+        io_statistics_t statistics;
+        switch (control_code)
+        {
+        case IOSTAT_GET_HANDLE:
+        {
+            auto file = get_file(write_buffer);
+            io_stat_get(file->stat, file->driver_stat ? file->driver_stat->name : nullptr, statistics);
+            break;
+        }
+        case IOSTAT_GET_DRIVER:
+        {
+            uint32_t index;
+            if (write_buffer.size() != sizeof(index))
+                SYS_THROW(errno_exception("Invalid driver index.", EINVAL));
+            memcpy(&index, write_buffer.data(), sizeof(index));
+            if (index >= io_driver_stats_count_.load(std::memory_order_acquire))
+                SYS_THROW(errno_exception("Invalid driver index.", ENOENT));
+            io_stat_get(io_driver_stats_[index].stat, io_driver_stats_[index].name, statistics);
+            break;
+        }
+        case IOSTAT_RESET:
+            if (write_buffer.empty())
+            {
+                size_t count = io_driver_stats_count_.load(std::memory_order_acquire);
+                for (size_t i = 0; i < count; i++)
+                    io_stat_reset(io_driver_stats_[i].stat);
+            }
+            else
+            {
+                io_stat_reset(get_file(write_buffer)->stat);
+            }
+            return 0;
+        default:
+            SYS_THROW(errno_exception("Invalid control code.", EINVAL));
+        }
+
+        if (read_buffer.size() < sizeof(statistics))
+            SYS_THROW(errno_exception("Buffer too small.", EINVAL));
+        memcpy(read_buffer.data(), &statistics, sizeof(statistics));
+        return sizeof(statistics);
+    }
+
+private:
+    static _file *get_file(gsl::span<const uint8_t> write_buffer)
+    {
+        handle_t handle;
+        if (write_buffer.size() != sizeof(handle))
+            SYS_THROW(errno_exception("Invalid handle.", EBADF));
+        memcpy(&handle, write_buffer.data(), sizeof(handle));
+        auto file = io_handle_to_file(handle);
+        if (!file)
+            SYS_THROW(errno_exception("Invalid handle.", EBADF));
+        return file;
+    }
+};
+
+static k_iostat_driver iostat_driver_;
+#endif
+
+static void install_iostat_driver()
+{
+#ifdef CONFIG_IO_STATISTICS
+    system_install_driver("/dev/iostat", { std::in_place, static_cast<driver *>(&iostat_driver_) });
+#endif
+}
+
 uint32_t system_set_cpu_frequency(uint32_t frequency)
 {
     uint32_t divider = (sysctl->clk_sel0.aclk_divider_sel + 1) * 2;
@@ -13,9 +13,126 @@
  * limitations under the License.
  */
 #include "kernel/driver_impl.hpp"
+#include <stdio.h>
+#include <stdlib.h>
 
 using namespace sys;
 
+#ifdef SYS_NO_EXCEPTIONS
+void sys::throw_fatal(const std::exception &e) noexcept
+{
+    printf("Fatal: %s\n", e.what());
+    configASSERT(!"Unhandled error.");
+    abort();
+}
+#endif
+
+template <class TResult, class TDriver>
+static TResult read_vectored(TDriver &driver, gsl::span<const io_vec_t> buffers)
+{
+    TResult total = 0;
+    for (auto &vec : buffers)
+    {
+        auto read = driver.read({ reinterpret_cast<uint8_t *>(vec.base), static_cast<std::ptrdiff_t>(vec.len) });
+        total += read;
+        if (static_cast<size_t>(read) != vec.len)
+            break;
+    }
+
+    return total;
+}
+
+template <class TResult, class TDriver>
+static TResult write_vectored(TDriver &driver, gsl::span<const io_vec_t> buffers)
+{
+    TResult total = 0;
+    for (auto &vec : buffers)
+    {
+        auto written = driver.write({ reinterpret_cast<const uint8_t *>(vec.base), static_cast<std::ptrdiff_t>(vec.len) });
+        total += written;
+        if (static_cast<size_t>(written) != vec.len)
+            break;
+    }
+
+    return total;
+}
+
+int uart_driver::readv(gsl::span<const io_vec_t> buffers)
+{
+    return read_vectored<int>(*this, buffers);
+}
+
+int uart_driver::writev(gsl::span<const io_vec_t> buffers)
+{
+    return write_vectored<int>(*this, buffers);
+}
+
+int i2c_device_driver::readv(gsl::span<const io_vec_t> buffers)
+{
+    return read_vectored<int>(*this, buffers);
+}
+
+int i2c_device_driver::writev(gsl::span<const io_vec_t> buffers)
+{
+    return write_vectored<int>(*this, buffers);
+}
+
+int spi_device_driver::readv(gsl::span<const io_vec_t> buffers)
+{
+    return read_vectored<int>(*this, buffers);
+}
+
+int spi_device_driver::writev(gsl::span<const io_vec_t> buffers)
+{
+    return write_vectored<int>(*this, buffers);
+}
+
+void dma_driver::release_buffers()
+{
+}
+
+void block_storage_driver::flush()
+{
+}
+
+result<size_t> filesystem_file::readv(gsl::span<const io_vec_t> buffers)
+{
+    size_t total = 0;
+    for (auto &vec : buffers)
+    {
+        auto read = this->read({ reinterpret_cast<uint8_t *>(vec.base), static_cast<std::ptrdiff_t>(vec.len) });
+        if (!read)
+            return total ? result<size_t>(total) : read;
+        total += read.value();
+        if (read.value() != vec.len)
+            break;
+    }
+
+    return total;
+}
+
+result<size_t> filesystem_file::writev(gsl::span<const io_vec_t> buffers)
+{
+    size_t total = 0;
+    for (auto &vec : buffers)
+    {
+        auto written = write({ reinterpret_cast<const uint8_t *>(vec.base), static_cast<std::ptrdiff_t>(vec.len) });
+        if (!written)
+            return total ? result<size_t>(total) : written;
+        total += written.value();
+        if (written.value() != vec.len)
+            break;
+    }
+
+    return total;
+}
+
+void network_adapter_driver::sendv(gsl::span<const io_vec_t> buffers)
+{
+    for (auto &vec : buffers)
+        send({ reinterpret_cast<const uint8_t *>(vec.base), static_cast<std::ptrdiff_t>(vec.len) });
+}
+
 void static_object::add_ref()
 {
 }
@@ -79,11 +196,20 @@ exclusive_object_access::exclusive_object_access() noexcept
 void exclusive_object_access::open()
 {
     if (used_.test_and_set(std::memory_order_acquire))
-        throw access_denied_exception();
+        SYS_THROW(access_denied_exception());
     else
         on_first_open();
 }
 
+bool exclusive_object_access::try_open()
+{
+    if (used_.test_and_set(std::memory_order_acquire))
+        return false;
+
+    on_first_open();
+    return true;
+}
+
 void exclusive_object_access::on_first_open()
 {
 }
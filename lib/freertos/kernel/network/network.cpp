@@ -32,6 +32,7 @@ using namespace sys;
 
 #define MAX_DHCP_TRIES 5
 #define NETIF_GUARD_BLOCK_TIME   (250 )
+#define NETIF_SEND_VECS 8
 
 int network_init()
 {
@@ -53,7 +54,7 @@ public:
         IP4_ADDR(&gw, gateway.data[0], gateway.data[1], gateway.data[2], gateway.data[3]);
 
         if (!netif_add(&netif_, &ipaddr, &netmask, &gw, this, ethernetif_init, ethernet_input))
-            throw std::runtime_error("Unable to init netif.");
+            SYS_THROW(std::runtime_error("Unable to init netif."));
     }
 
     void set_enable(bool enable)
@@ -368,12 +369,18 @@ private:
                 pbuf_remove_header(p, ETH_PAD_SIZE); /* drop the padding word */
     #endif
 
+                io_vec_t vecs[NETIF_SEND_VECS];
+                size_t vecs_count = 0;
                 for (q = p; q != NULL; q = q->next)
                 {
-                    /* Send the data from the pbuf to the interface, one pbuf at a
-                       time. The size of the data in each pbuf is kept in the ->len
-                       variable. */
-                    adapter->send({ (uint8_t *)q->payload, q->len });
+                    /* Hand the pbuf chain to the interface as one scatter list,
+                       so the adapter can send it without gathering it first. */
+                    vecs[vecs_count++] = { q->payload, q->len };
+                    if (vecs_count == NETIF_SEND_VECS || !q->next)
+                    {
+                        adapter->sendv({ vecs, std::ptrdiff_t(vecs_count) });
+                        vecs_count = 0;
+                    }
                 }
 
                 adapter->end_send();
@@ -414,11 +421,11 @@ private:
     auto f = obj.as<k_ethernet_interface>();
 
 #define CATCH_ALL \
-    catch (...) { return -1; }
+    SYS_CATCH_ALL { return -1; }
 
 handle_t network_interface_add(handle_t adapter_handle, const ip_address_t *ip_address, const ip_address_t *net_mask, const ip_address_t *gateway)
 {
-    try
+    SYS_TRY
     {
         if (!ip_address || !net_mask || !gateway)
             return -1;
@@ -427,7 +434,7 @@ handle_t network_interface_add(handle_t adapter_handle, const ip_address_t *ip_a
         netif->add_ref(); // Pin the object
         return system_alloc_handle(make_accessor<object_access>(netif));
     }
-    catch (...)
+    SYS_CATCH_ALL
     {
         return NULL_HANDLE;
     }
@@ -435,7 +442,7 @@ handle_t network_interface_add(handle_t adapter_handle, const ip_address_t *ip_a
 
 int network_interface_set_enable(handle_t netif_handle, bool enable)
 {
-    try
+    SYS_TRY
     {
         NETIF_ENTRY;
 
@@ -447,7 +454,7 @@ int network_interface_set_enable(handle_t netif_handle, bool enable)
 
 int network_interface_set_as_default(handle_t netif_handle)
 {
-    try
+    SYS_TRY
     {
         NETIF_ENTRY;
 
@@ -459,7 +466,7 @@ int network_interface_set_as_default(handle_t netif_handle)
 
 int network_set_addr(handle_t netif_handle, const ip_address_t *ip_address, const ip_address_t *net_mask, const ip_address_t *gateway)
 {
-    try
+    SYS_TRY
     {
         NETIF_ENTRY;
 
@@ -471,7 +478,7 @@ int network_set_addr(handle_t netif_handle, const ip_address_t *ip_address, cons
 
 int network_get_addr(handle_t netif_handle, ip_address_t *ip_address, ip_address_t *net_mask, ip_address_t *gateway)
 {
-    try
+    SYS_TRY
     {
         NETIF_ENTRY;
 
@@ -483,13 +490,13 @@ int network_get_addr(handle_t netif_handle, ip_address_t *ip_address, ip_address
 
 dhcp_state_t network_interface_dhcp_pooling(handle_t netif_handle)
 {
-    try
+    SYS_TRY
     {
         NETIF_ENTRY;
 
         return f->dhcp_pooling();
     }
-    catch (...)
+    SYS_CATCH_ALL
     {
         return DHCP_FAIL;
     }
@@ -497,7 +504,7 @@ dhcp_state_t network_interface_dhcp_pooling(handle_t netif_handle)
 
 int network_socket_gethostbyname(const char *name, hostent_t *hostent)
 {
-    try
+    SYS_TRY
     {
         struct hostent *lwip_hostent = lwip_gethostbyname(name);
         hostent->h_name = lwip_hostent->h_name;
@@ -510,7 +517,7 @@ int network_socket_gethostbyname(const char *name, hostent_t *hostent)
             hostent->h_addrtype = AF_INTERNETWORK;
             break;
         default:
-            throw std::invalid_argument("Invalid address type.");
+            SYS_THROW(std::invalid_argument("Invalid address type."));
         }
         return 0;
     }
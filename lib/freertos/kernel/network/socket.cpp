@@ -15,6 +15,7 @@
 #include "FreeRTOS.h"
 #include "devices.h"
 #include "kernel/driver_impl.hpp"
+#include "kernel/slab.hpp"
 #include "network.h"
 #include <lwip/sockets.h>
 #include <lwip/errno.h>
@@ -22,18 +23,22 @@
 
 using namespace sys;
 
+static_assert(sizeof(io_vec_t) == sizeof(iovec), "io_vec_t must match lwIP iovec.");
+static_assert(offsetof(io_vec_t, base) == offsetof(iovec, iov_base), "io_vec_t must match lwIP iovec.");
+static_assert(offsetof(io_vec_t, len) == offsetof(iovec, iov_len), "io_vec_t must match lwIP iovec.");
+
 static void check_lwip_error(int result)
 {
     if (result < 0)
     {
-        throw errno_exception(strerror(errno), errno);
+        SYS_THROW(errno_exception(strerror(errno), errno));
     }
 }
 
 static void to_lwip_sockaddr(sockaddr_in &addr, const socket_address_t &socket_addr)
 {
     if (socket_addr.family != AF_INTERNETWORK)
-        throw std::runtime_error("Invalid socket address.");
+        SYS_THROW(std::runtime_error("Invalid socket address."));
 
     addr.sin_len = sizeof(addr);
     addr.sin_family = AF_INET;
@@ -44,7 +49,7 @@ static void to_lwip_sockaddr(sockaddr_in &addr, const socket_address_t &socket_a
 static void to_sys_sockaddr(socket_address_t &addr, const sockaddr_in &socket_addr)
 {
     if (socket_addr.sin_family != AF_INET)
-        throw std::runtime_error("Invalid socket address.");
+        SYS_THROW(std::runtime_error("Invalid socket address."));
     addr.family = AF_INTERNETWORK;
     addr.data[3] = (socket_addr.sin_addr.s_addr >> 24) & 0xFF;
     addr.data[2] = (socket_addr.sin_addr.s_addr >> 16) & 0xFF;
@@ -53,7 +58,7 @@ static void to_sys_sockaddr(socket_address_t &addr, const sockaddr_in &socket_ad
     *reinterpret_cast<uint16_t *>(addr.data + 4) = ntohs(socket_addr.sin_port);
 }
 
-class k_network_socket : public network_socket, public heap_object, public exclusive_object_access
+class k_network_socket : public network_socket, public heap_object, public exclusive_object_access, public slab_object<k_network_socket>
 {
 public:
     k_network_socket(address_family_t address_family, socket_type_t type, protocol_type_t protocol)
@@ -66,7 +71,7 @@ public:
             domain = AF_INET;
             break;
         default:
-            throw std::invalid_argument("Invalid address family.");
+            SYS_THROW(std::invalid_argument("Invalid address family."));
         }
 
         int s_type;
@@ -79,7 +84,7 @@ public:
             s_type = SOCK_DGRAM;
             break;
         default:
-            throw std::invalid_argument("Invalid socket type.");
+            SYS_THROW(std::invalid_argument("Invalid socket type."));
         }
 
         int s_protocol;
@@ -89,7 +94,7 @@ public:
             s_protocol = IPPROTO_IP;
             break;
         default:
-            throw std::invalid_argument("Invalid protocol type.");
+            SYS_THROW(std::invalid_argument("Invalid protocol type."));
         }
 
         auto sock = lwip_socket(domain, s_type, s_protocol);
@@ -111,19 +116,18 @@ public:
     {
     }
 
-    virtual object_accessor<network_socket> accept(socket_address_t *remote_address) override
+    virtual result<object_accessor<network_socket>> accept(socket_address_t *remote_address) override
     {
-        object_ptr<k_network_socket> socket(std::in_place, new k_network_socket());
-
         sockaddr_in remote;
         socklen_t remote_len = sizeof(remote);
 
         auto sock = lwip_accept(sock_, reinterpret_cast<sockaddr *>(&remote), &remote_len);
-        check_lwip_error(sock);
-        socket->sock_ = sock;
+        if (sock < 0)
+            return make_error(errno);
+        object_ptr<k_network_socket> socket(std::in_place, new k_network_socket(sock));
         if (remote_address)
             to_sys_sockaddr(*remote_address, remote);
-        return make_accessor(socket);
+        return make_accessor<network_socket>(socket);
     }
 
     virtual void bind(const socket_address_t &address) override
@@ -133,11 +137,13 @@ public:
         check_lwip_error(lwip_bind(sock_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)));
     }
 
-    virtual void connect(const socket_address_t &address) override
+    virtual result<void> connect(const socket_address_t &address) override
     {
         sockaddr_in addr;
         to_lwip_sockaddr(addr, address);
-        check_lwip_error(lwip_connect(sock_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)));
+        if (lwip_connect(sock_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+            return make_error(errno);
+        return {};
     }
 
     virtual void listen(uint32_t backlog) override
@@ -160,13 +166,13 @@ public:
             s_how = SHUT_RDWR;
             break;
         default:
-            throw std::invalid_argument("Invalid how.");
+            SYS_THROW(std::invalid_argument("Invalid how."));
         }
 
         check_lwip_error(lwip_shutdown(sock_, s_how));
     }
 
-    virtual size_t send(gsl::span<const uint8_t> buffer, socket_message_flag_t flags) override
+    virtual result<size_t> send(gsl::span<const uint8_t> buffer, socket_message_flag_t flags) override
     {
         uint8_t send_flags = 0;
         if (flags & MESSAGE_PEEK)
@@ -181,12 +187,13 @@ public:
             send_flags |= MSG_MORE;
 
         auto ret = lwip_send(sock_, buffer.data(), buffer.size_bytes(), send_flags);
-        check_lwip_error(ret);
+        if (ret < 0)
+            return make_error(errno);
         configASSERT(ret == buffer.size_bytes());
-        return ret;
+        return size_t(ret);
     }
 
-    virtual size_t receive(gsl::span<uint8_t> buffer, socket_message_flag_t flags) override
+    virtual result<size_t> receive(gsl::span<uint8_t> buffer, socket_message_flag_t flags) override
     {
         uint8_t recv_flags = 0;
         if (flags & MESSAGE_PEEK)
@@ -200,11 +207,12 @@ public:
         if (flags & MESSAGE_MORE)
             recv_flags |= MSG_MORE;
         auto ret = lwip_recv(sock_, buffer.data(), buffer.size_bytes(), recv_flags);
-        check_lwip_error(ret);
-        return ret;
+        if (ret < 0)
+            return make_error(errno);
+        return size_t(ret);
     }
 
-    virtual size_t send_to(gsl::span<const uint8_t> buffer, socket_message_flag_t flags, const socket_address_t &to) override
+    virtual result<size_t> send_to(gsl::span<const uint8_t> buffer, socket_message_flag_t flags, const socket_address_t &to) override
     {
         uint8_t send_flags = 0;
         if (flags & MESSAGE_PEEK)
@@ -223,12 +231,13 @@ public:
         to_lwip_sockaddr(remote, to);
 
         auto ret = lwip_sendto(sock_, buffer.data(), buffer.size_bytes(), send_flags, reinterpret_cast<const sockaddr *>(&remote), remote_len);
-        check_lwip_error(ret);
+        if (ret < 0)
+            return make_error(errno);
         configASSERT(ret == buffer.size_bytes());
-        return ret;
+        return size_t(ret);
     }
 
-    virtual size_t receive_from(gsl::span<uint8_t> buffer, socket_message_flag_t flags, socket_address_t *from) override
+    virtual result<size_t> receive_from(gsl::span<uint8_t> buffer, socket_message_flag_t flags, socket_address_t *from) override
     {
         uint8_t recv_flags = 0;
         if (flags & MESSAGE_PEEK)
@@ -246,25 +255,44 @@ public:
         socklen_t remote_len = sizeof(remote);
 
         auto ret = lwip_recvfrom(sock_, buffer.data(), buffer.size_bytes(), recv_flags, reinterpret_cast<sockaddr *>(&remote), &remote_len);
-        check_lwip_error(ret);
+        if (ret < 0)
+            return make_error(errno);
         if (from)
             to_sys_sockaddr(*from, remote);
-        return ret;
+        return size_t(ret);
     }
 
-    virtual size_t read(gsl::span<uint8_t> buffer) override
+    virtual result<size_t> read(gsl::span<uint8_t> buffer) override
     {
         auto ret = lwip_read(sock_, buffer.data(), buffer.size_bytes());
-        check_lwip_error(ret);
-        return ret;
+        if (ret < 0)
+            return make_error(errno);
+        return size_t(ret);
     }
 
-    virtual size_t write(gsl::span<const uint8_t> buffer) override
+    virtual result<size_t> write(gsl::span<const uint8_t> buffer) override
     {
         auto ret = lwip_write(sock_, buffer.data(), buffer.size_bytes());
-        check_lwip_error(ret);
+        if (ret < 0)
+            return make_error(errno);
         configASSERT(ret == buffer.size_bytes());
-        return ret;
+        return size_t(ret);
+    }
+
+    virtual result<size_t> readv(gsl::span<const io_vec_t> buffers) override
+    {
+        auto ret = lwip_readv(sock_, reinterpret_cast<const iovec *>(buffers.data()), buffers.size());
+        if (ret < 0)
+            return make_error(errno);
+        return size_t(ret);
+    }
+
+    virtual result<size_t> writev(gsl::span<const io_vec_t> buffers) override
+    {
+        auto ret = lwip_writev(sock_, reinterpret_cast<const iovec *>(buffers.data()), buffers.size());
+        if (ret < 0)
+            return make_error(errno);
+        return size_t(ret);
     }
 
     virtual int fcntl(int cmd, int val) override
@@ -286,23 +314,19 @@ public:
         return 0;
     }
 
-private:
-    k_network_socket()
-        : sock_(0)
-    {
-    }
-
 private:
     int sock_;
 };
 
+DEFINE_SLAB_OBJECT(k_network_socket, 8);
+
 #define SOCKET_ENTRY                                    \
     auto &obj = system_handle_to_object(socket_handle); \
     configASSERT(obj.is<k_network_socket>());           \
     auto f = obj.as<k_network_socket>();
 
 #define CATCH_ALL \
-    catch (errno_exception &e)      \
+    SYS_CATCH(errno_exception &e)   \
     {                               \
         errno = e.code();           \
         return -1;                  \
@@ -310,16 +334,16 @@ private:
 
 #define CHECK_ARG(x) \
     if (!x)          \
-        throw std::invalid_argument(#x " is invalid.");
+        SYS_THROW(std::invalid_argument(#x " is invalid."));
 
 handle_t network_socket_open(address_family_t address_family, socket_type_t type, protocol_type_t protocol)
 {
-    try
+    SYS_TRY
     {
         auto socket = make_object<k_network_socket>(address_family, type, protocol);
         return system_alloc_handle(make_accessor<object_access>(socket));
     }
-    catch (...)
+    SYS_CATCH_ALL
     {
         return NULL_HANDLE;
     }
@@ -332,20 +356,19 @@ handle_t network_socket_close(handle_t socket_handle)
 
 int network_socket_connect(handle_t socket_handle, const socket_address_t *remote_address)
 {
-    try
+    SYS_TRY
     {
         SOCKET_ENTRY;
         CHECK_ARG(remote_address);
 
-        f->connect(*remote_address);
-        return 0;
+        return result_to_errno(f->connect(*remote_address));
     }
     CATCH_ALL;
 }
 
 int network_socket_listen(handle_t socket_handle, uint32_t backlog)
 {
-    try
+    SYS_TRY
     {
         SOCKET_ENTRY;
 
@@ -357,14 +380,21 @@ int network_socket_listen(handle_t socket_handle, uint32_t backlog)
 
 handle_t network_socket_accept(handle_t socket_handle, socket_address_t *remote_address)
 {
-    try
+    SYS_TRY
     {
         SOCKET_ENTRY;
         CHECK_ARG(remote_address);
 
-        return system_alloc_handle(f->accept(remote_address));
+        auto socket = f->accept(remote_address);
+        if (!socket)
+        {
+            errno = socket.error();
+            return NULL_HANDLE;
+        }
+
+        return system_alloc_handle(std::move(socket.value()));
     }
-    catch (...)
+    SYS_CATCH_ALL
     {
         return NULL_HANDLE;
     }
@@ -372,7 +402,7 @@ handle_t network_socket_accept(handle_t socket_handle, socket_address_t *remote_
 
 int network_socket_shutdown(handle_t socket_handle, socket_shutdown_t how)
 {
-    try
+    SYS_TRY
     {
         SOCKET_ENTRY;
 
@@ -384,7 +414,7 @@ int network_socket_shutdown(handle_t socket_handle, socket_shutdown_t how)
 
 int network_socket_bind(handle_t socket_handle, const socket_address_t *local_address)
 {
-    try
+    SYS_TRY
     {
         SOCKET_ENTRY;
         CHECK_ARG(local_address);
@@ -397,53 +427,53 @@ int network_socket_bind(handle_t socket_handle, const socket_address_t *local_ad
 
 int network_socket_send(handle_t socket_handle, const uint8_t *data, size_t len, socket_message_flag_t flags)
 {
-    try
+    SYS_TRY
     {
         SOCKET_ENTRY;
 
-        f->send({ data, std::ptrdiff_t(len) }, flags);
-        return 0;
+        auto ret = f->send({ data, std::ptrdiff_t(len) }, flags);
+        return ret ? 0 : result_to_errno(ret);
     }
     CATCH_ALL;
 }
 
 int network_socket_receive(handle_t socket_handle, uint8_t *data, size_t len, socket_message_flag_t flags)
 {
-    try
+    SYS_TRY
     {
         SOCKET_ENTRY;
 
-        return f->receive({ data, std::ptrdiff_t(len) }, flags);
+        return result_to_errno(f->receive({ data, std::ptrdiff_t(len) }, flags));
     }
     CATCH_ALL;
 }
 
 int network_socket_send_to(handle_t socket_handle, const uint8_t *data, size_t len, socket_message_flag_t flags, const socket_address_t *to)
 {
-    try
+    SYS_TRY
     {
         SOCKET_ENTRY;
 
-        f->send_to({ data, std::ptrdiff_t(len) }, flags, *to);
-        return 0;
+        auto ret = f->send_to({ data, std::ptrdiff_t(len) }, flags, *to);
+        return ret ? 0 : result_to_errno(ret);
     }
     CATCH_ALL;
 }
 
 int network_socket_receive_from(handle_t socket_handle, uint8_t *data, size_t len, socket_message_flag_t flags, socket_address_t *from)
 {
-    try
+    SYS_TRY
     {
         SOCKET_ENTRY;
 
-        return f->receive_from({ data, std::ptrdiff_t(len) }, flags, from);
+        return result_to_errno(f->receive_from({ data, std::ptrdiff_t(len) }, flags, from));
     }
     CATCH_ALL;
 }
 
 int network_socket_fcntl(handle_t socket_handle, int cmd, int val)
 {
-    try
+    SYS_TRY
     {
         SOCKET_ENTRY;
 
@@ -454,7 +484,7 @@ int network_socket_fcntl(handle_t socket_handle, int cmd, int val)
 
 int network_socket_select(int socket_handle, fd_set *readset, fd_set *writeset, fd_set *exceptset, struct timeval *timeout)
 {
-    try
+    SYS_TRY
     {
         SOCKET_ENTRY;
 
@@ -466,7 +496,7 @@ int network_socket_select(int socket_handle, fd_set *readset, fd_set *writeset,
 
 int network_socket_addr_parse(const char *ip_addr, int port, uint8_t *socket_addr)
 {
-    try
+    SYS_TRY
     {
         const char *sep = ".";
         char *p;
@@ -479,12 +509,12 @@ int network_socket_addr_parse(const char *ip_addr, int port, uint8_t *socket_add
         {
             data = atoi(p);
             if (data > 255)
-                throw std::invalid_argument(" ipaddr is invalid.");
+                SYS_THROW(std::invalid_argument(" ipaddr is invalid."));
             *socket_addr_p++ = (uint8_t)data;
             p = strtok(NULL, sep);
         }
         if (socket_addr_p - socket_addr != 4)
-            throw std::invalid_argument(" ipaddr size is invalid.");
+            SYS_THROW(std::invalid_argument(" ipaddr size is invalid."));
         *socket_addr_p++ = port & 0xff;
         *socket_addr_p = (port >> 8) & 0xff;
         return 0;
@@ -494,7 +524,7 @@ int network_socket_addr_parse(const char *ip_addr, int port, uint8_t *socket_add
 
 int network_socket_addr_to_string(uint8_t *socket_addr, char *ip_addr, int *port)
 {
-    try
+    SYS_TRY
     {
         char *p = ip_addr;
 
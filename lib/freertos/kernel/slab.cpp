@@ -0,0 +1,152 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "kernel/slab.hpp"
+#include <FreeRTOS.h>
+#include <devices.h>
+#include <stdlib.h>
+#include <task.h>
+
+using namespace sys;
+
+static spinlock_t registry_lock_ = SPINLOCK_INIT;
+static slab_allocator *registry_head_ = nullptr;
+
+void slab_allocator::lock() noexcept
+{
+    vTaskEnterCritical();
+    spinlock_lock(&lock_);
+}
+
+void slab_allocator::unlock() noexcept
+{
+    spinlock_unlock(&lock_);
+    vTaskExitCritical();
+}
+
+bool slab_allocator::grow() noexcept
+{
+    auto slab = reinterpret_cast<uint8_t *>(malloc(block_size_ * objects_per_slab_));
+    if (!slab)
+        return false;
+
+    free_block *head = nullptr;
+    for (size_t i = objects_per_slab_; i-- > 0;)
+    {
+        auto block = reinterpret_cast<free_block *>(slab + i * block_size_);
+        block->next = head;
+        head = block;
+    }
+
+    auto tail = reinterpret_cast<free_block *>(slab + (objects_per_slab_ - 1) * block_size_);
+    lock();
+    bool first = slabs_++ == 0;
+    tail->next = free_list_;
+    free_list_ = head;
+    unlock();
+
+    if (first)
+    {
+        vTaskEnterCritical();
+        spinlock_lock(&registry_lock_);
+        next_ = registry_head_;
+        registry_head_ = this;
+        spinlock_unlock(&registry_lock_);
+        vTaskExitCritical();
+    }
+
+    return true;
+}
+
+void *slab_allocator::allocate() noexcept
+{
+    while (true)
+    {
+        lock();
+        auto block = free_list_;
+        if (block)
+        {
+            free_list_ = block->next;
+            allocations_++;
+            if (++in_use_ > peak_)
+                peak_ = in_use_;
+        }
+        unlock();
+
+        if (block)
+            return block;
+        if (!grow())
+            return nullptr;
+    }
+}
+
+void slab_allocator::deallocate(void *ptr) noexcept
+{
+    if (!ptr)
+        return;
+
+    auto block = reinterpret_cast<free_block *>(ptr);
+    lock();
+    block->next = free_list_;
+    free_list_ = block;
+    in_use_--;
+    unlock();
+}
+
+void *slab_allocator::allocate_fallback(size_t size) noexcept
+{
+    lock();
+    fallbacks_++;
+    unlock();
+    return ::operator new(size, std::nothrow);
+}
+
+void slab_allocator::get_statistics(slab_statistics_t &stats) noexcept
+{
+    lock();
+    stats.name = name_;
+    stats.object_size = object_size_;
+    stats.objects_per_slab = objects_per_slab_;
+    stats.slabs = slabs_;
+    stats.in_use = in_use_;
+    stats.peak = peak_;
+    stats.allocations = allocations_;
+    stats.fallbacks = fallbacks_;
+    unlock();
+}
+
+size_t slab_allocator::get_all_statistics(slab_statistics_t *stats, size_t count) noexcept
+{
+    vTaskEnterCritical();
+    spinlock_lock(&registry_lock_);
+    auto head = registry_head_;
+    spinlock_unlock(&registry_lock_);
+    vTaskExitCritical();
+
+    /* Allocators are never unregistered, so the list can be walked without the lock. */
+    size_t total = 0;
+    for (auto allocator = head; allocator; allocator = allocator->next_)
+    {
+        if (total < count)
+            allocator->get_statistics(stats[total]);
+        total++;
+    }
+
+    return total;
+}
+
+size_t system_get_slab_statistics(slab_statistics_t *stats, size_t count)
+{
+    return slab_allocator::get_all_statistics(stats, count);
+}
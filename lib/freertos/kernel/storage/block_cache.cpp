@@ -0,0 +1,201 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "FreeRTOS.h"
+#include "kernel/block_cache.hpp"
+#include <cstring>
+
+using namespace sys;
+
+block_cache::block_cache(block_storage_driver &storage, size_t blocks, size_t bypass_blocks, size_t write_run_blocks)
+    : storage_(storage), block_size_(storage.get_rw_block_size()), blocks_(blocks), bypass_blocks_(bypass_blocks), write_run_blocks_(write_run_blocks), clock_(0), stats_({})
+{
+    configASSERT(blocks && bypass_blocks && write_run_blocks);
+    lines_.reset(new line[blocks]);
+    data_.reset(new uint8_t[blocks * block_size_]);
+    write_run_.reset(new uint8_t[write_run_blocks * block_size_]);
+    for (size_t i = 0; i < blocks; i++)
+        lines_[i] = { 0, 0, false, false, data_.get() + i * block_size_ };
+}
+
+void block_cache::read_blocks(uint32_t start_block, uint32_t blocks_count, gsl::span<uint8_t> buffer)
+{
+    auto dest = buffer.data();
+    if (blocks_count >= bypass_blocks_)
+    {
+        storage_.read_blocks(start_block, blocks_count, buffer);
+        stats_.bypassed_blocks += blocks_count;
+        /* Blocks not written back yet are newer than the device */
+        for (size_t i = 0; i < blocks_; i++)
+        {
+            auto &l = lines_[i];
+            if (l.valid && l.dirty && l.block >= start_block && l.block - start_block < blocks_count)
+                memcpy(dest + (l.block - start_block) * block_size_, l.data, block_size_);
+        }
+        return;
+    }
+
+    uint32_t i = 0;
+    while (i < blocks_count)
+    {
+        auto hit = find(start_block + i);
+        if (hit)
+        {
+            memcpy(dest + i * block_size_, hit->data, block_size_);
+            touch(*hit);
+            stats_.read_hits++;
+            i++;
+            continue;
+        }
+
+        /* Fetch a run of misses with one device read */
+        uint32_t run = 1;
+        while (i + run < blocks_count && !find(start_block + i + run))
+            run++;
+        storage_.read_blocks(start_block + i, run, { dest + i * block_size_, std::ptrdiff_t(run * block_size_) });
+        stats_.read_misses += run;
+        for (uint32_t j = 0; j < run; j++)
+        {
+            auto &l = allocate(start_block + i + j);
+            memcpy(l.data, dest + (i + j) * block_size_, block_size_);
+        }
+        i += run;
+    }
+}
+
+void block_cache::write_blocks(uint32_t start_block, uint32_t blocks_count, gsl::span<const uint8_t> buffer)
+{
+    auto src = buffer.data();
+    if (blocks_count >= bypass_blocks_)
+    {
+        storage_.write_blocks(start_block, blocks_count, buffer);
+        stats_.bypassed_blocks += blocks_count;
+        /* Cached copies now match the device */
+        for (size_t i = 0; i < blocks_; i++)
+        {
+            auto &l = lines_[i];
+            if (l.valid && l.block >= start_block && l.block - start_block < blocks_count)
+            {
+                memcpy(l.data, src + (l.block - start_block) * block_size_, block_size_);
+                l.dirty = false;
+            }
+        }
+        return;
+    }
+
+    for (uint32_t i = 0; i < blocks_count; i++)
+    {
+        auto l = find(start_block + i);
+        if (l)
+        {
+            stats_.write_hits++;
+        }
+        else
+        {
+            stats_.write_misses++;
+            l = &allocate(start_block + i);
+        }
+
+        memcpy(l->data, src + i * block_size_, block_size_);
+        l->dirty = true;
+        touch(*l);
+    }
+}
+
+void block_cache::flush()
+{
+    for (size_t i = 0; i < blocks_; i++)
+    {
+        auto &l = lines_[i];
+        if (l.valid && l.dirty)
+            write_back(l.block);
+    }
+}
+
+void block_cache::get_statistics(block_cache_statistics_t &stats) const noexcept
+{
+    stats = stats_;
+}
+
+block_cache::line *block_cache::find(uint32_t block) noexcept
+{
+    for (size_t i = 0; i < blocks_; i++)
+    {
+        auto &l = lines_[i];
+        if (l.valid && l.block == block)
+            return &l;
+    }
+
+    return nullptr;
+}
+
+block_cache::line *block_cache::find_dirty(uint32_t block) noexcept
+{
+    auto l = find(block);
+    return l && l->dirty ? l : nullptr;
+}
+
+/* Takes a free line or the least recently used one, writing it back first if dirty */
+block_cache::line &block_cache::allocate(uint32_t block)
+{
+    line *victim = &lines_[0];
+    for (size_t i = 0; i < blocks_; i++)
+    {
+        auto &l = lines_[i];
+        if (!l.valid)
+        {
+            victim = &l;
+            break;
+        }
+
+        if (l.last_use < victim->last_use)
+            victim = &l;
+    }
+
+    if (victim->valid && victim->dirty)
+        write_back(victim->block);
+
+    victim->block = block;
+    victim->valid = true;
+    victim->dirty = false;
+    touch(*victim);
+    return *victim;
+}
+
+void block_cache::touch(line &l) noexcept
+{
+    l.last_use = ++clock_;
+}
+
+/* Writes block back together with the dirty blocks next to it */
+void block_cache::write_back(uint32_t block)
+{
+    uint32_t first = block;
+    while (first > 0 && block - first + 1 < write_run_blocks_ && find_dirty(first - 1))
+        first--;
+    uint32_t last = block;
+    while (last - first + 1 < write_run_blocks_ && find_dirty(last + 1))
+        last++;
+
+    size_t count = last - first + 1;
+    for (size_t i = 0; i < count; i++)
+        memcpy(write_run_.get() + i * block_size_, find_dirty(first + i)->data, block_size_);
+
+    /* The blocks stay dirty if the write throws, so a later flush tries them again */
+    storage_.write_blocks(first, count, { write_run_.get(), std::ptrdiff_t(count * block_size_) });
+    for (size_t i = 0; i < count; i++)
+        find_dirty(first + i)->dirty = false;
+    stats_.written_back_blocks += count;
+    stats_.write_back_runs++;
+}
@@ -15,8 +15,11 @@
 #include "filesystem.h"
 #include "FreeRTOS.h"
 #include "devices.h"
+#include "kernel/block_cache.hpp"
 #include "kernel/driver_impl.hpp"
+#include "kernel/slab.hpp"
 #include <array>
+#include <cstdlib>
 #include <cstring>
 #include <diskio.h>
 #include <ff.h>
@@ -25,6 +28,49 @@ using namespace sys;
 
 #define MAX_FILE_SYSTEMS 16
 
+/* Blocks cached per mounted filesystem, 0 disables the cache */
+#ifndef CONFIG_FS_BLOCK_CACHE_BLOCKS
+#define CONFIG_FS_BLOCK_CACHE_BLOCKS 16
+#endif
+
+/* Requests of this many blocks or more bypass the cache, so file data does not evict the FAT */
+#ifndef CONFIG_FS_BLOCK_CACHE_BYPASS
+#define CONFIG_FS_BLOCK_CACHE_BYPASS 8
+#endif
+
+/* Most adjacent dirty blocks written back with one multi-block write */
+#ifndef CONFIG_FS_BLOCK_CACHE_WRITE_RUN
+#define CONFIG_FS_BLOCK_CACHE_WRITE_RUN 4
+#endif
+
+static int fatfs_to_errno(FRESULT result)
+{
+    static const int err_no[] = {
+        0,
+        EIO,
+        EIO,
+        ENODEV,
+        ENOENT,
+        ENOENT,
+        EINVAL,
+        EACCES,
+        EEXIST,
+        EBADF,
+        EROFS,
+        ENXIO,
+        ENODEV,
+        ENODEV,
+        EIO,
+        ETIMEDOUT,
+        EBUSY,
+        ENOMEM,
+        EMFILE,
+        EINVAL
+    };
+
+    return err_no[result];
+}
+
 static void check_fatfs_error(FRESULT result)
 {
     static const char *err_str[] = {
@@ -51,14 +97,14 @@ static void check_fatfs_error(FRESULT result)
     };
 
     if (result != FR_OK)
-        throw std::runtime_error(err_str[result]);
+        SYS_THROW(errno_exception(err_str[result], fatfs_to_errno(result)));
 }
 
 static const char *normalize_path(const char *name)
 {
     auto str = std::strstr(name, "/fs/");
     if (!str)
-        throw std::runtime_error("Invalid path.");
+        SYS_THROW(std::runtime_error("Invalid path."));
     return str + 4;
 }
 
@@ -70,6 +116,8 @@ public:
     k_filesystem(object_accessor<block_storage_driver> storage)
         : storage_(std::move(storage))
     {
+        if (CONFIG_FS_BLOCK_CACHE_BLOCKS)
+            cache_.reset(new block_cache(get_storage(), CONFIG_FS_BLOCK_CACHE_BLOCKS, CONFIG_FS_BLOCK_CACHE_BYPASS, CONFIG_FS_BLOCK_CACHE_WRITE_RUN));
     }
 
     block_storage_driver &get_storage() noexcept
@@ -77,6 +125,34 @@ public:
         return *storage_.operator->();
     }
 
+    block_cache *get_cache() noexcept
+    {
+        return cache_.get();
+    }
+
+    void read_blocks(uint32_t start_block, uint32_t blocks_count, gsl::span<uint8_t> buffer)
+    {
+        if (cache_)
+            cache_->read_blocks(start_block, blocks_count, buffer);
+        else
+            get_storage().read_blocks(start_block, blocks_count, buffer);
+    }
+
+    void write_blocks(uint32_t start_block, uint32_t blocks_count, gsl::span<const uint8_t> buffer)
+    {
+        if (cache_)
+            cache_->write_blocks(start_block, blocks_count, buffer);
+        else
+            get_storage().write_blocks(start_block, blocks_count, buffer);
+    }
+
+    void flush()
+    {
+        if (cache_)
+            cache_->flush();
+        get_storage().flush();
+    }
+
     static object_ptr<k_filesystem> install_filesystem(object_accessor<block_storage_driver> storage)
     {
         auto obj = make_object<k_filesystem>(std::move(storage));
@@ -90,7 +166,7 @@ public:
             }
         }
 
-        throw std::runtime_error("Max custom drivers exceeded.");
+        SYS_THROW(std::runtime_error("Max custom drivers exceeded."));
     }
 
     static object_ptr<k_filesystem> get_filesystem(size_t index)
@@ -102,14 +178,15 @@ private:
     static std::array<object_ptr<k_filesystem>, MAX_FILE_SYSTEMS> filesystems_;
 
     object_accessor<block_storage_driver> storage_;
+    std::unique_ptr<block_cache> cache_;
 };
 
 std::array<object_ptr<k_filesystem>, MAX_FILE_SYSTEMS> k_filesystem::filesystems_;
 
-class k_filesystem_file : public filesystem_file, public heap_object, public exclusive_object_access
+class k_filesystem_file : public filesystem_file, public heap_object, public exclusive_object_access, public slab_object<k_filesystem_file>
 {
 public:
-    k_filesystem_file(const char *fileName, file_access_t file_access, file_mode_t file_mode)
+    static result<object_ptr<k_filesystem_file>> open(const char *fileName, file_access_t file_access, file_mode_t file_mode)
     {
         BYTE mode = 0;
         if (file_access & FILE_ACCESS_READ)
@@ -127,15 +204,13 @@ public:
         else if (file_mode & FILE_MODE_APPEND)
             mode |= FA_OPEN_APPEND;
 
-        check_fatfs_error(f_open(&file_, normalize_path(fileName), mode));
-
-        if (file_mode & FILE_MODE_TRUNCATE)
-        {
-            auto err = f_truncate(&file_);
-            if (err != FR_OK)
-                f_close(&file_);
-            check_fatfs_error(err);
-        }
+        object_ptr<k_filesystem_file> file(std::in_place, new k_filesystem_file());
+        auto err = f_open(&file->file_, normalize_path(fileName), mode);
+        if (err == FR_OK && (file_mode & FILE_MODE_TRUNCATE))
+            err = f_truncate(&file->file_);
+        if (err != FR_OK)
+            return make_error(fatfs_to_errno(err));
+        return file;
     }
 
     ~k_filesystem_file()
@@ -143,20 +218,24 @@ public:
         f_close(&file_);
     }
 
-    virtual size_t read(gsl::span<uint8_t> buffer) override
+    virtual result<size_t> read(gsl::span<uint8_t> buffer) override
     {
         UINT read = buffer.size();
-        check_fatfs_error(f_read(&file_, buffer.data(), read, &read));
-        return read;
+        auto err = f_read(&file_, buffer.data(), read, &read);
+        if (err != FR_OK)
+            return make_error(fatfs_to_errno(err));
+        return size_t(read);
     }
 
-    virtual size_t write(gsl::span<const uint8_t> buffer) override
+    virtual result<size_t> write(gsl::span<const uint8_t> buffer) override
     {
         UINT written = buffer.size();
-        check_fatfs_error(f_write(&file_, buffer.data(), written, &written));
+        auto err = f_write(&file_, buffer.data(), written, &written);
+        if (err != FR_OK)
+            return make_error(fatfs_to_errno(err));
         if (written != buffer.size())
-            throw std::runtime_error("Disk full.");
-        return written;
+            return make_error(ENOSPC);
+        return size_t(written);
     }
 
     virtual fpos_t get_position() override
@@ -179,10 +258,18 @@ public:
         check_fatfs_error(f_sync(&file_));
     }
 
+private:
+    k_filesystem_file()
+        : file_()
+    {
+    }
+
 private:
     FIL file_;
 };
 
+DEFINE_SLAB_OBJECT(k_filesystem_file, 4);
+
 class k_filesystem_find : public virtual object_access, public heap_object, public exclusive_object_access
 {
 public:
@@ -208,13 +295,13 @@ private:
 
 int filesystem_mount(const char *name, handle_t storage_handle)
 {
-    try
+    SYS_TRY
     {
         auto fs = k_filesystem::install_filesystem(system_handle_to_object(storage_handle).move_as<block_storage_driver>());
         check_fatfs_error(f_mount(&fs->FatFS, normalize_path(name), 1));
         return 0;
     }
-    catch (...)
+    SYS_CATCH_ALL
     {
         return -1;
     }
@@ -226,16 +313,22 @@ int filesystem_mount(const char *name, handle_t storage_handle)
     auto f = obj.as<filesystem_file>();
 
 #define CATCH_ALL \
-    catch (...) { return -1; }
+    SYS_CATCH_ALL { return -1; }
 
 handle_t filesystem_file_open(const char *filename, file_access_t file_access, file_mode_t file_mode)
 {
-    try
+    SYS_TRY
     {
-        auto file = make_object<k_filesystem_file>(filename, file_access, file_mode);
-        return system_alloc_handle(make_accessor<object_access>(file));
+        auto file = k_filesystem_file::open(filename, file_access, file_mode);
+        if (!file)
+        {
+            errno = file.error();
+            return NULL_HANDLE;
+        }
+
+        return system_alloc_handle(make_accessor<object_access>(file.value()));
     }
-    catch (...)
+    SYS_CATCH_ALL
     {
         return NULL_HANDLE;
     }
@@ -248,29 +341,29 @@ int filesystem_file_close(handle_t file)
 
 int filesystem_file_read(handle_t file, uint8_t *buffer, size_t buffer_len)
 {
-    try
+    SYS_TRY
     {
         FILE_ENTRY;
 
-        return f->read({ buffer, std::ptrdiff_t(buffer_len) });
+        return result_to_errno(f->read({ buffer, std::ptrdiff_t(buffer_len) }));
     }
     CATCH_ALL;
 }
 
 int filesystem_file_write(handle_t file, const uint8_t *buffer, size_t buffer_len)
 {
-    try
+    SYS_TRY
     {
         FILE_ENTRY;
 
-        return f->write({ buffer, std::ptrdiff_t(buffer_len) });
+        return result_to_errno(f->write({ buffer, std::ptrdiff_t(buffer_len) }));
     }
     CATCH_ALL;
 }
 
 fpos_t filesystem_file_get_position(handle_t file)
 {
-    try
+    SYS_TRY
     {
         FILE_ENTRY;
 
@@ -281,7 +374,7 @@ fpos_t filesystem_file_get_position(handle_t file)
 
 int filesystem_file_set_position(handle_t file, fpos_t position)
 {
-    try
+    SYS_TRY
     {
         FILE_ENTRY;
 
@@ -293,7 +386,7 @@ int filesystem_file_set_position(handle_t file, fpos_t position)
 
 uint64_t filesystem_file_get_size(handle_t file)
 {
-    try
+    SYS_TRY
     {
         FILE_ENTRY;
 
@@ -304,7 +397,7 @@ uint64_t filesystem_file_get_size(handle_t file)
 
 int filesystem_file_flush(handle_t file)
 {
-    try
+    SYS_TRY
     {
         FILE_ENTRY;
 
@@ -321,14 +414,14 @@ int filesystem_file_flush(handle_t file)
 
 handle_t filesystem_find_first(const char *path, const char *pattern, find_find_data_t *find_data)
 {
-    try
+    SYS_TRY
     {
         auto find = make_object<k_filesystem_find>(path, pattern);
         find->fill_find_data(*find_data);
         auto handle = system_alloc_handle(make_accessor<object_access>(find));
         return handle;
     }
-    catch (...)
+    SYS_CATCH_ALL
     {
         return NULL_HANDLE;
     }
@@ -336,7 +429,7 @@ handle_t filesystem_find_first(const char *path, const char *pattern, find_find_
 
 bool filesystem_find_next(handle_t handle, find_find_data_t *find_data)
 {
-    try
+    SYS_TRY
     {
         FIND_ENTRY;
 
@@ -353,6 +446,19 @@ int filesystem_find_close(handle_t handle)
     return io_close(handle);
 }
 
+int filesystem_get_cache_statistics(const char *name, block_cache_statistics_t *stats)
+{
+    SYS_TRY
+    {
+        auto fs = k_filesystem::get_filesystem(std::strtoul(normalize_path(name), nullptr, 10));
+        if (!fs || !fs->get_cache())
+            return -1;
+        fs->get_cache()->get_statistics(*stats);
+        return 0;
+    }
+    CATCH_ALL;
+}
+
 extern "C"
 {
     DSTATUS disk_initialize(BYTE pdrv)
@@ -379,7 +485,7 @@ extern "C"
         auto fs = k_filesystem::get_filesystem(pdrv);
         auto &st = fs->get_storage();
 
-        st.read_blocks(sector, count, { buff, ptrdiff_t(st.get_rw_block_size() * count) });
+        fs->read_blocks(sector, count, { buff, ptrdiff_t(st.get_rw_block_size() * count) });
         return RES_OK;
     }
 
@@ -393,7 +499,7 @@ extern "C"
         auto fs = k_filesystem::get_filesystem(pdrv);
         auto &st = fs->get_storage();
 
-        st.write_blocks(sector, count, { buff, ptrdiff_t(st.get_rw_block_size() * count) });
+        fs->write_blocks(sector, count, { buff, ptrdiff_t(st.get_rw_block_size() * count) });
         return RES_OK;
     }
 
@@ -409,6 +515,7 @@ extern "C"
         switch (cmd)
         {
         case CTRL_SYNC:
+            fs->flush();
             break;
         case GET_SECTOR_COUNT:
             *(DWORD *)buff = st.get_blocks_count();
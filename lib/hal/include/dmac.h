@@ -1087,6 +1087,18 @@ typedef union _dmac_ch_llp_u
     uint64_t data;
 } dmac_ch_llp_u_t;
 
+typedef struct _dmac_lli_item
+{
+    uint64_t sar;
+    uint64_t dar;
+    uint64_t ch_block_ts;
+    uint64_t llp;
+    uint64_t ctl;
+    uint64_t sstat;
+    uint64_t dstat;
+    uint64_t resv;
+} __attribute__((packed, aligned(64))) dmac_lli_item_t;
+
 typedef struct _dmac_ch_status
 {
     /* Bits [21:0] is completed block transfer size */
@@ -22,7 +22,7 @@
 using namespace sys;
 
 #define CATCH_ALL \
-    catch (errno_exception &e)      \
+    SYS_CATCH(errno_exception &e)   \
     {                               \
         errno = e.code();           \
         return -1;                  \
@@ -30,7 +30,7 @@ using namespace sys;
 
 int ioctl(int handle, unsigned int cmd, void *argp)
 {
-    try
+    SYS_TRY
     {
         auto &obj = system_handle_to_object(handle); \
         configASSERT(obj.is<custom_driver>());      \
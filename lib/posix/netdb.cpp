@@ -24,7 +24,7 @@ using namespace sys;
 static struct hostent posix_hostent;
 struct hostent *gethostbyname(const char *name)
 {
-    try
+    SYS_TRY
     {
         hostent_t sys_hostent;
         network_socket_gethostbyname(name, &sys_hostent);
@@ -38,11 +38,11 @@ struct hostent *gethostbyname(const char *name)
             posix_hostent.h_addrtype = AF_INET;
             break;
         default:
-            throw std::invalid_argument("Invalid address type.");
+            SYS_THROW(std::invalid_argument("Invalid address type."));
         }
         return &posix_hostent;
     }
-    catch (...)
+    SYS_CATCH_ALL
     {
         return NULL;
     }
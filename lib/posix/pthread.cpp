@@ -287,12 +287,12 @@ int pthread_setspecific(pthread_key_t key, const void *value)
         vTaskSetThreadLocalStoragePointer(NULL, PTHREAD_TLS_INDEX, tls);
     }
 
-    try
+    SYS_TRY
     {
         tls->storage[key] = uintptr_t(value);
         return 0;
     }
-    catch (...)
+    SYS_CATCH_ALL
     {
         return ENOMEM;
     }
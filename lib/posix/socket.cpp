@@ -27,7 +27,7 @@ using namespace sys;
     auto f = obj.as<network_socket>();
 
 #define CATCH_ALL               \
-    catch (errno_exception & e) \
+    SYS_CATCH(errno_exception & e) \
     {                           \
         errno = e.code();       \
         return -1;              \
@@ -35,12 +35,12 @@ using namespace sys;
 
 #define CHECK_ARG(x) \
     if (!x)          \
-        throw std::invalid_argument(#x " is invalid.");
+        SYS_THROW(std::invalid_argument(#x " is invalid."));
 
 static void to_posix_sockaddr(sockaddr_in &addr, const socket_address_t &socket_addr)
 {
     if (socket_addr.family != AF_INTERNETWORK)
-        throw std::runtime_error("Invalid socket address.");
+        SYS_THROW(std::runtime_error("Invalid socket address."));
 
     addr.sin_len = sizeof(addr);
     addr.sin_family = AF_INET;
@@ -51,7 +51,7 @@ static void to_posix_sockaddr(sockaddr_in &addr, const socket_address_t &socket_
 static void to_sys_sockaddr(socket_address_t &addr, const sockaddr_in &socket_addr)
 {
     if (socket_addr.sin_family != AF_INET)
-        throw std::runtime_error("Invalid socket address.");
+        SYS_THROW(std::runtime_error("Invalid socket address."));
 
     addr.family = AF_INTERNETWORK;
     addr.data[3] = (socket_addr.sin_addr.s_addr >> 24) & 0xFF;
@@ -63,7 +63,7 @@ static void to_sys_sockaddr(socket_address_t &addr, const sockaddr_in &socket_ad
 
 int socket(int domain, int type, int protocol)
 {
-    try
+    SYS_TRY
     {
         address_family_t address_family;
         switch (domain)
@@ -72,7 +72,7 @@ int socket(int domain, int type, int protocol)
             address_family = AF_INTERNETWORK;
             break;
         default:
-            throw std::invalid_argument("Invalid domain.");
+            SYS_THROW(std::invalid_argument("Invalid domain."));
         }
 
         socket_type_t s_type;
@@ -85,7 +85,7 @@ int socket(int domain, int type, int protocol)
             s_type = SOCKET_DATAGRAM;
             break;
         default:
-            throw std::invalid_argument("Invalid type.");
+            SYS_THROW(std::invalid_argument("Invalid type."));
         }
 
         protocol_type_t s_protocol;
@@ -101,12 +101,12 @@ int socket(int domain, int type, int protocol)
             s_protocol = PROTCL_IP;
             break;
         default:
-            throw std::invalid_argument("Invalid protocol.");
+            SYS_THROW(std::invalid_argument("Invalid protocol."));
         }
 
         return network_socket_open(address_family, s_type, s_protocol);
     }
-    catch (...)
+    SYS_CATCH_ALL
     {
         return NULL_HANDLE;
     }
@@ -114,7 +114,7 @@ int socket(int domain, int type, int protocol)
 
 int bind(int socket, const struct sockaddr *address, socklen_t address_len)
 {
-    try
+    SYS_TRY
     {
         SOCKET_ENTRY;
         CHECK_ARG(address);
@@ -129,25 +129,30 @@ int bind(int socket, const struct sockaddr *address, socklen_t address_len)
 
 int accept(int socket, struct sockaddr *address, socklen_t *address_len)
 {
-    try
+    SYS_TRY
     {
         SOCKET_ENTRY;
         CHECK_ARG(address);
 
         socket_address_t remote_addr;
         auto ret = f->accept(&remote_addr);
+        if (!ret)
+        {
+            errno = ret.error();
+            return -1;
+        }
 
         sockaddr_in *addr = reinterpret_cast<sockaddr_in *>(address);
         to_posix_sockaddr(*addr, remote_addr);
 
-        return system_alloc_handle(std::move(ret));
+        return system_alloc_handle(std::move(ret.value()));
     }
     CATCH_ALL;
 }
 
 int shutdown(int socket, int how)
 {
-    try
+    SYS_TRY
     {
         SOCKET_ENTRY;
         f->shutdown((socket_shutdown_t)how);
@@ -158,22 +163,21 @@ int shutdown(int socket, int how)
 
 int connect(int socket, const struct sockaddr *address, socklen_t address_len)
 {
-    try
+    SYS_TRY
     {
         SOCKET_ENTRY;
         CHECK_ARG(address);
 
         socket_address_t remote_addr;
         to_sys_sockaddr(remote_addr, *reinterpret_cast<const sockaddr_in *>(address));
-        f->connect(remote_addr);
-        return 0;
+        return result_to_errno(f->connect(remote_addr));
     }
     CATCH_ALL;
 }
 
 int listen(int socket, int backlog)
 {
-    try
+    SYS_TRY
     {
         SOCKET_ENTRY;
 
@@ -185,7 +189,7 @@ int listen(int socket, int backlog)
 
 int recv(int socket, void *mem, size_t len, int flags)
 {
-    try
+    SYS_TRY
     {
         socket_message_flag_t recv_flags = MESSAGE_NORMAL;
         if (flags & MSG_PEEK)
@@ -201,14 +205,14 @@ int recv(int socket, void *mem, size_t len, int flags)
 
         SOCKET_ENTRY;
 
-        return f->receive({ (uint8_t *)mem, std::ptrdiff_t(len) }, recv_flags);
+        return result_to_errno(f->receive({ (uint8_t *)mem, std::ptrdiff_t(len) }, recv_flags));
     }
     CATCH_ALL;
 }
 
 int send(int socket, const void *data, size_t size, int flags)
 {
-    try
+    SYS_TRY
     {
         socket_message_flag_t send_flags = MESSAGE_NORMAL;
         if (flags & MSG_PEEK)
@@ -224,15 +228,15 @@ int send(int socket, const void *data, size_t size, int flags)
 
         SOCKET_ENTRY;
 
-        f->send({ (const uint8_t *)data, std::ptrdiff_t(size) }, send_flags);
-        return 0;
+        auto ret = f->send({ (const uint8_t *)data, std::ptrdiff_t(size) }, send_flags);
+        return ret ? 0 : result_to_errno(ret);
     }
     CATCH_ALL;
 }
 
 int recvfrom(int socket, void *mem, size_t len, int flags, struct sockaddr *from, socklen_t *fromlen)
 {
-    try
+    SYS_TRY
     {
         socket_message_flag_t recv_flags = MESSAGE_NORMAL;
         if (flags & MSG_PEEK)
@@ -250,17 +254,19 @@ int recvfrom(int socket, void *mem, size_t len, int flags, struct sockaddr *from
 
         socket_address_t remote_addr;
         auto ret = f->receive_from({ (uint8_t *)mem, std::ptrdiff_t(len) }, recv_flags, &remote_addr);
+        if (!ret)
+            return result_to_errno(ret);
 
         sockaddr_in *addr = reinterpret_cast<sockaddr_in *>(from);
         to_posix_sockaddr(*addr, remote_addr);
-        return ret;
+        return ret.value();
     }
     CATCH_ALL;
 }
 
 int sendto(int socket, const void *data, size_t size, int flags, const struct sockaddr *to, socklen_t tolen)
 {
-    try
+    SYS_TRY
     {
         socket_message_flag_t send_flags = MESSAGE_NORMAL;
         if (flags & MSG_PEEK)
@@ -279,15 +285,15 @@ int sendto(int socket, const void *data, size_t size, int flags, const struct so
         socket_address_t remote_addr;
         to_sys_sockaddr(remote_addr, *reinterpret_cast<const sockaddr_in *>(to));
 
-        f->send_to({ (const uint8_t *)data, std::ptrdiff_t(size) }, send_flags, remote_addr);
-        return 0;
+        auto ret = f->send_to({ (const uint8_t *)data, std::ptrdiff_t(size) }, send_flags, remote_addr);
+        return ret ? 0 : result_to_errno(ret);
     }
     CATCH_ALL;
 }
 
 int select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptset, struct timeval *timeout)
 {
-    try
+    SYS_TRY
     {
         int socket = maxfdp1 - 1;
         SOCKET_ENTRY;
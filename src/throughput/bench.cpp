@@ -0,0 +1,68 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "bench.h"
+#include <stdio.h>
+#ifdef BENCH_HOST
+#include <time.h>
+#else
+#include <encoding.h>
+#include <sysctl.h>
+#endif
+
+#ifdef BENCH_HOST
+#define BENCH_TARGET "host"
+#else
+#define BENCH_TARGET "k210"
+#endif
+
+uint8_t *const bench_src = new uint8_t[BENCH_BUFFER_SIZE];
+uint8_t *const bench_dest = new uint8_t[BENCH_BUFFER_SIZE];
+
+uint64_t bench_now()
+{
+#ifdef BENCH_HOST
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+#else
+    return read_csr(mcycle);
+#endif
+}
+
+uint64_t bench_clock_hz()
+{
+#ifdef BENCH_HOST
+    return 1000000000ULL;
+#else
+    return sysctl_clock_get_freq(SYSCTL_CLOCK_CPU);
+#endif
+}
+
+void bench_begin()
+{
+    printf("# target=%s clock_hz=%llu\n", BENCH_TARGET, (unsigned long long)bench_clock_hz());
+    printf("suite,variant,bytes,iterations,ticks_per_op,ns_per_op,kb_per_s\n");
+}
+
+void bench_report(const char *suite, const char *variant, size_t bytes, size_t iterations, uint64_t ticks)
+{
+    uint64_t hz = bench_clock_hz();
+    uint64_t per_op = iterations ? ticks / iterations : 0;
+    uint64_t ns = per_op * 1000000000ULL / hz;
+    uint64_t kb_per_s = ticks ? uint64_t(bytes) * iterations * hz / ticks / 1024 : 0;
+
+    printf("%s,%s,%u,%u,%llu,%llu,%llu\n", suite, variant, (unsigned)bytes, (unsigned)iterations,
+        (unsigned long long)per_op, (unsigned long long)ns, (unsigned long long)kb_per_s);
+}
@@ -0,0 +1,96 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _THROUGHPUT_BENCH_H
+#define _THROUGHPUT_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Frames from which the SPI driver switches from the FIFO to DMA. Build the SDK and the
+ * benchmark with the same -DCONFIG_SPI_DMA_THRESHOLD to measure another crossover. */
+#ifndef CONFIG_SPI_DMA_THRESHOLD
+#define CONFIG_SPI_DMA_THRESHOLD 0x800UL
+#endif
+
+#define BENCH_SPI_DMA_THRESHOLD CONFIG_SPI_DMA_THRESHOLD
+/* Frames the SPI FIFO holds, transfers up to this size are always polled */
+#define BENCH_SPI_FIFO_DEPTH 32
+/* Bytes of bench_src and bench_dest */
+#define BENCH_BUFFER_SIZE 65536
+
+/* Payload buffers for the suites. They are allocated rather than static: the DMA driver tells
+ * memory from peripherals by address, and the host build has SRAM only where its heap is. */
+extern uint8_t *const bench_src;
+extern uint8_t *const bench_dest;
+
+/**
+ * @brief       Read the benchmark clock
+ *
+ * @return      mcycle on the board, a monotonic nanosecond clock on the host
+ */
+uint64_t bench_now();
+
+/**
+ * @brief       Get the frequency of the benchmark clock
+ *
+ * @return      Ticks of bench_now per second
+ */
+uint64_t bench_clock_hz();
+
+/**
+ * @brief       Print the preamble and the column header of the result table
+ */
+void bench_begin();
+
+/**
+ * @brief       Print one row of the result table
+ *
+ * @param[in]   suite           The peripheral or service being measured
+ * @param[in]   variant         The path through it, e.g. pio or dma
+ * @param[in]   bytes           Payload of one operation, 0 if it has none
+ * @param[in]   iterations      Operations timed
+ * @param[in]   ticks           bench_now ticks taken by all operations
+ */
+void bench_report(const char *suite, const char *variant, size_t bytes, size_t iterations, uint64_t ticks);
+
+/**
+ * @brief       Time iterations calls of op and report them as one row
+ */
+template <class TOp>
+void bench_run(const char *suite, const char *variant, size_t bytes, size_t iterations, TOp &&op)
+{
+    /* One untimed call, so lazy driver installs and cold caches are not charged to the row */
+    op();
+    uint64_t start = bench_now();
+    for (size_t i = 0; i < iterations; i++)
+        op();
+    bench_report(suite, variant, bytes, iterations, bench_now() - start);
+}
+
+void bench_io_dispatch();
+void bench_io_open();
+void bench_dma_dispatch();
+void bench_dma();
+void bench_dma_subword();
+void bench_dma_memcpy();
+void bench_spi();
+void bench_i2c();
+void bench_sdcard();
+void bench_aes();
+void bench_sha();
+void bench_fft();
+void bench_dma_statistics();
+
+#endif /* _THROUGHPUT_BENCH_H */
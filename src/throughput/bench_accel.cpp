@@ -0,0 +1,70 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "bench.h"
+#include <FreeRTOS.h>
+#include <devices.h>
+
+void bench_aes()
+{
+    static const size_t sizes[] = { 16, 256, 4096, 16384 };
+    uint8_t key[16] = { 0 };
+    uint8_t iv[16] = { 0 };
+    uint8_t tag[16];
+    cbc_context_t cbc = { key, iv };
+    gcm_context_t gcm = { key, iv, nullptr, 0 };
+
+    for (size_t size : sizes)
+    {
+        size_t iterations = size >= 4096 ? 50 : 500;
+        bench_run("aes", "ecb128", size, iterations, [&] {
+            aes_ecb128_hard_encrypt(key, bench_src, size, bench_dest);
+        });
+        bench_run("aes", "cbc128", size, iterations, [&] {
+            aes_cbc128_hard_encrypt(&cbc, bench_src, size, bench_dest);
+        });
+        bench_run("aes", "gcm128", size, iterations, [&] {
+            aes_gcm128_hard_encrypt(&gcm, bench_src, size, bench_dest, tag);
+        });
+    }
+}
+
+void bench_sha()
+{
+    static const size_t sizes[] = { 64, 1024, 16384 };
+    uint8_t digest[32];
+
+    for (size_t size : sizes)
+    {
+        size_t iterations = size >= 16384 ? 50 : 500;
+        bench_run("sha256", "hard", size, iterations, [&] {
+            sha256_hard_calculate(bench_src, size, digest);
+        });
+    }
+}
+
+/* Each uint64_t of the input holds two complex points of 16-bit real and imaginary parts */
+void bench_fft()
+{
+    static const size_t points[] = { 64, 128, 256, 512 };
+    auto input = reinterpret_cast<const uint64_t *>(bench_src);
+    auto output = reinterpret_cast<uint64_t *>(bench_dest);
+
+    for (size_t point : points)
+    {
+        bench_run("fft", "complex_uint16", point * sizeof(uint32_t), 500, [&] {
+            fft_complex_uint16(0x1ff, FFT_DIR_FORWARD, input, point, output);
+        });
+    }
+}
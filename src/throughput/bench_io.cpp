@@ -0,0 +1,105 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "bench.h"
+#include <FreeRTOS.h>
+#include <devices.h>
+#include <hal.h>
+
+#define BENCH_SPI_CLOCK_RATE 25000000
+#define BENCH_I2C_CLOCK_RATE 400000
+/* Any slave will do: without one every transfer ends in an address NAK and only measures the abort */
+#define BENCH_I2C_SLAVE_ADDRESS 0x50
+
+void bench_dma()
+{
+    static const size_t sizes[] = { 8, 256, 1024, 4096, 16384, 65536 };
+
+    handle_t dma = dma_open_free();
+    for (size_t size : sizes)
+    {
+        size_t iterations = size >= 16384 ? 100 : 1000;
+        bench_run("dma_transmit", "mem2mem", size, iterations, [&] {
+            dma_transmit(dma, bench_src, bench_dest, true, true, sizeof(uint64_t), size / sizeof(uint64_t), 4);
+        });
+    }
+
+    dma_close(dma);
+}
+
+/* Sizes on both sides of the thresholds, so the polled, interrupt driven and DMA paths show up
+ * next to each other */
+void bench_spi()
+{
+    static const size_t sizes[] = { 16, BENCH_SPI_FIFO_DEPTH + 1, 256, 1024, BENCH_SPI_DMA_THRESHOLD - 1, BENCH_SPI_DMA_THRESHOLD, 8192, 32768 };
+    static const spi_fifo_mode_t modes[] = { SPI_FIFO_POLLED, SPI_FIFO_INTERRUPT };
+    auto tx = bench_src;
+    auto rx = bench_dest;
+
+    handle_t spi = io_open("/dev/spi0");
+    handle_t device = spi_get_device(spi, SPI_MODE_0, SPI_FF_STANDARD, 1, 8);
+    spi_dev_set_clock_rate(device, BENCH_SPI_CLOCK_RATE);
+
+    for (auto mode : modes)
+    {
+        spi_dev_set_fifo_mode(device, mode);
+        for (size_t size : sizes)
+        {
+            bool dma = size >= BENCH_SPI_DMA_THRESHOLD;
+            bool irq = mode == SPI_FIFO_INTERRUPT && !dma && size > BENCH_SPI_FIFO_DEPTH;
+            /* Only the interrupt driven sizes differ between the modes */
+            if (mode == SPI_FIFO_INTERRUPT && !irq)
+                continue;
+
+            const char *variant = dma ? "dma" : (irq ? "irq" : "pio");
+            size_t iterations = size >= 8192 ? 20 : 200;
+            bench_run("spi_write", variant, size, iterations, [&] {
+                io_write(device, tx, size);
+            });
+            bench_run("spi_read", variant, size, iterations, [&] {
+                io_read(device, rx, size);
+            });
+            bench_run("spi_full_duplex", variant, size, iterations, [&] {
+                spi_dev_transfer_full_duplex(device, tx, size, rx, size);
+            });
+        }
+    }
+
+    io_close(device);
+    io_close(spi);
+}
+
+void bench_i2c()
+{
+    static const size_t sizes[] = { 1, 16, 64 };
+    auto tx = bench_src;
+    auto rx = bench_dest;
+
+    handle_t i2c = io_open("/dev/i2c0");
+    handle_t device = i2c_get_device(i2c, BENCH_I2C_SLAVE_ADDRESS, 7);
+    i2c_dev_set_clock_rate(device, BENCH_I2C_CLOCK_RATE);
+
+    for (size_t size : sizes)
+    {
+        bench_run("i2c_write", "pio", size, 20, [&] {
+            io_write(device, tx, size);
+        });
+        bench_run("i2c_write_read", "pio", size, 20, [&] {
+            i2c_dev_transfer_sequential(device, tx, 1, rx, size);
+        });
+    }
+
+    io_close(device);
+    io_close(i2c);
+}
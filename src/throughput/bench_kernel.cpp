@@ -0,0 +1,261 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "bench.h"
+#include <FreeRTOS.h>
+#include <algorithm>
+#include <clint.h>
+#include <devices.h>
+#include <hal.h>
+#include <kernel/driver_impl.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysctl.h>
+#include <uart.h>
+
+using namespace sys;
+
+#define BENCH_KERNEL_ITERATIONS 10000
+#define BENCH_DMA_CHANNELS 8
+#define BENCH_DMA_SUBWORD_ITERATIONS 1000
+/* Custom drivers installed on top of /dev/bench_null, lookups should not slow down with them */
+#define BENCH_IO_OPEN_EXTRA_DRIVERS 16
+
+/* A file that does no work, so only the io_* dispatch cost is measured */
+class null_file : public filesystem_file, public heap_object, public free_object_access
+{
+public:
+    virtual result<size_t> read(gsl::span<uint8_t> buffer) override
+    {
+        return buffer.size();
+    }
+
+    virtual result<size_t> write(gsl::span<const uint8_t> buffer) override
+    {
+        return buffer.size();
+    }
+
+    virtual fpos_t get_position() override
+    {
+        return 0;
+    }
+
+    virtual void set_position(fpos_t position) override
+    {
+    }
+
+    virtual uint64_t get_size() override
+    {
+        return 0;
+    }
+
+    virtual void flush() override
+    {
+    }
+};
+
+/* A custom driver that does no work, so only the io_open/io_close cost is measured */
+class null_driver : public custom_driver, public heap_object, public free_object_access
+{
+public:
+    virtual void install() override
+    {
+    }
+
+    virtual int control(uint32_t control_code, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer) override
+    {
+        return 0;
+    }
+};
+
+/* The dispatch io_read used before the interface kind was cached in the handle */
+static int legacy_io_read(handle_t file, uint8_t *buffer, size_t len)
+{
+    auto &obj = system_handle_to_object(file);
+    if (auto f = obj.as<uart_driver>())
+        return f->read({ buffer, std::ptrdiff_t(len) });
+    else if (auto f = obj.as<i2c_device_driver>())
+        return f->read({ buffer, std::ptrdiff_t(len) });
+    else if (auto f = obj.as<spi_device_driver>())
+        return f->read({ buffer, std::ptrdiff_t(len) });
+    else if (auto f = obj.as<filesystem_file>())
+        return result_to_errno(f->read({ buffer, std::ptrdiff_t(len) }));
+    else if (auto f = obj.as<network_socket>())
+        return result_to_errno(f->read({ buffer, std::ptrdiff_t(len) }));
+    return -1;
+}
+
+void bench_io_dispatch()
+{
+    static const size_t sizes[] = { 1, 4, 16, 64 };
+    uint8_t buffer[64];
+
+    auto file = make_object<null_file>();
+    handle_t handle = system_alloc_handle(make_accessor<object_access>(file));
+    configASSERT(handle);
+
+    for (size_t size : sizes)
+    {
+        bench_run("io_dispatch", "legacy", size, BENCH_KERNEL_ITERATIONS, [&] {
+            legacy_io_read(handle, buffer, size);
+        });
+        bench_run("io_dispatch", "io_read", size, BENCH_KERNEL_ITERATIONS, [&] {
+            io_read(handle, buffer, size);
+        });
+    }
+
+    io_close(handle);
+}
+
+/* Open and close through the driver name index, for system drivers early and late in the
+ * registry and for custom drivers before and after more of them are installed */
+void bench_io_open()
+{
+    static const char *names[] = { "/dev/gpio0", "/dev/spi0", "/dev/kpu0", "/dev/bench_null" };
+    char last_name[32];
+
+    system_install_driver("/dev/bench_null", make_object<null_driver>());
+    for (const char *name : names)
+    {
+        bench_run("io_open", name, 0, BENCH_KERNEL_ITERATIONS, [=] {
+            io_close(io_open(name));
+        });
+    }
+
+    for (size_t i = 0; i < BENCH_IO_OPEN_EXTRA_DRIVERS; i++)
+    {
+        snprintf(last_name, sizeof(last_name), "/dev/bench_null%u", (unsigned)i);
+        system_install_driver(last_name, make_object<null_driver>());
+    }
+
+    bench_run("io_open", names[3], 0, BENCH_KERNEL_ITERATIONS, [=] {
+        io_close(io_open(names[3]));
+    });
+    bench_run("io_open", last_name, 0, BENCH_KERNEL_ITERATIONS, [&] {
+        io_close(io_open(last_name));
+    });
+}
+
+/* A channel through its handle against the driver reference, with one setting in between */
+void bench_dma_dispatch()
+{
+    bench_run("dma_dispatch", "handle", 0, BENCH_KERNEL_ITERATIONS, [] {
+        handle_t dma = dma_open_free();
+        dma_set_request_source(dma, SYSCTL_DMA_SELECT_SSI0_TX_REQ);
+        dma_close(dma);
+    });
+    bench_run("dma_dispatch", "direct", 0, BENCH_KERNEL_ITERATIONS, [] {
+        auto &dma = dma_acquire_channel();
+        dma_set_request_source(dma, SYSCTL_DMA_SELECT_SSI0_TX_REQ);
+        dma_release_channel(dma);
+    });
+}
+
+/* The per-transfer work the DMA driver does for 8-bit peripheral frames: the allocation the
+ * bounce buffer replaced, packing and unpacking through it, and on the host a whole transfer */
+void bench_dma_subword()
+{
+    static const size_t sizes[] = { 512, 1500 };
+    auto bytes = bench_src;
+    auto words = reinterpret_cast<uint32_t *>(bench_dest);
+#ifdef BENCH_HOST
+    /* UART1 has no model behind it, its THR takes each element as soon as the DMAC moves it.
+     * On the board the handshake would time the UART line instead. */
+    auto &uart1 = *reinterpret_cast<volatile uart_t *>(UART1_BASE_ADDR);
+#endif
+
+    for (size_t size : sizes)
+    {
+        bench_run("dma_subword", "malloc_widen", size, BENCH_KERNEL_ITERATIONS, [&] {
+            auto alloc_mem = reinterpret_cast<uint32_t *>(malloc(sizeof(uint32_t) * size + 128));
+            for (size_t j = 0; j < size; j++)
+                alloc_mem[j] = bytes[j];
+            /* Keep the compiler from dropping the copy and the allocation with it */
+            asm volatile("" : : "r"(alloc_mem) : "memory");
+            free(alloc_mem);
+        });
+        bench_run("dma_subword", "widen", size, BENCH_KERNEL_ITERATIONS, [&] {
+            dma_widen(words, bytes, 1, size, true);
+        });
+        bench_run("dma_subword", "narrow", size, BENCH_KERNEL_ITERATIONS, [&] {
+            dma_narrow(bytes, words, 1, size, true);
+        });
+#ifdef BENCH_HOST
+        bench_run("dma_subword", "dma_transmit", size, BENCH_DMA_SUBWORD_ITERATIONS, [&] {
+            auto &dma = dma_acquire_channel();
+            dma_transmit(dma, bytes, &uart1.THR, true, false, 1, size, 4);
+            dma_release_channel(dma);
+        });
+#endif
+    }
+}
+
+/* CPU against DMA copies, for tuning CONFIG_DMA_MEMCPY_THRESHOLD */
+void bench_dma_memcpy()
+{
+    static const size_t sizes[] = { 256, 1024, 4096, 16384, BENCH_BUFFER_SIZE };
+    const size_t iterations = 100;
+
+    for (size_t size : sizes)
+    {
+        bench_run("dma_memcpy", "memcpy", size, iterations, [&] {
+            memcpy(bench_dest, bench_src, size);
+        });
+        bench_run("dma_memcpy", "dma", size, iterations, [&] {
+            auto &dma = dma_acquire_channel();
+            dma_transmit(dma, bench_src, bench_dest, true, true, sizeof(uint64_t), size / sizeof(uint64_t), 16);
+            dma_release_channel(dma);
+        });
+        bench_run("dma_memcpy", "dma_memcpy", size, iterations, [&] {
+            dma_memcpy(bench_dest, bench_src, size);
+        });
+    }
+}
+
+/* How busy each channel and AXI master was over the suites before, as '#' lines after the table */
+void bench_dma_statistics()
+{
+    dma_channel_statistics_t stats[BENCH_DMA_CHANNELS];
+    size_t count = std::min(dma_get_channel_statistics(stats, BENCH_DMA_CHANNELS), size_t(BENCH_DMA_CHANNELS));
+
+    for (size_t i = 0; i < count; i++)
+    {
+        auto &stat = stats[i];
+        printf("# dma_channel name=%s grants=%u handoffs=%u busy_pct=%u\n", stat.name, (unsigned)stat.grants, (unsigned)stat.handoffs,
+            (unsigned)(stat.elapsed_time ? stat.busy_time * 100 / stat.elapsed_time : 0));
+    }
+
+    static const uint32_t controls[] = { DMAC_CONTROL_GET_CHANNEL_STATISTICS, DMAC_CONTROL_GET_MASTER_STATISTICS };
+    static const char *kinds[] = { "channel", "master" };
+    dmac_transfer_statistics_t transfers[BENCH_DMA_CHANNELS];
+    handle_t dmac = io_open("/dev/dmac0");
+    uint64_t cpu_mhz = sysctl_clock_get_freq(SYSCTL_CLOCK_CPU) / 1000000UL;
+
+    for (size_t c = 0; c < 2; c++)
+    {
+        int entries = io_control(dmac, controls[c], nullptr, 0, (uint8_t *)transfers, sizeof(transfers));
+        for (int i = 0; i < entries; i++)
+        {
+            auto &stat = transfers[i];
+            uint64_t busy_us = stat.busy_time * CLINT_CLOCK_DIV / cpu_mhz;
+            printf("# dma_%s_transfers index=%d bytes=%llu transfers=%u busy_pct=%u mb_per_s=%u\n", kinds[c], i,
+                (unsigned long long)stat.bytes, (unsigned)stat.transfers,
+                (unsigned)(stat.elapsed_time ? stat.busy_time * 100 / stat.elapsed_time : 0),
+                (unsigned)(busy_us ? stat.bytes / busy_us : 0));
+        }
+    }
+
+    io_close(dmac);
+}
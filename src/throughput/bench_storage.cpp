@@ -0,0 +1,59 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "bench.h"
+#include <FreeRTOS.h>
+#include <devices.h>
+#include <filesystem.h>
+#include <stdio.h>
+#include <storage/sdcard.h>
+
+/* Where the card is wired, the board must have muxed the SPI and chip select pins */
+#define BENCH_SD_SPI "/dev/spi1"
+#define BENCH_SD_CS_GPIO "/dev/gpio0"
+#define BENCH_SD_CS_PIN 7
+#define BENCH_SD_MOUNT "/fs/0/"
+#define BENCH_SD_FILE "/fs/0/bench.bin"
+#define BENCH_SD_ITERATIONS 32
+
+/* Sequential streaming of a file through FatFS. Whole sector chunks bypass the FatFS window
+ * and reach the card as one multi-block command each; kb_per_s / 1024 is the MB/s. */
+void bench_sdcard()
+{
+    static const size_t sizes[] = { 4096, 32768 };
+
+    handle_t spi = io_open(BENCH_SD_SPI);
+    handle_t gpio = io_open(BENCH_SD_CS_GPIO);
+    handle_t sdcard = spi_sdcard_driver_install(spi, gpio, BENCH_SD_CS_PIN);
+    if (!sdcard || filesystem_mount(BENCH_SD_MOUNT, sdcard) != 0)
+    {
+        printf("# sdcard: nothing mounted at %s, skipped\n", BENCH_SD_MOUNT);
+        return;
+    }
+
+    for (size_t size : sizes)
+    {
+        handle_t file = filesystem_file_open(BENCH_SD_FILE, FILE_ACCESS_READ_WRITE, FILE_MODE_CREATE_ALWAYS);
+        bench_run("sdcard_write", "sequential", size, BENCH_SD_ITERATIONS, [&] {
+            filesystem_file_write(file, bench_src, size);
+        });
+        filesystem_file_close(file);
+
+        file = filesystem_file_open(BENCH_SD_FILE, FILE_ACCESS_READ, FILE_MODE_OPEN_EXISTING);
+        bench_run("sdcard_read", "sequential", size, BENCH_SD_ITERATIONS, [&] {
+            filesystem_file_read(file, bench_src, size);
+        });
+        filesystem_file_close(file);
+    }
+}
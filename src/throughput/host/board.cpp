@@ -0,0 +1,35 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* The board the benchmark runs on in the host build: the TF card slot of the usual K210
+ * boards, on SPI1 with its chip select on GPIOHS7 */
+#include "sim_sdcard.h"
+#include <fpioa.h>
+
+#define BOARD_SD_CS_IO 29
+#define BOARD_SD_CS_GPIO_PIN 7
+/* 4MB, FAT16 */
+#define BOARD_SD_BLOCKS 8192
+
+extern "C" int configure_fpioa()
+{
+    static sim_sdcard sdcard(BOARD_SD_CS_GPIO_PIN, BOARD_SD_BLOCKS);
+
+    fpioa_set_function(27, FUNC_SPI1_SCLK);
+    fpioa_set_function(28, FUNC_SPI1_D0);
+    fpioa_set_function(26, FUNC_SPI1_D1);
+    fpioa_set_function(BOARD_SD_CS_IO, static_cast<fpioa_function_t>(FUNC_GPIOHS0 + BOARD_SD_CS_GPIO_PIN));
+    host_attach_spi_slave("/dev/spi1", 1, &sdcard);
+    return 0;
+}
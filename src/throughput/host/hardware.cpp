@@ -0,0 +1,391 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* The hardware the kernel and the drivers program: the peripheral registers are plain memory
+ * at their K210 addresses, and a thread plays the DMAC and the PLIC. It starts the channels
+ * the DMA driver enables, moves their blocks and linked lists element by element through the
+ * FIFO models of the peripherals, and runs the completion handlers. The AES, SHA256 and FFT
+ * engines are only as deep as their drivers look: their status reads ready and their data
+ * registers are memory, so those drivers run their full path on meaningless data. */
+#include "host.h"
+#include <FreeRTOS.h>
+#include <aes.h>
+#include <atomic>
+#include <chrono>
+#include <clint.h>
+#include <condition_variable>
+#include <dmac.h>
+#include <kernel/driver.hpp>
+#include <map>
+#include <mutex>
+#include <plic.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sysctl.h>
+#include <thread>
+#include <uarths.h>
+
+#define DMA_CHANNELS 6
+#define DMA_CHANNEL_EN(ch) (1ULL << (ch))
+#define DMA_CHANNEL_WE(ch) (1ULL << ((ch) + 8))
+/* Elements a channel moves before the others get a turn */
+#define DMA_ELEMENTS_PER_TURN 256
+/* How often the idle hardware thread looks at the registers without being woken */
+#define HARDWARE_POLL_INTERVAL std::chrono::milliseconds(1)
+
+volatile clint_t *const clint = (volatile clint_t *)CLINT_BASE_ADDR;
+volatile sysctl_t *const sysctl = (volatile sysctl_t *)SYSCTL_BASE_ADDR;
+
+namespace
+{
+typedef struct
+{
+    uintptr_t base;
+    size_t size;
+} peripheral_window_t;
+
+/* CLINT, GPIOHS, FFT, and the APB and SPI windows from the DMAC to SPI1 */
+const peripheral_window_t peripheral_windows_[] = {
+    { CLINT_BASE_ADDR, 0x10000 },
+    { GPIOHS_BASE_ADDR, 0x1000 },
+    { FFT_BASE_ADDR, 0x10000 },
+    { DMAC_BASE_ADDR, SPI1_BASE_ADDR + 0x10000 - DMAC_BASE_ADDR },
+};
+
+typedef struct
+{
+    bool active;
+    bool linked;
+    bool last;
+    uintptr_t next_lli;
+    uintptr_t sar;
+    uintptr_t dar;
+    size_t remaining;
+    size_t width;
+    bool sinc;
+    bool dinc;
+    sim_fifo *src_fifo;
+    sim_fifo *dst_fifo;
+} channel_state_t;
+
+std::mutex hardware_mutex_;
+std::condition_variable hardware_event_;
+bool hardware_woken_;
+std::thread hardware_thread_;
+const auto start_time_ = std::chrono::steady_clock::now();
+
+std::mutex fifos_mutex_;
+std::map<uintptr_t, sim_fifo *> fifos_;
+
+std::atomic<bool> irq_pending_[IRQN_MAX];
+std::atomic<bool> irq_enabled_[IRQN_MAX];
+
+channel_state_t channels_[DMA_CHANNELS];
+
+volatile dmac_t &dmac()
+{
+    return *reinterpret_cast<volatile dmac_t *>(DMAC_BASE_ADDR);
+}
+
+sim_fifo *find_fifo(uintptr_t address)
+{
+    std::lock_guard<std::mutex> lock(fifos_mutex_);
+    auto it = fifos_.find(address);
+    return it == fifos_.end() ? nullptr : it->second;
+}
+
+void run_isr(uint32_t irq)
+{
+    host_enter_isr();
+    sys::kernel_iface_pic_on_irq(irq);
+    host_exit_isr();
+}
+
+bool dispatch_irqs()
+{
+    bool dispatched = false;
+    for (uint32_t irq = 0; irq < IRQN_MAX; irq++)
+    {
+        if (irq_enabled_[irq].load() && irq_pending_[irq].exchange(false))
+        {
+            run_isr(irq);
+            dispatched = true;
+        }
+    }
+
+    return dispatched;
+}
+
+void load_block(channel_state_t &state, uint64_t sar, uint64_t dar, uint64_t block_ts, uint64_t ctl)
+{
+    dmac_ch_ctl_u_t ctl_u;
+    ctl_u.data = ctl;
+    state.sar = sar;
+    state.dar = dar;
+    state.remaining = block_ts + 1;
+    /* The driver sets both widths the same */
+    state.width = size_t(1) << ctl_u.ch_ctl.src_tr_width;
+    /* 0 increments */
+    state.sinc = !ctl_u.ch_ctl.sinc;
+    state.dinc = !ctl_u.ch_ctl.dinc;
+    state.last = !state.linked || ctl_u.ch_ctl.shadowreg_or_lli_last;
+    state.src_fifo = find_fifo(state.sar);
+    state.dst_fifo = find_fifo(state.dar);
+}
+
+/* The list is fetched from memory like the controller does, which is why the driver writes it
+ * through the uncached alias */
+void load_lli(channel_state_t &state)
+{
+    auto &lli = *reinterpret_cast<const volatile dmac_lli_item_t *>(state.next_lli);
+    state.next_lli = lli.llp & ~uint64_t(0x3F);
+    load_block(state, lli.sar, lli.dar, lli.ch_block_ts, lli.ctl);
+}
+
+void start_channel(size_t ch)
+{
+    auto &regs = dmac().channel[ch];
+    auto &state = channels_[ch];
+    dmac_ch_cfg_u_t cfg_u;
+    cfg_u.data = regs.cfg;
+
+    regs.intstatus &= ~regs.intclear;
+    regs.intclear = 0;
+    state.active = true;
+    state.linked = cfg_u.ch_cfg.src_multblk_type == LINKEDLIST;
+    if (state.linked)
+    {
+        state.next_lli = regs.llp & ~uint64_t(0x3F);
+        load_lli(state);
+    }
+    else
+    {
+        load_block(state, regs.sar, regs.dar, regs.block_ts, regs.ctl);
+    }
+}
+
+void complete_channel(size_t ch)
+{
+    auto &regs = dmac().channel[ch];
+    channels_[ch].active = false;
+
+    uint64_t chen = dmac().chen;
+    while (!__atomic_compare_exchange_n(&dmac().chen, &chen, chen & ~(DMA_CHANNEL_EN(ch) | DMA_CHANNEL_WE(ch)), false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        ;
+
+    regs.intstatus |= 0x2;
+    uint32_t irq = IRQN_DMA0_INTERRUPT + ch;
+    if (irq_enabled_[irq].load())
+        run_isr(irq);
+    else
+        irq_pending_[irq] = true;
+    regs.intstatus &= ~regs.intclear;
+    regs.intclear = 0;
+}
+
+/* Starts what the driver enabled with the write enable bit, and drops enable bits a racing
+ * read-modify-write of chen brought back for idle channels */
+void poll_channel_enable()
+{
+    uint64_t chen = dmac().chen;
+    for (size_t ch = 0; ch < DMA_CHANNELS; ch++)
+    {
+        if (channels_[ch].active || !(chen & DMA_CHANNEL_EN(ch)))
+            continue;
+
+        uint64_t clear = chen & DMA_CHANNEL_WE(ch) ? DMA_CHANNEL_WE(ch) : DMA_CHANNEL_EN(ch);
+        while (!__atomic_compare_exchange_n(&dmac().chen, &chen, chen & ~clear, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            ;
+        if (clear == DMA_CHANNEL_WE(ch))
+            start_channel(ch);
+        chen &= ~clear;
+    }
+}
+
+uint64_t read_element(sim_fifo *fifo, uintptr_t address, size_t width)
+{
+    if (fifo)
+        return fifo->dma_read(width);
+    uint64_t value = 0;
+    memcpy(&value, (const void *)address, width);
+    return value;
+}
+
+void write_element(sim_fifo *fifo, uintptr_t address, uint64_t value, size_t width)
+{
+    if (fifo)
+        fifo->dma_write(value, width);
+    else
+        memcpy((void *)address, &value, width);
+}
+
+/* Moves up to a turn of elements, returns whether any moved */
+bool step_channel(size_t ch)
+{
+    auto &state = channels_[ch];
+    bool progressed = false;
+    if (!state.src_fifo && !state.dst_fifo && state.sinc && state.dinc)
+    {
+        memmove((void *)state.dar, (const void *)state.sar, state.remaining * state.width);
+        state.remaining = 0;
+        progressed = true;
+    }
+    else
+    {
+        for (size_t i = 0; i < DMA_ELEMENTS_PER_TURN && state.remaining; i++)
+        {
+            if ((state.src_fifo && !state.src_fifo->dma_readable()) || (state.dst_fifo && !state.dst_fifo->dma_writable()))
+                break;
+
+            write_element(state.dst_fifo, state.dar, read_element(state.src_fifo, state.sar, state.width), state.width);
+            if (state.sinc)
+                state.sar += state.width;
+            if (state.dinc)
+                state.dar += state.width;
+            state.remaining--;
+            progressed = true;
+        }
+    }
+
+    if (!state.remaining)
+    {
+        if (state.last)
+            complete_channel(ch);
+        else
+            load_lli(state);
+    }
+
+    return progressed;
+}
+
+void hardware_main()
+{
+    while (true)
+    {
+        host_update_mtime();
+
+        /* The reset request clears itself */
+        dmac().reset &= ~uint64_t(1);
+
+        poll_channel_enable();
+        bool busy = false;
+        for (size_t ch = 0; ch < DMA_CHANNELS; ch++)
+        {
+            if (channels_[ch].active)
+                busy |= step_channel(ch);
+        }
+
+        busy |= dispatch_irqs();
+        if (busy)
+        {
+            sched_yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(hardware_mutex_);
+        hardware_event_.wait_for(lock, HARDWARE_POLL_INTERVAL, [] { return hardware_woken_; });
+        hardware_woken_ = false;
+    }
+}
+}
+
+void host_start_hardware()
+{
+    host_map_sram();
+    for (auto &window : peripheral_windows_)
+    {
+        void *mem = mmap((void *)window.base, window.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+        if (mem != (void *)window.base)
+        {
+            fprintf(stderr, "host: cannot map the peripherals at 0x%08lx\n", (unsigned long)window.base);
+            abort();
+        }
+    }
+
+    auto &aes = *reinterpret_cast<volatile aes_t *>(AES_BASE_ADDR);
+    aes.data_in_flag = 1;
+    aes.data_out_flag = 1;
+    aes.tag_in_flag = 1;
+    aes.tag_chk = 1;
+
+    hardware_thread_ = std::thread(hardware_main);
+    hardware_thread_.detach();
+}
+
+void host_wake_hardware()
+{
+    std::lock_guard<std::mutex> lock(hardware_mutex_);
+    hardware_woken_ = true;
+    hardware_event_.notify_one();
+}
+
+void host_update_mtime()
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time_);
+    clint->mtime = uint64_t(elapsed.count()) * (HOST_CPU_FREQ / CLINT_CLOCK_DIV / 1000) / 1000000;
+}
+
+void host_register_fifo(volatile void *address, sim_fifo &fifo)
+{
+    std::lock_guard<std::mutex> lock(fifos_mutex_);
+    fifos_[(uintptr_t)address] = &fifo;
+}
+
+void host_raise_irq(uint32_t irq)
+{
+    configASSERT(irq < IRQN_MAX);
+    irq_pending_[irq] = true;
+    host_wake_hardware();
+}
+
+void host_set_irq_enable(uint32_t irq, bool enable)
+{
+    configASSERT(irq < IRQN_MAX);
+    irq_enabled_[irq] = enable;
+    if (enable)
+        host_wake_hardware();
+}
+
+/* SYSCTL */
+
+int sysctl_clock_enable(sysctl_clock_t clock)
+{
+    return 0;
+}
+
+int sysctl_clock_disable(sysctl_clock_t clock)
+{
+    return 0;
+}
+
+void sysctl_reset(sysctl_reset_t reset)
+{
+}
+
+uint32_t sysctl_clock_get_freq(sysctl_clock_t clock)
+{
+    return HOST_CPU_FREQ;
+}
+
+uint32_t sysctl_pll_set_freq(sysctl_pll_t pll, uint32_t pll_freq)
+{
+    return pll_freq;
+}
+
+void uarths_init()
+{
+}
@@ -0,0 +1,115 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* The host runtime under the SDK sources: a FreeRTOS port on threads, the SRAM and the
+ * peripheral windows mapped at their K210 addresses, and a model of the DMAC and the PLIC
+ * running in a thread of its own. */
+#ifndef _THROUGHPUT_HOST_H
+#define _THROUGHPUT_HOST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HOST_SRAM_BASE 0x80000000UL
+#define HOST_SRAM_UNCACHED_BASE 0x40000000UL
+/* The main SRAM and the AI SRAM behind it, the heap takes the part the DMA reaches */
+#define HOST_SRAM_SIZE (8 * 1024 * 1024UL)
+#define HOST_HEAP_SIZE (6 * 1024 * 1024UL)
+#define HOST_CPU_FREQ 390000000UL
+
+/* The peripheral side of a hardware handshake: a DMA channel reading or writing a registered
+ * address goes through this instead of memory, and stalls while it is not ready */
+class sim_fifo
+{
+public:
+    virtual bool dma_readable()
+    {
+        return true;
+    }
+
+    virtual bool dma_writable()
+    {
+        return true;
+    }
+
+    virtual uint64_t dma_read(size_t width) = 0;
+    virtual void dma_write(uint64_t value, size_t width) = 0;
+};
+
+/* A device on a SPI chip select, seeing each frame a byte at a time, most significant first */
+class sim_spi_slave
+{
+public:
+    virtual void select()
+    {
+    }
+
+    virtual void deselect()
+    {
+    }
+
+    virtual uint8_t exchange(uint8_t value) = 0;
+};
+
+/**
+ * @brief       Map the SRAM and its uncached alias, done on the first allocation
+ */
+void host_map_sram();
+
+/**
+ * @brief       Map the peripheral windows and start the hardware thread
+ */
+void host_start_hardware();
+
+/**
+ * @brief       Let the hardware thread run, called before a task blocks
+ */
+void host_wake_hardware();
+
+/**
+ * @brief       Refresh mtime from the host clock
+ */
+void host_update_mtime();
+
+/**
+ * @brief       Route the DMA accesses to a peripheral data register through a FIFO model
+ */
+void host_register_fifo(volatile void *address, sim_fifo &fifo);
+
+/**
+ * @brief       Raise an interrupt, its handler runs in the hardware thread
+ */
+void host_raise_irq(uint32_t irq);
+
+/**
+ * @brief       Mask or unmask an interrupt at the PLIC
+ */
+void host_set_irq_enable(uint32_t irq, bool enable);
+
+/**
+ * @brief       Enter and leave an interrupt handler on the calling thread
+ */
+void host_enter_isr();
+void host_exit_isr();
+
+/**
+ * @brief       Wire a device to a chip select of a SPI controller
+ *
+ * @param[in]   spi                 The controller, e.g. "/dev/spi0"
+ * @param[in]   chip_select_mask    The chip select the device answers on
+ * @param[in]   slave               The device, nullptr to remove it
+ */
+void host_attach_spi_slave(const char *spi, uint32_t chip_select_mask, sim_spi_slave *slave);
+
+#endif /* _THROUGHPUT_HOST_H */
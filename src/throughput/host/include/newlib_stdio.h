@@ -0,0 +1,28 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* The file API takes and returns fpos_t as a plain offset, which it is in newlib. glibc's is a
+ * struct, so the host build force-includes this header: stdio is declared first with glibc's
+ * type, and everything after it sees newlib's. */
+#ifndef _THROUGHPUT_HOST_NEWLIB_STDIO_H
+#define _THROUGHPUT_HOST_NEWLIB_STDIO_H
+
+#include <stdio.h>
+#ifdef __cplusplus
+#include <cstdio>
+#endif
+
+#define fpos_t long
+
+#endif /* _THROUGHPUT_HOST_NEWLIB_STDIO_H */
@@ -0,0 +1,27 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* FreeRTOS.h pulls in newlib's reent.h for per-task errno. Host C libraries have no such header,
+ * and errno is already per thread there, so an empty reentrancy struct is enough. */
+#ifndef _THROUGHPUT_HOST_REENT_H
+#define _THROUGHPUT_HOST_REENT_H
+
+struct _reent
+{
+    int _errno;
+};
+
+#define _REENT_INIT_PTR(x)
+
+#endif /* _THROUGHPUT_HOST_REENT_H */
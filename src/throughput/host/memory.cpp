@@ -0,0 +1,333 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* The SRAM and the heap in it. The DMA driver decides between memory and peripheral by
+ * address, so everything the firmware would allocate has to live at 0x80000000 as it does on
+ * the board: malloc and friends are replaced for the whole process. The uncached alias at
+ * 0x40000000 maps the same pages. */
+#include "host.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define HEAP_ALIGNMENT 16
+#define HEAP_USED_MAGIC 0x5553454455534544ULL
+#define HEAP_ALIGNED_MAGIC 0x414c49474e414c49ULL
+
+namespace
+{
+/* Precedes every block. A free block links to the next free one, a used block holds the magic. */
+struct block_header
+{
+    size_t size;
+    union {
+        block_header *next;
+        uint64_t magic;
+    };
+};
+
+/* Precedes the pointer returned by the aligned allocations, in place of the block header */
+struct aligned_tag
+{
+    size_t offset;
+    uint64_t magic;
+};
+
+static_assert(sizeof(block_header) == HEAP_ALIGNMENT, "Block header must keep the alignment.");
+static_assert(sizeof(aligned_tag) == sizeof(block_header), "Tag must stand in for the header.");
+
+#define MIN_BLOCK_SIZE (2 * sizeof(block_header))
+
+pthread_mutex_t heap_lock_ = PTHREAD_MUTEX_INITIALIZER;
+pthread_once_t sram_once_ = PTHREAD_ONCE_INIT;
+/* Free blocks in address order */
+block_header *free_list_;
+
+void fatal(const char *message)
+{
+    static const char prefix[] = "host: ";
+    write(STDERR_FILENO, prefix, sizeof(prefix) - 1);
+    write(STDERR_FILENO, message, strlen(message));
+    write(STDERR_FILENO, "\n", 1);
+    abort();
+}
+
+void map_sram()
+{
+    int fd = memfd_create("k210-sram", 0);
+    if (fd < 0 || ftruncate(fd, HOST_SRAM_SIZE) != 0)
+        fatal("cannot create the SRAM");
+
+    void *cached = mmap((void *)HOST_SRAM_BASE, HOST_SRAM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    void *uncached = mmap((void *)HOST_SRAM_UNCACHED_BASE, HOST_SRAM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    if (cached != (void *)HOST_SRAM_BASE || uncached != (void *)HOST_SRAM_UNCACHED_BASE)
+        fatal("cannot map the SRAM at 0x80000000 and 0x40000000");
+    close(fd);
+
+    free_list_ = reinterpret_cast<block_header *>(HOST_SRAM_BASE);
+    free_list_->size = HOST_HEAP_SIZE;
+    free_list_->next = nullptr;
+}
+
+bool in_heap(const void *ptr)
+{
+    return (uintptr_t)ptr >= HOST_SRAM_BASE + sizeof(block_header) && (uintptr_t)ptr < HOST_SRAM_BASE + HOST_HEAP_SIZE;
+}
+
+size_t block_size_for(size_t size)
+{
+    if (size > HOST_HEAP_SIZE)
+        return 0;
+    size_t block = (size + sizeof(block_header) + HEAP_ALIGNMENT - 1) & ~(size_t)(HEAP_ALIGNMENT - 1);
+    return block < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : block;
+}
+
+/* First fit, the remainder stays in the free list if it can hold a block */
+void *alloc_locked(size_t size)
+{
+    size_t block_size = block_size_for(size);
+    if (!block_size)
+        return nullptr;
+
+    for (block_header **link = &free_list_; *link; link = &(*link)->next)
+    {
+        block_header *block = *link;
+        if (block->size < block_size)
+            continue;
+
+        if (block->size - block_size >= MIN_BLOCK_SIZE)
+        {
+            auto rest = reinterpret_cast<block_header *>(reinterpret_cast<uint8_t *>(block) + block_size);
+            rest->size = block->size - block_size;
+            rest->next = block->next;
+            block->size = block_size;
+            *link = rest;
+        }
+        else
+        {
+            *link = block->next;
+        }
+
+        block->magic = HEAP_USED_MAGIC;
+        return block + 1;
+    }
+
+    return nullptr;
+}
+
+/* Inserts in address order and merges with both neighbours */
+void free_block_locked(block_header *block)
+{
+    block_header *prev = nullptr, *next = free_list_;
+    while (next && next < block)
+    {
+        prev = next;
+        next = next->next;
+    }
+
+    block->next = next;
+    if (next && reinterpret_cast<uint8_t *>(block) + block->size == reinterpret_cast<uint8_t *>(next))
+    {
+        block->size += next->size;
+        block->next = next->next;
+    }
+
+    if (prev && reinterpret_cast<uint8_t *>(prev) + prev->size == reinterpret_cast<uint8_t *>(block))
+    {
+        prev->size += block->size;
+        prev->next = block->next;
+    }
+    else if (prev)
+    {
+        prev->next = block;
+    }
+    else
+    {
+        free_list_ = block;
+    }
+}
+
+/* The block an allocation lives in and the usable bytes from ptr on, nullptr if ptr is not ours */
+block_header *find_block(void *ptr, size_t &usable)
+{
+    if (!in_heap(ptr))
+        return nullptr;
+
+    auto tag = reinterpret_cast<aligned_tag *>(ptr) - 1;
+    if (tag->magic == HEAP_ALIGNED_MAGIC)
+    {
+        auto block = reinterpret_cast<block_header *>(reinterpret_cast<uint8_t *>(ptr) - tag->offset) - 1;
+        usable = block->size - sizeof(block_header) - tag->offset;
+        return block;
+    }
+
+    auto block = reinterpret_cast<block_header *>(ptr) - 1;
+    if (block->magic != HEAP_USED_MAGIC)
+        fatal("free of a pointer that is not allocated");
+    usable = block->size - sizeof(block_header);
+    return block;
+}
+
+void *aligned_alloc_impl(size_t alignment, size_t size)
+{
+    if (alignment <= HEAP_ALIGNMENT)
+        return malloc(size);
+    if (alignment & (alignment - 1) || size > HOST_HEAP_SIZE)
+        return nullptr;
+
+    pthread_once(&sram_once_, map_sram);
+    pthread_mutex_lock(&heap_lock_);
+    /* Room for the tag ahead of the aligned pointer, which is at least one header in */
+    auto raw = reinterpret_cast<uint8_t *>(alloc_locked(size + alignment));
+    void *ptr = nullptr;
+    if (raw)
+    {
+        auto aligned = reinterpret_cast<uint8_t *>(((uintptr_t)raw + alignment - 1) & ~(uintptr_t)(alignment - 1));
+        if (aligned == raw)
+        {
+            ptr = raw;
+        }
+        else
+        {
+            auto tag = reinterpret_cast<aligned_tag *>(aligned) - 1;
+            tag->offset = aligned - raw;
+            tag->magic = HEAP_ALIGNED_MAGIC;
+            ptr = aligned;
+        }
+    }
+
+    pthread_mutex_unlock(&heap_lock_);
+    return ptr;
+}
+}
+
+void host_map_sram()
+{
+    pthread_once(&sram_once_, map_sram);
+}
+
+extern "C"
+{
+void *malloc(size_t size) noexcept
+{
+    pthread_once(&sram_once_, map_sram);
+    pthread_mutex_lock(&heap_lock_);
+    void *ptr = alloc_locked(size);
+    pthread_mutex_unlock(&heap_lock_);
+    if (!ptr)
+        errno = ENOMEM;
+    return ptr;
+}
+
+void free(void *ptr) noexcept
+{
+    size_t usable;
+    /* Whatever the dynamic loader allocated before us stays where it is */
+    auto block = find_block(ptr, usable);
+    if (!block)
+        return;
+
+    pthread_mutex_lock(&heap_lock_);
+    free_block_locked(block);
+    pthread_mutex_unlock(&heap_lock_);
+}
+
+void *calloc(size_t count, size_t size) noexcept
+{
+    size_t total;
+    if (__builtin_mul_overflow(count, size, &total))
+    {
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    void *ptr = malloc(total);
+    if (ptr)
+        memset(ptr, 0, total);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) noexcept
+{
+    if (!ptr)
+        return malloc(size);
+    if (!size)
+    {
+        free(ptr);
+        return nullptr;
+    }
+
+    size_t usable;
+    if (!find_block(ptr, usable))
+        fatal("realloc of a pointer outside the heap");
+    if (size <= usable)
+        return ptr;
+
+    void *new_ptr = malloc(size);
+    if (new_ptr)
+    {
+        memcpy(new_ptr, ptr, usable);
+        free(ptr);
+    }
+
+    return new_ptr;
+}
+
+void *memalign(size_t alignment, size_t size) noexcept
+{
+    void *ptr = aligned_alloc_impl(alignment, size);
+    if (!ptr)
+        errno = ENOMEM;
+    return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept
+{
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) noexcept
+{
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)))
+        return EINVAL;
+    void *ptr = aligned_alloc_impl(alignment, size);
+    if (!ptr)
+        return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+void *valloc(size_t size) noexcept
+{
+    return memalign(getpagesize(), size);
+}
+
+void *pvalloc(size_t size) noexcept
+{
+    size_t page = getpagesize();
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void *ptr) noexcept
+{
+    size_t usable = 0;
+    if (ptr && !find_block(ptr, usable))
+        return 0;
+    return usable;
+}
+}
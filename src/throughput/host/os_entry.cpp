@@ -0,0 +1,71 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* The startup of lib/freertos/os_entry.c: main runs in the Core 0 Main task once the HAL and
+ * the drivers are installed. The executables link with --wrap=main to come through here. */
+#include "host.h"
+#include <FreeRTOS.h>
+#include <device_priv.h>
+#include <semphr.h>
+#include <task.h>
+
+typedef struct
+{
+    int (*user_main)(int, char **);
+    int argc;
+    char **argv;
+    int ret;
+    SemaphoreHandle_t exited;
+} main_thunk_param_t;
+
+extern "C" int __attribute__((weak)) configure_fpioa()
+{
+    return 0;
+}
+
+static void main_thunk(void *p)
+{
+    install_hal();
+    install_drivers();
+    configure_fpioa();
+
+    main_thunk_param_t *param = (main_thunk_param_t *)p;
+    param->ret = param->user_main(param->argc, param->argv);
+    xSemaphoreGive(param->exited);
+    vTaskDelete(NULL);
+}
+
+static int os_entry(int (*user_main)(int, char **), int argc, char **argv)
+{
+    host_start_hardware();
+
+    main_thunk_param_t param = {};
+    param.user_main = user_main;
+    param.argc = argc;
+    param.argv = argv;
+    param.exited = xSemaphoreCreateBinary();
+
+    if (xTaskCreate(main_thunk, "Core 0 Main", configMAIN_TASK_STACK_SIZE, &param, configMAIN_TASK_PRIORITY, NULL) != pdPASS)
+        return -1;
+
+    xSemaphoreTake(param.exited, portMAX_DELAY);
+    return param.ret;
+}
+
+extern "C" int __real_main(int argc, char **argv);
+
+extern "C" int __wrap_main(int argc, char **argv)
+{
+    return os_entry(__real_main, argc, argv);
+}
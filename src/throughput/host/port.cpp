@@ -0,0 +1,547 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* FreeRTOS on host threads. Tasks are threads with their stacks in the SRAM heap, queues and
+ * semaphores are a mutex and a condition variable each. Interrupt handlers run in the hardware
+ * thread under the same lock as the critical sections, so a task in a critical section keeps
+ * them out as masking interrupts would on the board. */
+#include "host.h"
+#include <FreeRTOS.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <pthread.h>
+#include <queue.h>
+#include <sched.h>
+#include <semphr.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <task.h>
+#include <thread>
+
+/* Host threads need more stack than the firmware sizes its tasks for */
+#define HOST_MIN_TASK_STACK_SIZE (64 * 1024)
+
+UBaseType_t uxCPUClockRate = HOST_CPU_FREQ;
+
+namespace
+{
+typedef struct
+{
+    TaskFunction_t function;
+    void *parameter;
+    void *stack;
+    UBaseType_t priority;
+    char name[configMAX_TASK_NAME_LEN];
+} host_task_t;
+
+struct host_queue
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    uint8_t *storage;
+    uint32_t length;
+    uint32_t item_size;
+    uint32_t count;
+    uint32_t head;
+    TaskHandle_t holder;
+    uint32_t recursion;
+    uint8_t type;
+    bool is_static;
+};
+
+static_assert(sizeof(host_queue) <= sizeof(StaticQueue_t), "A queue must fit its static buffer.");
+
+std::recursive_mutex interrupt_lock_;
+thread_local host_task_t *current_task_;
+thread_local bool in_isr_;
+const auto start_time_ = std::chrono::steady_clock::now();
+
+host_queue &get_queue(QueueHandle_t handle)
+{
+    configASSERT(handle);
+    return *reinterpret_cast<host_queue *>(handle);
+}
+
+QueueHandle_t create_queue(UBaseType_t length, UBaseType_t item_size, uint8_t *storage, StaticQueue_t *buffer, uint8_t type)
+{
+    configASSERT(length);
+    host_queue *queue;
+    if (buffer)
+    {
+        queue = new (buffer) host_queue();
+        queue->storage = storage;
+        queue->is_static = true;
+    }
+    else
+    {
+        queue = new (std::nothrow) host_queue();
+        if (!queue)
+            return nullptr;
+        queue->storage = item_size ? new (std::nothrow) uint8_t[length * item_size] : nullptr;
+        if (item_size && !queue->storage)
+        {
+            delete queue;
+            return nullptr;
+        }
+        queue->is_static = false;
+    }
+
+    configASSERT(!item_size || queue->storage);
+    queue->length = length;
+    queue->item_size = item_size;
+    queue->count = 0;
+    queue->head = 0;
+    queue->holder = nullptr;
+    queue->recursion = 0;
+    queue->type = type;
+    return queue;
+}
+
+QueueHandle_t create_mutex(uint8_t type, StaticQueue_t *buffer)
+{
+    auto handle = create_queue(1, 0, nullptr, buffer, type);
+    if (handle)
+        get_queue(handle).count = 1;
+    return handle;
+}
+
+bool is_mutex(const host_queue &queue)
+{
+    return queue.type == queueQUEUE_TYPE_MUTEX || queue.type == queueQUEUE_TYPE_RECURSIVE_MUTEX;
+}
+
+std::chrono::milliseconds ticks_to_duration(TickType_t ticks)
+{
+    return std::chrono::milliseconds(uint64_t(ticks) * 1000 / configTICK_RATE_HZ);
+}
+
+/* Blocks for up to ticks until ready() holds, the caller holds the queue mutex */
+template <class TReady>
+bool wait(host_queue &queue, std::unique_lock<std::mutex> &lock, TickType_t ticks, TReady ready)
+{
+    if (ready())
+        return true;
+    if (!ticks)
+        return false;
+
+    configASSERT(!in_isr_);
+    host_wake_hardware();
+    if (ticks == portMAX_DELAY)
+    {
+        queue.changed.wait(lock, ready);
+        return true;
+    }
+
+    return queue.changed.wait_for(lock, ticks_to_duration(ticks), ready);
+}
+
+void copy_in(host_queue &queue, const void *item, BaseType_t position)
+{
+    if (queue.item_size)
+    {
+        uint32_t index;
+        if (position == queueOVERWRITE && queue.count == queue.length)
+        {
+            index = (queue.head + queue.count - 1) % queue.length;
+            queue.count--;
+        }
+        else if (position == queueSEND_TO_FRONT)
+        {
+            queue.head = (queue.head + queue.length - 1) % queue.length;
+            index = queue.head;
+        }
+        else
+        {
+            index = (queue.head + queue.count) % queue.length;
+        }
+
+        memcpy(queue.storage + index * queue.item_size, item, queue.item_size);
+    }
+    else if (position == queueOVERWRITE && queue.count == queue.length)
+    {
+        queue.count--;
+    }
+
+    if (is_mutex(queue))
+        queue.holder = nullptr;
+    queue.count++;
+    queue.changed.notify_all();
+}
+
+void copy_out(host_queue &queue, void *buffer, bool remove)
+{
+    if (queue.item_size && buffer)
+        memcpy(buffer, queue.storage + queue.head * queue.item_size, queue.item_size);
+    if (remove)
+    {
+        queue.head = (queue.head + 1) % queue.length;
+        queue.count--;
+        queue.changed.notify_all();
+    }
+}
+
+BaseType_t send(QueueHandle_t handle, const void *item, TickType_t ticks, BaseType_t position)
+{
+    auto &queue = get_queue(handle);
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    if (!wait(queue, lock, ticks, [&] { return position == queueOVERWRITE || queue.count < queue.length; }))
+        return errQUEUE_FULL;
+    copy_in(queue, item, position);
+    return pdPASS;
+}
+
+BaseType_t receive(QueueHandle_t handle, void *buffer, TickType_t ticks, bool remove)
+{
+    auto &queue = get_queue(handle);
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    if (!wait(queue, lock, ticks, [&] { return queue.count != 0; }))
+        return errQUEUE_EMPTY;
+    copy_out(queue, buffer, remove);
+    if (remove && is_mutex(queue))
+        queue.holder = xTaskGetCurrentTaskHandle();
+    return pdPASS;
+}
+
+void *task_entry(void *arg)
+{
+    auto task = reinterpret_cast<host_task_t *>(arg);
+    current_task_ = task;
+    task->function(task->parameter);
+    /* A task function must not return, end the thread as vTaskDelete would */
+    return nullptr;
+}
+}
+
+/* Queues */
+
+QueueHandle_t xQueueGenericCreate(const UBaseType_t uxQueueLength, const UBaseType_t uxItemSize, const uint8_t ucQueueType)
+{
+    return create_queue(uxQueueLength, uxItemSize, nullptr, nullptr, ucQueueType);
+}
+
+QueueHandle_t xQueueGenericCreateStatic(const UBaseType_t uxQueueLength, const UBaseType_t uxItemSize, uint8_t *pucQueueStorage, StaticQueue_t *pxStaticQueue, const uint8_t ucQueueType)
+{
+    configASSERT(pxStaticQueue);
+    return create_queue(uxQueueLength, uxItemSize, pucQueueStorage, pxStaticQueue, ucQueueType);
+}
+
+QueueHandle_t xQueueCreateMutex(const uint8_t ucQueueType)
+{
+    return create_mutex(ucQueueType, nullptr);
+}
+
+QueueHandle_t xQueueCreateMutexStatic(const uint8_t ucQueueType, StaticQueue_t *pxStaticQueue)
+{
+    configASSERT(pxStaticQueue);
+    return create_mutex(ucQueueType, pxStaticQueue);
+}
+
+QueueHandle_t xQueueCreateCountingSemaphore(const UBaseType_t uxMaxCount, const UBaseType_t uxInitialCount)
+{
+    auto handle = create_queue(uxMaxCount, 0, nullptr, nullptr, queueQUEUE_TYPE_COUNTING_SEMAPHORE);
+    if (handle)
+        get_queue(handle).count = uxInitialCount;
+    return handle;
+}
+
+QueueHandle_t xQueueCreateCountingSemaphoreStatic(const UBaseType_t uxMaxCount, const UBaseType_t uxInitialCount, StaticQueue_t *pxStaticQueue)
+{
+    configASSERT(pxStaticQueue);
+    auto handle = create_queue(uxMaxCount, 0, nullptr, pxStaticQueue, queueQUEUE_TYPE_COUNTING_SEMAPHORE);
+    get_queue(handle).count = uxInitialCount;
+    return handle;
+}
+
+void vQueueDelete(QueueHandle_t xQueue)
+{
+    auto &queue = get_queue(xQueue);
+    if (queue.is_static)
+    {
+        queue.~host_queue();
+    }
+    else
+    {
+        delete[] queue.storage;
+        delete &queue;
+    }
+}
+
+BaseType_t xQueueGenericSend(QueueHandle_t xQueue, const void *const pvItemToQueue, TickType_t xTicksToWait, const BaseType_t xCopyPosition)
+{
+    return send(xQueue, pvItemToQueue, xTicksToWait, xCopyPosition);
+}
+
+BaseType_t xQueueGenericSendFromISR(QueueHandle_t xQueue, const void *const pvItemToQueue, BaseType_t *const pxHigherPriorityTaskWoken, const BaseType_t xCopyPosition)
+{
+    if (pxHigherPriorityTaskWoken)
+        *pxHigherPriorityTaskWoken = pdFALSE;
+    return send(xQueue, pvItemToQueue, 0, xCopyPosition);
+}
+
+BaseType_t xQueueGiveFromISR(QueueHandle_t xQueue, BaseType_t *const pxHigherPriorityTaskWoken)
+{
+    return xQueueGenericSendFromISR(xQueue, nullptr, pxHigherPriorityTaskWoken, queueSEND_TO_BACK);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *const pvBuffer, TickType_t xTicksToWait)
+{
+    return receive(xQueue, pvBuffer, xTicksToWait, true);
+}
+
+BaseType_t xQueueReceiveFromISR(QueueHandle_t xQueue, void *const pvBuffer, BaseType_t *const pxHigherPriorityTaskWoken)
+{
+    if (pxHigherPriorityTaskWoken)
+        *pxHigherPriorityTaskWoken = pdFALSE;
+    return receive(xQueue, pvBuffer, 0, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t xQueue, void *const pvBuffer, TickType_t xTicksToWait)
+{
+    return receive(xQueue, pvBuffer, xTicksToWait, false);
+}
+
+BaseType_t xQueueSemaphoreTake(QueueHandle_t xQueue, TickType_t xTicksToWait)
+{
+    return receive(xQueue, nullptr, xTicksToWait, true);
+}
+
+BaseType_t xQueueTakeMutexRecursive(QueueHandle_t xMutex, TickType_t xTicksToWait)
+{
+    auto &queue = get_queue(xMutex);
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.holder && queue.holder == xTaskGetCurrentTaskHandle())
+        {
+            queue.recursion++;
+            return pdPASS;
+        }
+    }
+
+    if (xQueueSemaphoreTake(xMutex, xTicksToWait) != pdPASS)
+        return pdFAIL;
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.recursion = 1;
+    return pdPASS;
+}
+
+BaseType_t xQueueGiveMutexRecursive(QueueHandle_t xMutex)
+{
+    auto &queue = get_queue(xMutex);
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.holder != xTaskGetCurrentTaskHandle())
+            return pdFAIL;
+        if (--queue.recursion)
+            return pdPASS;
+    }
+
+    return xQueueGenericSend(xMutex, nullptr, 0, queueSEND_TO_BACK);
+}
+
+void *xQueueGetMutexHolder(QueueHandle_t xSemaphore)
+{
+    auto &queue = get_queue(xSemaphore);
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    return queue.holder;
+}
+
+UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t xQueue)
+{
+    auto &queue = get_queue(xQueue);
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    return queue.count;
+}
+
+/* Tasks */
+
+BaseType_t xTaskCreate(TaskFunction_t pxTaskCode, const char *const pcName, const configSTACK_DEPTH_TYPE usStackDepth, void *const pvParameters, UBaseType_t uxPriority, TaskHandle_t *const pxCreatedTask)
+{
+    size_t stack_size = std::max(size_t(usStackDepth) * sizeof(StackType_t), size_t(HOST_MIN_TASK_STACK_SIZE));
+    auto task = new (std::nothrow) host_task_t();
+    void *stack = malloc(stack_size);
+    if (!task || !stack)
+    {
+        delete task;
+        free(stack);
+        return errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
+    }
+
+    task->function = pxTaskCode;
+    task->parameter = pvParameters;
+    task->stack = stack;
+    task->priority = uxPriority;
+    strncpy(task->name, pcName ? pcName : "", sizeof(task->name) - 1);
+
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, stack_size);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int ret = pthread_create(&thread, &attr, task_entry, task);
+    pthread_attr_destroy(&attr);
+    if (ret)
+    {
+        delete task;
+        free(stack);
+        return errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
+    }
+
+    if (pxCreatedTask)
+        *pxCreatedTask = task;
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete)
+{
+    /* Only a task ending itself is supported, its stack is not reclaimed */
+    configASSERT(!xTaskToDelete || xTaskToDelete == current_task_);
+    pthread_exit(nullptr);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    /* Threads the port did not create, the process main thread and the hardware thread */
+    if (!current_task_)
+    {
+        current_task_ = new host_task_t();
+        strncpy(current_task_->name, "host", sizeof(current_task_->name) - 1);
+    }
+
+    return current_task_;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time_);
+    return TickType_t(uint64_t(elapsed.count()) * configTICK_RATE_HZ / 1000);
+}
+
+void vTaskDelay(const TickType_t xTicksToDelay)
+{
+    host_wake_hardware();
+    if (xTicksToDelay)
+        std::this_thread::sleep_for(ticks_to_duration(xTicksToDelay));
+    else
+        sched_yield();
+}
+
+void vTaskSetTimeOutState(TimeOut_t *const pxTimeOut)
+{
+    pxTimeOut->xOverflowCount = 0;
+    pxTimeOut->xTimeOnEntering = xTaskGetTickCount();
+}
+
+BaseType_t xTaskCheckForTimeOut(TimeOut_t *const pxTimeOut, TickType_t *const pxTicksToWait)
+{
+    if (*pxTicksToWait == portMAX_DELAY)
+        return pdFALSE;
+
+    TickType_t now = xTaskGetTickCount();
+    TickType_t elapsed = now - pxTimeOut->xTimeOnEntering;
+    if (elapsed < *pxTicksToWait)
+    {
+        *pxTicksToWait -= elapsed;
+        pxTimeOut->xTimeOnEntering = now;
+        return pdFALSE;
+    }
+
+    *pxTicksToWait = 0;
+    return pdTRUE;
+}
+
+void vTaskEnterCritical(void)
+{
+    interrupt_lock_.lock();
+    host_update_mtime();
+}
+
+void vTaskExitCritical(void)
+{
+    interrupt_lock_.unlock();
+}
+
+/* Port */
+
+void vPortEnterCritical(void)
+{
+    vTaskEnterCritical();
+}
+
+void vPortExitCritical(void)
+{
+    vTaskExitCritical();
+}
+
+int vPortSetInterruptMask(void)
+{
+    vTaskEnterCritical();
+    return 0;
+}
+
+void vPortClearInterruptMask(int uxSavedStatusValue)
+{
+    vTaskExitCritical();
+}
+
+void vPortYield(void)
+{
+    sched_yield();
+}
+
+void vPortYieldFromISR(void)
+{
+}
+
+UBaseType_t uxPortGetProcessorId(void)
+{
+    return 0;
+}
+
+UBaseType_t uxPortGetCPUClock(void)
+{
+    return uxCPUClockRate;
+}
+
+UBaseType_t uxPortIsInISR(void)
+{
+    return in_isr_;
+}
+
+void vPortDebugBreak(void)
+{
+    abort();
+}
+
+void vPortFatal(const char *file, int line, const char *message)
+{
+    fprintf(stderr, "(%s:%d) %s\n", file, line, message);
+    fflush(stderr);
+    abort();
+}
+
+void host_enter_isr()
+{
+    interrupt_lock_.lock();
+    in_isr_ = true;
+}
+
+void host_exit_isr()
+{
+    in_isr_ = false;
+    interrupt_lock_.unlock();
+}
@@ -0,0 +1,844 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* Stand-ins for the drivers whose hardware cannot be plain memory: the SPI and I2C masters
+ * poll FIFO levels the CPU fills, the PLIC is reached through CSRs and the KPU runs its own
+ * interrupt protocol. The SPI driver keeps the path of spi.cpp, with its bus mutex, the FIFO
+ * interrupt handshake and DMA channels through dmac.cpp, bounce buffers for sub-word frames
+ * included. Its frames go to the slave models wired to the chip selects. Everything else in
+ * the registries below is the SDK's own driver. */
+#include "host.h"
+#include <FreeRTOS.h>
+#include <algorithm>
+#include <devices.h>
+#include <hal.h>
+#include <i2c.h>
+#include <kernel/driver_impl.hpp>
+#include <plic.h>
+#include <semphr.h>
+#include <spi.h>
+#include <string.h>
+#include <sysctl.h>
+#include <unistd.h>
+
+using namespace sys;
+
+/* Frames from which transfers go through DMA rather than the FIFO, as in spi.cpp */
+#ifndef CONFIG_SPI_DMA_THRESHOLD
+#define CONFIG_SPI_DMA_THRESHOLD 0x800UL
+#endif
+
+#define SPI_TRANSMISSION_THRESHOLD CONFIG_SPI_DMA_THRESHOLD
+#define SPI_FIFO_DEPTH 32
+/* Frames the FIFO interrupt moves each time it is taken */
+#define SPI_FRAMES_PER_IRQ (SPI_FIFO_DEPTH / 2)
+#define SPI_CHIP_SELECTS 4
+
+#define COMMON_ENTRY \
+    semaphore_lock locker(free_mutex_);
+
+/* PIC */
+
+class sim_pic_driver : public pic_driver, public static_object, public free_object_access
+{
+public:
+    virtual void install() override
+    {
+    }
+
+    virtual void set_irq_enable(uint32_t irq, bool enable) override
+    {
+        configASSERT(irq <= PLIC_NUM_SOURCES);
+        host_set_irq_enable(irq, enable);
+    }
+
+    virtual void set_irq_priority(uint32_t irq, uint32_t priority) override
+    {
+        configASSERT(irq <= PLIC_NUM_SOURCES);
+    }
+};
+
+/* SPI */
+
+typedef enum
+{
+    SIM_SPI_TX,
+    SIM_SPI_RX,
+    SIM_SPI_DUPLEX
+} sim_spi_direction_t;
+
+class sim_spi_device_driver;
+
+class sim_spi_driver : public spi_driver, public static_object, public free_object_access, public sim_fifo
+{
+public:
+    sim_spi_driver(const char *name, uintptr_t base_addr, sysctl_dma_select_t dma_req, plic_irq_t irq)
+        : name_(name), spi_(*reinterpret_cast<volatile spi_t *>(base_addr)), dma_req_(dma_req), irq_(irq)
+    {
+    }
+
+    virtual void install() override
+    {
+        free_mutex_ = xSemaphoreCreateMutex();
+        fifo_event_ = xSemaphoreCreateBinary();
+        host_register_fifo(&spi_.dr[0], *this);
+
+        pic_set_irq_handler(irq_, on_fifo_irq, this);
+        pic_set_irq_priority(irq_, 1);
+    }
+
+    virtual void on_first_open() override
+    {
+        pic_set_irq_enable(irq_, 1);
+    }
+
+    virtual void on_last_close() override
+    {
+        pic_set_irq_enable(irq_, 0);
+    }
+
+    virtual object_ptr<spi_device_driver> get_device(spi_mode_t mode, spi_frame_format_t frame_format, uint32_t chip_select_mask, uint32_t data_bit_length) override;
+
+    virtual void slave_config(uint32_t data_bit_length, const spi_slave_handler_t &handler) override
+    {
+        configASSERT(!"SPI slave mode is not simulated.");
+    }
+
+    virtual void slave_config_dma(const spi_slave_dma_config_t &config) override
+    {
+        configASSERT(!"SPI slave mode is not simulated.");
+    }
+
+    virtual size_t slave_read(gsl::span<uint8_t> buffer) override
+    {
+        configASSERT(!"SPI slave mode is not simulated.");
+        return 0;
+    }
+
+    virtual size_t slave_write(gsl::span<const uint8_t> buffer) override
+    {
+        configASSERT(!"SPI slave mode is not simulated.");
+        return 0;
+    }
+
+    virtual void slave_get_statistics(spi_slave_statistics_t &stats) override
+    {
+        configASSERT(!"SPI slave mode is not simulated.");
+    }
+
+    const char *name() const noexcept
+    {
+        return name_;
+    }
+
+    void attach(uint32_t chip_select_mask, sim_spi_slave *slave)
+    {
+        configASSERT(chip_select_mask && chip_select_mask < (1U << SPI_CHIP_SELECTS));
+        slaves_[__builtin_ctz(chip_select_mask)] = slave;
+    }
+
+    int read(sim_spi_device_driver &device, gsl::span<uint8_t> buffer);
+    int write(sim_spi_device_driver &device, gsl::span<const uint8_t> buffer);
+    int transfer_full_duplex(sim_spi_device_driver &device, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer);
+    int transfer_sequential(sim_spi_device_driver &device, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer);
+    int transfer_list(sim_spi_device_driver &device, gsl::span<const spi_segment_t> segments);
+    void fill(sim_spi_device_driver &device, uint32_t instruction, uint32_t address, uint32_t value, size_t count);
+
+    /* The data register as the DMA sees it */
+
+    virtual bool dma_readable() override
+    {
+        return direction_ != SIM_SPI_DUPLEX || replies_count_;
+    }
+
+    virtual bool dma_writable() override
+    {
+        return direction_ != SIM_SPI_DUPLEX || replies_count_ < SPI_FIFO_DEPTH;
+    }
+
+    virtual uint64_t dma_read(size_t width) override
+    {
+        if (direction_ != SIM_SPI_DUPLEX)
+            return exchange_frame(0xFFFFFFFF);
+
+        uint32_t reply = replies_[replies_head_];
+        replies_head_ = (replies_head_ + 1) % SPI_FIFO_DEPTH;
+        replies_count_--;
+        return reply;
+    }
+
+    virtual void dma_write(uint64_t value, size_t width) override
+    {
+        uint32_t reply = exchange_frame(uint32_t(value));
+        if (direction_ == SIM_SPI_DUPLEX)
+        {
+            replies_[(replies_head_ + replies_count_) % SPI_FIFO_DEPTH] = reply;
+            replies_count_++;
+        }
+    }
+
+private:
+    void select(sim_spi_device_driver &device);
+    void deselect();
+    void send_inst_addr(const uint8_t **buffer, size_t width, uint32_t length);
+    void transfer(sim_spi_device_driver &device, const uint8_t *tx_buffer, uint8_t *rx_buffer, size_t frames);
+    void transfer_pio(const uint8_t *tx_buffer, uint8_t *rx_buffer, size_t frames);
+    void transfer_fifo_irq(const uint8_t *tx_buffer, uint8_t *rx_buffer, size_t frames);
+    void transfer_dma(sim_spi_device_driver &device, const uint8_t *tx_buffer, uint8_t *rx_buffer, size_t frames);
+    bool use_fifo_irq(sim_spi_device_driver &device, size_t frames);
+    bool service_fifo();
+
+    uint8_t exchange_byte(uint8_t value)
+    {
+        return selected_ ? selected_->exchange(value) : 0xFF;
+    }
+
+    /* Most significant byte first, as the controller shifts them out */
+    uint32_t exchange_frame(uint32_t value)
+    {
+        uint32_t reply = 0;
+        for (size_t i = frame_bytes_; i--;)
+            reply = (reply << 8) | exchange_byte(uint8_t(value >> (i * 8)));
+        return reply;
+    }
+
+    uint32_t load_frame(const uint8_t *buffer, size_t index)
+    {
+        switch (width_)
+        {
+        case 4:
+            return reinterpret_cast<const uint32_t *>(buffer)[index];
+        case 2:
+            return reinterpret_cast<const uint16_t *>(buffer)[index];
+        default:
+            return buffer[index];
+        }
+    }
+
+    void store_frame(uint8_t *buffer, size_t index, uint32_t value)
+    {
+        switch (width_)
+        {
+        case 4:
+            reinterpret_cast<uint32_t *>(buffer)[index] = value;
+            break;
+        case 2:
+            reinterpret_cast<uint16_t *>(buffer)[index] = uint16_t(value);
+            break;
+        default:
+            buffer[index] = uint8_t(value);
+            break;
+        }
+    }
+
+    static void on_fifo_irq(void *userdata);
+
+private:
+    const char *name_;
+    volatile spi_t &spi_;
+    sysctl_dma_select_t dma_req_;
+    plic_irq_t irq_;
+    SemaphoreHandle_t free_mutex_;
+    SemaphoreHandle_t fifo_event_;
+    sim_spi_slave *slaves_[SPI_CHIP_SELECTS] = {};
+
+    sim_spi_slave *selected_ = nullptr;
+    size_t frame_bytes_ = 1;
+    size_t width_ = 1;
+    sim_spi_direction_t direction_ = SIM_SPI_TX;
+    uint32_t replies_[SPI_FIFO_DEPTH];
+    size_t replies_head_ = 0;
+    size_t replies_count_ = 0;
+
+    struct
+    {
+        const uint8_t *tx_buffer;
+        uint8_t *rx_buffer;
+        size_t frames;
+    } fifo_;
+};
+
+class sim_spi_device_driver : public spi_device_driver, public heap_object, public exclusive_object_access
+{
+public:
+    sim_spi_device_driver(object_accessor<sim_spi_driver> spi, spi_mode_t mode, spi_frame_format_t frame_format, uint32_t chip_select_mask, uint32_t data_bit_length)
+        : spi_(std::move(spi)), mode_(mode), frame_format_(frame_format), chip_select_mask_(chip_select_mask), data_bit_length_(data_bit_length)
+    {
+        configASSERT(data_bit_length >= 4 && data_bit_length <= 32);
+        configASSERT(chip_select_mask);
+
+        buffer_width_ = data_bit_length <= 8 ? 1 : (data_bit_length <= 16 ? 2 : 4);
+    }
+
+    virtual void install() override
+    {
+    }
+
+    virtual void config_non_standard(uint32_t instruction_length, uint32_t address_length, uint32_t wait_cycles, spi_inst_addr_trans_mode_t trans_mode) override
+    {
+        instruction_length_ = instruction_length;
+        address_length_ = address_length;
+        inst_width_ = get_inst_addr_width(instruction_length);
+        addr_width_ = get_inst_addr_width(address_length);
+    }
+
+    virtual double set_clock_rate(double clock_rate) override
+    {
+        return clock_rate;
+    }
+
+    virtual int read(gsl::span<uint8_t> buffer) override
+    {
+        return spi_->read(*this, buffer);
+    }
+
+    virtual int write(gsl::span<const uint8_t> buffer) override
+    {
+        return spi_->write(*this, buffer);
+    }
+
+    virtual int transfer_full_duplex(gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer) override
+    {
+        return spi_->transfer_full_duplex(*this, write_buffer, read_buffer);
+    }
+
+    virtual int transfer_sequential(gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer) override
+    {
+        return spi_->transfer_sequential(*this, write_buffer, read_buffer);
+    }
+
+    virtual int transfer_list(gsl::span<const spi_segment_t> segments) override
+    {
+        return spi_->transfer_list(*this, segments);
+    }
+
+    virtual void fill(uint32_t instruction, uint32_t address, uint32_t value, size_t count) override
+    {
+        spi_->fill(*this, instruction, address, value, count);
+    }
+
+    virtual void set_dma_priority(dma_priority_t priority, dma_subsystem_t subsystem) override
+    {
+        dma_priority_ = priority;
+        dma_subsystem_ = subsystem;
+    }
+
+    virtual void set_fifo_mode(spi_fifo_mode_t mode) override
+    {
+        fifo_mode_ = mode;
+    }
+
+private:
+    static uint32_t get_inst_addr_width(size_t length)
+    {
+        if (length == 0)
+            return 0;
+        else if (length <= 8)
+            return 1;
+        else if (length <= 16)
+            return 2;
+        else if (length <= 24)
+            return 3;
+        return 4;
+    }
+
+private:
+    friend class sim_spi_driver;
+
+    object_accessor<sim_spi_driver> spi_;
+    spi_mode_t mode_;
+    spi_frame_format_t frame_format_;
+    uint32_t chip_select_mask_;
+    uint32_t data_bit_length_;
+    uint32_t instruction_length_ = 0;
+    uint32_t address_length_ = 0;
+    uint32_t inst_width_ = 0;
+    uint32_t addr_width_ = 0;
+    uint32_t buffer_width_ = 0;
+    dma_priority_t dma_priority_ = DMA_PRIORITY_NORMAL;
+    dma_subsystem_t dma_subsystem_ = DMA_SUBSYSTEM_NONE;
+    spi_fifo_mode_t fifo_mode_ = SPI_FIFO_POLLED;
+};
+
+object_ptr<spi_device_driver> sim_spi_driver::get_device(spi_mode_t mode, spi_frame_format_t frame_format, uint32_t chip_select_mask, uint32_t data_bit_length)
+{
+    auto driver = make_object<sim_spi_device_driver>(make_accessor<sim_spi_driver>(this), mode, frame_format, chip_select_mask, data_bit_length);
+    driver->install();
+    return driver;
+}
+
+int sim_spi_driver::read(sim_spi_device_driver &device, gsl::span<uint8_t> buffer)
+{
+    COMMON_ENTRY;
+
+    size_t rx_frames = buffer.size() / device.buffer_width_;
+    select(device);
+    /* The received frames overwrite the instruction and address at the head of the buffer */
+    const uint8_t *buffer_it = buffer.data();
+    send_inst_addr(&buffer_it, device.inst_width_, device.instruction_length_);
+    send_inst_addr(&buffer_it, device.addr_width_, device.address_length_);
+    transfer(device, nullptr, buffer.data(), rx_frames);
+    deselect();
+    return buffer.size();
+}
+
+int sim_spi_driver::write(sim_spi_device_driver &device, gsl::span<const uint8_t> buffer)
+{
+    COMMON_ENTRY;
+
+    size_t tx_frames = (buffer.size() - (device.inst_width_ + device.addr_width_)) / device.buffer_width_;
+    select(device);
+    const uint8_t *buffer_write = buffer.data();
+    send_inst_addr(&buffer_write, device.inst_width_, device.instruction_length_);
+    send_inst_addr(&buffer_write, device.addr_width_, device.address_length_);
+    transfer(device, buffer_write, nullptr, tx_frames);
+    deselect();
+    return buffer.size();
+}
+
+int sim_spi_driver::transfer_full_duplex(sim_spi_device_driver &device, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer)
+{
+    configASSERT(device.frame_format_ == SPI_FF_STANDARD);
+    COMMON_ENTRY;
+
+    size_t tx_frames = write_buffer.size() / device.buffer_width_;
+    size_t rx_frames = read_buffer.size() / device.buffer_width_;
+    size_t frames = std::min(tx_frames, rx_frames);
+    select(device);
+    transfer(device, write_buffer.data(), read_buffer.data(), frames);
+    if (tx_frames > frames)
+        transfer(device, write_buffer.data() + frames * width_, nullptr, tx_frames - frames);
+    else if (rx_frames > frames)
+        transfer(device, nullptr, read_buffer.data() + frames * width_, rx_frames - frames);
+    deselect();
+    return read_buffer.size();
+}
+
+int sim_spi_driver::transfer_sequential(sim_spi_device_driver &device, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer)
+{
+    configASSERT(device.frame_format_ == SPI_FF_STANDARD);
+    COMMON_ENTRY;
+
+    select(device);
+    transfer(device, write_buffer.data(), nullptr, write_buffer.size() / device.buffer_width_);
+    transfer(device, nullptr, read_buffer.data(), read_buffer.size() / device.buffer_width_);
+    deselect();
+    return read_buffer.size();
+}
+
+int sim_spi_driver::transfer_list(sim_spi_device_driver &device, gsl::span<const spi_segment_t> segments)
+{
+    configASSERT(device.frame_format_ == SPI_FF_STANDARD);
+    COMMON_ENTRY;
+
+    size_t transferred = 0;
+    while (!segments.empty())
+    {
+        if (segments[0].type == SPI_SEGMENT_DELAY)
+        {
+            usleep(segments[0].length);
+            segments = segments.subspan(1);
+            continue;
+        }
+
+        /* One chip select frame: writes, then reads, up to a release */
+        size_t writes = 0, count = 0;
+        while (count < (size_t)segments.size())
+        {
+            auto &segment = segments[count];
+            if (segment.type == SPI_SEGMENT_DELAY || (segment.type == SPI_SEGMENT_WRITE && writes != count))
+                break;
+            configASSERT(segment.length && segment.length % device.buffer_width_ == 0);
+            if (segment.type == SPI_SEGMENT_WRITE)
+                writes++;
+            count++;
+            if (segment.cs_release)
+                break;
+        }
+
+        select(device);
+        for (auto &segment : segments.first(count))
+        {
+            if (segment.type == SPI_SEGMENT_WRITE)
+                transfer(device, segment.write_buffer, nullptr, segment.length / device.buffer_width_);
+            else
+                transfer(device, nullptr, segment.read_buffer, segment.length / device.buffer_width_);
+            transferred += segment.length;
+        }
+        deselect();
+
+        segments = segments.subspan(count);
+    }
+
+    return transferred;
+}
+
+void sim_spi_driver::fill(sim_spi_device_driver &device, uint32_t instruction, uint32_t address, uint32_t value, size_t count)
+{
+    COMMON_ENTRY;
+
+    select(device);
+    const uint8_t *buffer = (const uint8_t *)&instruction;
+    send_inst_addr(&buffer, device.inst_width_, device.instruction_length_);
+    buffer = (const uint8_t *)&address;
+    send_inst_addr(&buffer, device.addr_width_, device.address_length_);
+
+    auto &dma_write = dma_acquire_channel(device.dma_priority_, device.dma_subsystem_);
+    dma_set_request_source(dma_write, dma_req_ + 1);
+    direction_ = SIM_SPI_TX;
+    dma_transmit_async(dma_write, &value, &spi_.dr[0], 0, 0, sizeof(uint32_t), count, 4);
+    dma_wait(dma_write);
+    dma_release_channel(dma_write);
+    deselect();
+}
+
+void sim_spi_driver::select(sim_spi_device_driver &device)
+{
+    selected_ = slaves_[__builtin_ctz(device.chip_select_mask_)];
+    frame_bytes_ = (device.data_bit_length_ + 7) / 8;
+    width_ = device.buffer_width_;
+    if (selected_)
+        selected_->select();
+}
+
+void sim_spi_driver::deselect()
+{
+    if (selected_)
+        selected_->deselect();
+    selected_ = nullptr;
+}
+
+/* The same little endian gather as spi.cpp, then shifted out over the bytes of the length */
+void sim_spi_driver::send_inst_addr(const uint8_t **buffer, size_t width, uint32_t length)
+{
+    uint32_t cmd = 0;
+    for (size_t i = 0; i < width; i++)
+        cmd |= uint32_t(*(*buffer)++) << (i * 8);
+    for (size_t i = (length + 7) / 8; i--;)
+        exchange_byte(uint8_t(cmd >> (i * 8)));
+}
+
+/* Picks the path spi.cpp would for this many frames */
+void sim_spi_driver::transfer(sim_spi_device_driver &device, const uint8_t *tx_buffer, uint8_t *rx_buffer, size_t frames)
+{
+    if (!frames)
+        return;
+    if (use_fifo_irq(device, frames))
+        transfer_fifo_irq(tx_buffer, rx_buffer, frames);
+    else if (frames < SPI_TRANSMISSION_THRESHOLD)
+        transfer_pio(tx_buffer, rx_buffer, frames);
+    else
+        transfer_dma(device, tx_buffer, rx_buffer, frames);
+}
+
+void sim_spi_driver::transfer_pio(const uint8_t *tx_buffer, uint8_t *rx_buffer, size_t frames)
+{
+    vTaskEnterCritical();
+    for (size_t i = 0; i < frames; i++)
+    {
+        uint32_t reply = exchange_frame(tx_buffer ? load_frame(tx_buffer, i) : 0xFFFFFFFF);
+        if (rx_buffer)
+            store_frame(rx_buffer, i, reply);
+    }
+    vTaskExitCritical();
+}
+
+void sim_spi_driver::transfer_fifo_irq(const uint8_t *tx_buffer, uint8_t *rx_buffer, size_t frames)
+{
+    fifo_.tx_buffer = tx_buffer;
+    fifo_.rx_buffer = rx_buffer;
+    fifo_.frames = frames;
+    host_raise_irq(irq_);
+    xSemaphoreTake(fifo_event_, portMAX_DELAY);
+}
+
+/* Receiving starts first and waits on the replies the sending channel produces */
+void sim_spi_driver::transfer_dma(sim_spi_device_driver &device, const uint8_t *tx_buffer, uint8_t *rx_buffer, size_t frames)
+{
+    dma_driver *dma_read = nullptr, *dma_write = nullptr;
+    direction_ = rx_buffer ? (tx_buffer ? SIM_SPI_DUPLEX : SIM_SPI_RX) : SIM_SPI_TX;
+    replies_head_ = replies_count_ = 0;
+
+    if (rx_buffer)
+    {
+        dma_read = &dma_acquire_channel(device.dma_priority_, device.dma_subsystem_);
+        dma_set_request_source(*dma_read, dma_req_);
+        dma_transmit_async(*dma_read, &spi_.dr[0], rx_buffer, 0, 1, width_, frames, 1);
+    }
+
+    if (tx_buffer)
+    {
+        dma_write = &dma_acquire_channel(device.dma_priority_, device.dma_subsystem_);
+        dma_set_request_source(*dma_write, dma_req_ + 1);
+        dma_transmit_async(*dma_write, tx_buffer, &spi_.dr[0], 1, 0, width_, frames, 4);
+        dma_wait(*dma_write);
+        dma_release_channel(*dma_write);
+    }
+
+    if (dma_read)
+    {
+        dma_wait(*dma_read);
+        dma_release_channel(*dma_read);
+    }
+}
+
+/* Transfers that fit the FIFO are over before an interrupt could be taken, so they are polled */
+bool sim_spi_driver::use_fifo_irq(sim_spi_device_driver &device, size_t frames)
+{
+    return device.fifo_mode_ == SPI_FIFO_INTERRUPT && device.frame_format_ == SPI_FF_STANDARD
+        && device.inst_width_ + device.addr_width_ == 0 && frames > SPI_FIFO_DEPTH && frames < SPI_TRANSMISSION_THRESHOLD;
+}
+
+/* Moves the frames of one interrupt, returns true once the transfer is complete */
+bool sim_spi_driver::service_fifo()
+{
+    size_t frames = std::min(fifo_.frames, size_t(SPI_FRAMES_PER_IRQ));
+    for (size_t i = 0; i < frames; i++)
+    {
+        uint32_t reply = exchange_frame(fifo_.tx_buffer ? load_frame(fifo_.tx_buffer, i) : 0xFFFFFFFF);
+        if (fifo_.rx_buffer)
+            store_frame(fifo_.rx_buffer, i, reply);
+    }
+
+    if (fifo_.tx_buffer)
+        fifo_.tx_buffer += frames * width_;
+    if (fifo_.rx_buffer)
+        fifo_.rx_buffer += frames * width_;
+    fifo_.frames -= frames;
+    return !fifo_.frames;
+}
+
+void sim_spi_driver::on_fifo_irq(void *userdata)
+{
+    auto &driver = *reinterpret_cast<sim_spi_driver *>(userdata);
+    if (driver.service_fifo())
+    {
+        BaseType_t higher_priority_task_woken = pdFALSE;
+        xSemaphoreGiveFromISR(driver.fifo_event_, &higher_priority_task_woken);
+    }
+    else
+    {
+        host_raise_irq(driver.irq_);
+    }
+}
+
+/* I2C, with no slave on the bus every read returns the idle level */
+
+class sim_i2c_device_driver;
+
+class sim_i2c_driver : public i2c_driver, public static_object, public free_object_access
+{
+public:
+    sim_i2c_driver(uintptr_t base_addr)
+        : i2c_(*reinterpret_cast<volatile i2c_t *>(base_addr))
+    {
+    }
+
+    virtual void install() override
+    {
+        free_mutex_ = xSemaphoreCreateMutex();
+    }
+
+    virtual object_ptr<i2c_device_driver> get_device(uint32_t slave_address, uint32_t address_width) override;
+
+    virtual void config_as_slave(uint32_t slave_address, uint32_t address_width, const i2c_slave_handler_t &handler) override
+    {
+        configASSERT(!"I2C slave mode is not simulated.");
+    }
+
+    virtual double slave_set_clock_rate(double clock_rate) override
+    {
+        configASSERT(!"I2C slave mode is not simulated.");
+        return 0;
+    }
+
+    int read(gsl::span<uint8_t> buffer)
+    {
+        COMMON_ENTRY;
+        for (auto &data : buffer)
+        {
+            i2c_.data_cmd = I2C_DATA_CMD_CMD;
+            data = 0xFF;
+        }
+
+        return buffer.size();
+    }
+
+    int write(gsl::span<const uint8_t> buffer)
+    {
+        COMMON_ENTRY;
+        for (auto data : buffer)
+            i2c_.data_cmd = data;
+        return buffer.size();
+    }
+
+    int transfer_sequential(gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer)
+    {
+        COMMON_ENTRY;
+        for (auto data : write_buffer)
+            i2c_.data_cmd = data;
+        for (auto &data : read_buffer)
+        {
+            i2c_.data_cmd = I2C_DATA_CMD_CMD;
+            data = 0xFF;
+        }
+
+        return read_buffer.size();
+    }
+
+private:
+    volatile i2c_t &i2c_;
+    SemaphoreHandle_t free_mutex_;
+};
+
+class sim_i2c_device_driver : public i2c_device_driver, public heap_object, public exclusive_object_access
+{
+public:
+    sim_i2c_device_driver(object_accessor<sim_i2c_driver> i2c)
+        : i2c_(std::move(i2c))
+    {
+    }
+
+    virtual void install() override
+    {
+    }
+
+    virtual double set_clock_rate(double clock_rate) override
+    {
+        return clock_rate;
+    }
+
+    virtual int read(gsl::span<uint8_t> buffer) override
+    {
+        return i2c_->read(buffer);
+    }
+
+    virtual int write(gsl::span<const uint8_t> buffer) override
+    {
+        return i2c_->write(buffer);
+    }
+
+    virtual int transfer_sequential(gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer) override
+    {
+        return i2c_->transfer_sequential(write_buffer, read_buffer);
+    }
+
+private:
+    object_accessor<sim_i2c_driver> i2c_;
+};
+
+object_ptr<i2c_device_driver> sim_i2c_driver::get_device(uint32_t slave_address, uint32_t address_width)
+{
+    auto driver = make_object<sim_i2c_device_driver>(make_accessor<sim_i2c_driver>(this));
+    driver->install();
+    return driver;
+}
+
+/* KPU, opened by install_drivers but not run by anything on the host */
+
+class sim_kpu_driver : public kpu_driver, public static_object, public free_object_access
+{
+public:
+    virtual void install() override
+    {
+    }
+
+    virtual handle_t model_load_from_buffer(uint8_t *buffer) override
+    {
+        configASSERT(!"The KPU is not simulated.");
+        return NULL_HANDLE;
+    }
+
+    virtual int run(handle_t context, const uint8_t *src) override
+    {
+        configASSERT(!"The KPU is not simulated.");
+        return -1;
+    }
+
+    virtual int get_output(handle_t context, uint32_t index, uint8_t **data, size_t *size) override
+    {
+        configASSERT(!"The KPU is not simulated.");
+        return -1;
+    }
+};
+
+static sim_pic_driver pic0_driver;
+static sim_spi_driver spi0_driver("/dev/spi0", SPI0_BASE_ADDR, SYSCTL_DMA_SELECT_SSI0_RX_REQ, IRQN_SPI0_INTERRUPT);
+static sim_spi_driver spi1_driver("/dev/spi1", SPI1_BASE_ADDR, SYSCTL_DMA_SELECT_SSI1_RX_REQ, IRQN_SPI1_INTERRUPT);
+static sim_i2c_driver i2c0_driver(I2C0_BASE_ADDR);
+static sim_kpu_driver kpu0_driver;
+
+static sim_spi_driver *const spi_drivers[] = { &spi0_driver, &spi1_driver };
+
+static driver &g_pic_driver_pic0 = static_cast<driver &>(pic0_driver);
+static driver &g_spi_driver_spi0 = static_cast<driver &>(spi0_driver);
+static driver &g_spi_driver_spi1 = static_cast<driver &>(spi1_driver);
+static driver &g_i2c_driver_i2c0 = static_cast<driver &>(i2c0_driver);
+static driver &g_kpu_driver_kpu0 = static_cast<driver &>(kpu0_driver);
+
+void host_attach_spi_slave(const char *spi, uint32_t chip_select_mask, sim_spi_slave *slave)
+{
+    for (auto driver : spi_drivers)
+    {
+        if (!strcmp(driver->name(), spi))
+        {
+            driver->attach(chip_select_mask, slave);
+            return;
+        }
+    }
+
+    configASSERT(!"No such SPI controller.");
+}
+
+/* Registries, in place of the board's registry.cpp */
+
+extern driver &g_gpiohs_driver_gpio0;
+extern driver &g_fft_driver_fft0;
+extern driver &g_aes_driver_aes0;
+extern driver &g_sha_driver_sha256;
+extern driver &g_dmac_driver_dmac0;
+extern driver &g_dma_driver_dma0;
+extern driver &g_dma_driver_dma1;
+extern driver &g_dma_driver_dma2;
+extern driver &g_dma_driver_dma3;
+extern driver &g_dma_driver_dma4;
+extern driver &g_dma_driver_dma5;
+
+driver_registry_t sys::g_system_drivers[] = {
+    { "/dev/gpio0", { std::in_place, &g_gpiohs_driver_gpio0 } },
+    { "/dev/i2c0", { std::in_place, &g_i2c_driver_i2c0 } },
+    { "/dev/spi0", { std::in_place, &g_spi_driver_spi0 } },
+    { "/dev/spi1", { std::in_place, &g_spi_driver_spi1 } },
+    { "/dev/fft0", { std::in_place, &g_fft_driver_fft0 } },
+    { "/dev/aes0", { std::in_place, &g_aes_driver_aes0 } },
+    { "/dev/sha256", { std::in_place, &g_sha_driver_sha256 } },
+    { "/dev/kpu0", { std::in_place, &g_kpu_driver_kpu0 } },
+    {}
+};
+
+driver_registry_t sys::g_hal_drivers[] = {
+    { "/dev/pic0", { std::in_place, &g_pic_driver_pic0 } },
+    { "/dev/dmac0", { std::in_place, &g_dmac_driver_dmac0 } },
+    {}
+};
+
+driver_registry_t sys::g_dma_drivers[] = {
+    { "/dev/dmac0/0", { std::in_place, &g_dma_driver_dma0 } },
+    { "/dev/dmac0/1", { std::in_place, &g_dma_driver_dma1 } },
+    { "/dev/dmac0/2", { std::in_place, &g_dma_driver_dma2 } },
+    { "/dev/dmac0/3", { std::in_place, &g_dma_driver_dma3 } },
+    { "/dev/dmac0/4", { std::in_place, &g_dma_driver_dma4 } },
+    { "/dev/dmac0/5", { std::in_place, &g_dma_driver_dma5 } },
+    {}
+};
@@ -0,0 +1,342 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "sim_sdcard.h"
+#include <FreeRTOS.h>
+#include <gpiohs.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define SD_CMD0 0
+#define SD_CMD8 8
+#define SD_CMD9 9
+#define SD_CMD10 10
+#define SD_CMD12 12
+#define SD_CMD16 16
+#define SD_CMD17 17
+#define SD_CMD18 18
+#define SD_ACMD23 23
+#define SD_CMD24 24
+#define SD_CMD25 25
+#define SD_ACMD41 41
+#define SD_CMD55 55
+#define SD_CMD58 58
+
+#define SD_TOKEN_SINGLE 0xFE
+#define SD_TOKEN_MULTIPLE_WRITE 0xFC
+#define SD_TOKEN_STOP 0xFD
+#define SD_DATA_ACCEPTED 0x05
+#define SD_R1_ILLEGAL_COMMAND 0x04
+#define SD_R1_PARAMETER_ERROR 0x40
+/* Bytes the card holds DO low after taking a block */
+#define SD_BUSY_BYTES 4
+
+#define FAT16_RESERVED_SECTORS 1
+#define FAT16_FATS 2
+#define FAT16_ROOT_ENTRIES 512
+
+static volatile gpiohs_t &gpiohs = *reinterpret_cast<volatile gpiohs_t *>(GPIOHS_BASE_ADDR);
+
+static void put_le16(uint8_t *p, uint16_t value)
+{
+    p[0] = uint8_t(value);
+    p[1] = uint8_t(value >> 8);
+}
+
+static void put_le32(uint8_t *p, uint32_t value)
+{
+    put_le16(p, uint16_t(value));
+    put_le16(p + 2, uint16_t(value >> 16));
+}
+
+sim_sdcard::sim_sdcard(uint32_t cs_gpio_pin, uint32_t blocks)
+    : cs_gpio_pin_(cs_gpio_pin), blocks_(blocks)
+{
+    configASSERT(blocks % 1024 == 0);
+    /* Outside the SRAM, the card is not something the DMA reaches */
+    void *storage = mmap(nullptr, size_t(blocks) * SIM_SD_BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    configASSERT(storage != MAP_FAILED);
+    storage_ = reinterpret_cast<uint8_t *>(storage);
+    format();
+}
+
+sim_sdcard::~sim_sdcard()
+{
+    munmap(storage_, size_t(blocks_) * SIM_SD_BLOCK_SIZE);
+}
+
+/* A FAT16 volume without a partition table, one sector per cluster */
+void sim_sdcard::format()
+{
+    uint32_t fat_sectors = ((blocks_ + 2) * 2 + SIM_SD_BLOCK_SIZE - 1) / SIM_SD_BLOCK_SIZE;
+    uint8_t *boot = storage_;
+    static const uint8_t jump[] = { 0xEB, 0x3C, 0x90 };
+
+    memcpy(boot, jump, sizeof(jump));
+    memcpy(boot + 3, "MSDOS5.0", 8);
+    put_le16(boot + 11, SIM_SD_BLOCK_SIZE);
+    boot[13] = 1;
+    put_le16(boot + 14, FAT16_RESERVED_SECTORS);
+    boot[16] = FAT16_FATS;
+    put_le16(boot + 17, FAT16_ROOT_ENTRIES);
+    put_le16(boot + 19, blocks_ < 0x10000 ? blocks_ : 0);
+    boot[21] = 0xF8;
+    put_le16(boot + 22, fat_sectors);
+    put_le16(boot + 24, 63);
+    put_le16(boot + 26, 255);
+    put_le32(boot + 32, blocks_ < 0x10000 ? 0 : blocks_);
+    boot[36] = 0x80;
+    boot[38] = 0x29;
+    put_le32(boot + 39, 0x20181210);
+    memcpy(boot + 43, "NO NAME    ", 11);
+    memcpy(boot + 54, "FAT16   ", 8);
+    put_le16(boot + 510, 0xAA55);
+
+    for (uint32_t i = 0; i < FAT16_FATS; i++)
+    {
+        uint8_t *fat = storage_ + (FAT16_RESERVED_SECTORS + i * fat_sectors) * SIM_SD_BLOCK_SIZE;
+        put_le16(fat, 0xFFF8);
+        put_le16(fat + 2, 0xFFFF);
+    }
+}
+
+void sim_sdcard::reset_transaction()
+{
+    command_length_ = 0;
+    output_head_ = output_count_ = 0;
+    reading_ = false;
+    receive_ = RECEIVE_NONE;
+}
+
+uint8_t sim_sdcard::exchange(uint8_t value)
+{
+    if (gpiohs.output_val.u32[0] & (1U << cs_gpio_pin_))
+    {
+        selected_ = false;
+        return 0xFF;
+    }
+
+    if (!selected_)
+    {
+        selected_ = true;
+        reset_transaction();
+    }
+
+    if (!output_count_ && reading_)
+    {
+        if (read_block_ < blocks_)
+            queue_block(read_block_++);
+        else
+            reading_ = false;
+    }
+
+    uint8_t reply = pop();
+    if (receive_ != RECEIVE_NONE)
+    {
+        on_data(value);
+    }
+    else if (command_length_ || (value & 0xC0) == 0x40)
+    {
+        command_[command_length_++] = value;
+        if (command_length_ == sizeof(command_))
+        {
+            command_length_ = 0;
+            on_command();
+        }
+    }
+
+    return reply;
+}
+
+void sim_sdcard::on_command()
+{
+    static const uint8_t ocr[] = { 0xC0, 0xFF, 0x80, 0x00 };
+    static const uint8_t r7[] = { 0x00, 0x00, 0x01, 0xAA };
+    static const uint8_t cid[] = { 0x03, 'S', 'D', 'S', 'I', 'M', '0', '1', 0x10, 0x12, 0x34, 0x56, 0x78, 0x01, 0x2C, 0x01 };
+    uint8_t cmd = command_[0] & 0x3F;
+    uint32_t arg = uint32_t(command_[1]) << 24 | uint32_t(command_[2]) << 16 | uint32_t(command_[3]) << 8 | command_[4];
+    bool app_command = app_command_;
+    app_command_ = false;
+
+    /* The response follows after one byte */
+    push(0xFF);
+    switch (cmd)
+    {
+    case SD_CMD0:
+        idle_ = true;
+        push(r1());
+        break;
+    case SD_CMD8:
+        push(r1());
+        push(r7, sizeof(r7));
+        break;
+    case SD_CMD9:
+    {
+        /* CSD version 2, 512 byte blocks, C_SIZE in units of 512KB */
+        uint32_t c_size = blocks_ / 1024 - 1;
+        const uint8_t csd[] = { 0x40, 0x0E, 0x00, 0x32, 0x5B, 0x59, 0x00, uint8_t((c_size >> 16) & 0x3F),
+            uint8_t(c_size >> 8), uint8_t(c_size), 0x7F, 0x80, 0x0A, 0x40, 0x00, 0x01 };
+        push(r1());
+        push(SD_TOKEN_SINGLE);
+        push(csd, sizeof(csd));
+        push(0x00);
+        push(0x00);
+        break;
+    }
+    case SD_CMD10:
+        push(r1());
+        push(SD_TOKEN_SINGLE);
+        push(cid, sizeof(cid));
+        push(0x00);
+        push(0x00);
+        break;
+    case SD_CMD12:
+        reading_ = false;
+        push(r1());
+        break;
+    case SD_CMD17:
+        if (arg >= blocks_)
+        {
+            push(SD_R1_PARAMETER_ERROR);
+            break;
+        }
+        push(r1());
+        queue_block(arg);
+        break;
+    case SD_CMD18:
+        if (arg >= blocks_)
+        {
+            push(SD_R1_PARAMETER_ERROR);
+            break;
+        }
+        push(r1());
+        read_block_ = arg;
+        reading_ = true;
+        break;
+    case SD_CMD24:
+    case SD_CMD25:
+        if (arg >= blocks_)
+        {
+            push(SD_R1_PARAMETER_ERROR);
+            break;
+        }
+        push(r1());
+        write_block_ = arg;
+        multiple_write_ = cmd == SD_CMD25;
+        receive_ = RECEIVE_TOKEN;
+        break;
+    case SD_ACMD41:
+        if (app_command)
+            idle_ = false;
+        push(app_command ? r1() : uint8_t(r1() | SD_R1_ILLEGAL_COMMAND));
+        break;
+    case SD_CMD55:
+        app_command_ = true;
+        push(r1());
+        break;
+    case SD_CMD58:
+        push(r1());
+        push(ocr, sizeof(ocr));
+        break;
+    case SD_CMD16:
+    case SD_ACMD23:
+        push(r1());
+        break;
+    default:
+        push(r1() | SD_R1_ILLEGAL_COMMAND);
+        break;
+    }
+}
+
+void sim_sdcard::on_data(uint8_t value)
+{
+    switch (receive_)
+    {
+    case RECEIVE_TOKEN:
+        if (value == SD_TOKEN_SINGLE || (multiple_write_ && value == SD_TOKEN_MULTIPLE_WRITE))
+        {
+            receive_ = RECEIVE_DATA;
+            write_offset_ = 0;
+        }
+        else if (multiple_write_ && value == SD_TOKEN_STOP)
+        {
+            receive_ = RECEIVE_NONE;
+            /* Busy from the byte after the stop token */
+            push(0xFF);
+            for (size_t i = 0; i < SD_BUSY_BYTES; i++)
+                push(0x00);
+        }
+        break;
+    case RECEIVE_DATA:
+        write_buffer_[write_offset_++] = value;
+        if (write_offset_ == SIM_SD_BLOCK_SIZE)
+        {
+            receive_ = RECEIVE_CRC;
+            write_offset_ = 0;
+        }
+        break;
+    case RECEIVE_CRC:
+        if (++write_offset_ < 2)
+            break;
+        if (write_block_ < blocks_)
+        {
+            memcpy(storage_ + size_t(write_block_++) * SIM_SD_BLOCK_SIZE, write_buffer_, SIM_SD_BLOCK_SIZE);
+            push(SD_DATA_ACCEPTED);
+        }
+        else
+        {
+            /* Write error */
+            push(0x0D);
+        }
+        for (size_t i = 0; i < SD_BUSY_BYTES; i++)
+            push(0x00);
+        receive_ = multiple_write_ ? RECEIVE_TOKEN : RECEIVE_NONE;
+        break;
+    default:
+        break;
+    }
+}
+
+/* A gap byte, the data token, the block and its CRC */
+void sim_sdcard::queue_block(uint32_t block)
+{
+    push(0xFF);
+    push(SD_TOKEN_SINGLE);
+    push(storage_ + size_t(block) * SIM_SD_BLOCK_SIZE, SIM_SD_BLOCK_SIZE);
+    push(0x5A);
+    push(0xA5);
+}
+
+void sim_sdcard::push(uint8_t value)
+{
+    configASSERT(output_count_ < SIM_SD_OUTPUT_SIZE);
+    output_[(output_head_ + output_count_++) % SIM_SD_OUTPUT_SIZE] = value;
+}
+
+void sim_sdcard::push(const uint8_t *data, size_t length)
+{
+    while (length--)
+        push(*data++);
+}
+
+uint8_t sim_sdcard::pop()
+{
+    if (!output_count_)
+        return 0xFF;
+
+    uint8_t value = output_[output_head_];
+    output_head_ = (output_head_ + 1) % SIM_SD_OUTPUT_SIZE;
+    output_count_--;
+    return value;
+}
@@ -0,0 +1,83 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _THROUGHPUT_HOST_SIM_SDCARD_H
+#define _THROUGHPUT_HOST_SIM_SDCARD_H
+
+#include "host.h"
+
+#define SIM_SD_BLOCK_SIZE 512
+/* Enough for the responses of a command and one data block with its token and CRC */
+#define SIM_SD_OUTPUT_SIZE 1024
+
+/* An SDHC card in SPI mode, formatted FAT16. Its chip select is a GPIOHS pin as the SD card
+ * driver drives it, which the card samples on each byte: a byte clocked while the pin is high
+ * is ignored, and the first one after it went low starts a new command. */
+class sim_sdcard : public sim_spi_slave
+{
+public:
+    sim_sdcard(uint32_t cs_gpio_pin, uint32_t blocks);
+    ~sim_sdcard();
+
+    virtual uint8_t exchange(uint8_t value) override;
+
+private:
+    typedef enum
+    {
+        RECEIVE_NONE,
+        RECEIVE_TOKEN,
+        RECEIVE_DATA,
+        RECEIVE_CRC
+    } receive_state_t;
+
+    void format();
+    void reset_transaction();
+    void on_command();
+    void on_data(uint8_t value);
+    void queue_block(uint32_t block);
+    void push(uint8_t value);
+    void push(const uint8_t *data, size_t length);
+    uint8_t pop();
+
+    uint8_t r1() const noexcept
+    {
+        return idle_ ? 0x01 : 0x00;
+    }
+
+private:
+    uint32_t cs_gpio_pin_;
+    uint32_t blocks_;
+    uint8_t *storage_;
+    bool selected_ = false;
+    bool idle_ = true;
+    bool app_command_ = false;
+
+    uint8_t command_[6];
+    size_t command_length_ = 0;
+
+    uint8_t output_[SIM_SD_OUTPUT_SIZE];
+    size_t output_head_ = 0;
+    size_t output_count_ = 0;
+
+    bool reading_ = false;
+    uint32_t read_block_ = 0;
+
+    receive_state_t receive_ = RECEIVE_NONE;
+    bool multiple_write_ = false;
+    uint32_t write_block_ = 0;
+    size_t write_offset_ = 0;
+    uint8_t write_buffer_[SIM_SD_BLOCK_SIZE];
+};
+
+#endif /* _THROUGHPUT_HOST_SIM_SDCARD_H */
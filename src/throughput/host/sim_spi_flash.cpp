@@ -0,0 +1,185 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "sim_spi_flash.h"
+#include <FreeRTOS.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define FLASH_CMD_WRITE_ENABLE 0x06
+#define FLASH_CMD_READ_STATUS1 0x05
+#define FLASH_CMD_READ_STATUS2 0x35
+#define FLASH_CMD_WRITE_STATUS2 0x31
+#define FLASH_CMD_PAGE_PROGRAM 0x02
+#define FLASH_CMD_SECTOR_ERASE 0x20
+#define FLASH_CMD_READ_JEDEC_ID 0x9F
+#define FLASH_CMD_FAST_READ_QUAD_IO 0xEB
+
+#define FLASH_STATUS1_BUSY 0x01
+#define FLASH_MANUFACTURER_WINBOND 0xEF
+#define FLASH_MEMORY_TYPE_W25Q 0x40
+
+/* The instruction and three address bytes */
+#define FLASH_ADDRESS_END 4
+/* The quad read sends a mode byte after the address */
+#define FLASH_QUAD_READ_DATA_START 5
+
+sim_spi_flash::sim_spi_flash(uint32_t size_log2)
+    : size_log2_(size_log2), size_(1U << size_log2)
+{
+    configASSERT(size_log2 >= 16 && size_log2 <= 24);
+    /* Outside the SRAM, the flash is not something the DMA reaches */
+    void *storage = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    configASSERT(storage != MAP_FAILED);
+    storage_ = reinterpret_cast<uint8_t *>(storage);
+    memset(storage_, 0xFF, size_);
+}
+
+sim_spi_flash::~sim_spi_flash()
+{
+    munmap(storage_, size_);
+}
+
+void sim_spi_flash::select()
+{
+    command_length_ = 0;
+    data_length_ = 0;
+    ignored_ = false;
+}
+
+uint8_t sim_spi_flash::exchange(uint8_t value)
+{
+    if (ignored_)
+        return 0xFF;
+
+    if (!command_length_)
+    {
+        command_[command_length_++] = value;
+        if (value == FLASH_CMD_READ_STATUS1)
+        {
+            busy_reply_ = busy_polls_ != 0;
+            if (busy_polls_)
+                busy_polls_--;
+        }
+        else if (busy_polls_)
+        {
+            stats_.rejected_commands++;
+            ignored_ = true;
+        }
+        else if (value == FLASH_CMD_PAGE_PROGRAM)
+        {
+            memset(page_, 0xFF, sizeof(page_));
+        }
+
+        return 0xFF;
+    }
+
+    switch (command_[0])
+    {
+    case FLASH_CMD_READ_STATUS1:
+        return busy_reply_ ? FLASH_STATUS1_BUSY : 0;
+    case FLASH_CMD_READ_STATUS2:
+        return status2_;
+    case FLASH_CMD_READ_JEDEC_ID:
+    {
+        const uint8_t id[] = { FLASH_MANUFACTURER_WINBOND, FLASH_MEMORY_TYPE_W25Q, uint8_t(size_log2_) };
+        size_t index = command_length_++ - 1;
+        return index < sizeof(id) ? id[index] : 0xFF;
+    }
+    case FLASH_CMD_WRITE_STATUS2:
+        if (command_length_ == 1)
+            command_[command_length_++] = value;
+        return 0xFF;
+    case FLASH_CMD_SECTOR_ERASE:
+        if (command_length_ < FLASH_ADDRESS_END)
+            command_[command_length_++] = value;
+        return 0xFF;
+    case FLASH_CMD_PAGE_PROGRAM:
+        if (command_length_ < FLASH_ADDRESS_END)
+        {
+            command_[command_length_++] = value;
+        }
+        else
+        {
+            /* Past the end of the page the address wraps to its start */
+            page_[(address() + data_length_++) % SIM_FLASH_PAGE_SIZE] = value;
+        }
+        return 0xFF;
+    case FLASH_CMD_FAST_READ_QUAD_IO:
+        if (command_length_ < FLASH_QUAD_READ_DATA_START)
+        {
+            command_[command_length_++] = value;
+            return 0xFF;
+        }
+        return storage_[(address() + data_length_++) & (size_ - 1)];
+    default:
+        return 0xFF;
+    }
+}
+
+void sim_spi_flash::deselect()
+{
+    if (ignored_ || !command_length_)
+        return;
+
+    switch (command_[0])
+    {
+    case FLASH_CMD_WRITE_ENABLE:
+        write_enabled_ = true;
+        break;
+    case FLASH_CMD_WRITE_STATUS2:
+        if (command_length_ == 2 && check_writable())
+            status2_ = command_[1];
+        break;
+    case FLASH_CMD_SECTOR_ERASE:
+        if (command_length_ == FLASH_ADDRESS_END && check_writable())
+        {
+            memset(storage_ + (address() & ~(SIM_FLASH_SECTOR_SIZE - 1)), 0xFF, SIM_FLASH_SECTOR_SIZE);
+            stats_.sector_erases++;
+        }
+        break;
+    case FLASH_CMD_PAGE_PROGRAM:
+        if (command_length_ == FLASH_ADDRESS_END && data_length_ && check_writable())
+        {
+            /* Programming only clears bits */
+            uint8_t *page = storage_ + (address() & ~(SIM_FLASH_PAGE_SIZE - 1));
+            for (size_t i = 0; i < SIM_FLASH_PAGE_SIZE; i++)
+                page[i] &= page_[i];
+            stats_.page_programs++;
+        }
+        break;
+    case FLASH_CMD_FAST_READ_QUAD_IO:
+        if (data_length_)
+        {
+            stats_.quad_reads++;
+            stats_.quad_read_bytes += data_length_;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+bool sim_spi_flash::check_writable()
+{
+    if (!write_enabled_)
+    {
+        stats_.rejected_commands++;
+        return false;
+    }
+
+    write_enabled_ = false;
+    busy_polls_ = SIM_FLASH_BUSY_POLLS;
+    return true;
+}
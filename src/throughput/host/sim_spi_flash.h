@@ -0,0 +1,101 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _THROUGHPUT_HOST_SIM_SPI_FLASH_H
+#define _THROUGHPUT_HOST_SIM_SPI_FLASH_H
+
+#include "host.h"
+
+#define SIM_FLASH_PAGE_SIZE 256
+#define SIM_FLASH_SECTOR_SIZE 4096
+/* Status reads that see BUSY after an erase, a program or a status write */
+#define SIM_FLASH_BUSY_POLLS 2
+
+/* A W25Q NOR flash with the commands the SPI flash driver sends. Like the real part it only
+ * clears bits when programming, a page program wraps within its page, and erase and program
+ * need the write enable latch. The quad read sees its bytes in order as the host SPI
+ * controller passes them, without dummy clocks. Commands take effect when the chip select
+ * is released. */
+class sim_spi_flash : public sim_spi_slave
+{
+public:
+    typedef struct
+    {
+        uint32_t sector_erases;
+        uint32_t page_programs;
+        uint32_t quad_reads;
+        uint32_t quad_read_bytes;
+        /* Erases, programs and status writes without the write enable latch, and commands
+         * while busy. The driver never should. */
+        uint32_t rejected_commands;
+    } statistics_t;
+
+    explicit sim_spi_flash(uint32_t size_log2);
+    ~sim_spi_flash();
+
+    virtual void select() override;
+    virtual void deselect() override;
+    virtual uint8_t exchange(uint8_t value) override;
+
+    uint8_t *data() noexcept
+    {
+        return storage_;
+    }
+
+    uint32_t size() const noexcept
+    {
+        return size_;
+    }
+
+    uint8_t status2() const noexcept
+    {
+        return status2_;
+    }
+
+    const statistics_t &statistics() const noexcept
+    {
+        return stats_;
+    }
+
+    void reset_statistics() noexcept
+    {
+        stats_ = {};
+    }
+
+private:
+    uint32_t address() const noexcept
+    {
+        return (uint32_t(command_[1]) << 16 | uint32_t(command_[2]) << 8 | command_[3]) & (size_ - 1);
+    }
+
+    bool check_writable();
+
+private:
+    uint32_t size_log2_;
+    uint32_t size_;
+    uint8_t *storage_;
+    uint8_t status2_ = 0;
+    bool write_enabled_ = false;
+    size_t busy_polls_ = 0;
+
+    bool ignored_ = false;
+    bool busy_reply_ = false;
+    uint8_t command_[5];
+    size_t command_length_ = 0;
+    size_t data_length_ = 0;
+    uint8_t page_[SIM_FLASH_PAGE_SIZE];
+    statistics_t stats_ = {};
+};
+
+#endif /* _THROUGHPUT_HOST_SIM_SPI_FLASH_H */
@@ -0,0 +1,350 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* The filesystem's block cache in front of a RAM disk that records every device request */
+#include "test.h"
+#include <errno.h>
+#include <kernel/block_cache.hpp>
+#include <kernel/driver_impl.hpp>
+#include <string.h>
+#include <vector>
+
+using namespace sys;
+
+#define RAM_DISK_BLOCK_SIZE 512
+#define RAM_DISK_BLOCKS 64
+
+#define CACHE_BLOCKS 4
+#define CACHE_BYPASS_BLOCKS 8
+#define CACHE_WRITE_RUN_BLOCKS 4
+
+class ram_disk : public block_storage_driver, public static_object, public free_object_access
+{
+public:
+    struct request
+    {
+        uint32_t start_block;
+        uint32_t blocks_count;
+    };
+
+    std::vector<request> reads;
+    std::vector<request> writes;
+    /* Writes throw EIO without touching the medium while set */
+    bool fail_writes;
+
+    virtual void install() override
+    {
+    }
+
+    virtual uint32_t get_rw_block_size() override
+    {
+        return RAM_DISK_BLOCK_SIZE;
+    }
+
+    virtual uint32_t get_blocks_count() override
+    {
+        return RAM_DISK_BLOCKS;
+    }
+
+    virtual void read_blocks(uint32_t start_block, uint32_t blocks_count, gsl::span<uint8_t> buffer) override
+    {
+        TEST_CHECK(start_block + blocks_count <= RAM_DISK_BLOCKS);
+        TEST_CHECK(size_t(buffer.size()) == blocks_count * RAM_DISK_BLOCK_SIZE);
+        reads.push_back({ start_block, blocks_count });
+        memcpy(buffer.data(), block(start_block), blocks_count * RAM_DISK_BLOCK_SIZE);
+    }
+
+    virtual void write_blocks(uint32_t start_block, uint32_t blocks_count, gsl::span<const uint8_t> buffer) override
+    {
+        TEST_CHECK(start_block + blocks_count <= RAM_DISK_BLOCKS);
+        TEST_CHECK(size_t(buffer.size()) == blocks_count * RAM_DISK_BLOCK_SIZE);
+        if (fail_writes)
+            SYS_THROW(errno_exception("Write failed.", EIO));
+        writes.push_back({ start_block, blocks_count });
+        memcpy(block(start_block), buffer.data(), blocks_count * RAM_DISK_BLOCK_SIZE);
+    }
+
+    uint8_t *block(uint32_t index)
+    {
+        return data_ + index * RAM_DISK_BLOCK_SIZE;
+    }
+
+    /* Every block filled with its own index */
+    void reset()
+    {
+        reads.clear();
+        writes.clear();
+        fail_writes = false;
+        for (uint32_t i = 0; i < RAM_DISK_BLOCKS; i++)
+            memset(block(i), uint8_t(i), RAM_DISK_BLOCK_SIZE);
+    }
+
+private:
+    uint8_t data_[RAM_DISK_BLOCKS * RAM_DISK_BLOCK_SIZE];
+};
+
+static ram_disk disk;
+static uint8_t buffer[RAM_DISK_BLOCKS * RAM_DISK_BLOCK_SIZE];
+
+static bool filled_with(const uint8_t *data, uint8_t value)
+{
+    for (size_t i = 0; i < RAM_DISK_BLOCK_SIZE; i++)
+    {
+        if (data[i] != value)
+            return false;
+    }
+
+    return true;
+}
+
+static void read(block_cache &cache, uint32_t start_block, uint32_t blocks_count)
+{
+    cache.read_blocks(start_block, blocks_count, { buffer, std::ptrdiff_t(blocks_count * RAM_DISK_BLOCK_SIZE) });
+}
+
+static void write(block_cache &cache, uint32_t start_block, uint32_t blocks_count, uint8_t value)
+{
+    memset(buffer, value, blocks_count * RAM_DISK_BLOCK_SIZE);
+    cache.write_blocks(start_block, blocks_count, { buffer, std::ptrdiff_t(blocks_count * RAM_DISK_BLOCK_SIZE) });
+}
+
+static block_cache_statistics_t statistics(block_cache &cache)
+{
+    block_cache_statistics_t stats;
+    cache.get_statistics(stats);
+    return stats;
+}
+
+/* The least recently used line goes, whether it was last read or written */
+static void test_lru_eviction()
+{
+    disk.reset();
+    block_cache cache(disk, CACHE_BLOCKS, CACHE_BYPASS_BLOCKS, CACHE_WRITE_RUN_BLOCKS);
+
+    for (uint32_t i = 0; i < CACHE_BLOCKS; i++)
+        read(cache, i, 1);
+    TEST_CHECK(disk.reads.size() == CACHE_BLOCKS);
+
+    read(cache, 0, 1);
+    TEST_CHECK(disk.reads.size() == CACHE_BLOCKS);
+    TEST_CHECK(filled_with(buffer, 0));
+
+    /* Evicts block 1, block 0 was used since */
+    read(cache, 4, 1);
+    TEST_CHECK(disk.reads.size() == CACHE_BLOCKS + 1);
+    read(cache, 0, 1);
+    TEST_CHECK(disk.reads.size() == CACHE_BLOCKS + 1);
+    read(cache, 1, 1);
+    TEST_CHECK(disk.reads.size() == CACHE_BLOCKS + 2);
+    TEST_CHECK(filled_with(buffer, 1));
+
+    auto stats = statistics(cache);
+    TEST_CHECK(stats.read_hits == 2);
+    TEST_CHECK(stats.read_misses == CACHE_BLOCKS + 2);
+    TEST_CHECK(disk.writes.empty());
+}
+
+/* A run of misses is fetched with one device read */
+static void test_read_miss_run()
+{
+    disk.reset();
+    block_cache cache(disk, CACHE_BLOCKS, CACHE_BYPASS_BLOCKS, CACHE_WRITE_RUN_BLOCKS);
+
+    read(cache, 10, 1);
+    read(cache, 8, 4);
+    TEST_CHECK(disk.reads.size() == 3);
+    TEST_CHECK(disk.reads[1].start_block == 8 && disk.reads[1].blocks_count == 2);
+    TEST_CHECK(disk.reads[2].start_block == 11 && disk.reads[2].blocks_count == 1);
+    for (uint32_t i = 0; i < 4; i++)
+        TEST_CHECK(filled_with(buffer + i * RAM_DISK_BLOCK_SIZE, uint8_t(8 + i)));
+}
+
+/* Writes stay in the cache, a dirty victim goes out with its dirty neighbours */
+static void test_write_back_on_eviction()
+{
+    disk.reset();
+    block_cache cache(disk, CACHE_BLOCKS, CACHE_BYPASS_BLOCKS, CACHE_WRITE_RUN_BLOCKS);
+
+    write(cache, 20, 1, 0xA0);
+    write(cache, 21, 1, 0xA1);
+    write(cache, 22, 1, 0xA2);
+    TEST_CHECK(disk.writes.empty());
+    TEST_CHECK(filled_with(disk.block(20), 20));
+
+    read(cache, 0, 1);
+    TEST_CHECK(disk.writes.empty());
+    /* Evicts block 20, the least recently used */
+    read(cache, 1, 1);
+    TEST_CHECK(disk.writes.size() == 1);
+    TEST_CHECK(disk.writes[0].start_block == 20 && disk.writes[0].blocks_count == 3);
+    TEST_CHECK(filled_with(disk.block(20), 0xA0));
+    TEST_CHECK(filled_with(disk.block(21), 0xA1));
+    TEST_CHECK(filled_with(disk.block(22), 0xA2));
+
+    /* Blocks 21 and 22 are clean now and leave without another write */
+    read(cache, 2, 1);
+    read(cache, 3, 1);
+    TEST_CHECK(disk.writes.size() == 1);
+
+    auto stats = statistics(cache);
+    TEST_CHECK(stats.write_misses == 3);
+    TEST_CHECK(stats.written_back_blocks == 3);
+    TEST_CHECK(stats.write_back_runs == 1);
+}
+
+/* Dirty blocks are coalesced into runs of at most write_run_blocks */
+static void test_write_back_coalescing()
+{
+    disk.reset();
+    block_cache cache(disk, 8, CACHE_BYPASS_BLOCKS, CACHE_WRITE_RUN_BLOCKS);
+
+    for (uint32_t i = 0; i < 6; i++)
+        write(cache, 30 + i, 1, uint8_t(0xB0 + i));
+    write(cache, 40, 1, 0xC0);
+    /* A second write to a dirty block is a hit and still goes out once */
+    write(cache, 31, 1, 0xB9);
+    TEST_CHECK(disk.writes.empty());
+
+    cache.flush();
+    size_t blocks = 0;
+    for (auto &request : disk.writes)
+    {
+        TEST_CHECK(request.blocks_count <= CACHE_WRITE_RUN_BLOCKS);
+        blocks += request.blocks_count;
+    }
+    TEST_CHECK(disk.writes.size() == 3);
+    TEST_CHECK(blocks == 7);
+    TEST_CHECK(filled_with(disk.block(30), 0xB0));
+    TEST_CHECK(filled_with(disk.block(31), 0xB9));
+    TEST_CHECK(filled_with(disk.block(35), 0xB5));
+    TEST_CHECK(filled_with(disk.block(40), 0xC0));
+
+    auto stats = statistics(cache);
+    TEST_CHECK(stats.write_hits == 1);
+    TEST_CHECK(stats.written_back_blocks == 7);
+    TEST_CHECK(stats.write_back_runs == 3);
+}
+
+/* Long reads skip the cache but must see blocks not written back yet */
+static void test_bypassed_read_overlay()
+{
+    disk.reset();
+    block_cache cache(disk, CACHE_BLOCKS, CACHE_BYPASS_BLOCKS, CACHE_WRITE_RUN_BLOCKS);
+
+    read(cache, 3, 1);
+    write(cache, 5, 1, 0xD5);
+    write(cache, 9, 1, 0xD9);
+    size_t reads = disk.reads.size();
+
+    read(cache, 2, CACHE_BYPASS_BLOCKS);
+    TEST_CHECK(disk.reads.size() == reads + 1);
+    TEST_CHECK(disk.reads.back().start_block == 2 && disk.reads.back().blocks_count == CACHE_BYPASS_BLOCKS);
+    TEST_CHECK(disk.writes.empty());
+    for (uint32_t i = 0; i < CACHE_BYPASS_BLOCKS; i++)
+    {
+        uint32_t block = 2 + i;
+        uint8_t expected = block == 5 ? 0xD5 : (block == 9 ? 0xD9 : uint8_t(block));
+        TEST_CHECK(filled_with(buffer + i * RAM_DISK_BLOCK_SIZE, expected));
+    }
+
+    /* The bypassed read does not fill the cache */
+    TEST_CHECK(statistics(cache).bypassed_blocks == CACHE_BYPASS_BLOCKS);
+    read(cache, 4, 1);
+    TEST_CHECK(disk.reads.size() == reads + 2);
+}
+
+/* Long writes go straight to the device and refresh the cached copies */
+static void test_bypassed_write()
+{
+    disk.reset();
+    block_cache cache(disk, CACHE_BLOCKS, CACHE_BYPASS_BLOCKS, CACHE_WRITE_RUN_BLOCKS);
+
+    write(cache, 5, 1, 0xE5);
+    write(cache, 0, CACHE_BYPASS_BLOCKS, 0xEE);
+    TEST_CHECK(disk.writes.size() == 1);
+    TEST_CHECK(filled_with(disk.block(5), 0xEE));
+
+    /* Block 5 is clean and current, the flush has nothing to write */
+    cache.flush();
+    TEST_CHECK(disk.writes.size() == 1);
+    read(cache, 5, 1);
+    TEST_CHECK(filled_with(buffer, 0xEE));
+    TEST_CHECK(statistics(cache).read_hits == 1);
+}
+
+static void test_flush()
+{
+    disk.reset();
+    block_cache cache(disk, CACHE_BLOCKS, CACHE_BYPASS_BLOCKS, CACHE_WRITE_RUN_BLOCKS);
+
+    write(cache, 50, 1, 0xF0);
+    write(cache, 60, 1, 0xF1);
+    cache.flush();
+    TEST_CHECK(disk.writes.size() == 2);
+    TEST_CHECK(filled_with(disk.block(50), 0xF0));
+    TEST_CHECK(filled_with(disk.block(60), 0xF1));
+
+    /* Nothing is dirty after a flush, and the lines stay cached */
+    cache.flush();
+    TEST_CHECK(disk.writes.size() == 2);
+    size_t reads = disk.reads.size();
+    read(cache, 50, 1);
+    TEST_CHECK(disk.reads.size() == reads);
+    TEST_CHECK(filled_with(buffer, 0xF0));
+}
+
+#ifndef SYS_NO_EXCEPTIONS
+/* A write back the disk refused leaves the blocks dirty for the next flush */
+static void test_failed_write_back()
+{
+    disk.reset();
+    block_cache cache(disk, CACHE_BLOCKS, CACHE_BYPASS_BLOCKS, CACHE_WRITE_RUN_BLOCKS);
+
+    write(cache, 50, 2, 0xF2);
+    disk.fail_writes = true;
+    bool failed = false;
+    SYS_TRY
+    {
+        cache.flush();
+    }
+    SYS_CATCH(errno_exception & e)
+    {
+        failed = e.code() == EIO;
+    }
+    TEST_CHECK(failed);
+    TEST_CHECK(disk.writes.empty());
+    TEST_CHECK(filled_with(disk.block(50), 50));
+
+    disk.fail_writes = false;
+    cache.flush();
+    TEST_CHECK(disk.writes.size() == 1);
+    TEST_CHECK(filled_with(disk.block(50), 0xF2));
+    TEST_CHECK(filled_with(disk.block(51), 0xF2));
+}
+#endif
+
+int main()
+{
+    test_lru_eviction();
+    test_read_miss_run();
+    test_write_back_on_eviction();
+    test_write_back_coalescing();
+    test_bypassed_read_overlay();
+    test_bypassed_write();
+    test_flush();
+#ifndef SYS_NO_EXCEPTIONS
+    test_failed_write_back();
+#endif
+    return test_report("block_cache");
+}
@@ -0,0 +1,216 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* The SPI flash driver on /dev/spi0 against the NOR flash model: when a sector is erased and
+ * when its pages are only programmed, and what ends up in the flash */
+#include "sim_spi_flash.h"
+#include "test.h"
+#include <devices.h>
+#include <kernel/driver_impl.hpp>
+#include <storage/spi_flash.h>
+#include <string.h>
+
+using namespace sys;
+
+/* 1MB */
+#define FLASH_SIZE_LOG2 20
+#define FLASH_CS_MASK 1
+/* The driver's window starts at the second 64KB of the flash */
+#define FLASH_BASE_ADDRESS 0x10000
+#define FLASH_WINDOW_SIZE 0x20000
+
+#define BLOCK_SIZE 512
+#define BLOCKS_PER_SECTOR (SIM_FLASH_SECTOR_SIZE / BLOCK_SIZE)
+#define PAGES_PER_BLOCK (BLOCK_SIZE / SIM_FLASH_PAGE_SIZE)
+
+static sim_spi_flash flash(FLASH_SIZE_LOG2);
+/* On the heap, the driver reads long runs with DMA */
+static uint8_t *const buffer = new uint8_t[BLOCKS_PER_SECTOR * 2 * BLOCK_SIZE];
+
+static uint8_t *flash_block(uint32_t block)
+{
+    return flash.data() + FLASH_BASE_ADDRESS + block * BLOCK_SIZE;
+}
+
+static void fill_pattern(uint8_t *data, size_t length, uint8_t seed)
+{
+    for (size_t i = 0; i < length; i++)
+        data[i] = uint8_t(seed + i * 13);
+}
+
+static bool matches_pattern(const uint8_t *data, size_t length, uint8_t seed)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        if (data[i] != uint8_t(seed + i * 13))
+            return false;
+    }
+
+    return true;
+}
+
+static bool erased(const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        if (data[i] != 0xFF)
+            return false;
+    }
+
+    return true;
+}
+
+static void write(block_storage_driver &storage, uint32_t start_block, uint32_t blocks_count, uint8_t seed)
+{
+    fill_pattern(buffer, blocks_count * BLOCK_SIZE, seed);
+    storage.write_blocks(start_block, blocks_count, { buffer, std::ptrdiff_t(blocks_count * BLOCK_SIZE) });
+}
+
+static void read(block_storage_driver &storage, uint32_t start_block, uint32_t blocks_count)
+{
+    memset(buffer, 0, blocks_count * BLOCK_SIZE);
+    storage.read_blocks(start_block, blocks_count, { buffer, std::ptrdiff_t(blocks_count * BLOCK_SIZE) });
+}
+
+static void test_install(handle_t handle, block_storage_driver &storage)
+{
+    TEST_CHECK(handle != NULL_HANDLE);
+    TEST_CHECK(storage.get_rw_block_size() == BLOCK_SIZE);
+    TEST_CHECK(storage.get_blocks_count() == FLASH_WINDOW_SIZE / BLOCK_SIZE);
+    /* The quad enable bit is set with a status register write */
+    TEST_CHECK(flash.status2() & 0x02);
+    TEST_CHECK(flash.statistics().sector_erases == 0);
+}
+
+/* Writes into erased flash only clear bits: the dirty pages are programmed, nothing erased */
+static void test_program_only(block_storage_driver &storage)
+{
+    flash.reset_statistics();
+    write(storage, 1, 1, 0x10);
+    /* Buffered until the sector is flushed */
+    TEST_CHECK(erased(flash_block(1), BLOCK_SIZE));
+    TEST_CHECK(flash.statistics().page_programs == 0);
+
+    storage.flush();
+    TEST_CHECK(flash.statistics().sector_erases == 0);
+    TEST_CHECK(flash.statistics().page_programs == PAGES_PER_BLOCK);
+    TEST_CHECK(matches_pattern(flash_block(1), BLOCK_SIZE, 0x10));
+    TEST_CHECK(erased(flash_block(0), BLOCK_SIZE));
+    TEST_CHECK(erased(flash_block(2), BLOCK_SIZE));
+
+    /* A flush with nothing buffered does nothing */
+    storage.flush();
+    TEST_CHECK(flash.statistics().page_programs == PAGES_PER_BLOCK);
+}
+
+/* Rewriting programmed data sets bits: the sector is erased and every page still holding
+ * data is programmed again, so the rest of the sector survives */
+static void test_erase(block_storage_driver &storage)
+{
+    flash.reset_statistics();
+    write(storage, 0, 1, 0x20);
+    write(storage, 1, 1, 0x30);
+    storage.flush();
+
+    TEST_CHECK(flash.statistics().sector_erases == 1);
+    TEST_CHECK(flash.statistics().page_programs == 2 * PAGES_PER_BLOCK);
+    TEST_CHECK(matches_pattern(flash_block(0), BLOCK_SIZE, 0x20));
+    TEST_CHECK(matches_pattern(flash_block(1), BLOCK_SIZE, 0x30));
+    TEST_CHECK(erased(flash_block(2), (BLOCKS_PER_SECTOR - 2) * BLOCK_SIZE));
+    TEST_CHECK(flash.statistics().rejected_commands == 0);
+}
+
+/* Moving to another sector commits the buffered one first */
+static void test_sector_switch(block_storage_driver &storage)
+{
+    flash.reset_statistics();
+    write(storage, BLOCKS_PER_SECTOR + 3, 1, 0x40);
+    TEST_CHECK(flash.statistics().page_programs == 0);
+    write(storage, 2 * BLOCKS_PER_SECTOR + 3, 1, 0x50);
+    TEST_CHECK(flash.statistics().page_programs == PAGES_PER_BLOCK);
+    TEST_CHECK(matches_pattern(flash_block(BLOCKS_PER_SECTOR + 3), BLOCK_SIZE, 0x40));
+    TEST_CHECK(erased(flash_block(2 * BLOCKS_PER_SECTOR + 3), BLOCK_SIZE));
+
+    storage.flush();
+    TEST_CHECK(matches_pattern(flash_block(2 * BLOCKS_PER_SECTOR + 3), BLOCK_SIZE, 0x50));
+    TEST_CHECK(flash.statistics().sector_erases == 0);
+}
+
+/* A whole sector rewrite erases without reading the old contents first */
+static void test_whole_sector(block_storage_driver &storage)
+{
+    flash.reset_statistics();
+    write(storage, BLOCKS_PER_SECTOR, BLOCKS_PER_SECTOR, 0x60);
+    TEST_CHECK(flash.statistics().quad_reads == 0);
+
+    storage.flush();
+    TEST_CHECK(flash.statistics().sector_erases == 1);
+    TEST_CHECK(flash.statistics().page_programs == SIM_FLASH_SECTOR_SIZE / SIM_FLASH_PAGE_SIZE);
+    TEST_CHECK(matches_pattern(flash_block(BLOCKS_PER_SECTOR), SIM_FLASH_SECTOR_SIZE, 0x60));
+}
+
+/* Reads see the buffered sector before it is flushed, single and multi block alike */
+static void test_read_back(block_storage_driver &storage)
+{
+    write(storage, 4 * BLOCKS_PER_SECTOR, 2, 0x70);
+    flash.reset_statistics();
+
+    read(storage, 4 * BLOCKS_PER_SECTOR + 1, 1);
+    TEST_CHECK(matches_pattern(buffer, BLOCK_SIZE, uint8_t(0x70 + BLOCK_SIZE * 13)));
+    TEST_CHECK(flash.statistics().quad_reads == 0);
+
+    read(storage, 4 * BLOCKS_PER_SECTOR - 2, 4);
+    TEST_CHECK(erased(buffer, 2 * BLOCK_SIZE));
+    TEST_CHECK(matches_pattern(buffer + 2 * BLOCK_SIZE, 2 * BLOCK_SIZE, 0x70));
+    TEST_CHECK(flash.statistics().page_programs == 0);
+
+    /* Two whole sectors from the flash in one quad read */
+    read(storage, BLOCKS_PER_SECTOR, 2 * BLOCKS_PER_SECTOR);
+    TEST_CHECK(matches_pattern(buffer, SIM_FLASH_SECTOR_SIZE, 0x60));
+    TEST_CHECK(matches_pattern(buffer + SIM_FLASH_SECTOR_SIZE + 3 * BLOCK_SIZE, BLOCK_SIZE, 0x50));
+
+    /* Single blocks come from the cache the second time */
+    read(storage, 0, 1);
+    uint32_t quad_reads = flash.statistics().quad_reads;
+    read(storage, 0, 1);
+    TEST_CHECK(flash.statistics().quad_reads == quad_reads);
+    TEST_CHECK(matches_pattern(buffer, BLOCK_SIZE, 0x20));
+}
+
+int main()
+{
+    host_attach_spi_slave("/dev/spi0", FLASH_CS_MASK, &flash);
+    handle_t spi = io_open("/dev/spi0");
+    handle_t handle = spi_flash_driver_install(spi, FLASH_CS_MASK, FLASH_BASE_ADDRESS, FLASH_WINDOW_SIZE);
+    auto &storage = *system_handle_to_object(handle).as<block_storage_driver>();
+
+    test_install(handle, storage);
+    test_program_only(storage);
+    test_erase(storage);
+    test_sector_switch(storage);
+    test_whole_sector(storage);
+    test_read_back(storage);
+
+    /* The last close commits the sector still buffered from test_read_back */
+    flash.reset_statistics();
+    io_close(handle);
+    TEST_CHECK(flash.statistics().page_programs == PAGES_PER_BLOCK * 2);
+    TEST_CHECK(matches_pattern(flash_block(4 * BLOCKS_PER_SECTOR), 2 * BLOCK_SIZE, 0x70));
+    TEST_CHECK(erased(flash.data(), FLASH_BASE_ADDRESS));
+    TEST_CHECK(erased(flash.data() + FLASH_BASE_ADDRESS + FLASH_WINDOW_SIZE, flash.size() - FLASH_BASE_ADDRESS - FLASH_WINDOW_SIZE));
+    TEST_CHECK(flash.statistics().rejected_commands == 0);
+
+    io_close(spi);
+    return test_report("spi_flash");
+}
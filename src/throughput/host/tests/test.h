@@ -0,0 +1,44 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _THROUGHPUT_HOST_TESTS_TEST_H
+#define _THROUGHPUT_HOST_TESTS_TEST_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* Checks for the host tests. A failed check is printed and the test goes on, main returns
+ * test_report so ctest sees the failures. */
+#define TEST_CHECK(cond) test_check((cond), #cond, __FILE__, __LINE__)
+
+static size_t test_checks_;
+static size_t test_failures_;
+
+static inline void test_check(bool passed, const char *expression, const char *file, int line)
+{
+    test_checks_++;
+    if (!passed)
+    {
+        test_failures_++;
+        printf("%s:%d: check failed: %s\n", file, line, expression);
+    }
+}
+
+static inline int test_report(const char *name)
+{
+    printf("%s: %u checks, %u failed\n", name, (unsigned)test_checks_, (unsigned)test_failures_);
+    return test_failures_ ? 1 : 0;
+}
+
+#endif /* _THROUGHPUT_HOST_TESTS_TEST_H */
@@ -0,0 +1,41 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "bench.h"
+
+/* Prints one CSV table: a '#' preamble line, a header row and one row per measurement.
+ * The same sources build natively from host/ against the SDK on modelled hardware. */
+int main()
+{
+    bench_begin();
+    bench_io_dispatch();
+    bench_io_open();
+    bench_dma_dispatch();
+    bench_dma();
+    bench_dma_subword();
+    bench_dma_memcpy();
+    bench_spi();
+    bench_i2c();
+    bench_sdcard();
+    bench_aes();
+    bench_sha();
+    bench_fft();
+    bench_dma_statistics();
+#ifdef BENCH_HOST
+    return 0;
+#else
+    while (1)
+        ;
+#endif
+}
@@ -0,0 +1,4 @@
+# host/ holds the FreeRTOS port and hardware models for the native build, keep them out of the firmware
+get_target_property(THROUGHPUT_SOURCES ${PROJECT_NAME} SOURCES)
+list(FILTER THROUGHPUT_SOURCES EXCLUDE REGEX "/src/throughput/host/")
+set_property(TARGET ${PROJECT_NAME} PROPERTY SOURCES ${THROUGHPUT_SOURCES})